@@ -0,0 +1,217 @@
+#include "Bench.h"
+#include "coproto/Socket/LocalAsyncSock.h"
+#include "coproto/Socket/BufferingSocket.h"
+#include "coproto/Socket/PosixSocket.h"
+#include "coproto/Socket/IoUringSocket.h"
+#include "coproto/Socket/SharedMemSocket.h"
+#include "coproto/Socket/AsioSocket.h"
+#include "tests/config.h"
+#include <algorithm>
+#include <ctime>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
+
+namespace coproto
+{
+	namespace bench
+	{
+		namespace
+		{
+			std::string quote(const std::string& s)
+			{
+				std::stringstream ss;
+				ss << '"';
+				for (auto c : s)
+				{
+					if (c == '"' || c == '\\')
+						ss << '\\' << c;
+					else if (static_cast<unsigned char>(c) < 0x20)
+						ss << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c << std::dec;
+					else
+						ss << c;
+				}
+				ss << '"';
+				return ss.str();
+			}
+		}
+
+		Record& Record::add(const std::string& key, const std::string& value)
+		{
+			mFields.emplace_back(key, quote(value));
+			return *this;
+		}
+
+		Record& Record::add(const std::string& key, u64 value)
+		{
+			mFields.emplace_back(key, std::to_string(value));
+			return *this;
+		}
+
+		Record& Record::add(const std::string& key, double value)
+		{
+			std::stringstream ss;
+			ss << std::setprecision(6) << value;
+			mFields.emplace_back(key, ss.str());
+			return *this;
+		}
+
+		void Record::write(std::ostream& out) const
+		{
+			out << "{";
+			for (u64 i = 0; i < mFields.size(); ++i)
+				out << (i ? ", " : "") << quote(mFields[i].first) << ": " << mFields[i].second;
+			out << "}";
+		}
+
+		void Report::write(std::ostream& out) const
+		{
+			out << "{\n  \"version\": " << quote(COPROTO_BENCH_VERSION) << ",\n"
+				<< "  \"results\": [";
+			for (u64 i = 0; i < mRecords.size(); ++i)
+			{
+				out << (i ? ",\n    " : "\n    ");
+				mRecords[i].write(out);
+			}
+			out << "\n  ]\n}" << std::endl;
+		}
+
+		Percentiles Percentiles::compute(std::vector<u64>& samples)
+		{
+			Percentiles p;
+			if (samples.size() == 0)
+				return p;
+
+			std::sort(samples.begin(), samples.end());
+			auto at = [&](double q) {
+				auto i = static_cast<u64>(q * (samples.size() - 1) + 0.5);
+				return samples[i];
+			};
+
+			p.mP50 = at(0.5);
+			p.mP99 = at(0.99);
+			p.mP999 = at(0.999);
+			p.mMin = samples.front();
+			p.mMax = samples.back();
+			p.mMean = std::accumulate(samples.begin(), samples.end(), 0.0) / samples.size();
+			return p;
+		}
+
+		std::vector<Backend> makeBackends(const CLP& cmd)
+		{
+			std::vector<Backend> backends;
+
+			backends.push_back({ "local", [] {
+				auto s = LocalAsyncSocket::makePair();
+				return SocketPair{ { { s[0], s[1] } }, nullptr };
+			} });
+
+			backends.push_back({ "buffering", [] {
+				std::array<BufferingSocket, 2> s;
+				auto pump = std::make_shared<BufferingSocketPump>();
+				pump->add(s[0], s[1]);
+				return SocketPair{ { { s[0], s[1] } }, pump };
+			} });
+
+#ifdef COPROTO_ENABLE_POSIX_SOCKET
+			backends.push_back({ "posix", [] {
+				auto s = PosixSocket::makePair();
+				return SocketPair{ { { s[0], s[1] } }, nullptr };
+			} });
+#endif
+
+#ifdef COPROTO_ENABLE_IO_URING
+			backends.push_back({ "iouring", [] {
+				auto s = IoUringSocket::makePair();
+				return SocketPair{ { { s[0], s[1] } }, nullptr };
+			} });
+#endif
+
+#ifdef COPROTO_ENABLE_SHARED_MEM
+			backends.push_back({ "shm", [] {
+				auto s = SharedMemSocket::makePair();
+				return SocketPair{ { { s[0], s[1] } }, nullptr };
+			} });
+#endif
+
+#ifdef COPROTO_ENABLE_BOOST
+			backends.push_back({ "asio", [] {
+				auto s = AsioSocket::makePair();
+				return SocketPair{ { { s[0], s[1] } }, nullptr };
+			} });
+
+#ifdef COPROTO_ENABLE_OPENSSL
+			{
+				// the contexts are shared by all the pairs.
+				struct Contexts
+				{
+					boost::asio::ssl::context mServer{ boost::asio::ssl::context::tlsv13_server };
+					boost::asio::ssl::context mClient{ boost::asio::ssl::context::tlsv13_client };
+				};
+				auto ctx = std::make_shared<Contexts>();
+
+				auto dir = cmd.getOr<std::string>("cert", std::string(COPROTO_TEST_DIR) + "/cert");
+				ctx->mClient.load_verify_file(dir + "/ca.cert.pem");
+				ctx->mServer.use_private_key_file(dir + "/server-0.key.pem", boost::asio::ssl::context::file_format::pem);
+				ctx->mServer.use_certificate_file(dir + "/server-0.cert.pem", boost::asio::ssl::context::file_format::pem);
+
+				auto address = cmd.getOr<std::string>("address", "localhost:1212");
+				backends.push_back({ "tls", [ctx, address] {
+					auto& ioc = global_io_context();
+					auto r = macoro::sync_wait(macoro::when_all_ready(
+						macoro::make_task(AsioTlsAcceptor(address, ioc, ctx->mServer)),
+						macoro::make_task(AsioTlsConnect(address, ioc, ctx->mClient))
+					));
+					return SocketPair{ { {
+						std::get<0>(r).result(),
+						std::get<1>(r).result() } }, ctx };
+				} });
+			}
+#endif
+#endif
+
+			if (cmd.isSet("socket"))
+			{
+				auto names = cmd.getManyOr<std::string>("socket", {});
+				for (auto& n : names)
+				{
+					auto iter = std::find_if(backends.begin(), backends.end(),
+						[&](const Backend& b) { return b.mName == n; });
+					if (iter == backends.end())
+						throw std::runtime_error("unknown or disabled socket type: " + n + " " COPROTO_LOCATION);
+				}
+
+				backends.erase(std::remove_if(backends.begin(), backends.end(), [&](const Backend& b) {
+					return std::find(names.begin(), names.end(), b.mName) == names.end();
+					}), backends.end());
+			}
+
+			return backends;
+		}
+
+		std::vector<u64> messageSizes(const CLP& cmd)
+		{
+			auto minSize = cmd.getOr<u64>("minSize", 1);
+			auto maxSize = cmd.getOr<u64>("maxSize", 1ull << 26);
+			auto step = std::max<u64>(2, cmd.getOr<u64>("step", 4));
+
+			std::vector<u64> sizes;
+			for (auto s = std::max<u64>(minSize, 1); s <= maxSize; s *= step)
+				sizes.push_back(s);
+			return sizes;
+		}
+
+		u64 cpuNanoseconds()
+		{
+			return static_cast<u64>(std::clock() * (1e9 / CLOCKS_PER_SEC));
+		}
+
+		u64 iterations(const CLP& cmd, u64 size)
+		{
+			auto trials = cmd.getOr<u64>("trials", 10000);
+			auto bytes = cmd.getOr<u64>("bytes", 1ull << 28);
+			auto minTrials = std::min<u64>(trials, 5);
+			return std::max<u64>(minTrials, std::min<u64>(trials, bytes / size));
+		}
+	}
+}
@@ -0,0 +1,118 @@
+#pragma once
+// © 2022 Visa.
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "coproto/Common/Defines.h"
+#include "coproto/Common/CLP.h"
+#include "coproto/Socket/Socket.h"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace coproto
+{
+	namespace bench
+	{
+		// A flat JSON object, e.g. {"bench":"pingpong","size":1024}.
+		// Each benchmark run produces one record.
+		class Record
+		{
+		public:
+			Record& add(const std::string& key, const std::string& value);
+			Record& add(const std::string& key, const char* value) { return add(key, std::string(value)); }
+			Record& add(const std::string& key, u64 value);
+			Record& add(const std::string& key, double value);
+
+			void write(std::ostream& out) const;
+
+		private:
+			// the keys and the already encoded values.
+			std::vector<std::pair<std::string, std::string>> mFields;
+		};
+
+		// The records of all the runs, written as 
+		//   {"version":"...","results":[ record, record, ... ]}
+		class Report
+		{
+		public:
+			std::vector<Record> mRecords;
+
+			void write(std::ostream& out) const;
+		};
+
+		// The latency percentiles of a set of samples, in nanoseconds.
+		struct Percentiles
+		{
+			u64 mP50 = 0, mP99 = 0, mP999 = 0, mMin = 0, mMax = 0;
+			double mMean = 0;
+
+			// sorts samples.
+			static Percentiles compute(std::vector<u64>& samples);
+		};
+
+		// A pair of connected sockets along with anything that they
+		// depend on, e.g. a BufferingSocketPump.
+		struct SocketPair
+		{
+			std::array<Socket, 2> mSockets;
+
+			// state that must outlive the sockets.
+			std::shared_ptr<void> mState;
+		};
+
+		// A way to construct a pair of connected sockets, e.g. 
+		// LocalAsyncSocket::makePair().
+		struct Backend
+		{
+			std::string mName;
+
+			// returns a new pair of connected sockets.
+			std::function<SocketPair()> mMakePair;
+		};
+
+		// The backends that are enabled in this build, filtered by the
+		// -socket option if given.
+		std::vector<Backend> makeBackends(const CLP& cmd);
+
+		// The message sizes to run: -minSize to -maxSize, each -step 
+		// times larger than the last.
+		std::vector<u64> messageSizes(const CLP& cmd);
+
+		// The number of iterations to run for a message of the given size.
+		// This is -trials but bounded such that roughly -bytes bytes are sent.
+		u64 iterations(const CLP& cmd, u64 size);
+
+		inline u64 nanoseconds(std::chrono::steady_clock::duration d)
+		{
+			return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+		}
+
+		// one message of size bytes is sent back and forth. The round trip
+		// time of each iteration is recorded.
+		void pingPong(const CLP& cmd, Backend& backend, Report& report);
+
+		// party 0 sends messages to party 1 as fast as possible.
+		void throughput(const CLP& cmd, Backend& backend, Report& report);
+
+		// the rate at which Socket::fork() creates forks, both without and
+		// with the first message that establishes the fork with the other
+		// party.
+		void forkCreation(const CLP& cmd, Backend& backend, Report& report);
+
+		// the aggregate throughput of 1..N forks of one socket, each driven
+		// by a macoro::thread_pool with 1..M threads. Both the wall time and
+		// the CPU time of the process, i.e. of both parties, are reported.
+		void forkScaling(const CLP& cmd, Backend& backend, Report& report);
+
+		// the CPU time used by the process so far.
+		u64 cpuNanoseconds();
+	}
+}
@@ -0,0 +1,181 @@
+#include "Bench.h"
+#include "coproto/Common/macoro.h"
+#include "macoro/thread_pool.h"
+#include "macoro/start_on.h"
+#include "tests/AllocationCounter.h"
+#include <iostream>
+
+namespace coproto
+{
+	namespace bench
+	{
+		namespace
+		{
+			void closePair(SocketPair& pair)
+			{
+				macoro::sync_wait(pair.mSockets[0].close());
+				macoro::sync_wait(pair.mSockets[1].close());
+			}
+
+			// the wall and cpu time of f().
+			template<typename F>
+			std::pair<u64, u64> time(F&& f)
+			{
+				auto cpu = cpuNanoseconds();
+				auto begin = std::chrono::steady_clock::now();
+				f();
+				auto wall = nanoseconds(std::chrono::steady_clock::now() - begin);
+				return { std::max<u64>(wall, 1), cpuNanoseconds() - cpu };
+			}
+		}
+
+		void forkCreation(const CLP& cmd, Backend& backend, Report& report)
+		{
+			auto n = cmd.getOr<u64>("forkCount", 10000);
+
+			// fork() without any messages. This only creates the local state.
+			{
+				auto pair = backend.mMakePair();
+				std::vector<Socket> forks;
+				forks.reserve(n);
+				auto allocs = tests::allocationCount();
+				auto t = time([&] {
+					for (u64 i = 0; i < n; ++i)
+						forks.push_back(pair.mSockets[0].fork());
+					});
+				allocs = tests::allocationCount() - allocs;
+				forks.clear();
+				closePair(pair);
+
+				report.mRecords.push_back(Record{}
+					.add("bench", "fork_create")
+					.add("socket", backend.mName)
+					.add("forks", n)
+					.add("wall_ns", t.first)
+					.add("cpu_ns", t.second)
+					.add("forks_per_sec", n / (t.first / 1e9))
+					.add("allocs_per_fork", double(allocs) / std::max<u64>(n, 1)));
+			}
+
+			// fork() and then one message, which establishes the fork
+			// with the other party.
+			{
+				auto pair = backend.mMakePair();
+				auto party = [&](u64 p) -> task<> {
+					u8 v = 0;
+					for (u64 i = 0; i < n; ++i)
+					{
+						auto f = pair.mSockets[p].fork();
+						if (p)
+							co_await f.recv(v);
+						else
+							co_await f.send(v);
+					}
+					co_await pair.mSockets[p].flush();
+				};
+
+				auto allocs = tests::allocationCount();
+				auto t = time([&] {
+					auto r = macoro::sync_wait(macoro::when_all_ready(party(0), party(1)));
+					std::get<0>(r).result();
+					std::get<1>(r).result();
+					});
+				allocs = tests::allocationCount() - allocs;
+				closePair(pair);
+
+				report.mRecords.push_back(Record{}
+					.add("bench", "fork_first_message")
+					.add("socket", backend.mName)
+					.add("forks", n)
+					.add("wall_ns", t.first)
+					.add("cpu_ns", t.second)
+					.add("forks_per_sec", n / (t.first / 1e9))
+					.add("allocs_per_fork", double(allocs) / std::max<u64>(n, 1)));
+			}
+
+			if (cmd.isSet("v"))
+				std::cerr << "forkCreation " << backend.mName << " " << n << " forks" << std::endl;
+		}
+
+		void forkScaling(const CLP& cmd, Backend& backend, Report& report)
+		{
+			auto forkCounts = cmd.getManyOr<u64>("forks", { 1, 4, 16, 64 });
+			auto threadCounts = cmd.getManyOr<u64>("threads", { 1, 2, 4, 8 });
+			auto totalMessages = cmd.getOr<u64>("forkMessages", 1 << 16);
+			auto size = cmd.getOr<u64>("forkSize", 1024);
+
+			for (auto threads : threadCounts)
+			{
+				// each party runs its forks on its own pool.
+				macoro::thread_pool pool0, pool1;
+				auto w0 = pool0.make_work();
+				auto w1 = pool1.make_work();
+				pool0.create_threads(threads);
+				pool1.create_threads(threads);
+				std::array<macoro::thread_pool*, 2> pools{ { &pool0, &pool1 } };
+
+				for (auto numForks : forkCounts)
+				{
+					auto perFork = std::max<u64>(1, totalMessages / numForks);
+					auto pair = backend.mMakePair();
+
+					std::array<std::vector<Socket>, 2> forks;
+					for (u64 i = 0; i < numForks; ++i)
+					{
+						forks[0].push_back(pair.mSockets[0].fork());
+						forks[1].push_back(pair.mSockets[1].fork());
+					}
+
+					auto drive = [&](Socket& s, u64 p) -> task<> {
+						std::vector<u8> buffer(size);
+						for (u64 i = 0; i < perFork; ++i)
+						{
+							if (p)
+								co_await s.recv(buffer);
+							else
+								co_await s.send(buffer);
+						}
+						if (p == 0)
+							co_await s.flush();
+					};
+
+					auto party = [&](u64 p) -> task<> {
+						std::vector<macoro::eager_task<void>> tasks;
+						tasks.reserve(numForks);
+						for (u64 i = 0; i < numForks; ++i)
+							tasks.push_back(drive(forks[p][i], p) | macoro::start_on(*pools[p]));
+						for (auto& t : tasks)
+							co_await t;
+					};
+
+					auto t = time([&] {
+						auto r = macoro::sync_wait(macoro::when_all_ready(party(0), party(1)));
+						std::get<0>(r).result();
+						std::get<1>(r).result();
+						});
+					forks[0].clear();
+					forks[1].clear();
+					closePair(pair);
+
+					auto messages = perFork * numForks;
+					report.mRecords.push_back(Record{}
+						.add("bench", "fork_scaling")
+						.add("socket", backend.mName)
+						.add("forks", numForks)
+						.add("threads", threads)
+						.add("size", size)
+						.add("messages", messages)
+						.add("wall_ns", t.first)
+						.add("cpu_ns", t.second)
+						.add("wall_ns_per_message", double(t.first) / messages)
+						.add("cpu_ns_per_message", double(t.second) / messages)
+						.add("bytes_per_sec", size * messages / (t.first / 1e9)));
+
+					if (cmd.isSet("v"))
+						std::cerr << "forkScaling " << backend.mName << " forks " << numForks << " threads " << threads
+						<< " " << double(t.first) / messages << " ns/msg" << std::endl;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,124 @@
+#include "Bench.h"
+#include "coproto/Common/macoro.h"
+#include "tests/AllocationCounter.h"
+#include <iostream>
+
+namespace coproto
+{
+	namespace bench
+	{
+		namespace
+		{
+			void closePair(SocketPair& pair)
+			{
+				macoro::sync_wait(pair.mSockets[0].close());
+				macoro::sync_wait(pair.mSockets[1].close());
+			}
+
+			Record makeRecord(const char* name, Backend& backend, u64 size, u64 iters)
+			{
+				Record r;
+				r.add("bench", name)
+					.add("socket", backend.mName)
+					.add("size", size)
+					.add("iterations", iters);
+				return r;
+			}
+		}
+
+		void pingPong(const CLP& cmd, Backend& backend, Report& report)
+		{
+			for (auto size : messageSizes(cmd))
+			{
+				auto iters = iterations(cmd, size);
+				auto warmup = std::min<u64>(iters / 10, 100);
+				auto pair = backend.mMakePair();
+				std::vector<u8> b0(size), b1(size);
+				std::vector<u64> samples;
+				samples.reserve(iters);
+				u64 allocBegin = 0, allocEnd = 0;
+
+				auto party0 = [&]() -> task<> {
+					auto& s = pair.mSockets[0];
+					for (u64 i = 0; i < warmup + iters; ++i)
+					{
+						if (i == warmup)
+							allocBegin = tests::allocationCount();
+						auto begin = std::chrono::steady_clock::now();
+						co_await s.send(b0);
+						co_await s.recv(b0);
+						if (i >= warmup)
+							samples.push_back(nanoseconds(std::chrono::steady_clock::now() - begin));
+					}
+					allocEnd = tests::allocationCount();
+				};
+				auto party1 = [&]() -> task<> {
+					auto& s = pair.mSockets[1];
+					for (u64 i = 0; i < warmup + iters; ++i)
+					{
+						co_await s.recv(b1);
+						co_await s.send(b1);
+					}
+				};
+
+				auto r = macoro::sync_wait(macoro::when_all_ready(party0(), party1()));
+				std::get<0>(r).result();
+				std::get<1>(r).result();
+				closePair(pair);
+
+				auto p = Percentiles::compute(samples);
+				report.mRecords.push_back(makeRecord("pingpong", backend, size, iters)
+					.add("p50_ns", p.mP50)
+					.add("p99_ns", p.mP99)
+					.add("p999_ns", p.mP999)
+					.add("min_ns", p.mMin)
+					.add("max_ns", p.mMax)
+					.add("mean_ns", p.mMean)
+					.add("allocs_per_roundtrip", double(allocEnd - allocBegin) / std::max<u64>(iters, 1)));
+
+				if (cmd.isSet("v"))
+					std::cerr << "pingpong   " << backend.mName << " " << size << " B p50 " << p.mP50 << " ns" << std::endl;
+			}
+		}
+
+		void throughput(const CLP& cmd, Backend& backend, Report& report)
+		{
+			for (auto size : messageSizes(cmd))
+			{
+				auto iters = iterations(cmd, size);
+				auto pair = backend.mMakePair();
+				std::vector<u8> b0(size), b1(size);
+				std::chrono::steady_clock::time_point end;
+
+				auto party0 = [&]() -> task<> {
+					auto& s = pair.mSockets[0];
+					for (u64 i = 0; i < iters; ++i)
+						co_await s.send(b0);
+					co_await s.flush();
+				};
+				auto party1 = [&]() -> task<> {
+					auto& s = pair.mSockets[1];
+					for (u64 i = 0; i < iters; ++i)
+						co_await s.recv(b1);
+					end = std::chrono::steady_clock::now();
+				};
+
+				auto begin = std::chrono::steady_clock::now();
+				auto r = macoro::sync_wait(macoro::when_all_ready(party0(), party1()));
+				std::get<0>(r).result();
+				std::get<1>(r).result();
+				closePair(pair);
+
+				auto ns = std::max<u64>(1, nanoseconds(end - begin));
+				auto seconds = ns / 1e9;
+				report.mRecords.push_back(makeRecord("throughput", backend, size, iters)
+					.add("total_ns", ns)
+					.add("bytes_per_sec", size * iters / seconds)
+					.add("messages_per_sec", iters / seconds));
+
+				if (cmd.isSet("v"))
+					std::cerr << "throughput " << backend.mName << " " << size << " B " << (size * iters / seconds / (1 << 20)) << " MiB/s" << std::endl;
+			}
+		}
+	}
+}
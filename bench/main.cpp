@@ -0,0 +1,97 @@
+#include "Bench.h"
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+
+using namespace coproto;
+using namespace coproto::bench;
+
+namespace
+{
+	void printHelp()
+	{
+		std::cout <<
+			"coprotoBench, socket benchmarks. The results are written as JSON.\n"
+			"  -bench <names>    the benchmarks to run: pingpong throughput forkCreation\n"
+			"                    forkScaling (default all)\n"
+			"  -socket <names>   the sockets to run over: local buffering posix iouring shm asio tls\n"
+			"                    (default all that are enabled in this build)\n"
+			"  -minSize <n>      the smallest message size in bytes (default 1)\n"
+			"  -maxSize <n>      the largest message size in bytes (default 64 MiB)\n"
+			"  -step <n>         each message size is step times the last (default 4)\n"
+			"  -trials <n>       the maximum number of iterations per message size (default 10000)\n"
+			"  -bytes <n>        limit the iterations to about n bytes per message size (default 256 MiB)\n"
+			"  -forkCount <n>    the number of forks that forkCreation creates (default 10000)\n"
+			"  -forks <n...>     the numbers of forks for forkScaling (default 1 4 16 64)\n"
+			"  -threads <n...>   the numbers of threads per party for forkScaling (default 1 2 4 8)\n"
+			"  -forkMessages <n> the total number of messages for forkScaling (default 65536)\n"
+			"  -forkSize <n>     the message size for forkScaling (default 1024)\n"
+			"  -o <file>         write the JSON to file instead of stdout\n"
+			"  -cert <dir>       the certificate directory for tls (default tests/cert)\n"
+			"  -address <a>      the loopback address for tls (default localhost:1212)\n"
+			"  -v                print progress to stderr\n";
+	}
+}
+
+int main(int argc, char** argv)
+{
+	CLP cmd(argc, argv);
+
+	if (cmd.isSet("h") || cmd.isSet("help"))
+	{
+		printHelp();
+		return 0;
+	}
+
+	using BenchFn = void(*)(const CLP&, Backend&, Report&);
+	std::vector<std::pair<std::string, BenchFn>> benches{
+		{ "pingpong", &pingPong },
+		{ "throughput", &throughput },
+		{ "forkCreation", &forkCreation },
+		{ "forkScaling", &forkScaling }
+	};
+	auto names = cmd.getManyOr<std::string>("bench", {});
+
+	Report report;
+	try
+	{
+		auto backends = makeBackends(cmd);
+		for (auto& bench : benches)
+		{
+			if (names.size() && std::find(names.begin(), names.end(), bench.first) == names.end())
+				continue;
+
+			for (auto& backend : backends)
+			{
+				try
+				{
+					bench.second(cmd, backend, report);
+				}
+				catch (std::exception& e)
+				{
+					// record the failure and move on to the next backend.
+					report.mRecords.push_back(Record{}
+						.add("bench", bench.first)
+						.add("socket", backend.mName)
+						.add("error", e.what()));
+					std::cerr << bench.first << " " << backend.mName << " failed: " << e.what() << std::endl;
+				}
+			}
+		}
+	}
+	catch (std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	if (cmd.hasValue("o"))
+	{
+		std::ofstream out(cmd.get<std::string>("o"));
+		report.write(out);
+	}
+	else
+		report.write(std::cout);
+
+	return 0;
+}
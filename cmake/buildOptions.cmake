@@ -25,12 +25,45 @@ option(COPROTO_ASAN "build the library with asan enabled." false)
 
 option(COPROTO_ENABLE_ASSERTS "compile the library with asserts enabled" ON)
 
+# some socket backends are only available on linux.
+if(CMAKE_SYSTEM_NAME STREQUAL "Linux")
+	set(COPROTO_LINUX ON)
+else()
+	set(COPROTO_LINUX OFF)
+endif()
+
+option(COPROTO_ENABLE_SHARED_MEM "build the shared memory socket, linux only" ${COPROTO_LINUX})
+if(COPROTO_ENABLE_SHARED_MEM AND NOT COPROTO_LINUX)
+	message(FATAL_ERROR "COPROTO_ENABLE_SHARED_MEM requires linux.")
+endif()
+
+option(COPROTO_ENABLE_POSIX_SOCKET "build the epoll socket, linux only" ${COPROTO_LINUX})
+if(COPROTO_ENABLE_POSIX_SOCKET AND NOT COPROTO_LINUX)
+	message(FATAL_ERROR "COPROTO_ENABLE_POSIX_SOCKET requires linux.")
+endif()
+
+set(COPROTO_HAS_IO_URING OFF)
+if(COPROTO_LINUX)
+	include(CheckIncludeFileCXX)
+	check_include_file_cxx("linux/io_uring.h" COPROTO_HAS_IO_URING_H)
+	if(COPROTO_HAS_IO_URING_H)
+		set(COPROTO_HAS_IO_URING ON)
+	endif()
+endif()
+option(COPROTO_ENABLE_IO_URING "build the io_uring socket, linux only" ${COPROTO_HAS_IO_URING})
+if(COPROTO_ENABLE_IO_URING AND NOT COPROTO_HAS_IO_URING)
+	message(FATAL_ERROR "COPROTO_ENABLE_IO_URING requires linux and <linux/io_uring.h>.")
+endif()
+
 message(STATUS "Option: COPROTO_CPP_VER         = ${COPROTO_CPP_VER}")
 message(STATUS "Option: COPROTO_PIC             = ${COPROTO_PIC}")
 message(STATUS "Option: COPROTO_ASAN            = ${COPROTO_ASAN}")
 message(STATUS "Option: COPROTO_ENABLE_BOOST    = ${COPROTO_ENABLE_BOOST}")
 message(STATUS "Option: COPROTO_ENABLE_SPAN     = ${COPROTO_ENABLE_SPAN}")
 message(STATUS "Option: COPROTO_ENABLE_OPENSSL  = ${COPROTO_ENABLE_OPENSSL}")
+message(STATUS "Option: COPROTO_ENABLE_SHARED_MEM = ${COPROTO_ENABLE_SHARED_MEM}")
+message(STATUS "Option: COPROTO_ENABLE_IO_URING = ${COPROTO_ENABLE_IO_URING}")
+message(STATUS "Option: COPROTO_ENABLE_POSIX_SOCKET = ${COPROTO_ENABLE_POSIX_SOCKET}")
 
 message(STATUS "Option: COPROTO_ENABLE_ASSERTS  = ${COPROTO_ENABLE_ASSERTS}\n")
 
@@ -12,6 +12,8 @@
 #include <condition_variable>
 #include <queue>
 #include <memory>
+#include <new>
+#include <vector>
 #include "coproto/Common/Optional.h"
 #include "coproto/Common/Defines.h"
 
@@ -19,10 +21,117 @@ namespace coproto
 {
 	std::string hexPtr(void* p);
 
+	// A cache of memory blocks that can be shared by many Queue's, e.g.
+	// the receive queues of all the forks of a socket. Freed blocks are
+	// kept, up to retainedCapacity() bytes, and reused for blocks of the
+	// same size. Not thread safe, the owner must synchronize access.
+	class QueueBlockPool
+	{
+	public:
+		// the alignment of the blocks.
+		static constexpr u64 Alignment = 32;
+
+		QueueBlockPool(u64 retainedCapacity = 1 << 16)
+			: mRetainedCapacity(retainedCapacity)
+		{}
+
+		QueueBlockPool(const QueueBlockPool&) = delete;
+
+		~QueueBlockPool()
+		{
+			assert(mInUse == 0);
+			setRetainedCapacity(0);
+		}
+
+		void* allocate(u64 size)
+		{
+			auto& list = freeList(size);
+			void* ptr;
+			if (list.mHead)
+			{
+				ptr = std::exchange(list.mHead, list.mHead->mNext);
+				mRetained -= size;
+			}
+			else
+				ptr = ::operator new(size, std::align_val_t{ Alignment });
+
+			mInUse += size;
+			mHighWaterMark = std::max(mHighWaterMark, mInUse);
+			return ptr;
+		}
+
+		void deallocate(void* ptr, u64 size)
+		{
+			COPROTO_ASSERT(mInUse >= size);
+			mInUse -= size;
+			if (mRetained + size <= mRetainedCapacity)
+			{
+				auto& list = freeList(size);
+				list.mHead = new (ptr) Node{ list.mHead };
+				mRetained += size;
+			}
+			else
+				::operator delete(ptr, std::align_val_t{ Alignment });
+		}
+
+		// the number of bytes of freed blocks that are kept. Blocks
+		// beyond this are released.
+		void setRetainedCapacity(u64 bytes)
+		{
+			mRetainedCapacity = bytes;
+			for (auto& list : mFreeLists)
+			{
+				while (mRetained > mRetainedCapacity && list.mHead)
+				{
+					::operator delete(std::exchange(list.mHead, list.mHead->mNext), std::align_val_t{ Alignment });
+					mRetained -= list.mSize;
+				}
+			}
+		}
+
+		u64 retainedCapacity() const { return mRetainedCapacity; }
+
+		// the number of bytes of freed blocks that are currently kept.
+		u64 retained() const { return mRetained; }
+
+		// the number of bytes of blocks that are currently in use.
+		u64 inUse() const { return mInUse; }
+
+		// the largest value that inUse() has had.
+		u64 highWaterMark() const { return mHighWaterMark; }
+
+	private:
+		struct Node
+		{
+			Node* mNext;
+		};
+
+		struct FreeList
+		{
+			u64 mSize;
+			Node* mHead;
+		};
+
+		// one list per block size. A Queue only uses a few sizes.
+		std::vector<FreeList> mFreeLists;
+
+		u64 mRetainedCapacity = 0, mRetained = 0, mInUse = 0, mHighWaterMark = 0;
+
+		FreeList& freeList(u64 size)
+		{
+			for (auto& list : mFreeLists)
+				if (list.mSize == size)
+					return list;
+			mFreeLists.push_back({ size, nullptr });
+			return mFreeLists.back();
+		}
+	};
+
 	// a variable sized queue with small buffer optimization and
 	// stable iterators. Items can be pushed to the back, popped from
 	// the front and eased from the middle using iterators. The queue
-	// can also be forward iterated. Capacity is allocated in blocks.
+	// can also be forward iterated. Capacity is allocated in blocks,
+	// optionally from a QueueBlockPool.
 	template<typename T, u64 _DefaultCapacity = 8>
 	class Queue
 	{
@@ -196,8 +305,11 @@ namespace coproto
 		// storage for the small buffer optimization.
 		std::aligned_storage_t<sizeof(Block) + _DefaultCapacity * sizeof(Entry), 32> mInitalBuff;
 
+		// if set, blocks are allocated from this pool.
+		QueueBlockPool* mPool = nullptr;
 
-		Queue()
+		Queue(QueueBlockPool* pool = nullptr)
+			: mPool(pool)
 		{
 			mBegin = mLast = (Block*)&mInitalBuff;
 			new (mBegin) Block(DefaultCapacity);
@@ -240,7 +352,9 @@ namespace coproto
 		void allocateBlock(u64 nextSize)
 		{
 			auto allocSize = sizeof(Block) + nextSize * sizeof(Entry);
-			auto ptr = ::operator new(allocSize, std::align_val_t{ 32 });
+			auto ptr = mPool ?
+				mPool->allocate(allocSize) :
+				::operator new(allocSize, std::align_val_t{ 32 });
 			//std::cout << "new " << hexPtr(ptr) << " " << nextSize << std::endl;
 
 			auto blk = new (ptr) Block(nextSize);
@@ -296,7 +410,7 @@ namespace coproto
 					if ((u8*)mBegin != (u8*)&mInitalBuff)
 					{
 						//std::cout << "del " << hexPtr(mBegin) << " " << mBegin->capacity() << std::endl;
-						::operator delete((void*)mBegin, std::align_val_t{ 32 });
+						deallocateBlock(mBegin);
 					}
 					mBegin = n;
 				}
@@ -312,10 +426,18 @@ namespace coproto
 			if (mBegin != (Block*)&mInitalBuff)
 			{
 				//std::cout << "del " << hexPtr(mBegin) << " " << mBegin->capacity() << std::endl;
-				::operator delete((void*)mBegin, std::align_val_t{ 32 });
+				deallocateBlock(mBegin);
 			}
 		}
 
+		void deallocateBlock(Block* blk)
+		{
+			if (mPool)
+				mPool->deallocate(blk, sizeof(Block) + blk->capacity() * sizeof(Entry));
+			else
+				::operator delete((void*)blk, std::align_val_t{ 32 });
+		}
+
 		template<typename ...Args>
 		void construct(Entry* ptr, Args&&... args)
 		{
@@ -491,6 +613,7 @@ namespace coproto
 	namespace tests
 	{
 		void Queue_test();
+		void Queue_pool_test();
 	}
 
 }
\ No newline at end of file
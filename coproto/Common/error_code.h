@@ -20,7 +20,7 @@ namespace coproto
 		// The operation has been suspended.
 		suspend,
 		cancel,
-		//remoteCancel,
+		remoteCancel,
 
 		closed,
 		remoteClosed,
@@ -79,18 +79,22 @@ namespace coproto
 		{
 			SockScheduler* mSock = nullptr;
 			SessionID mId;
+			// optional, the fork of mSock with session id mId.
+			SocketFork* mFork = nullptr;
 			macoro::stop_token mToken;
 			std::exception_ptr mExPtr;
 			std::source_location mLoc{};
-			SendAwaiterBase(SockScheduler* s, SessionID sid, macoro::stop_token&& token)
+			SendAwaiterBase(SockScheduler* s, SessionID sid, macoro::stop_token&& token, SocketFork* fork = nullptr)
 				: mSock(s)
 				, mId(sid)
+				, mFork(fork)
 				, mToken(std::move(token))
 			{}
 
 			SendAwaiterBase(SendAwaiterBase&& other)
 				: mSock(other.mSock)
 				, mId(other.mId)
+				, mFork(other.mFork)
 				, mToken(std::move(other.mToken))
 				, mLoc(other.mLoc)
 			{
@@ -113,14 +117,14 @@ namespace coproto
 			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise> h)
 			{
 				set_parent(macoro::detail::get_traceable(h), mLoc);
-				return mSock->send(mId, self().getBuffer(), coroutine_handle<>(h), std::move(mToken)).std_cast();
+				return mSock->send(mId, self().getBuffer(), coroutine_handle<>(h), std::move(mToken), mFork).std_cast();
 			}
 #endif
 			template<typename promise>
 			coroutine_handle<> await_suspend(coroutine_handle<promise> h)
 			{
 				set_parent(macoro::detail::get_traceable(h), mLoc);
-				return mSock->send(mId, self().getBuffer(), h, std::move(mToken));
+				return mSock->send(mId, self().getBuffer(), h, std::move(mToken), mFork);
 			}
 
 			void await_resume()
@@ -147,19 +151,23 @@ namespace coproto
 		public:
 			SockScheduler* mSock = nullptr;
 			SessionID mId;
+			// optional, the fork of mSock with session id mId.
+			SocketFork* mFork = nullptr;
 			macoro::stop_token mToken;
 			std::exception_ptr mExPtr;
 			std::source_location mLoc{};
 
-			RecvAwaiterBase(SockScheduler* s, SessionID sid, macoro::stop_token&& token)
+			RecvAwaiterBase(SockScheduler* s, SessionID sid, macoro::stop_token&& token, SocketFork* fork = nullptr)
 				: mSock(s)
 				, mId(sid)
+				, mFork(fork)
 				, mToken(std::move(token))
 			{}
 
 			RecvAwaiterBase(RecvAwaiterBase&& other)
 				: mSock(other.mSock)
 				, mId(other.mId)
+				, mFork(other.mFork)
 				, mToken(std::move(other.mToken))
 				, mLoc(other.mLoc)
 			{
@@ -182,7 +190,7 @@ namespace coproto
 			{
 				set_parent(macoro::detail::get_traceable(h), mLoc);
 
-				return mSock->recv(mId, self().getBuffer(), coroutine_handle<>(h), std::move(mToken)).std_cast();
+				return mSock->recv(mId, self().getBuffer(), coroutine_handle<>(h), std::move(mToken), mFork).std_cast();
 			}
 #endif
 			template<typename promise>
@@ -190,7 +198,7 @@ namespace coproto
 				coroutine_handle<promise> h)
 			{
 				set_parent(macoro::detail::get_traceable(h), mLoc);
-				return mSock->recv(mId, self().getBuffer(), h, std::move(mToken));
+				return mSock->recv(mId, self().getBuffer(), h, std::move(mToken), mFork);
 			}
 
 			void await_resume()
@@ -215,13 +223,13 @@ namespace coproto
 			Container mContainer;
 			RefRecvBuffer<Container, allowResize> mRef;
 
-			MoveRecvAwaiter(SockScheduler* s, SessionID id, Container&& c, macoro::stop_token&& token)
-				: Base(s, id, std::move(token))
+			MoveRecvAwaiter(SockScheduler* s, SessionID id, Container&& c, macoro::stop_token&& token, SocketFork* fork = nullptr)
+				: Base(s, id, std::move(token), fork)
 				, mContainer(std::forward<Container>(c))
 				, mRef(mContainer, &this->mExPtr)
 			{}
-			MoveRecvAwaiter(SockScheduler* s, SessionID id, macoro::stop_token&& token)
-				: Base(s, id, std::move(token))
+			MoveRecvAwaiter(SockScheduler* s, SessionID id, macoro::stop_token&& token, SocketFork* fork = nullptr)
+				: Base(s, id, std::move(token), fork)
 				, mContainer()
 				, mRef(mContainer, &this->mExPtr)
 			{}
@@ -253,8 +261,8 @@ namespace coproto
 			Container& mContainer;
 			RefRecvBuffer<Container, allowResize> mRef;
 
-			RefRecvAwaiter(SockScheduler* s, SessionID id, Container& t, macoro::stop_token&& token)
-				: Base(s, id, std::move(token))
+			RefRecvAwaiter(SockScheduler* s, SessionID id, Container& t, macoro::stop_token&& token, SocketFork* fork = nullptr)
+				: Base(s, id, std::move(token), fork)
 				, mContainer(t)
 				, mRef(mContainer, &this->mExPtr)
 			{
@@ -282,8 +290,8 @@ namespace coproto
 			using Base = SendAwaiterBase<RefSendAwaiter<Container>>;
 			Container& mContainer;
 
-			RefSendAwaiter(SockScheduler* s, SessionID id, Container& t, macoro::stop_token&& token)
-				: Base(s, id, std::move(token))
+			RefSendAwaiter(SockScheduler* s, SessionID id, Container& t, macoro::stop_token&& token, SocketFork* fork = nullptr)
+				: Base(s, id, std::move(token), fork)
 				, mContainer(t)
 			{
 #ifdef COPROTO_LOGGING
@@ -322,8 +330,8 @@ namespace coproto
 			using Base = SendAwaiterBase<MoveSendAwaiter<Container>>;
 			Container mContainer;
 
-			MoveSendAwaiter(SockScheduler* s, SessionID id, Container&& t, macoro::stop_token&& token)
-				: Base(s, id, std::move(token))
+			MoveSendAwaiter(SockScheduler* s, SessionID id, Container&& t, macoro::stop_token&& token, SocketFork* fork = nullptr)
+				: Base(s, id, std::move(token), fork)
 				, mContainer(std::move(t))
 			{
 #ifdef COPROTO_LOGGING
@@ -336,15 +344,26 @@ namespace coproto
 			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise> h)
 			{
 				this->set_parent(macoro::detail::get_traceable(h), this->mLoc);
-				this->mSock->send(this->mId, getBuffer(), macoro::noop_coroutine(), std::move(this->mToken)).resume();
-				return h;
+				return start(coroutine_handle<>(h)).std_cast();
 			}
 #endif
 			template<typename promise>
 			coroutine_handle<> await_suspend(coroutine_handle<promise> h)
 			{
 				this->set_parent(macoro::detail::get_traceable(h), this->mLoc);
-				this->mSock->send(this->mId, getBuffer(), macoro::noop_coroutine(), std::move(this->mToken)).resume();
+				return start(h);
+			}
+
+			// The caller is resumed right away if the socket has room to buffer 
+			// the message. Otherwise, e.g. if the fork is out of flow control 
+			// credit, it is resumed once the message has been sent.
+			coroutine_handle<> start(coroutine_handle<> h)
+			{
+				auto size = ::coproto::internal::asSpan(mContainer).size();
+				if (size && this->mSock->reserveBufferedSend(size, this->mId, this->mFork) == false)
+					return this->mSock->send(this->mId, getBuffer(&this->mExPtr), h, std::move(this->mToken), this->mFork);
+
+				this->mSock->send(this->mId, getBuffer(), macoro::noop_coroutine(), std::move(this->mToken), this->mFork, true).resume();
 				return h;
 			}
 
@@ -355,9 +374,10 @@ namespace coproto
 			{
 			}
 
-			MvSendBuffer<Container> getBuffer()
+			// errors are only reported if the caller waits for the send.
+			MvSendBuffer<Container> getBuffer(std::exception_ptr* exPtr = nullptr)
 			{
-				return MvSendBuffer<Container>(std::move(mContainer), nullptr);
+				return MvSendBuffer<Container>(std::move(mContainer), exPtr);
 			}
 		};
 
@@ -276,21 +276,5 @@ namespace coproto
 			}
 		};
 
-		// an operation that can be queued. Its is simply a callback.
-		// it is used to check when all pending operations are completed.
-		struct FlushToken
-		{
-			// the callback
-			coroutine_handle<> mHandle;
-
-			FlushToken(coroutine_handle<> h) :mHandle(h) {
-				assert(mHandle);
-			}
-			~FlushToken()
-			{
-				assert(!mHandle);
-			}
-		};
-
 	}
 }
\ No newline at end of file
@@ -1,5 +1,27 @@
 
 #include "AsioSocket.h"
+#if defined(COPROTO_ENABLE_BOOST) && defined(__linux__)
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+#endif
+#if defined(COPROTO_ENABLE_BOOST) && defined(COPROTO_ENABLE_OPENSSL)
+#include <openssl/kdf.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/tls.h>)
+#define COPROTO_ENABLE_KTLS
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+#endif
+#endif
 
 namespace coproto
 {
@@ -7,11 +29,421 @@ namespace coproto
 	namespace detail
 	{
 		optional<GlobalIOContext> global_asio_io_context;
+		AsioContextConfig global_asio_io_context_config;
 		std::mutex global_asio_io_context_mutex;
 
+		void configureAsioThread(std::thread& thrd, const AsioContextConfig& config, u64 idx)
+		{
+#ifdef __linux__
+			auto handle = thrd.native_handle();
+			if (config.mThreadName.size())
+			{
+				auto name = (config.mThreadName + std::to_string(idx)).substr(0, 15);
+				pthread_setname_np(handle, name.c_str());
+			}
+
+			if (config.mCpus.size())
+			{
+				auto cpu = config.mCpus[idx % config.mCpus.size()];
+				if (cpu >= CPU_SETSIZE)
+					throw std::runtime_error("cpu " + std::to_string(cpu) + " is out of range. " COPROTO_LOCATION);
+
+				cpu_set_t set;
+				CPU_ZERO(&set);
+				CPU_SET(cpu, &set);
+				auto err = pthread_setaffinity_np(handle, sizeof(set), &set);
+				if (err)
+					throw std::runtime_error("failed to pin asio thread " + std::to_string(idx) + 
+						" to cpu " + std::to_string(cpu) + ", " + std::strerror(err) + ". " COPROTO_LOCATION);
+			}
+#else
+			(void)thrd;
+			(void)config;
+			(void)idx;
+#endif
+		}
+
+	}
+
+	AsioContextConfig AsioContextConfig::perCore()
+	{
+		AsioContextConfig c;
+		c.mThreadsPerContext = 1;
+
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (sched_getaffinity(0, sizeof(set), &set) == 0)
+		{
+			for (u64 i = 0; i < CPU_SETSIZE; ++i)
+				if (CPU_ISSET(i, &set))
+					c.mCpus.push_back(i);
+		}
+#endif
+
+		// without the affinity mask, the threads are not pinned.
+		c.mNumContexts = c.mCpus.size() ? 
+			c.mCpus.size() :
+			std::max<u64>(1, std::thread::hardware_concurrency());
+		return c;
+	}
+
+#ifdef COPROTO_ENABLE_OPENSSL
+	namespace
+	{
+		// The TLS 1.3 application traffic secrets of a connection.
+		// These are captured by the keylog callback.
+		struct KtlsSecrets
+		{
+			std::vector<u8> mClient, mServer;
+		};
+
+		int ktlsSecretsIndex()
+		{
+			static int idx = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+				[](void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+					delete static_cast<KtlsSecrets*>(ptr);
+				});
+			return idx;
+		}
+
+		std::vector<u8> fromHex(const std::string& hex)
+		{
+			std::vector<u8> r(hex.size() / 2);
+			for (u64 i = 0; i < r.size(); ++i)
+				r[i] = static_cast<u8>(std::stoi(hex.substr(i * 2, 2), nullptr, 16));
+			return r;
+		}
+
+		// the line is "<label> <client random> <secret>", all in hex.
+		void ktlsKeylog(const SSL* ssl, const char* line)
+		{
+			std::string l(line);
+			auto p0 = l.find(' ');
+			auto p1 = l.find(' ', p0 + 1);
+			if (p0 == std::string::npos || p1 == std::string::npos)
+				return;
+
+			auto label = l.substr(0, p0);
+			bool client = label == "CLIENT_TRAFFIC_SECRET_0";
+			if (!client && label != "SERVER_TRAFFIC_SECRET_0")
+				return;
+
+			auto secrets = static_cast<KtlsSecrets*>(SSL_get_ex_data(ssl, ktlsSecretsIndex()));
+			if (!secrets)
+			{
+				secrets = new KtlsSecrets;
+				SSL_set_ex_data(const_cast<SSL*>(ssl), ktlsSecretsIndex(), secrets);
+			}
+			(client ? secrets->mClient : secrets->mServer) = fromHex(l.substr(p1 + 1));
+		}
+
+#ifdef COPROTO_ENABLE_KTLS
+		// HKDF-Expand-Label(secret, label, "", out.size()) of RFC 8446.
+		bool hkdfExpandLabel(const EVP_MD* md, const std::vector<u8>& secret, std::string label, span<u8> out)
+		{
+			label = "tls13 " + label;
+			std::vector<u8> info;
+			info.push_back(static_cast<u8>(out.size() >> 8));
+			info.push_back(static_cast<u8>(out.size()));
+			info.push_back(static_cast<u8>(label.size()));
+			info.insert(info.end(), label.begin(), label.end());
+			info.push_back(0);
+
+			auto ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_HKDF, nullptr);
+			size_t size = out.size();
+			bool ok = ctx &&
+				EVP_PKEY_derive_init(ctx) > 0 &&
+				EVP_PKEY_CTX_set_hkdf_mode(ctx, EVP_PKEY_HKDEF_MODE_EXPAND_ONLY) > 0 &&
+				EVP_PKEY_CTX_set_hkdf_md(ctx, md) > 0 &&
+				EVP_PKEY_CTX_set1_hkdf_key(ctx, secret.data(), static_cast<int>(secret.size())) > 0 &&
+				EVP_PKEY_CTX_add1_hkdf_info(ctx, info.data(), static_cast<int>(info.size())) > 0 &&
+				EVP_PKEY_derive(ctx, out.data(), &size) > 0 &&
+				size == out.size();
+			EVP_PKEY_CTX_free(ctx);
+			return ok;
+		}
+
+		// install the key derived from secret as the TLS_TX or TLS_RX
+		// key of fd, where seq is the sequence number of the next record.
+		bool ktlsInstall(SSL* ssl, int fd, int dir, const std::vector<u8>& secret, u64 seq)
+		{
+			auto cipher = SSL_get_current_cipher(ssl);
+			auto md = cipher ? SSL_CIPHER_get_handshake_digest(cipher) : nullptr;
+			if (!md || secret.empty())
+				return false;
+
+			union
+			{
+				tls_crypto_info mInfo;
+				tls12_crypto_info_aes_gcm_128 mAes128;
+				tls12_crypto_info_aes_gcm_256 mAes256;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+				tls12_crypto_info_chacha20_poly1305 mChacha;
+#endif
+			} info;
+			std::memset(&info, 0, sizeof(info));
+			info.mInfo.version = TLS_1_3_VERSION;
+
+			std::array<u8, 12> iv;
+			std::array<u8, 32> key;
+			u64 keySize = 0, size = 0;
+			u8* recSeq = nullptr;
+			switch (SSL_CIPHER_get_id(cipher) & 0xFFFF)
+			{
+			case 0x1301: // TLS_AES_128_GCM_SHA256
+				info.mInfo.cipher_type = TLS_CIPHER_AES_GCM_128;
+				keySize = 16;
+				size = sizeof(info.mAes128);
+				recSeq = info.mAes128.rec_seq;
+				break;
+			case 0x1302: // TLS_AES_256_GCM_SHA384
+				info.mInfo.cipher_type = TLS_CIPHER_AES_GCM_256;
+				keySize = 32;
+				size = sizeof(info.mAes256);
+				recSeq = info.mAes256.rec_seq;
+				break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+			case 0x1303: // TLS_CHACHA20_POLY1305_SHA256
+				info.mInfo.cipher_type = TLS_CIPHER_CHACHA20_POLY1305;
+				keySize = 32;
+				size = sizeof(info.mChacha);
+				recSeq = info.mChacha.rec_seq;
+				break;
+#endif
+			default:
+				return false;
+			}
+
+			if (!hkdfExpandLabel(md, secret, "key", span<u8>(key.data(), keySize)) ||
+				!hkdfExpandLabel(md, secret, "iv", iv))
+				return false;
+
+			// the first 4 bytes of the iv are the salt, except for chacha
+			// which takes the whole iv.
+			switch (info.mInfo.cipher_type)
+			{
+			case TLS_CIPHER_AES_GCM_128:
+				std::memcpy(info.mAes128.salt, iv.data(), 4);
+				std::memcpy(info.mAes128.iv, iv.data() + 4, 8);
+				std::memcpy(info.mAes128.key, key.data(), keySize);
+				break;
+			case TLS_CIPHER_AES_GCM_256:
+				std::memcpy(info.mAes256.salt, iv.data(), 4);
+				std::memcpy(info.mAes256.iv, iv.data() + 4, 8);
+				std::memcpy(info.mAes256.key, key.data(), keySize);
+				break;
+#ifdef TLS_CIPHER_CHACHA20_POLY1305
+			default:
+				std::memcpy(info.mChacha.iv, iv.data(), 12);
+				std::memcpy(info.mChacha.key, key.data(), keySize);
+				break;
+#endif
+			}
+
+			// big endian.
+			for (u64 i = 0; i < 8; ++i)
+				recSeq[i] = static_cast<u8>(seq >> (56 - 8 * i));
+
+			bool ok = setsockopt(fd, SOL_TLS, dir, &info, static_cast<socklen_t>(size)) == 0;
+			OPENSSL_cleanse(&info, sizeof(info));
+			OPENSSL_cleanse(key.data(), key.size());
+			return ok;
+		}
+#endif
+	}
+
+	namespace
+	{
+		// the TlsSessionCache of an SSL_CTX.
+		int sessionCacheIndex()
+		{
+			static int idx = SSL_CTX_get_ex_new_index(0, nullptr, nullptr, nullptr, nullptr);
+			return idx;
+		}
+
+		// the endpoint that an SSL is connected to, as a cache key.
+		int sessionKeyIndex()
+		{
+			static int idx = SSL_get_ex_new_index(0, nullptr, nullptr, nullptr,
+				[](void*, void* ptr, CRYPTO_EX_DATA*, int, long, void*) {
+					delete static_cast<std::string*>(ptr);
+				});
+			return idx;
+		}
+
+		int newSessionCallback(SSL* ssl, SSL_SESSION* session)
+		{
+			if (auto cache = TlsSessionCache::get(SSL_get_SSL_CTX(ssl)))
+				cache->onNewSession(ssl, session);
 
+			// OpenSSL keeps its reference.
+			return 0;
+		}
 	}
 
+	TlsSessionCache::TlsSessionCache(boost::asio::ssl::context& ctx)
+		: mCtx(ctx.native_handle())
+	{
+		sessionKeyIndex();
+		if (get(mCtx))
+			throw std::runtime_error("the context already has a session cache. " COPROTO_LOCATION);
+
+		SSL_CTX_set_ex_data(mCtx, sessionCacheIndex(), this);
+		SSL_CTX_set_session_cache_mode(mCtx, SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+		SSL_CTX_sess_set_new_cb(mCtx, newSessionCallback);
+	}
+
+	TlsSessionCache::~TlsSessionCache()
+	{
+		SSL_CTX_sess_set_new_cb(mCtx, nullptr);
+		SSL_CTX_set_ex_data(mCtx, sessionCacheIndex(), nullptr);
+		clear();
+	}
+
+	TlsSessionCache* TlsSessionCache::get(SSL_CTX* ctx)
+	{
+		return static_cast<TlsSessionCache*>(SSL_CTX_get_ex_data(ctx, sessionCacheIndex()));
+	}
+
+	u64 TlsSessionCache::size()
+	{
+		std::lock_guard<std::mutex> lock(mMtx);
+		return mSessions.size();
+	}
+
+	void TlsSessionCache::clear()
+	{
+		std::lock_guard<std::mutex> lock(mMtx);
+		for (auto& s : mSessions)
+			SSL_SESSION_free(s.second);
+		mSessions.clear();
+	}
+
+	void TlsSessionCache::onConnect(SSL* ssl, const boost::asio::ip::tcp::endpoint& endpoint)
+	{
+		auto key = new std::string(endpoint.address().to_string() + ":" + std::to_string(endpoint.port()));
+		SSL_set_ex_data(ssl, sessionKeyIndex(), key);
+
+		std::lock_guard<std::mutex> lock(mMtx);
+		auto iter = mSessions.find(*key);
+		if (iter != mSessions.end())
+		{
+			// an expired session is not offered.
+			if (SSL_SESSION_is_resumable(iter->second) &&
+				SSL_SESSION_get_time(iter->second) + SSL_SESSION_get_timeout(iter->second) > time(nullptr))
+			{
+				// OpenSSL marks the session of a connection that is not shut
+				// down cleanly as not resumable. Since the sockets are closed
+				// without a TLS shutdown, each connection gets a copy.
+				auto copy = SSL_SESSION_dup(iter->second);
+				SSL_set_session(ssl, copy);
+				SSL_SESSION_free(copy);
+			}
+			else
+			{
+				SSL_SESSION_free(iter->second);
+				mSessions.erase(iter);
+			}
+		}
+	}
+
+	void TlsSessionCache::onNewSession(SSL* ssl, SSL_SESSION* session)
+	{
+		auto key = static_cast<std::string*>(SSL_get_ex_data(ssl, sessionKeyIndex()));
+		if (!key)
+			return;
+
+		// see onConnect(...) for why this is a copy.
+		auto copy = SSL_SESSION_dup(session);
+		if (!copy)
+			return;
+
+		std::lock_guard<std::mutex> lock(mMtx);
+		auto& s = mSessions[*key];
+		if (s)
+			SSL_SESSION_free(s);
+		s = copy;
+	}
+
+	void tlsEnableResumption(boost::asio::ssl::context& ctx, const std::string& id, std::chrono::seconds timeout)
+	{
+		auto c = ctx.native_handle();
+		if (!SSL_CTX_set_session_id_context(c, reinterpret_cast<const u8*>(id.data()), static_cast<unsigned int>(id.size())))
+			throw std::runtime_error("the session id is too long. " COPROTO_LOCATION);
+		SSL_CTX_clear_options(c, SSL_OP_NO_TICKET);
+		SSL_CTX_set_num_tickets(c, 1);
+		SSL_CTX_set_timeout(c, static_cast<long>(timeout.count()));
+	}
+
+	void ktlsPrepare(boost::asio::ssl::context& ctx)
+	{
+		ktlsSecretsIndex();
+		SSL_CTX_set_keylog_callback(ctx.native_handle(), ktlsKeylog);
+		SSL_CTX_set_num_tickets(ctx.native_handle(), 0);
+	}
+
+	task<bool> ktlsEnable(AsioTlsSocket& socket)
+	{
+		auto& state = *socket.mSock->mState;
+		auto ssl = state.mSock_.native_handle();
+		bool server = SSL_is_server(ssl);
+
+		auto install = [&](u64 rxSeq) {
+#ifdef COPROTO_ENABLE_KTLS
+			auto secrets = static_cast<KtlsSecrets*>(SSL_get_ex_data(ssl, ktlsSecretsIndex()));
+			int fd = state.mSock_.lowest_layer().native_handle();
+			if (!secrets || SSL_version(ssl) != TLS1_3_VERSION ||
+				setsockopt(fd, SOL_TCP, TCP_ULP, "tls", sizeof("tls")))
+				return;
+
+			auto& tx = server ? secrets->mServer : secrets->mClient;
+			auto& rx = server ? secrets->mClient : secrets->mServer;
+			state.mKtlsTx = ktlsInstall(ssl, fd, TLS_TX, tx, 0);
+			state.mKtlsRx = ktlsInstall(ssl, fd, TLS_RX, rx, rxSeq);
+			OPENSSL_cleanse(tx.data(), tx.size());
+			OPENSSL_cleanse(rx.data(), rx.size());
+#else
+			(void)rxSeq;
+#endif
+		};
+
+		std::array<u8, 1> ready{ { 1 } }, ack{ { 1 } };
+		std::pair<error_code, u64> r;
+		if (server)
+		{
+			// the client does not send until it receives ready and
+			// so nothing has been received past the handshake.
+			install(0);
+			r = co_await socket.mSock->send(ready);
+
+			// until the client has installed its keys it reads through 
+			// OpenSSL, which reads ahead and would keep anything else that
+			// we send. Therefore wait for its ack, which is the first
+			// record it sends and so is received through the kernel.
+			if (!r.first)
+				r = co_await socket.mSock->recv(ack);
+		}
+		else
+		{
+			// ready is the first record after the handshake and the
+			// server sends nothing else until it has our ack. Once ready
+			// has been read, OpenSSL therefore has nothing else buffered.
+			r = co_await socket.mSock->recv(ready);
+			if (!r.first)
+			{
+				install(1);
+				r = co_await socket.mSock->send(ack);
+			}
+		}
+
+		if (r.first)
+			throw std::system_error(r.first);
+
+		co_return state.mKtlsTx && state.mKtlsRx;
+	}
+#endif
+
 #ifdef COPROTO_ASIO_LOG
 	std::mutex ggMtx;
 	std::vector<std::string> ggLog;
@@ -17,49 +17,131 @@
 #include <boost/asio/ssl.hpp>
 #endif
 
+#include <atomic>
+#include <chrono>
 #include <mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+// The log and the lifetime checks allocate on every operation
+// and are therefore only enabled in debug builds.
 #ifndef NDEBUG
-#endif
 	#define COPROTO_ASIO_LOG
 	#define COPROTO_ASIO_DEBUG
+#endif
 
 namespace coproto
 {
+	// The configuration of the io_contexts that are used by the functions
+	// that do not take an io_context, e.g. AsioSocket::makePair() and
+	// asioConnect(ip, server). Each new socket is placed on the next
+	// io_context in round-robin order, so that a busy connection only
+	// delays the sockets that share its io_context.
+	struct AsioContextConfig
+	{
+		// the number of io_contexts.
+		u64 mNumContexts = 1;
+
+		// the number of threads that run each io_context.
+		u64 mThreadsPerContext = 2;
+
+		// If not empty, thread i is pinned to the cpu mCpus[i % mCpus.size()].
+		// The threads of io_context j are numbered j * mThreadsPerContext + k.
+		// Starting the io_contexts throws if a thread can not be pinned, e.g.
+		// the cpu is not in the affinity mask of the process. Only supported
+		// on linux and ignored elsewhere.
+		std::vector<u64> mCpus;
+
+		// The threads are named mThreadName followed by their number.
+		// Linux limits the name to 15 characters. Only supported on linux.
+		std::string mThreadName = "coproto-asio";
+
+		// one single threaded io_context per core that this process may run
+		// on, each pinned to its core. On linux these are the cores in the
+		// affinity mask of the process.
+		static AsioContextConfig perCore();
+	};
+
 	namespace detail
 	{
+		// name and pin thrd, which is thread idx of the pool. Throws if
+		// it can not be pinned.
+		void configureAsioThread(std::thread& thrd, const AsioContextConfig& config, u64 idx);
+
 		struct GlobalIOContext
 		{
-			boost::asio::io_context mIoc;
-			optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> mWork;
+			std::vector<std::unique_ptr<boost::asio::io_context>> mIocs;
+			std::vector<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> mWork;
 			std::vector<std::thread> mThreads;
 
-			GlobalIOContext()
-				:mWork(boost::asio::make_work_guard(mIoc))
-				, mThreads(2)
+			// the number of io_contexts that have been handed out.
+			std::atomic<u64> mNext{ 0 };
+
+			GlobalIOContext(const AsioContextConfig& config)
 			{
-				for (auto& thrd : mThreads)
-					thrd = std::thread([this] {mIoc.run(); });
+				if (config.mNumContexts == 0 || config.mThreadsPerContext == 0)
+					throw std::runtime_error("the global io_context requires at least one context and thread. " COPROTO_LOCATION);
+
+				for (u64 i = 0; i < config.mNumContexts; ++i)
+				{
+					mIocs.emplace_back(new boost::asio::io_context(static_cast<int>(config.mThreadsPerContext)));
+					mWork.push_back(boost::asio::make_work_guard(*mIocs.back()));
+				}
+
+				try
+				{
+					for (u64 i = 0; i < config.mNumContexts * config.mThreadsPerContext; ++i)
+					{
+						auto& ioc = *mIocs[i / config.mThreadsPerContext];
+						mThreads.emplace_back([&ioc] { ioc.run(); });
+						configureAsioThread(mThreads.back(), config, i);
+					}
+				}
+				catch (...)
+				{
+					stop();
+					throw;
+				}
 			}
 
 			~GlobalIOContext()
 			{
-				mWork.reset();
+				stop();
+			}
+
+			// let the io_contexts run out of work and join the threads.
+			void stop()
+			{
+				mWork.clear();
 				for (auto& thrd : mThreads)
 					thrd.join();
+				mThreads.clear();
+			}
+
+			// the io_context that the next socket should use.
+			boost::asio::io_context& next()
+			{
+				return *mIocs[mNext++ % mIocs.size()];
+			}
+
+			// the io_context for the given hash, e.g. of a session id.
+			boost::asio::io_context& get(u64 hash)
+			{
+				return *mIocs[hash % mIocs.size()];
 			}
 		};
 		
 		extern optional<GlobalIOContext> global_asio_io_context;
+		extern AsioContextConfig global_asio_io_context_config;
 		extern std::mutex global_asio_io_context_mutex;
 		inline void init_global_asio_io_context()
 		{
 			std::lock_guard<std::mutex> lock(global_asio_io_context_mutex);
 			if (!global_asio_io_context)
 			{
-				global_asio_io_context.emplace();
+				global_asio_io_context.emplace(global_asio_io_context_config);
 			}
 		}
 
@@ -165,6 +247,109 @@ namespace coproto
 #endif
 		};
 
+		// The memory for the handlers of a socket. Asio allocates the
+		// operations that it queues, e.g. for dispatch(...) and
+		// async_read(...), using the allocator associated with the handler.
+		// This pool keeps a few blocks that are reused by the operations of
+		// the socket so that, once warm, these allocations do not touch
+		// the heap. A block that is too small is replaced with a larger one.
+		// If all blocks are in use, the heap is used.
+		struct AsioHandlerPool
+		{
+			struct Slot
+			{
+				std::atomic<bool> mInUse{ false };
+				std::atomic<void*> mPtr{ nullptr };
+				u64 mSize = 0;
+			};
+
+			// a send, a recv and a dispatch of each.
+			std::array<Slot, 4> mSlots;
+
+			AsioHandlerPool() = default;
+			AsioHandlerPool(const AsioHandlerPool&) = delete;
+
+			~AsioHandlerPool()
+			{
+				for (auto& s : mSlots)
+					::operator delete(s.mPtr.load());
+			}
+
+			void* allocate(u64 size)
+			{
+				for (auto& s : mSlots)
+				{
+					if (s.mInUse.load(std::memory_order_relaxed) == false &&
+						s.mInUse.exchange(true, std::memory_order_acquire) == false)
+					{
+						if (s.mSize < size)
+						{
+							// the old block is freed only once mPtr no longer refers
+							// to it. Otherwise the heap could hand its address to
+							// another thread whose deallocate would match this slot.
+							auto old = s.mPtr.exchange(::operator new(size));
+							s.mSize = size;
+							::operator delete(old);
+						}
+						return s.mPtr.load();
+					}
+				}
+				return ::operator new(size);
+			}
+
+			void deallocate(void* p)
+			{
+				for (auto& s : mSlots)
+				{
+					if (s.mPtr.load(std::memory_order_relaxed) == p)
+					{
+						s.mInUse.store(false, std::memory_order_release);
+						return;
+					}
+				}
+				::operator delete(p);
+			}
+		};
+
+		template<typename T>
+		struct AsioHandlerAllocator
+		{
+			using value_type = T;
+
+			AsioHandlerPool* mPool;
+
+			AsioHandlerAllocator(AsioHandlerPool& pool) noexcept
+				: mPool(&pool)
+			{}
+
+			template<typename U>
+			AsioHandlerAllocator(const AsioHandlerAllocator<U>& o) noexcept
+				: mPool(o.mPool)
+			{}
+
+			T* allocate(std::size_t n)
+			{
+				return static_cast<T*>(mPool->allocate(n * sizeof(T)));
+			}
+
+			void deallocate(T* p, std::size_t)
+			{
+				mPool->deallocate(p);
+			}
+
+			template<typename U>
+			bool operator==(const AsioHandlerAllocator<U>& o) const noexcept { return mPool == o.mPool; }
+			template<typename U>
+			bool operator!=(const AsioHandlerAllocator<U>& o) const noexcept { return mPool != o.mPool; }
+		};
+
+		template<typename T>
+		struct IsSslStream : std::false_type {};
+#ifdef COPROTO_ENABLE_OPENSSL
+		template<typename T>
+		struct IsSslStream<boost::asio::ssl::stream<T>> : std::true_type {};
+#endif
+
 		template<typename SocketType = boost::asio::ip::tcp::socket>
 		struct AsioSocket : public Socket
 		{
@@ -200,10 +385,11 @@ namespace coproto
 
 
 
-				Awaiter(Sock* ss, span<u8> dd, bool send, macoro::stop_token&& t, i64 idx = 0)
+				Awaiter(Sock* ss, span<u8> dd, bool send, macoro::stop_token&& t, i64 idx = 0, bool some = false)
 					: mSock(ss)
 					, mData(dd)
 					, mType(send ? Type::send : Type::recv)
+					, mSome(some)
 					, mCancellationRequested(false)
 					, mSynchronousFlag(false)
 					, mActiveCount()
@@ -214,6 +400,35 @@ namespace coproto
 #endif
 				{
 					COPROTO_ASSERT(dd.size());
+					registerStop();
+				}
+
+				// A vectored operation. At most mBuffers.size() buffers 
+				// are supported. They are passed to asio as a single
+				// buffer sequence.
+				Awaiter(Sock* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t, i64 idx = 0)
+					: mSock(ss)
+					, mNumBuffers(dd.size())
+					, mType(send ? Type::send : Type::recv)
+					, mCancellationRequested(false)
+					, mSynchronousFlag(false)
+					, mActiveCount()
+					, mToken(t)
+#ifdef COPROTO_ASIO_LOG
+					, mLogState(ss->mState)
+					, mIdx(idx)
+#endif
+				{
+					COPROTO_ASSERT(dd.size() && dd.size() <= mBuffers.size());
+					for (u64 i = 0; i < dd.size(); ++i)
+						mBuffers[i] = boost::asio::mutable_buffer(dd[i].data(), dd[i].size());
+					if (dd.size())
+						mData = dd[0];
+					registerStop();
+				}
+
+				void registerStop()
+				{
 					if (mToken.stop_possible())
 					{
 						mReg.emplace(mToken, [this] {
@@ -229,9 +444,17 @@ namespace coproto
 
 				Sock* mSock;
 				span<u8> mData;
+
+				// the buffer sequence for vectored operations. Unused 
+				// buffers are left empty.
+				std::array<boost::asio::mutable_buffer, 4> mBuffers;
+				u64 mNumBuffers = 0;
 				u64 mBt = 0;
 				enum Type { send, recv };
 				Type mType;
+
+				// if true, a recv completes once any data has been received.
+				bool mSome = false;
 				optional<error_code> mEc;
 				boost::asio::cancellation_signal mCancelSignal;
 				std::atomic<bool> mCancellationRequested, mSynchronousFlag;
@@ -307,6 +530,28 @@ namespace coproto
 				std::atomic_bool mSslLock;
 #endif
 				AsioLifetime mOpCount;
+
+				// the memory of the asio operations of this socket.
+				AsioHandlerPool mHandlerPool;
+
+				// For TLS sockets, true if the kernel encrypts the data that is
+				// sent/received. The io is then performed on the tcp socket.
+				bool mKtlsTx = false, mKtlsRx = false;
+
+				// call f with the stream that the io in the given direction
+				// should be performed on.
+				template<typename F>
+				void withStream(bool send, F&& f)
+				{
+					if constexpr (IsSslStream<SocketType>::value)
+					{
+						if (send ? mKtlsTx : mKtlsRx)
+							return f(mSock_.next_layer());
+					}
+					f(mSock_);
+				}
+
+				AsioHandlerAllocator<void> allocator() { return mHandlerPool; }
 			};
 
 
@@ -341,7 +586,7 @@ namespace coproto
 						{
 
 							boost::asio::dispatch(mState->mSock_.get_executor(),
-								[s = mState,
+								boost::asio::bind_allocator(mState->allocator(), [s = mState,
 								lt = mState->mOpCount.lockPtr(),
 								h
 								]()mutable {
@@ -355,7 +600,7 @@ namespace coproto
 									lt.reset();
 									h.resume();
 
-								});
+								}));
 						}
 						void await_resume() const noexcept {}
 					};
@@ -371,6 +616,15 @@ namespace coproto
 				Awaiter send(span<u8> data, macoro::stop_token token, u64 idx) { return Awaiter(this, data, true, std::move(token), idx); };
 				Awaiter recv(span<u8> data, macoro::stop_token token, u64 idx) { return Awaiter(this, data, false, std::move(token), idx); };
 
+				// optional vectored send and recv. These perform a single 
+				// async_write/async_read with a buffer sequence.
+				Awaiter send(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(this, data, true, std::move(token)); };
+				Awaiter recv(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(this, data, false, std::move(token)); };
+
+				// optional recv that completes once some data has been received.
+				// Performs a single async_read_some.
+				Awaiter recvSome(span<u8> data, macoro::stop_token token = {}) { return Awaiter(this, data, false, std::move(token), 0, true); };
+
 #ifdef COPROTO_ASIO_LOG
 				void log(std::string msg)
 				{
@@ -450,7 +704,7 @@ namespace coproto
 				"send " : "recv ") + std::to_string(mIdx));
 #endif
 			boost::asio::dispatch(mSock->mState->mSock_.get_executor(),
-				[this,
+				boost::asio::bind_allocator(mSock->mState->allocator(), [this,
 				lt0 = mSock->mState->mOpCount.lockPtr(), 
 				lt1 = mActiveCount.lockPtr()
 				]() mutable {
@@ -470,34 +724,41 @@ namespace coproto
 						std::terminate();
 #endif
 
-					if (mType == Type::send)
-					{
-						async_write(mSock->mState->mSock_, boost::asio::const_buffer(mData.data(), mData.size()),
-							boost::asio::bind_cancellation_slot(
-								mCancelSignal.slot(),
-								[this,
-								lt0 = mSock->mState->mOpCount.lock(),
-								lt1 = mActiveCount.lock()
-								](boost::system::error_code error, std::size_t n) mutable {
-									callback(error, n, std::move(lt0), std::move(lt1));
-								}
-						));
-					}
-					else
-					{
-						async_read(mSock->mState->mSock_, boost::asio::mutable_buffer(mData.data(), mData.size()),
-							boost::asio::bind_cancellation_slot(
-								mCancelSignal.slot(),
-								[this,
-								lt0 = mSock->mState->mOpCount.lock(),
-								lt1 = mActiveCount.lock()
-								](boost::system::error_code error, std::size_t n) mutable {
+					// start the operation on either a single buffer or 
+					// the vectored buffer sequence.
+					auto start = [this](auto&& buffers) {
+						auto handler = boost::asio::bind_allocator(
+							mSock->mState->allocator(),
+							[this,
+							lt0 = mSock->mState->mOpCount.lock(),
+							lt1 = mActiveCount.lock()
+							](boost::system::error_code error, std::size_t n) mutable {
+								callback(error, n, std::move(lt0), std::move(lt1));
+							});
+
+						auto run = [&](auto&& completion) {
+							mSock->mState->withStream(mType == Type::send, [&](auto& stream) {
+								if (mType == Type::send)
+									async_write(stream, buffers, std::move(completion));
+								else if (mSome)
+									stream.async_read_some(buffers, std::move(completion));
+								else
+									async_read(stream, buffers, std::move(completion));
+								});
+						};
 
-									callback(error, n, std::move(lt0), std::move(lt1));
+						// the cancellation slot allocates and so it is
+						// only connected if the operation can be canceled.
+						if (mToken.stop_possible())
+							run(boost::asio::bind_cancellation_slot(mCancelSignal.slot(), std::move(handler)));
+						else
+							run(std::move(handler));
+					};
 
-								}
-						));
-					}
+					if (mNumBuffers)
+						start(mBuffers);
+					else
+						start(boost::asio::mutable_buffer(mData.data(), mData.size()));
 
 #ifdef COPROTO_ASIO_DEBUG
 					exp = true;
@@ -548,14 +809,33 @@ namespace coproto
 
 				}
 
-				});
+				}));
 		}
 	}
 
+	// Set the configuration of the global io_contexts. This must be called
+	// before they are first used or after detail::destroy_global_asio_io_context().
+	inline void configure_global_io_context(const AsioContextConfig& config)
+	{
+		std::lock_guard<std::mutex> lock(detail::global_asio_io_context_mutex);
+		if (detail::global_asio_io_context)
+			throw std::runtime_error("the global io_context is already running. " COPROTO_LOCATION);
+		detail::global_asio_io_context_config = config;
+	}
+
+	// The next global io_context in round-robin order.
 	inline boost::asio::io_context& global_io_context()
 	{
 		detail::init_global_asio_io_context();
-		return detail::global_asio_io_context->mIoc;
+		return detail::global_asio_io_context->next();
+	}
+
+	// The global io_context that the given hash, e.g. of a
+	// session id, maps to. The same hash always gives the same one.
+	inline boost::asio::io_context& global_io_context(u64 hash)
+	{
+		detail::init_global_asio_io_context();
+		return detail::global_asio_io_context->get(hash);
 	}
 
 	struct AsioSocket : public detail::AsioSocket<boost::asio::ip::tcp::socket>
@@ -573,8 +853,7 @@ namespace coproto
 		static std::array<AsioSocket, 2> makePair(boost::asio::io_context& ioc);
 		static std::array<AsioSocket, 2> makePair()
 		{
-			detail::init_global_asio_io_context();
-			return makePair(detail::global_asio_io_context.value().mIoc);
+			return makePair(global_io_context());
 		}
 	};
 
@@ -1069,11 +1348,85 @@ namespace coproto
 	};
 
 #ifdef COPROTO_ENABLE_OPENSSL
+	// Counts the TLS handshakes that resumed a previous session (hits)
+	// and those that performed a full handshake (misses).
+	struct TlsResumptionStats
+	{
+		std::atomic<u64> mHits{ 0 }, mMisses{ 0 };
+
+		void record(SSL* ssl)
+		{
+			if (SSL_session_reused(ssl))
+				++mHits;
+			else
+				++mMisses;
+		}
+	};
+
+	// A client side cache of TLS sessions keyed by the endpoint that
+	// was connected to. Once a cache has been created for a client
+	// context, each AsioTlsConnect that uses the context offers the last
+	// session that was received from the same endpoint. If the server
+	// accepts it, the handshake is abbreviated and the certificates
+	// are not exchanged or verified again.
+	//
+	// The server must enable resumption with tlsEnableResumption(...).
+	// The cache must be destroyed before the context.
+	class TlsSessionCache
+	{
+	public:
+		TlsSessionCache(boost::asio::ssl::context& ctx);
+		TlsSessionCache(const TlsSessionCache&) = delete;
+		~TlsSessionCache();
+
+		TlsResumptionStats mStats;
+
+		u64 hits() const { return mStats.mHits; }
+		u64 misses() const { return mStats.mMisses; }
+
+		// the number of endpoints with a session.
+		u64 size();
+
+		// remove all sessions.
+		void clear();
+
+		// the cache of ctx, if any.
+		static TlsSessionCache* get(SSL_CTX* ctx);
+
+		// called before the handshake with the endpoint.
+		void onConnect(SSL* ssl, const boost::asio::ip::tcp::endpoint& endpoint);
+
+		// called once the handshake has succeeded.
+		void onHandshake(SSL* ssl) { mStats.record(ssl); }
+
+		// called by OpenSSL when the server issues a new session.
+		void onNewSession(SSL* ssl, SSL_SESSION* session);
+
+	private:
+		SSL_CTX* mCtx;
+		std::mutex mMtx;
+		std::unordered_map<std::string, SSL_SESSION*> mSessions;
+	};
+
+	// Allow clients to resume their sessions with a server that uses ctx.
+	// The server issues a session ticket after each handshake that the
+	// client can present on its next connection. id identifies the server
+	// application; a session is only resumed with the same id. Sessions
+	// expire after timeout. Note that ktlsPrepare(...) disables TLS 1.3
+	// tickets and so resumption.
+	void tlsEnableResumption(
+		boost::asio::ssl::context& ctx,
+		const std::string& id = "coproto",
+		std::chrono::seconds timeout = std::chrono::hours(2));
+
 	struct AsioTlsAcceptor
 	{
 		AsioAcceptor mAcceptor;
 		boost::asio::ssl::context& mContext;
 
+		// the number of accepted connections that resumed a session.
+		TlsResumptionStats mStats;
+
 		AsioTlsAcceptor(
 			std::string address,
 			boost::asio::io_context& ioc,
@@ -1151,6 +1504,8 @@ namespace coproto
 								mCancelSignal.slot(),
 								[this, h](boost::system::error_code ec) {
 									mEc = ec;
+									if (!ec)
+										mAcceptor.mStats.record(mSocket.native_handle());
 
 									auto f = mSynchronousFlag--;
 
@@ -1280,11 +1635,17 @@ namespace coproto
 					}
 					else
 					{
+						auto cache = TlsSessionCache::get(SSL_get_SSL_CTX(mSocket.native_handle()));
+						if (cache)
+							cache->onConnect(mSocket.native_handle(), mConnector.mEndpoint);
+
 						mSocket.async_handshake(boost::asio::ssl::stream_base::client, boost::asio::bind_cancellation_slot(
 							mConnector.mCancelSignal.slot(),
-							[this](boost::system::error_code ec)
+							[this, cache](boost::system::error_code ec)
 							{
 								mConnector.mEc = ec;
+								if (cache && !ec)
+									cache->onHandshake(mSocket.native_handle());
 
 								auto f = mConnector.mSynchronousFlag--;
 
@@ -1386,6 +1747,32 @@ namespace coproto
 		}
 	};
 
+	// Kernel TLS (linux only). Once the handshake is done, the record
+	// encryption can be moved into the kernel. The socket then reads and
+	// writes plaintext on the tcp socket and OpenSSL no longer copies and
+	// encrypts the data on the protocol's threads.
+	//
+	// * ktlsPrepare(ctx) must be called on the contexts of both parties
+	//   before they connect. It captures the traffic secrets of the
+	//   connections, replacing any keylog callback, and disables TLS 1.3
+	//   session tickets, whose records the kernel would otherwise hand
+	//   to the socket.
+	// * co_await ktlsEnable(socket) must be called by both parties right
+	//   after the connection is established, before anything else is sent
+	//   or received. The server installs the keys and then sends a one
+	//   byte record. The client installs the keys once it has received
+	//   this record, at which point OpenSSL has no data buffered, and
+	//   replies with a one byte record. The server returns once it has
+	//   received the reply so that nothing it sends afterwards can be
+	//   read ahead by OpenSSL on the client.
+	//
+	// Only TLS 1.3 with AES-GCM or ChaCha20-Poly1305 is supported. Each
+	// direction falls back to OpenSSL if the kernel can not perform it,
+	// e.g. if the tls module is not loaded. ktlsEnable(...) returns true
+	// if the kernel performs both directions.
+	void ktlsPrepare(boost::asio::ssl::context& ctx);
+	task<bool> ktlsEnable(AsioTlsSocket& socket);
+
 	struct OpenSslX509
 	{
 		X509* mPtr = nullptr;
@@ -9,6 +9,9 @@
 
 #include "coproto/Socket/Socket.h"
 #include <sstream>
+#include <algorithm>
+#include <condition_variable>
+#include <thread>
 
 namespace coproto
 {
@@ -34,11 +37,10 @@ namespace coproto
 	// & then receive one message.
 	// 
 	// Messages are obtained by calling getOutbound(). This returns a 
-	// Buffer. The size of the buffer can be obtained by calling Buffer::size().
-	// You can then get the contained data by calling Buffer::pop(span<u8> dest)
-	// which will copy the buffered data into dest. Alternatively, you can
-	// call Buffer::pop() to get returned a std::vector<u8> with all the 
-	// buffered data in it.
+	// std::vector<u8> with all the buffered data in it. Alternatively, 
+	// getOutbound(std::vector<u8>& dest) swaps the buffered data into dest
+	// and keeps the old storage of dest for future messages. Calling it with
+	// the same vector each round therefore does not allocate or copy.
 	// 
 	// You can set as incoming message by calling processInbound(span<u8> src).
 	// This will buffer the data in src and resume the protocol if possible. The
@@ -58,10 +60,33 @@ namespace coproto
 	// or if its run on some (multi-threaded) executor since processInbound(...)
 	// might return even though the protocol is still making progress on the executor.
 	//
+	// To connect BufferingSockets to each other, e.g. for testing, see 
+	// exchangeMessages(...) or BufferingSocketPump, which does so on a
+	// background thread.
+	//
 	struct BufferingSocket : public Socket
 	{
 		struct SendRecvAwaiter;
 		struct SockImpl;
+		struct Buffer;
+
+		// A flag and condition variable that a socket signals when it
+		// has new outbound data or is closed. See BufferingSocketPump.
+		struct Signal
+		{
+			std::mutex mMtx;
+			std::condition_variable mCv;
+			bool mPending = false;
+
+			void notify()
+			{
+				{
+					std::lock_guard<std::mutex> lock(mMtx);
+					mPending = true;
+				}
+				mCv.notify_one();
+			}
+		};
 
 		// Constructs the "actual socket" SockImpl and pass that to Socket.
 		// This somewhat unusual pattern is used so that the Socket 
@@ -87,7 +112,11 @@ namespace coproto
 		struct SendRecvAwaiter
 		{
 
-			SendRecvAwaiter(SockImpl* ss, span<u8> dd, bool send, macoro::stop_token&& t);
+			SendRecvAwaiter(SockImpl* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some = false);
+
+			// A vectored operation. The buffers are sent/received in order
+			// as if they were one contiguous buffer.
+			SendRecvAwaiter(SockImpl* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t);
 
 			// The socket that the operation is performed on.
 			SockImpl* mSock;
@@ -95,6 +124,17 @@ namespace coproto
 			// The data to be sent or received.
 			span<u8> mData;
 
+			// For vectored operations, the buffers to be sent or
+			// received. mData is empty in this case.
+			span<span<u8>> mBuffers;
+
+			// The total number of bytes to be sent or received.
+			u64 mSize = 0;
+
+			// If true, a receive completes once any data is available.
+			// mSize is then set to the number of bytes received.
+			bool mSome = false;
+
 			enum Type { send, recv };
 
 			// the type of operation.
@@ -131,101 +171,154 @@ namespace coproto
 			// of bytes that were sent or received.
 			std::pair<error_code, u64> await_resume() {
 				COPROTO_ASSERT(mEc);
-				auto bt = (!*mEc) ? mData.size() : 0;
+				auto bt = (!*mEc) ? mSize : 0;
 				return { *mEc, bt };
 			}
 
+			// register the cancellation callback if the user gave us
+			// a stop token.
+			void registerStop();
+
+			// push our data onto the buffer.
+			void pushTo(Buffer& buffer);
+
+			// pop our data from the buffer.
+			void popFrom(Buffer& buffer);
+
+			// pop our data from the front of data. Returns the number
+			// of bytes that were consumed.
+			u64 popFrom(span<u8> data);
+
+			// the number of buffered bytes required to complete a receive.
+			u64 minSize() const { return mSome ? 1 : mSize; }
 		};
 
 
+		// A growable ring buffer. The data is stored contiguously in
+		// mData starting at mBegin and wraps around to the start of mData.
+		// The storage is only reallocated when the buffer is full, so
+		// once warmed up, pushing and popping does not allocate.
 		struct Buffer
 		{
-			// the offset into the first buffer where the data starts;
-			u64 mFront = 0;
+			// the storage. mData.size() is the capacity of the buffer.
+			std::vector<u8> mData;
+
+			// the offset into mData where the data starts.
+			u64 mBegin = 0;
 
 			// total number of bytes contained in the buffer.
 			u64 mSize = 0;
-			std::deque<std::vector<u8>> mData;
 
-			~Buffer() { size(); }
 			Buffer() = default;
 			Buffer(const Buffer&) = delete;
 			Buffer(Buffer&&) = delete;
 
-			u64 size() {
-#ifndef NDEBUG
-				auto ss = 0ull;
-				for (auto& b : mData)
-					ss += b.size();
+			u64 size() const { return mSize; }
 
-				ss -= mFront;
-				COPROTO_ASSERT(ss == mSize);
-#endif
-				return mSize;
+			u64 capacity() const { return mData.size(); }
+
+			// the buffered data, in order, as at most two spans. The spans
+			// are valid until the buffer is next modified.
+			std::array<span<u8>, 2> front()
+			{
+				auto m = std::min<u64>(mSize, capacity() - mBegin);
+				return { {
+					span<u8>(mData.data() + mBegin, m),
+					span<u8>(mData.data(), mSize - m)
+				} };
+			}
+
+			// remove the first n bytes from the buffer.
+			void consume(u64 n)
+			{
+				COPROTO_ASSERT(n <= mSize);
+				mSize -= n;
+				mBegin = mSize ? (mBegin + n) % capacity() : 0;
+			}
+
+			// make sure that n more bytes can be pushed without reallocating.
+			void reserve(u64 n)
+			{
+				if (mSize + n <= capacity())
+					return;
+
+				std::vector<u8> data(std::max<u64>(mSize + n, 2 * capacity()));
+				auto f = front();
+				std::copy(f[0].begin(), f[0].end(), data.begin());
+				std::copy(f[1].begin(), f[1].end(), data.begin() + f[0].size());
+				mData = std::move(data);
+				mBegin = 0;
 			}
 
 			// get the next data.size() bytes from the buffer.
 			void pop(span<u8> data)
 			{
 				COPROTO_ASSERT(mSize >= data.size());
+				auto f = front();
+				auto m = std::min<u64>(data.size(), f[0].size());
+				std::copy(f[0].begin(), f[0].begin() + m, data.begin());
+				std::copy(f[1].begin(), f[1].begin() + (data.size() - m), data.begin() + m);
+				consume(data.size());
+			}
 
-				while (data.size())
-				{
-					auto m = std::min<u64>(data.size(), mData.front().size() - mFront);
-					auto f = mData.front().begin() + mFront;
-					std::copy(f, f + m, data.begin());
-					mFront += m;
-					mSize -= m;
-
-					if (mFront == mData.front().size())
-					{
-						mData.pop_front();
-						mFront = 0;
-					}
-
-					data = data.subspan(m);
-				}
-
-				size();
+			// get the next bytes from the buffer, in order, for each of the buffers.
+			void pop(span<span<u8>> data)
+			{
+				for (auto d : data)
+					pop(d);
 			}
 
 			// add the data to the buffer.
 			void push(span<u8> data)
 			{
-				mData.emplace_back(data.begin(), data.end());
+				reserve(data.size());
+				auto end = (mBegin + mSize) % std::max<u64>(capacity(), 1);
+				auto m = std::min<u64>(data.size(), capacity() - end);
+				std::copy(data.begin(), data.begin() + m, mData.begin() + end);
+				std::copy(data.begin() + m, data.end(), mData.begin());
 				mSize += data.size();
-				size();
 			}
 
+			// add the data to the buffer, in order, for each of the buffers.
+			void push(span<span<u8>> data)
+			{
+				u64 n = 0;
+				for (auto d : data)
+					n += d.size();
+				reserve(n);
+				for (auto d : data)
+					push(d);
+			}
 
-			// add the data to the buffer.
-			void push(Buffer&& data)
+			// move the data so that it starts at the beginning of mData.
+			void linearize()
 			{
-				mSize += data.size();
-				data.mSize = 0;
+				if (mBegin + mSize > capacity())
+					std::rotate(mData.begin(), mData.begin() + mBegin, mData.end());
+				else if (mBegin)
+					std::copy(mData.begin() + mBegin, mData.begin() + mBegin + mSize, mData.begin());
+				mBegin = 0;
+			}
 
-				while (data.mData.size())
-				{
-					COPROTO_ASSERT(data.mFront == 0);
-					mData.emplace_back(std::move(data.mData.front()));
-					data.mData.pop_front();
-				}
-				size();
+			// move the buffered data into dest. On return dest holds exactly
+			// the buffered data and the previous storage of dest, whose
+			// contents are discarded, is reused as the storage of this buffer. The data is only copied
+			// if it wrapped around, so calling this repeatedly with the same
+			// vector does not allocate or copy.
+			void swap(std::vector<u8>& dest)
+			{
+				linearize();
+				mData.resize(mSize);
+				std::swap(mData, dest);
+				mData.resize(mData.capacity());
+				mSize = 0;
 			}
 
+			// get all of the data as a vector.
 			std::vector<u8> pop()
 			{
-				std::vector<u8> buff(size());
-				auto iter = buff.begin();
-				while (mData.size())
-				{
-					COPROTO_ASSERT(mFront == 0);
-					std::copy(mData.front().begin(), mData.front().end(), iter);
-					iter += mData.front().size();
-					mData.pop_front();
-				}
-				mSize = 0;
-				size();
+				std::vector<u8> buff;
+				swap(buff);
 				return buff;
 			}
 		};
@@ -246,12 +339,23 @@ namespace coproto
 			// data that has been received and can consumes.
 			Buffer mInboundBuffer_;
 
+			// if set, notified when outbound data becomes available
+			// or the socket is closed.
+			Signal* mSignal = nullptr;
+
 			//std::vector<std::string> mLog;
 
 			void close();
 
 			SendRecvAwaiter send(span<u8> data, macoro::stop_token token = {}) { return SendRecvAwaiter(this, data, true, std::move(token)); };
 			SendRecvAwaiter recv(span<u8> data, macoro::stop_token token = {}) { return SendRecvAwaiter(this, data, false, std::move(token)); };
+
+			// optional vectored versions of send(...) and recv(...).
+			SendRecvAwaiter send(span<span<u8>> data, macoro::stop_token token = {}) { return SendRecvAwaiter(this, data, true, std::move(token)); };
+			SendRecvAwaiter recv(span<span<u8>> data, macoro::stop_token token = {}) { return SendRecvAwaiter(this, data, false, std::move(token)); };
+
+			// optional receive that completes with whatever data is buffered.
+			SendRecvAwaiter recvSome(span<u8> data, macoro::stop_token token = {}) { return SendRecvAwaiter(this, data, false, std::move(token), true); };
 		};
 
 
@@ -263,17 +367,29 @@ namespace coproto
 
 				//mSock->mLog.push_back("processInbound\n inbound "+std::to_string((u64)mSock->mInbound_)+"\ndata " + hex(data));
 
-				mSock->mInboundBuffer_.push(data);
-
-				if (mSock->mInbound_ && (mSock->mInbound_->mData.size() <= mSock->mInboundBuffer_.size()))
+				auto& inbound = mSock->mInboundBuffer_;
+				if (mSock->mInbound_ && (mSock->mInbound_->minSize() <= inbound.size() + data.size()))
 				{
-					mSock->mInboundBuffer_.pop(mSock->mInbound_->mData);
+					// complete the pending receive. If nothing is buffered
+					// the data is copied directly to the receiver.
+					if (inbound.size() == 0)
+						data = data.subspan(mSock->mInbound_->popFrom(data));
+					else
+					{
+						inbound.push(data);
+						data = {};
+						mSock->mInbound_->popFrom(inbound);
+					}
+
 					mSock->mInbound_->mEc = code::success;
 					cb = mSock->mInbound_->mHandle;
 					mSock->mInbound_ = nullptr;
 					COPROTO_ASSERT(cb);
 				}
 
+				if (data.size())
+					inbound.push(data);
+
 			}
 
 			if (cb)
@@ -308,18 +424,28 @@ namespace coproto
 		}
 
 		optional<std::vector<u8>> getOutbound() {
-			std::lock_guard<std::mutex> lock(mSock->mMtx);
-			auto out = mSock->mOutboundBuffer_.pop();
-
-			if (out.size() == 0 && mSock->mEc_)
+			std::vector<u8> out;
+			if (!getOutbound(out))
 				return {};
-
 			return out;
 		}
 
+		// Swap the outbound messages into dest. The previous storage of
+		// dest is kept by the socket and is used to buffer future
+		// messages. Therefore, passing the same vector each round does not
+		// allocate once the buffers are large enough. Returns false if the
+		// socket has an error and there are no outbound messages.
+		bool getOutbound(std::vector<u8>& dest) {
+			std::lock_guard<std::mutex> lock(mSock->mMtx);
+			mSock->mOutboundBuffer_.swap(dest);
+
+			return dest.size() || !mSock->mEc_;
+		}
+
 		static void exchangeMessages(BufferingSocket& s0, BufferingSocket& s1)
 		{
 			std::array<BufferingSocket, 2> s{ { s0,s1 } };
+			std::vector<u8> buffer;
 
 			bool progress = true;
 			while (progress)
@@ -327,13 +453,11 @@ namespace coproto
 				progress = false;
 				for (u64 i = 0; i < 2; ++i)
 				{
-					auto bb = s[i].getOutbound();
-
-					if (bb)
+					if (s[i].getOutbound(buffer))
 					{
-						if (bb->size())
+						if (buffer.size())
 						{
-							s[1 ^ i].processInbound(*bb);
+							s[1 ^ i].processInbound(buffer);
 							progress = true;
 						}
 					}
@@ -348,13 +472,72 @@ namespace coproto
 	};
 
 
-	inline BufferingSocket::SendRecvAwaiter::SendRecvAwaiter(SockImpl* ss, span<u8> dd, bool send, macoro::stop_token&& t)
+	inline BufferingSocket::SendRecvAwaiter::SendRecvAwaiter(SockImpl* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some)
 		: mSock(ss)
 		, mData(dd)
+		, mSize(dd.size())
+		, mSome(some)
 		, mType(send ? Type::send : Type::recv)
 		, mToken(t)
 	{
 		COPROTO_ASSERT(dd.size());
+		registerStop();
+	}
+
+	inline BufferingSocket::SendRecvAwaiter::SendRecvAwaiter(SockImpl* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t)
+		: mSock(ss)
+		, mBuffers(dd)
+		, mType(send ? Type::send : Type::recv)
+		, mToken(t)
+	{
+		for (auto& d : dd)
+			mSize += d.size();
+		COPROTO_ASSERT(mSize);
+		registerStop();
+	}
+
+	inline void BufferingSocket::SendRecvAwaiter::pushTo(Buffer& buffer)
+	{
+		if (mBuffers.size())
+			buffer.push(mBuffers);
+		else
+			buffer.push(mData);
+	}
+
+	inline void BufferingSocket::SendRecvAwaiter::popFrom(Buffer& buffer)
+	{
+		if (mBuffers.size())
+			buffer.pop(mBuffers);
+		else
+		{
+			if (mSome)
+				mSize = std::min<u64>(mSize, buffer.size());
+			buffer.pop(mData.subspan(0, mSize));
+		}
+	}
+
+	inline u64 BufferingSocket::SendRecvAwaiter::popFrom(span<u8> data)
+	{
+		if (mSome)
+			mSize = std::min<u64>(mSize, data.size());
+		COPROTO_ASSERT(data.size() >= mSize);
+
+		if (mBuffers.size())
+		{
+			auto iter = data.begin();
+			for (auto d : mBuffers)
+			{
+				std::copy(iter, iter + d.size(), d.begin());
+				iter += d.size();
+			}
+		}
+		else
+			std::copy(data.begin(), data.begin() + mSize, mData.begin());
+		return mSize;
+	}
+
+	inline void BufferingSocket::SendRecvAwaiter::registerStop()
+	{
 		if (mToken.stop_possible())
 		{
 			//register the cancellation callback.
@@ -401,8 +584,6 @@ namespace coproto
 					cb.resume();
 				});
 		}
-
-
 	}
 
 	inline void BufferingSocket::SockImpl::close()
@@ -419,6 +600,10 @@ namespace coproto
 			if (!mEc_)
 				mEc_ = code::closed;
 
+			// let the pump tell the other party.
+			if (mSignal)
+				mSignal->notify();
+
 			// if we have an active receive, then we need to cancel it
 			// and clear the pending receive from the socket.
 			auto op = std::exchange(mInbound_, nullptr);
@@ -464,20 +649,26 @@ namespace coproto
 					// simply adding the data to our internal buffer.
 
 					//mSock->mLog.push_back("send " + hex(mData));
-					mSock->mOutboundBuffer_.push(mData);
+					auto notify = mSock->mSignal && mSock->mOutboundBuffer_.size() == 0;
+					pushTo(mSock->mOutboundBuffer_);
 					mEc = code::success;
 					c1 = h;
 
+					// only the first send after the outbound data was taken
+					// needs to wake the pump.
+					if (notify)
+						mSock->mSignal->notify();
+
 				}
 				else
 				{
 					// receive operations complete synchronously if we have 
 					// the requested data in our internal buffer. Otherwise
 					// we record the request as mSock->mInbound and suspend.
-					if (mSock->mInboundBuffer_.size() >= mData.size())
+					if (mSock->mInboundBuffer_.size() >= minSize())
 					{
 						//mSock->mLog.push_back("pop " + hex(mData));
-						mSock->mInboundBuffer_.pop(mData);
+						popFrom(mSock->mInboundBuffer_);
 						mEc = code::success;
 						c1 = h;
 					}
@@ -496,4 +687,148 @@ namespace coproto
 
 
 
+	// A background thread that moves the outbound messages of pairs of
+	// BufferingSocket to each other, i.e. the threaded version of
+	// BufferingSocket::exchangeMessages(...). The thread sleeps on a
+	// condition variable until one of the sockets has new outbound data
+	// or is closed. Once a socket is closed (or has an error), the other 
+	// socket of the pair is given code::remoteClosed.
+	//
+	// A receive that is completed by the pump is resumed on the pump's 
+	// thread. Protocols that run on an executor should therefore transfer
+	// back to it, e.g. using macoro::start_on(...), so as not to block
+	// the pump.
+	class BufferingSocketPump
+	{
+	public:
+		BufferingSocketPump()
+			: mThread([this] { run(); })
+		{}
+
+		BufferingSocketPump(const BufferingSocketPump&) = delete;
+
+		~BufferingSocketPump() { stop(); }
+
+		// connect s0 and s1. A socket can only be added to one pump.
+		void add(BufferingSocket s0, BufferingSocket s1)
+		{
+			for (auto s : { s0.mSock, s1.mSock })
+			{
+				std::lock_guard<std::mutex> lock(s->mMtx);
+				COPROTO_ASSERT(s->mSignal == nullptr);
+				s->mSignal = &mSignal;
+			}
+
+			{
+				std::lock_guard<std::mutex> lock(mSignal.mMtx);
+				COPROTO_ASSERT(!mStop);
+				mAdded.push_back({ { { s0, s1 } } });
+				mSignal.mPending = true;
+			}
+			mSignal.mCv.notify_one();
+		}
+
+		// move any remaining messages and then stop the thread. The
+		// sockets are disconnected from the pump.
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> lock(mSignal.mMtx);
+				if (mStop)
+					return;
+				mStop = true;
+			}
+			mSignal.mCv.notify_one();
+			mThread.join();
+
+			for (auto& p : mPairs)
+			{
+				for (auto& s : p.mSocks)
+				{
+					std::lock_guard<std::mutex> lock(s.mSock->mMtx);
+					s.mSock->mSignal = nullptr;
+				}
+			}
+		}
+
+	private:
+
+		struct Pair
+		{
+			std::array<BufferingSocket, 2> mSocks;
+
+			// true once the other socket has been given code::remoteClosed.
+			std::array<bool, 2> mClosed = { { false, false } };
+		};
+
+		void run()
+		{
+			std::unique_lock<std::mutex> lock(mSignal.mMtx);
+			while (true)
+			{
+				mSignal.mCv.wait(lock, [this] { return mSignal.mPending || mStop; });
+				mSignal.mPending = false;
+				auto stop = mStop;
+				for (auto& p : mAdded)
+					mPairs.push_back(std::move(p));
+				mAdded.clear();
+				lock.unlock();
+
+				exchange();
+
+				lock.lock();
+				if (stop)
+					break;
+			}
+		}
+
+		// move messages until no more progress is made.
+		void exchange()
+		{
+			bool progress = true;
+			while (progress)
+			{
+				progress = false;
+				for (auto& p : mPairs)
+				{
+					for (u64 i = 0; i < 2; ++i)
+					{
+						if (p.mClosed[i])
+							continue;
+
+						if (p.mSocks[i].getOutbound(mBuffer))
+						{
+							if (mBuffer.size())
+							{
+								p.mSocks[1 ^ i].processInbound(mBuffer);
+								progress = true;
+							}
+						}
+						else
+						{
+							p.mSocks[1 ^ i].setError(code::remoteClosed);
+							p.mClosed[i] = true;
+						}
+					}
+				}
+			}
+		}
+
+		BufferingSocket::Signal mSignal;
+
+		// set once stop() has been called.
+		bool mStop = false;
+
+		// pairs that have been added but not yet seen by the thread.
+		std::vector<Pair> mAdded;
+
+		// the pairs that the thread is moving messages between.
+		std::vector<Pair> mPairs;
+
+		// the buffer that outbound messages are swapped into.
+		std::vector<u8> mBuffer;
+
+		std::thread mThread;
+	};
+
 }
\ No newline at end of file
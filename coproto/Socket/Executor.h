@@ -10,8 +10,10 @@
 #include "coproto/Common/Defines.h"
 #include "coproto/Common/span.h"
 #include "coproto/Common/Function.h"
+#include "coproto/Common/Optional.h"
 
 #include "coproto/Common/macoro.h"
+#include "macoro/stop.h"
 #include <vector>
 #include <mutex>
 
@@ -142,20 +144,16 @@ namespace coproto
 				if (mHead == mTail + mVec.size())
 				{
 					std::vector<T> v(std::max<u64>(mVec.size() * 2, 1ull << mLogTwoSize));
-					if (mVec.size())
-					{
-						auto begin = mTail & mask;
-						auto end = mHead & mask;
-						for (u64 i = begin, j = 0; i != end; i = (i + 1) & mask, ++j)
-						{
-							v[j] = std::move(mVec[i]);
-						}
 
-						mVecBacking = std::move(v);
-						mVec = mVecBacking;
-						mHead = mHead - mTail;
-						mTail = 0;
-					}
+					// the buffer is full, every slot holds an item.
+					for (u64 j = 0; j < mVec.size(); ++j)
+						v[j] = std::move(mVec[(mTail + j) & mask]);
+
+					mVecBacking = std::move(v);
+					mVec = mVecBacking;
+					mHead = mHead - mTail;
+					mTail = 0;
+					mask = mVec.size() - 1;
 				}
 
 				// push back to the next location.
@@ -164,6 +162,16 @@ namespace coproto
 
 			u64 size() const { return mHead - mTail; }
 
+			// the number of items that can be held without allocating.
+			u64 capacity() const { return mVec.size(); }
+
+			// the i'th item from the front.
+			T& operator[](u64 i)
+			{
+				COPROTO_ASSERT(i < size());
+				return mVec[(mTail + i) & (mVec.size() - 1)];
+			}
+
 			// pops the next item and returns it.
 			T pop_front()
 			{
@@ -187,6 +195,11 @@ namespace coproto
 			}
 		};
 
+		// a stop source whose stop should be requested once the
+		// lock is released. empty by default so that the inline
+		// backing of CBQueue does not allocate stop states.
+		using StopRequest = optional<macoro::stop_source>;
+
 		// the default executor is simply the socket itself.
 		// when a task is added it is enqued. If no one has 
 		// aquaired the executor, then we aquire it and run 
@@ -222,7 +235,7 @@ namespace coproto
 				// the current list of tasks.
 				CBQueue<coroutine_handle<>> mCBs;
 
-				CBQueue<unique_function<void()>> mFns;
+				CBQueue<StopRequest> mStops;
 
 				// a mutex that the constructor should provide.
 				std::recursive_mutex* mMtx = nullptr;
@@ -252,7 +265,7 @@ namespace coproto
 
 				CBQueue<ExCoHandle> mXCBs;
 				CBQueue<coroutine_handle<>> mCBs;
-				CBQueue<unique_function<void()>> mFns;
+				CBQueue<StopRequest> mStops;
 
 				~Handle()
 				{
@@ -275,17 +288,18 @@ namespace coproto
 						mEx->mHasRunner = true;
 						mAquired = true;
 						//mCBs = std::move(mEx->mCBs);
-						//mFns = std::move(mEx->mFns);
+						//mStops = std::move(mEx->mStops);
 					}
 				}
 
-				void push_back_fn(unique_function<void()> f, Lock& lock)
+				// request stop on src once the callbacks are run.
+				void push_back_stop(macoro::stop_source&& src, Lock& lock)
 				{
 					assert(mEx->mMtx == lock.mutex());
 					if(mAquired)
-						mFns.push_back(std::move(f));
+						mStops.push_back(std::move(src));
 					else
-						mEx->mFns.push_back(std::move(f));
+						mEx->mStops.push_back(std::move(src));
 				}
 
 				void push_back(std::coroutine_handle<> h, ExecutorRef ref, Lock& lock)
@@ -320,23 +334,30 @@ namespace coproto
 					coroutine_handle<> next = nullptr;
 					while (mAquired)
 					{
-						if(mCBs.size() == 0 && mFns.size() == 0)
+						if(mCBs.size() == 0 && mStops.size() == 0)
 						{
 							std::unique_lock<std::recursive_mutex> l(*mEx->mMtx);
 							std::swap(mEx->mCBs, mCBs);
-							std::swap(mEx->mFns, mFns);
-							if (mCBs.size() == 0 && mFns.size() == 0)
+							std::swap(mEx->mStops, mStops);
+							if (mCBs.size() == 0 && mStops.size() == 0)
 							{
+								// keep the larger buffer with the queue so that
+								// it is reused by the next runner instead of
+								// being freed with this handle.
+								if (mCBs.capacity() > mEx->mCBs.capacity())
+									std::swap(mEx->mCBs, mCBs);
 								mEx->mHasRunner = false;
 								mAquired = false;
 							}
 						}
 
-						while (mCBs.size() || mFns.size())
+						while (mCBs.size() || mStops.size())
 						{
-							if (mFns.size())
+							if (mStops.size())
 							{
-								mFns.pop_front()();
+								auto src = mStops.pop_front();
+								if (src)
+									src->request_stop();
 							}
 							else
 							{
@@ -348,12 +369,12 @@ namespace coproto
 								next = h;
 							}
 
-							//if (mCBs.size() == 0 && mFns.size() == 0)
+							//if (mCBs.size() == 0 && mStops.size() == 0)
 							//{
 							//	std::unique_lock<std::recursive_mutex> l(*mEx->mMtx);
 							//	std::swap(mEx->mCBs, mCBs);
-							//	std::swap(mEx->mFns, mFns);
-							//	if (mCBs.size() == 0 && mFns.size() == 0)
+							//	std::swap(mEx->mStops, mStops);
+							//	if (mCBs.size() == 0 && mStops.size() == 0)
 							//	{
 							//		mEx->mHasRunner = false;
 							//		mAquired = false;
@@ -0,0 +1,98 @@
+#pragma once
+#include "coproto/Common/Defines.h"
+#include "coproto/Socket/Executor.h"
+
+namespace coproto::internal
+{
+	// Tracks the operations that flush() waits on. Each send and recv
+	// operation is given the next sequence number when it is registered
+	// with the scheduler. A flush waits until every operation with a
+	// sequence number less than its target, i.e. the next sequence
+	// number at the time of the flush, has completed.
+	//
+	// Operations on different forks complete out of order. Therefore
+	// each waiter counts the pending operations in [prev.mTarget, mTarget),
+	// where prev is the waiter before it. A waiter is resumed once its
+	// count and the count of all the waiters before it are zero.
+	// Targets are non-decreasing so the waiters are kept in order
+	// and the waiter of an operation is found by binary search.
+	struct FlushQueue
+	{
+		struct Waiter
+		{
+			// the operations with sequence numbers less than this
+			// must complete before mHandle is resumed.
+			u64 mTarget = 0;
+
+			// the number of pending operations in [prev.mTarget, mTarget).
+			u64 mPending = 0;
+
+			coroutine_handle<> mHandle;
+		};
+
+		// the sequence number of the next operation.
+		u64 mNextSeq = 0;
+
+		// the number of registered operations that have not completed.
+		u64 mNumPending = 0;
+
+		// the sum of mPending over all the waiters.
+		u64 mNumWaiting = 0;
+
+		// the waiters ordered by mTarget.
+		CBQueue<Waiter> mWaiters;
+
+		// returns the sequence number of a new operation.
+		u64 registerOp(Lock&)
+		{
+			++mNumPending;
+			return mNextSeq++;
+		}
+
+		// the operation with sequence number seq has completed. Waiters
+		// that are no longer waiting on anything are pushed to queue.
+		void complete(u64 seq, ExecutorRef ex, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			COPROTO_ASSERT(mNumPending && seq < mNextSeq);
+			--mNumPending;
+
+			// fast path, no flush is waiting on this operation.
+			auto size = mWaiters.size();
+			if (size == 0 || seq >= mWaiters[size - 1].mTarget)
+				return;
+
+			// the first waiter with mTarget > seq.
+			u64 begin = 0, end = size - 1;
+			while (begin < end)
+			{
+				auto mid = begin + (end - begin) / 2;
+				if (mWaiters[mid].mTarget > seq)
+					end = mid;
+				else
+					begin = mid + 1;
+			}
+
+			auto& w = mWaiters[begin];
+			COPROTO_ASSERT(w.mPending && mNumWaiting);
+			--w.mPending;
+			--mNumWaiting;
+
+			while (mWaiters.size() && mWaiters[0].mPending == 0)
+				queue.push_back(mWaiters.pop_front().mHandle, ex, l);
+		}
+
+		// resume h once all the registered operations have completed.
+		void flush(coroutine_handle<> h, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			auto pending = mNumPending - mNumWaiting;
+			if (pending == 0 && mWaiters.size() == 0)
+			{
+				queue.push_back(h, {}, l);
+				return;
+			}
+
+			mWaiters.push_back({ mNextSeq, pending, h });
+			mNumWaiting += pending;
+		}
+	};
+}
@@ -0,0 +1,293 @@
+#pragma once
+#include "coproto/Common/Defines.h"
+#include "coproto/Proto/SessionID.h"
+#include "coproto/Socket/SocketFork.h"
+#include <array>
+#include <memory>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace coproto::internal
+{
+	// An open addressing (linear probing) hash map from SessionID to fork.
+	// Entries are removed by shifting the entries that follow them back.
+	struct SessionIDMap
+	{
+		struct Entry
+		{
+			SessionID mId;
+			SocketFork* mFork = nullptr;
+		};
+
+		// the table, its size is a power of 2.
+		std::vector<Entry> mEntries;
+
+		// the number of occupied entries.
+		u64 mSize = 0;
+
+		// 64 - log2(mEntries.size()).
+		u64 mShift = 64;
+
+		u64 slot(const SessionID& id) const
+		{
+			// fibonacci hashing, SessionID's hash is just its low word.
+			return (std::hash<SessionID>{}(id) * 0x9E3779B97F4A7C15ull) >> mShift;
+		}
+
+		SocketFork* find(const SessionID& id) const
+		{
+			if (mEntries.size() == 0)
+				return nullptr;
+
+			auto mask = mEntries.size() - 1;
+			for (auto i = slot(id); mEntries[i].mFork; i = (i + 1) & mask)
+			{
+				if (mEntries[i].mId == id)
+					return mEntries[i].mFork;
+			}
+			return nullptr;
+		}
+
+		// id must not already be in the map.
+		void insert(const SessionID& id, SocketFork* fork)
+		{
+			COPROTO_ASSERT(fork && find(id) == nullptr);
+
+			// keep the load factor below 3/4.
+			if (4 * (mSize + 1) > 3 * mEntries.size())
+				rehash(std::max<u64>(16, 2 * mEntries.size()));
+
+			auto mask = mEntries.size() - 1;
+			auto i = slot(id);
+			while (mEntries[i].mFork)
+				i = (i + 1) & mask;
+
+			mEntries[i].mId = id;
+			mEntries[i].mFork = fork;
+			++mSize;
+		}
+
+		// id must be in the map.
+		void erase(const SessionID& id)
+		{
+			auto mask = mEntries.size() - 1;
+			auto i = slot(id);
+			while (mEntries[i].mId != id)
+			{
+				COPROTO_ASSERT(mEntries[i].mFork);
+				i = (i + 1) & mask;
+			}
+
+			// move back any entry after i whose home slot is not in (i, j].
+			for (auto j = (i + 1) & mask; mEntries[j].mFork; j = (j + 1) & mask)
+			{
+				auto home = slot(mEntries[j].mId);
+				auto stays = i < j ?
+					i < home && home <= j :
+					i < home || home <= j;
+				if (!stays)
+				{
+					mEntries[i] = mEntries[j];
+					i = j;
+				}
+			}
+
+			mEntries[i] = {};
+			--mSize;
+		}
+
+		void rehash(u64 capacity)
+		{
+			COPROTO_ASSERT((capacity & (capacity - 1)) == 0);
+			auto old = std::move(mEntries);
+			mEntries.clear();
+			mEntries.resize(capacity);
+			mShift = 64;
+			while (capacity > 1)
+			{
+				--mShift;
+				capacity >>= 1;
+			}
+
+			mSize = 0;
+			for (auto& e : old)
+				if (e.mFork)
+					insert(e.mId, e.mFork);
+		}
+	};
+
+	// The forks of a socket. Forks are stored densely in chunks that double
+	// in size so that their addresses are stable as the table grows. The fork
+	// in slot i has local id i + 1. Forks can be found by SessionID, by local
+	// id or by the id the remote party uses in its message headers. When a
+	// fork is erased its slot, and therefore its local id, is reused by the
+	// next fork.
+	struct ForkTable
+	{
+		// the number of forks in the first chunk.
+		static constexpr u64 FirstChunkSize = 8;
+
+		// the number of remote ids per chunk of the remote index.
+		static constexpr u64 RemoteChunkSize = 1024;
+
+		// remote ids are read from the wire. Those from this bound on are 
+		// kept in a map so that an id can not make the index allocate much.
+		static constexpr u64 RemoteDenseLimit = 1 << 16;
+
+		using Chunk = std::unique_ptr<std::optional<SocketFork>[]>;
+		using RemoteChunk = std::unique_ptr<std::array<SocketFork*, RemoteChunkSize>>;
+
+		// the recv queues of the forks allocate from pool, if set.
+		ForkTable(QueueBlockPool* pool = nullptr)
+			: mBlockPool(pool)
+		{}
+		ForkTable(const ForkTable&) = delete;
+		ForkTable(ForkTable&&) = delete;
+
+		QueueBlockPool* mBlockPool = nullptr;
+
+		// the fork storage. Chunk c holds FirstChunkSize << c forks.
+		std::vector<Chunk> mChunks;
+
+		// the number of slots, some of which may be free.
+		u64 mSize = 0;
+
+		// the local ids of the free slots.
+		std::vector<u32> mFreeIds;
+
+		// SessionID -> fork.
+		SessionIDMap mIds;
+
+		// remote id -> fork, allocated in chunks as ids are seen.
+		std::vector<RemoteChunk> mRemote;
+
+		// remote id -> fork for the ids from RemoteDenseLimit on.
+		std::unordered_map<u32, SocketFork*> mRemoteSparse;
+
+		// the number of slots. Local ids are at most this.
+		u64 size() const { return mSize; }
+
+		// the number of forks.
+		u64 numForks() const { return mSize - mFreeIds.size(); }
+
+		std::optional<SocketFork>& slot(u64 i)
+		{
+			COPROTO_ASSERT(i < mSize);
+
+			// find the chunk c such that the first
+			// FirstChunkSize * (2^c - 1) slots come before it.
+			u64 c = 0;
+			auto q = i / FirstChunkSize + 1;
+			while (q >>= 1)
+				++c;
+
+			auto offset = i - FirstChunkSize * ((u64(1) << c) - 1);
+			return mChunks[c][offset];
+		}
+
+		// the fork in slot i, which must not be free.
+		SocketFork& operator[](u64 i)
+		{
+			auto& s = slot(i);
+			COPROTO_ASSERT(s.has_value());
+			return *s;
+		}
+
+		// create a new fork in a free slot or else the next new slot. 
+		// id must not already be in the table.
+		SocketFork& emplace(const SessionID& id)
+		{
+			u64 i;
+			if (mFreeIds.size())
+			{
+				i = mFreeIds.back() - 1;
+				mFreeIds.pop_back();
+			}
+			else
+			{
+				auto c = mChunks.size();
+				if (mSize == FirstChunkSize * ((u64(1) << c) - 1))
+					mChunks.emplace_back(new std::optional<SocketFork>[FirstChunkSize << c]);
+				i = mSize++;
+			}
+
+			auto& fork = slot(i).emplace(id, mBlockPool);
+			fork.mLocalId = static_cast<u32>(i + 1);
+			mIds.insert(id, &fork);
+			return fork;
+		}
+
+		// remove the fork from the table and free its slot.
+		void erase(SocketFork& fork)
+		{
+			mIds.erase(fork.mSessionID);
+			if (fork.mRemoteId != ~u32(0))
+				clearRemote(fork.mRemoteId);
+
+			auto localId = fork.mLocalId;
+			slot(localId - 1).reset();
+			mFreeIds.push_back(localId);
+		}
+
+		SocketFork* find(const SessionID& id) const
+		{
+			return mIds.find(id);
+		}
+
+		SocketFork* findLocal(u32 localId)
+		{
+			if (localId == 0 || localId > mSize)
+				return nullptr;
+			auto& s = slot(localId - 1);
+			return s ? &*s : nullptr;
+		}
+
+		SocketFork* findRemote(u32 remoteId) const
+		{
+			if (remoteId >= RemoteDenseLimit)
+			{
+				auto iter = mRemoteSparse.find(remoteId);
+				return iter == mRemoteSparse.end() ? nullptr : iter->second;
+			}
+
+			auto c = remoteId / RemoteChunkSize;
+			if (c >= mRemote.size() || mRemote[c] == nullptr)
+				return nullptr;
+			return (*mRemote[c])[remoteId % RemoteChunkSize];
+		}
+
+		void setRemote(u32 remoteId, SocketFork& fork)
+		{
+			if (remoteId >= RemoteDenseLimit)
+			{
+				auto inserted = mRemoteSparse.emplace(remoteId, &fork).second;
+				COPROTO_ASSERT(inserted);
+				(void)inserted;
+				return;
+			}
+
+			auto c = remoteId / RemoteChunkSize;
+			if (c >= mRemote.size())
+				mRemote.resize(c + 1);
+			if (mRemote[c] == nullptr)
+			{
+				mRemote[c].reset(new std::array<SocketFork*, RemoteChunkSize>);
+				mRemote[c]->fill(nullptr);
+			}
+
+			COPROTO_ASSERT((*mRemote[c])[remoteId % RemoteChunkSize] == nullptr);
+			(*mRemote[c])[remoteId % RemoteChunkSize] = &fork;
+		}
+
+		// the remote party has retired remoteId. It may later be reused.
+		void clearRemote(u32 remoteId)
+		{
+			COPROTO_ASSERT(findRemote(remoteId));
+			if (remoteId >= RemoteDenseLimit)
+				mRemoteSparse.erase(remoteId);
+			else
+				(*mRemote[remoteId / RemoteChunkSize])[remoteId % RemoteChunkSize] = nullptr;
+		}
+	};
+}
@@ -0,0 +1,750 @@
+#include "IoUringSocket.h"
+
+#ifdef COPROTO_ENABLE_IO_URING
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace coproto
+{
+	namespace
+	{
+		int ioUringSetup(u32 entries, io_uring_params* p)
+		{
+			return (int)syscall(__NR_io_uring_setup, entries, p);
+		}
+
+		int ioUringEnter(int fd, u32 toSubmit, u32 minComplete, u32 flags)
+		{
+			return (int)syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0);
+		}
+
+		int ioUringRegister(int fd, u32 op, void* arg, u32 n)
+		{
+			return (int)syscall(__NR_io_uring_register, fd, op, arg, n);
+		}
+
+		// The low bits of the user_data of a request identify the kind
+		// of request, the rest is the IoUringSocket::State*.
+		enum Tag : u64
+		{
+			ignoreTag = 0,
+			recvTag = 1,
+			sendTag = 2,
+			tagMask = 3
+		};
+
+		error_code toErrorCode(int res)
+		{
+			switch (-res)
+			{
+			case EPIPE:
+			case ECONNRESET:
+				return code::remoteClosed;
+			default:
+				return error_code(-res, std::system_category());
+			}
+		}
+
+		u64 roundUpPow2(u64 n)
+		{
+			u64 r = 1;
+			while (r < n)
+				r *= 2;
+			return r;
+		}
+
+		void* mapOrThrow(u64 size, int fd, off_t offset)
+		{
+			auto flags = fd == -1 ? MAP_PRIVATE | MAP_ANONYMOUS : MAP_SHARED | MAP_POPULATE;
+			auto ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, flags, fd, offset);
+			if (ptr == MAP_FAILED)
+				throw std::runtime_error("io_uring mmap failed. " COPROTO_LOCATION);
+			return ptr;
+		}
+	}
+
+	struct IoUringContext::Impl
+	{
+		Impl(u64 entries, u64 bufferCount, u64 bufferSize);
+		~Impl();
+
+		int mFd = -1;
+
+		// the submission queue. The tail is written by us, the head by the kernel.
+		u32* mSqHead = nullptr, * mSqTail = nullptr, * mSqArray = nullptr;
+		u32 mSqMask = 0, mSqEntries = 0;
+		io_uring_sqe* mSqes = nullptr;
+
+		// the completion queue. The tail is written by the kernel, the head by us.
+		u32* mCqHead = nullptr, * mCqTail = nullptr;
+		u32 mCqMask = 0;
+		io_uring_cqe* mCqes = nullptr;
+
+		void* mSqPtr = nullptr, * mCqPtr = nullptr;
+		u64 mSqSize = 0, mCqSize = 0, mSqesSize = 0;
+
+		// protects the submission queue and the buffer ring.
+		std::mutex mMtx;
+
+		// the tail of the submission queue that has not yet been published.
+		u32 mSqLocalTail = 0;
+
+		// The buffers that the kernel receives into. They are handed to the
+		// kernel through mBufRing and returned to it once they are consumed.
+		io_uring_buf_ring* mBufRing = nullptr;
+		u8* mBuffers = nullptr;
+		u64 mBufferCount, mBufferSize;
+		u16 mBufTail = 0;
+
+		// the number of buffers that the kernel has filled and we
+		// have not yet returned.
+		std::atomic<u64> mOutstanding{ 0 };
+
+		// sockets whose receive stopped because the kernel ran out of buffers.
+		std::vector<std::shared_ptr<IoUringSocket::State>> mStarved;
+
+		std::atomic<bool> mStop{ false };
+		std::thread mThread;
+
+		u8* buffer(u16 bid) { return mBuffers + bid * mBufferSize; }
+
+		// get a zeroed submission queue entry. Requires mMtx.
+		io_uring_sqe* getSqe(std::unique_lock<std::mutex>& lock)
+		{
+			while (mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE) == mSqEntries)
+				submit(lock);
+
+			auto idx = mSqLocalTail & mSqMask;
+			auto sqe = &mSqes[idx];
+			std::memset(sqe, 0, sizeof(*sqe));
+			mSqArray[idx] = idx;
+			++mSqLocalTail;
+			return sqe;
+		}
+
+		// publish and submit the queued entries. Requires mMtx.
+		void submit(std::unique_lock<std::mutex>&)
+		{
+			__atomic_store_n(mSqTail, mSqLocalTail, __ATOMIC_RELEASE);
+			while (true)
+			{
+				auto n = mSqLocalTail - __atomic_load_n(mSqHead, __ATOMIC_ACQUIRE);
+				if (n == 0)
+					return;
+				if (ioUringEnter(mFd, n, 0, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+					throw std::runtime_error("io_uring_enter failed, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+			}
+		}
+
+		// give buffer bid back to the kernel. Returns the sockets that
+		// were waiting for buffers, which should now be rearmed.
+		void recycle(u16 bid, std::vector<std::shared_ptr<IoUringSocket::State>>& starved)
+		{
+			std::lock_guard<std::mutex> lock(mMtx);
+
+			// the entries are indexed from the start of the ring. In c++, the
+			// uapi header places io_uring_buf_ring::bufs at the wrong offset.
+			auto bufs = reinterpret_cast<io_uring_buf*>(mBufRing);
+			auto& buf = bufs[mBufTail & (mBufferCount - 1)];
+			buf.addr = reinterpret_cast<u64>(buffer(bid));
+			buf.len = static_cast<u32>(mBufferSize);
+			buf.bid = bid;
+			++mBufTail;
+			__atomic_store_n(&mBufRing->tail, mBufTail, __ATOMIC_RELEASE);
+			--mOutstanding;
+
+			if (mStarved.size())
+				std::swap(starved, mStarved);
+		}
+
+		// The loop run by mThread.
+		void run();
+
+		// unmap the rings and close the io_uring.
+		void cleanup();
+	};
+
+	struct IoUringSocket::State : std::enable_shared_from_this<State>
+	{
+		State(int fd, IoUringContext::Impl* ctx)
+			: mFd(fd)
+			, mCtx(ctx)
+		{}
+
+		~State()
+		{
+			::close(mFd);
+		}
+
+		int mFd;
+		IoUringContext::Impl* mCtx;
+
+		// protects the members below.
+		std::mutex mMtx;
+
+		// received data that has not been consumed. Part of buffer mBid.
+		struct Chunk
+		{
+			u16 mBid;
+			u32 mSize, mOffset;
+		};
+		std::deque<Chunk> mInbound;
+
+		// set once no more data will be received.
+		optional<error_code> mRecvEc;
+
+		// true if the multishot recv is active.
+		bool mArmed = false;
+
+		// true once the socket has been closed.
+		bool mClosed = false;
+
+		// The pending operations, if any.
+		Awaiter* mPendingRecv = nullptr;
+		Awaiter* mPendingSend = nullptr;
+
+		// true if the pending send has been asked to stop.
+		bool mSendCanceled = false;
+
+		// The number of requests the kernel holds that refer to us. While
+		// non-zero, we keep ourselves alive.
+		u64 mInFlight = 0;
+		std::shared_ptr<State> mKeepAlive;
+
+		using Lock = std::unique_lock<std::mutex>;
+		using Starved = std::vector<std::shared_ptr<State>>;
+
+		u64 userData(Tag t) { return reinterpret_cast<u64>(this) | t; }
+
+		void acquire(Lock&)
+		{
+			if (mInFlight++ == 0)
+				mKeepAlive = shared_from_this();
+		}
+
+		// the returned pointer should be destroyed once the lock is released.
+		std::shared_ptr<State> release(Lock&)
+		{
+			COPROTO_ASSERT(mInFlight);
+			if (--mInFlight == 0)
+				return std::move(mKeepAlive);
+			return {};
+		}
+
+		// start the multishot recv if its not running.
+		void arm(Lock& l)
+		{
+			if (mArmed || mClosed || mRecvEc)
+				return;
+
+			mArmed = true;
+			acquire(l);
+			std::unique_lock<std::mutex> lock(mCtx->mMtx);
+			auto sqe = mCtx->getSqe(lock);
+			sqe->opcode = IORING_OP_RECV;
+			sqe->fd = mFd;
+			sqe->ioprio = IORING_RECV_MULTISHOT;
+			sqe->flags = IOSQE_BUFFER_SELECT;
+			sqe->buf_group = 0;
+			sqe->user_data = userData(recvTag);
+			mCtx->submit(lock);
+		}
+
+		void submitSend(Awaiter* op, Lock& l)
+		{
+			u64 n = 0;
+			op->mIov[n++] = { op->mData.data(), op->mData.size() };
+			for (u64 i = 0; i < op->mRest.size() && n < Awaiter::MaxIov; ++i)
+				if (op->mRest[i].size())
+					op->mIov[n++] = { op->mRest[i].data(), op->mRest[i].size() };
+
+			std::memset(&op->mMsg, 0, sizeof(op->mMsg));
+			op->mMsg.msg_iov = op->mIov.data();
+			op->mMsg.msg_iovlen = n;
+
+			acquire(l);
+			std::unique_lock<std::mutex> lock(mCtx->mMtx);
+			auto sqe = mCtx->getSqe(lock);
+			sqe->opcode = IORING_OP_SENDMSG;
+			sqe->fd = mFd;
+			sqe->addr = reinterpret_cast<u64>(&op->mMsg);
+			sqe->len = 1;
+			sqe->msg_flags = MSG_NOSIGNAL;
+			sqe->user_data = userData(sendTag);
+			mCtx->submit(lock);
+		}
+
+		// ask the kernel to stop the request with the given tag.
+		void cancel(Tag t, Lock&)
+		{
+			std::unique_lock<std::mutex> lock(mCtx->mMtx);
+			auto sqe = mCtx->getSqe(lock);
+			sqe->opcode = IORING_OP_ASYNC_CANCEL;
+			sqe->addr = userData(t);
+			sqe->user_data = ignoreTag;
+			mCtx->submit(lock);
+		}
+
+		// copy the received data into op. Returns true if op has completed.
+		bool serve(Awaiter* op, Starved& starved, Lock&)
+		{
+			while (op->mData.size() && mInbound.size())
+			{
+				auto& c = mInbound.front();
+				auto n = std::min<u64>(op->mData.size(), c.mSize - c.mOffset);
+				std::memcpy(op->mData.data(), mCtx->buffer(c.mBid) + c.mOffset, n);
+				op->advance(n);
+				c.mOffset += static_cast<u32>(n);
+				if (c.mOffset == c.mSize)
+				{
+					mCtx->recycle(c.mBid, starved);
+					mInbound.pop_front();
+				}
+			}
+
+			if (op->mData.size() == 0 || (op->mSome && op->mBytesTransfered))
+				op->mEc = code::success;
+			else if (mClosed)
+				op->mEc = code::closed;
+			else if (mRecvEc && mInbound.empty())
+				op->mEc = *mRecvEc;
+
+			return op->mEc.has_value();
+		}
+
+		static void rearm(Starved& starved)
+		{
+			for (auto& s : starved)
+			{
+				Lock l(s->mMtx);
+				s->arm(l);
+			}
+		}
+
+		static void complete(Awaiter* op)
+		{
+			if (op->mReg)
+				op->mReg.reset();
+			op->mHandle.resume();
+		}
+
+		// a completion of the multishot recv.
+		void onRecv(int res, u32 flags)
+		{
+			Awaiter* done = nullptr;
+			std::shared_ptr<State> keep;
+			Starved starved;
+			bool noBuffers = false;
+			{
+				Lock l(mMtx);
+				if (flags & IORING_CQE_F_BUFFER)
+				{
+					auto bid = static_cast<u16>(flags >> IORING_CQE_BUFFER_SHIFT);
+					++mCtx->mOutstanding;
+					if (res > 0 && !mClosed)
+						mInbound.push_back({ bid, static_cast<u32>(res), 0 });
+					else
+						mCtx->recycle(bid, starved);
+				}
+
+				bool rearm = false;
+				if (!(flags & IORING_CQE_F_MORE))
+				{
+					mArmed = false;
+					keep = release(l);
+					if (res > 0)
+						rearm = true;
+					else if (res == -ENOBUFS && !mClosed)
+						noBuffers = true;
+					else if (res == 0)
+						mRecvEc = mClosed ? code::closed : code::remoteClosed;
+					else
+						mRecvEc = mClosed ? code::closed : toErrorCode(res);
+				}
+
+				if (mPendingRecv && serve(mPendingRecv, starved, l))
+					done = std::exchange(mPendingRecv, nullptr);
+
+				if (rearm)
+					arm(l);
+			}
+
+			if (noBuffers)
+			{
+				// wait for a buffer to be returned unless one
+				// already has been.
+				std::unique_lock<std::mutex> lock(mCtx->mMtx);
+				if (mCtx->mOutstanding == mCtx->mBufferCount)
+					mCtx->mStarved.push_back(shared_from_this());
+				else
+					starved.push_back(shared_from_this());
+			}
+
+			rearm(starved);
+			if (done)
+				complete(done);
+		}
+
+		// a completion of a sendmsg.
+		void onSend(int res)
+		{
+			Awaiter* done = nullptr;
+			std::shared_ptr<State> keep;
+			{
+				Lock l(mMtx);
+				auto op = mPendingSend;
+				COPROTO_ASSERT(op);
+
+				if (res > 0)
+					op->advance(res);
+
+				if (res < 0)
+					op->mEc = mClosed ? code::closed :
+						res == -ECANCELED ? code::operation_aborted :
+						toErrorCode(res);
+				else if (op->mData.size() == 0)
+					op->mEc = code::success;
+				else if (mClosed)
+					op->mEc = code::closed;
+				else if (mSendCanceled)
+					op->mEc = code::operation_aborted;
+				else
+					submitSend(op, l);
+
+				if (op->mEc)
+				{
+					done = std::exchange(mPendingSend, nullptr);
+					mSendCanceled = false;
+				}
+				keep = release(l);
+			}
+
+			if (done)
+				complete(done);
+		}
+	};
+
+	IoUringContext::Impl::Impl(u64 entries, u64 bufferCount, u64 bufferSize)
+		: mBufferCount(roundUpPow2(bufferCount))
+		, mBufferSize(bufferSize)
+	{
+		if (mBufferCount > (1 << 15) || bufferSize == 0 || bufferSize > (1ull << 31))
+			throw std::runtime_error("invalid io_uring buffer parameters. " COPROTO_LOCATION);
+
+		io_uring_params p;
+		std::memset(&p, 0, sizeof(p));
+		mFd = ioUringSetup(static_cast<u32>(entries), &p);
+		if (mFd < 0)
+			throw std::runtime_error("io_uring_setup failed, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+
+		try {
+			mSqSize = p.sq_off.array + p.sq_entries * sizeof(u32);
+			mCqSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+			if (p.features & IORING_FEAT_SINGLE_MMAP)
+				mSqSize = mCqSize = std::max(mSqSize, mCqSize);
+
+			mSqPtr = mapOrThrow(mSqSize, mFd, IORING_OFF_SQ_RING);
+			mCqPtr = (p.features & IORING_FEAT_SINGLE_MMAP) ? mSqPtr : mapOrThrow(mCqSize, mFd, IORING_OFF_CQ_RING);
+			mSqesSize = p.sq_entries * sizeof(io_uring_sqe);
+			mSqes = static_cast<io_uring_sqe*>(mapOrThrow(mSqesSize, mFd, IORING_OFF_SQES));
+
+			auto sq = static_cast<u8*>(mSqPtr);
+			mSqHead = reinterpret_cast<u32*>(sq + p.sq_off.head);
+			mSqTail = reinterpret_cast<u32*>(sq + p.sq_off.tail);
+			mSqArray = reinterpret_cast<u32*>(sq + p.sq_off.array);
+			mSqMask = *reinterpret_cast<u32*>(sq + p.sq_off.ring_mask);
+			mSqEntries = *reinterpret_cast<u32*>(sq + p.sq_off.ring_entries);
+			mSqLocalTail = *mSqTail;
+
+			auto cq = static_cast<u8*>(mCqPtr);
+			mCqHead = reinterpret_cast<u32*>(cq + p.cq_off.head);
+			mCqTail = reinterpret_cast<u32*>(cq + p.cq_off.tail);
+			mCqMask = *reinterpret_cast<u32*>(cq + p.cq_off.ring_mask);
+			mCqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+			// the provided buffer ring, which must be page aligned.
+			mBufRing = static_cast<io_uring_buf_ring*>(mapOrThrow(mBufferCount * sizeof(io_uring_buf), -1, 0));
+			mBuffers = static_cast<u8*>(mapOrThrow(mBufferCount * mBufferSize, -1, 0));
+
+			io_uring_buf_reg reg;
+			std::memset(&reg, 0, sizeof(reg));
+			reg.ring_addr = reinterpret_cast<u64>(mBufRing);
+			reg.ring_entries = static_cast<u32>(mBufferCount);
+			reg.bgid = 0;
+			if (ioUringRegister(mFd, IORING_REGISTER_PBUF_RING, &reg, 1))
+				throw std::runtime_error("io_uring provided buffer rings are not supported, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+		}
+		catch (...)
+		{
+			cleanup();
+			throw;
+		}
+
+		std::vector<std::shared_ptr<IoUringSocket::State>> starved;
+		mOutstanding = mBufferCount;
+		for (u64 i = 0; i < mBufferCount; ++i)
+			recycle(static_cast<u16>(i), starved);
+
+		mThread = std::thread([this] { run(); });
+	}
+
+	IoUringContext::Impl::~Impl()
+	{
+		if (mThread.joinable())
+		{
+			// wake the thread with a no-op.
+			mStop = true;
+			{
+				std::unique_lock<std::mutex> lock(mMtx);
+				auto sqe = getSqe(lock);
+				sqe->opcode = IORING_OP_NOP;
+				sqe->user_data = ignoreTag;
+				submit(lock);
+			}
+			mThread.join();
+		}
+
+		cleanup();
+	}
+
+	void IoUringContext::Impl::cleanup()
+	{
+		if (mBuffers)
+			munmap(mBuffers, mBufferCount * mBufferSize);
+		if (mBufRing)
+			munmap(mBufRing, mBufferCount * sizeof(io_uring_buf));
+		if (mSqes)
+			munmap(mSqes, mSqesSize);
+		if (mCqPtr && mCqPtr != mSqPtr)
+			munmap(mCqPtr, mCqSize);
+		if (mSqPtr)
+			munmap(mSqPtr, mSqSize);
+		if (mFd != -1)
+			::close(mFd);
+	}
+
+	void IoUringContext::Impl::run()
+	{
+		while (!mStop)
+		{
+			if (ioUringEnter(mFd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY)
+			{
+				std::cout << "io_uring_enter failed, " << strerror(errno) << " " << COPROTO_LOCATION << std::endl;
+				std::terminate();
+			}
+
+			auto head = *mCqHead;
+			auto tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+			for (; head != tail; ++head)
+			{
+				auto cqe = mCqes[head & mCqMask];
+				__atomic_store_n(mCqHead, head + 1, __ATOMIC_RELEASE);
+
+				auto state = reinterpret_cast<IoUringSocket::State*>(cqe.user_data & ~u64(tagMask));
+				switch (cqe.user_data & tagMask)
+				{
+				case recvTag:
+					state->onRecv(cqe.res, cqe.flags);
+					break;
+				case sendTag:
+					state->onSend(cqe.res);
+					break;
+				default:
+					break;
+				}
+			}
+		}
+	}
+
+	IoUringContext::IoUringContext(u64 entries, u64 bufferCount, u64 bufferSize)
+		: mImpl(new Impl(entries, bufferCount, bufferSize))
+	{}
+
+	IoUringContext::~IoUringContext() = default;
+
+	IoUringContext& global_io_uring_context()
+	{
+		static IoUringContext ctx;
+		return ctx;
+	}
+
+	IoUringSocket::Awaiter::Awaiter(State* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some)
+		: mState(ss)
+		, mData(dd)
+		, mSend(send)
+		, mSome(some)
+		, mToken(t)
+	{
+		COPROTO_ASSERT(dd.size());
+	}
+
+	IoUringSocket::Awaiter::Awaiter(State* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t)
+		: mState(ss)
+		, mRest(dd)
+		, mSend(send)
+		, mToken(t)
+	{
+		advance(0);
+		COPROTO_ASSERT(mData.size());
+	}
+
+	void IoUringSocket::Awaiter::advance(u64 n)
+	{
+		// a partial sendmsg can end anywhere in the buffers.
+		do {
+			auto m = std::min<u64>(n, mData.size());
+			mData = mData.subspan(m);
+			mBytesTransfered += m;
+			n -= m;
+			while (mData.size() == 0 && mRest.size())
+			{
+				mData = mRest[0];
+				mRest = mRest.subspan(1);
+			}
+		} while (n);
+	}
+
+	coroutine_handle<> IoUringSocket::Awaiter::await_suspend(coroutine_handle<> h)
+	{
+		if (mToken.stop_possible())
+		{
+			mReg.emplace(mToken, [this] {
+
+				// This might be called synchronously, before mHandle is set.
+				coroutine_handle<> cb;
+				{
+					State::Lock l(mState->mMtx);
+					if (!mEc)
+					{
+						if (!mHandle)
+							mEc = code::operation_aborted;
+						else if (!mSend)
+						{
+							COPROTO_ASSERT(mState->mPendingRecv == this);
+							mState->mPendingRecv = nullptr;
+							mEc = code::operation_aborted;
+							cb = mHandle;
+						}
+						else if (!mState->mSendCanceled)
+						{
+							// the send completes once the kernel is done with it.
+							mState->mSendCanceled = true;
+							mState->cancel(sendTag, l);
+						}
+					}
+				}
+
+				if (cb)
+					cb.resume();
+				});
+		}
+
+		State::Starved starved;
+		bool completed;
+		{
+			State::Lock l(mState->mMtx);
+			mHandle = h;
+
+			// canceled synchronously.
+			if (mEc)
+				return h;
+
+			if (mSend)
+			{
+				if (mState->mClosed)
+				{
+					mEc = code::closed;
+					return h;
+				}
+
+				COPROTO_ASSERT(mState->mPendingSend == nullptr);
+				mState->mPendingSend = this;
+				mState->submitSend(this, l);
+				return macoro::noop_coroutine();
+			}
+
+			COPROTO_ASSERT(mState->mPendingRecv == nullptr);
+			completed = mState->serve(this, starved, l);
+			if (!completed)
+				mState->mPendingRecv = this;
+		}
+
+		State::rearm(starved);
+		return completed ? h : macoro::noop_coroutine();
+	}
+
+	IoUringSocket::Sock::Sock(std::shared_ptr<State> state)
+		: mState(std::move(state))
+	{}
+
+	IoUringSocket::Sock::~Sock()
+	{
+		if (mState)
+			close();
+	}
+
+	void IoUringSocket::Sock::close()
+	{
+		Awaiter* done = nullptr;
+		State::Starved starved;
+		{
+			State::Lock l(mState->mMtx);
+			if (mState->mClosed)
+				return;
+			mState->mClosed = true;
+			::shutdown(mState->mFd, SHUT_RDWR);
+
+			if (mState->mArmed)
+				mState->cancel(recvTag, l);
+			if (mState->mPendingSend)
+				mState->cancel(sendTag, l);
+
+			if (mState->mPendingRecv)
+			{
+				done = std::exchange(mState->mPendingRecv, nullptr);
+				done->mEc = code::closed;
+			}
+
+			for (auto& c : mState->mInbound)
+				mState->mCtx->recycle(c.mBid, starved);
+			mState->mInbound.clear();
+		}
+
+		State::rearm(starved);
+		if (done)
+			State::complete(done);
+	}
+
+	IoUringSocket::IoUringSocket(int fd, IoUringContext& ctx)
+	{
+		auto state = std::make_shared<State>(fd, ctx.mImpl.get());
+		{
+			State::Lock l(state->mMtx);
+			state->arm(l);
+		}
+
+		auto sock = std::make_unique<Sock>(std::move(state));
+		mSock = sock.get();
+		*static_cast<Socket*>(this) = Socket(make_socket_tag{}, std::move(sock));
+	}
+
+	std::array<IoUringSocket, 2> IoUringSocket::makePair(IoUringContext& ctx)
+	{
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+			throw std::runtime_error("socketpair failed, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+
+		return { IoUringSocket(fds[0], ctx), IoUringSocket(fds[1], ctx) };
+	}
+}
+#endif
@@ -0,0 +1,166 @@
+#pragma once
+// © 2022 Visa.
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "coproto/config.h"
+
+#ifdef COPROTO_ENABLE_IO_URING
+#include "coproto/Socket/Socket.h"
+#include "coproto/Common/macoro.h"
+#include <memory>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+namespace coproto
+{
+	// An io_uring instance along with the thread that reaps its
+	// completions. Any number of IoUringSocket can share one context.
+	// Received data is written by the kernel into a ring of
+	// bufferCount buffers of bufferSize bytes, which is shared by
+	// all the sockets of the context. A socket that holds on to many
+	// buffers, i.e. received data that has not been read yet, delays
+	// the other sockets until it is read. The context must outlive
+	// its sockets.
+	class IoUringContext
+	{
+	public:
+		IoUringContext(u64 entries = 256, u64 bufferCount = 256, u64 bufferSize = 1 << 14);
+		IoUringContext(const IoUringContext&) = delete;
+		~IoUringContext();
+
+		struct Impl;
+		std::unique_ptr<Impl> mImpl;
+	};
+
+	// A context that is created on first use and lives until the
+	// program exits.
+	IoUringContext& global_io_uring_context();
+
+	// A socket that performs its io on a connected stream socket, e.g.
+	// TCP or unix domain, using io_uring. The socket owns the file
+	// descriptor and closes it once the socket is destroyed.
+	//
+	// Operations are submitted by the caller and completed by the thread
+	// of the IoUringContext.
+	//
+	// * Data is received by a single multishot recv into the buffers of
+	//   the context. The data is then copied out to the receive
+	//   operations. Data that arrives while no receive is pending is
+	//   held until one is, so a receive often completes synchronously.
+	// * A send is one sendmsg with one iovec per buffer. The message
+	//   header and body are therefore sent together.
+	struct IoUringSocket : public Socket
+	{
+		// The state of the socket. This is shared with the context's
+		// thread so that it lives until the kernel is done with it.
+		struct State;
+
+		// The actual socket implementation.
+		struct Sock;
+
+		// The awaiter that is returned from send(...) and recv(...).
+		struct Awaiter
+		{
+			Awaiter(State* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some = false);
+
+			// A vectored operation. The buffers are sent/received in order
+			// as if they were one contiguous buffer.
+			Awaiter(State* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t);
+
+			// The socket that this io operation belongs to.
+			State* mState;
+
+			// The data remaining to be sent or received. For vectored
+			// operations this is the current buffer.
+			span<u8> mData;
+
+			// For vectored operations, the buffers that follow mData.
+			span<span<u8>> mRest;
+
+			// The amount of data that has been sent or received.
+			u64 mBytesTransfered = 0;
+
+			// If true, this is a send, otherwise a receive.
+			bool mSend;
+
+			// If true, a receive completes as soon as some data
+			// has been received.
+			bool mSome = false;
+
+			// Set once the operation has completed.
+			optional<error_code> mEc;
+
+			// The coroutine callback that should be called when this operation completes.
+			coroutine_handle<> mHandle;
+
+			// An optional token that the user can provide to stop an asynchronous operation.
+			macoro::stop_token mToken;
+
+			// the stop callback.
+			macoro::optional_stop_callback mReg;
+
+			// the buffers of the sendmsg that is in flight. A send of more
+			// than MaxIov buffers is split over several sendmsg.
+			static constexpr u64 MaxIov = 8;
+			std::array<iovec, MaxIov> mIov;
+			msghdr mMsg;
+
+			bool await_ready() { return false; }
+
+			// Starts the operation. A receive completes synchronously if
+			// enough data has already been received. A send is submitted
+			// and completes on the context's thread.
+			macoro::coroutine_handle<> await_suspend(macoro::coroutine_handle<> h);
+
+#ifdef COPROTO_CPP20
+			// this version of await_suspend allows c++20 coroutine support.
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+				return await_suspend(macoro::coroutine_handle<>(h)).std_cast();
+			}
+#endif
+
+			std::pair<error_code, u64> await_resume()
+			{
+				COPROTO_ASSERT(mEc);
+				return { *mEc, mBytesTransfered };
+			}
+
+			// consume n bytes of the data.
+			void advance(u64 n);
+		};
+
+		struct Sock
+		{
+			Sock(std::shared_ptr<State> state);
+			Sock(const Sock&) = delete;
+			~Sock();
+
+			Awaiter send(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, true, std::move(token)); };
+			Awaiter recv(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token)); };
+			Awaiter send(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, true, std::move(token)); };
+			Awaiter recv(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token)); };
+			Awaiter recvSome(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token), true); };
+
+			// Shut the socket down. Pending operations complete with
+			// code::closed and the other party sees code::remoteClosed.
+			void close();
+
+			std::shared_ptr<State> mState;
+		};
+
+		IoUringSocket() = default;
+
+		// Take ownership of the connected stream socket fd.
+		IoUringSocket(int fd, IoUringContext& ctx = global_io_uring_context());
+
+		// Create a pair of connected sockets using socketpair(...).
+		static std::array<IoUringSocket, 2> makePair(IoUringContext& ctx = global_io_uring_context());
+
+		Sock* mSock = nullptr;
+	};
+}
+#endif
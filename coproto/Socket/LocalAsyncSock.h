@@ -19,6 +19,12 @@ namespace coproto
 	// It implementations asynchronous communication with full 
 	// cancellation support.
 	//
+	// By default a send only completes once the other end has 
+	// received the data, i.e. a rendezvous. Alternatively, 
+	// makePair(bufferSize) gives each direction a ring buffer of
+	// bufferSize bytes. A send then completes as soon as its data
+	// fits in the buffer and a receive drains it, like a TCP socket.
+	//
 	// The implementation comes in several parts. There is an 
 	// object SharedState that both sockets will have in common.
 	// 
@@ -52,6 +58,44 @@ namespace coproto
 			Awaiter* mRecv = nullptr;
 		};
 
+		// A fixed capacity circular byte buffer. Used by 
+		// the buffered mode to hold the data in flight.
+		struct RingBuffer
+		{
+			std::vector<u8> mData;
+
+			// the read position and the number of buffered bytes.
+			u64 mBegin = 0, mSize = 0;
+
+			u64 capacity() const { return mData.size(); }
+			u64 size() const { return mSize; }
+			u64 space() const { return capacity() - mSize; }
+
+			// copy as much of src as fits. Returns the number of bytes copied.
+			u64 push(span<u8> src)
+			{
+				auto n = std::min<u64>(src.size(), space());
+				auto end = (mBegin + mSize) % capacity();
+				auto n0 = std::min<u64>(n, capacity() - end);
+				std::memcpy(mData.data() + end, src.data(), n0);
+				std::memcpy(mData.data(), src.data() + n0, n - n0);
+				mSize += n;
+				return n;
+			}
+
+			// copy as much as is available into dst. Returns the number of bytes copied.
+			u64 pop(span<u8> dst)
+			{
+				auto n = std::min<u64>(dst.size(), mSize);
+				auto n0 = std::min<u64>(n, capacity() - mBegin);
+				std::memcpy(dst.data(), mData.data() + mBegin, n0);
+				std::memcpy(dst.data() + n0, mData.data(), n - n0);
+				mBegin = (mBegin + n) % capacity();
+				mSize -= n;
+				return n;
+			}
+		};
+
 		// The actual socket implementation.
 		struct Sock;
 
@@ -68,22 +112,37 @@ namespace coproto
 		struct Awaiter
 		{
 
-			Awaiter(Sock* ss, span<u8> dd, bool send, macoro::stop_token&& t);
+			Awaiter(Sock* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some = false);
+
+			// A vectored operation. The buffers are sent/received in order
+			// as if they were one contiguous buffer.
+			Awaiter(Sock* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t);
 
 			// A pointer to the socket that this io operation belongs to.
 			Sock* mSock;
 
 			// The data to be sent or received. This will shrink as we 
-			// make progress in sending or receiving data.
+			// make progress in sending or receiving data. For vectored 
+			// operations this is the current buffer.
 			span<u8> mData;
 
+			// For vectored operations, the buffers that follow mData.
+			span<span<u8>> mRest;
+
 			// The total amount of data to be sent or received.
 			u64 mTotalSize;
+
+			// The amount of data that has been sent or received.
+			u64 mBytesTransfered = 0;
 			enum Type { send, recv };
 
 			// The type of the operation (send or receive).
 			Type mType;
 
+			// If true, a receive completes as soon as some data
+			// has been received.
+			bool mSome = false;
+
 			// An error code that is set once the operation has 
 			// completed successfully or with an error.
 			optional<error_code> mEc;
@@ -123,6 +182,11 @@ namespace coproto
 			//
 			macoro::coroutine_handle<> await_suspend(macoro::coroutine_handle<> h);
 
+			// await_suspend for the buffered mode. Called while holding the lock.
+			// Transfers data through the ring buffer and returns the operations 
+			// that have completed in done.
+			void suspendBuffered(std::array<Awaiter*, 2>& done);
+
 #ifdef COPROTO_CPP20
 			// this version of await_suspend allows c++20 coroutine support.
 			std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
@@ -137,10 +201,13 @@ namespace coproto
 			// should be some other value.
 			std::pair<error_code, u64> await_resume() {
 				COPROTO_ASSERT(mEc);
-				auto bt = mTotalSize - mData.size();
-				return { *mEc, bt };
+				return { *mEc, mBytesTransfered };
 			}
 
+			// mark n bytes of mData as transfered and move on to the 
+			// next non-empty buffer if mData is exhausted.
+			void advance(u64 n);
+
 			// helper functions
 			error_code& ec();
 			unique_function<error_code()>& errFn();
@@ -188,6 +255,21 @@ namespace coproto
 			// that this operation should be canceled. See Awaiter for more details.
 			Awaiter recv(span<u8> data, macoro::stop_token token = {}) { return Awaiter(this, data, false, std::move(token)); };
 
+			////////////////////////////////////////////////
+			// Optional interface
+			////////////////////////////////////////////////
+
+			// The vectored versions of send(...) and recv(...). The 
+			// buffers are copied in one pass, as if they were a single
+			// contiguous buffer. `data` must outlive the operation.
+			Awaiter send(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(this, data, true, std::move(token)); };
+			Awaiter recv(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(this, data, false, std::move(token)); };
+
+			// A receive that completes once some data has been received, i.e. 
+			// when it is matched with a send. The number of bytes received is
+			// returned by await_resume().
+			Awaiter recvSome(span<u8> data, macoro::stop_token token = {}) { return Awaiter(this, data, false, std::move(token), true); };
+
 			////////////////////////////////////////////////
 			// internal implementation
 			////////////////////////////////////////////////
@@ -220,6 +302,12 @@ namespace coproto
 			// returns the OpPair that will hold the receive operation
 			auto& inbound() { return mImpl->mInbound[mIdx]; }
 
+			// returns the ring buffer that data we send is written to.
+			auto& outBuffer() { return mImpl->mBuffers[mIdx ^ 1]; }
+
+			// returns the ring buffer that data we receive is read from.
+			auto& inBuffer() { return mImpl->mBuffers[mIdx]; }
+
 		};
 
 		// the shared state that the two ends communicate by
@@ -240,6 +328,10 @@ namespace coproto
 			// The two sets of operations that the socket can have. 
 			std::array<OpPair, 2> mInbound;
 
+			// In buffered mode, the data in flight to each socket. Empty
+			// (zero capacity) in the default rendezvous mode.
+			std::array<RingBuffer, 2> mBuffers;
+
 			// The two sockets.
 			std::array<Sock*, 2> mSocks;
 		};
@@ -249,11 +341,14 @@ namespace coproto
 		Sock* mSock;
 
 		// A helper function to make a pair of LocalAsyncSocket
-		// that can communicate with each other.
-		static std::array<LocalAsyncSocket, 2> makePair()
+		// that can communicate with each other. If bufferSize is
+		// non-zero, each direction buffers up to bufferSize bytes.
+		static std::array<LocalAsyncSocket, 2> makePair(u64 bufferSize = 0)
 		{
 			std::array<LocalAsyncSocket, 2> pair;
 			auto state = std::make_shared<SharedState>();
+			state->mBuffers[0].mData.resize(bufferSize);
+			state->mBuffers[1].mData.resize(bufferSize);
 			auto s0 = std::unique_ptr<Sock>(new Sock(0, state));
 			auto s1 = std::unique_ptr<Sock>(new Sock(1, state));
 
@@ -271,16 +366,41 @@ namespace coproto
 	};
 
 
-	inline LocalAsyncSocket::Awaiter::Awaiter(Sock* ss, span<u8> dd, bool send, macoro::stop_token&& t)
+	inline LocalAsyncSocket::Awaiter::Awaiter(Sock* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some)
 		: mSock(ss)
 		, mData(dd)
 		, mTotalSize(dd.size())
 		, mType(send ? Type::send : Type::recv)
+		, mSome(some)
 		, mToken(t)
 	{
 		COPROTO_ASSERT(dd.size());
 	}
 
+	inline LocalAsyncSocket::Awaiter::Awaiter(Sock* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t)
+		: mSock(ss)
+		, mRest(dd)
+		, mTotalSize(0)
+		, mType(send ? Type::send : Type::recv)
+		, mToken(t)
+	{
+		for (auto& d : dd)
+			mTotalSize += d.size();
+		COPROTO_ASSERT(mTotalSize);
+		advance(0);
+	}
+
+	inline void LocalAsyncSocket::Awaiter::advance(u64 n)
+	{
+		mData = mData.subspan(n);
+		mBytesTransfered += n;
+		while (mData.size() == 0 && mRest.size())
+		{
+			mData = mRest[0];
+			mRest = mRest.subspan(1);
+		}
+	}
+
 	inline error_code& LocalAsyncSocket::Awaiter::ec() { return mSock->ec(); }
 	inline unique_function<error_code()>& LocalAsyncSocket::Awaiter::errFn() { return mSock->errFn(); }
 	inline LocalAsyncSocket::OpPair& LocalAsyncSocket::Awaiter::outbound() { return mSock->outbound(); }
@@ -354,9 +474,6 @@ namespace coproto
 		// event that we complete the operation.
 		macoro::optional_stop_callback* r0 = nullptr, * r1 = nullptr;
 
-		// The source and destination buffers of the operation.
-		span<u8> src, dst;
-
 		// First we need to check it the stop token can be used.
 		if (mToken.stop_possible())
 		{
@@ -396,6 +513,34 @@ namespace coproto
 		}
 
 
+		if (mSock->inBuffer().capacity())
+		{
+			std::array<Awaiter*, 2> done{};
+			{
+				std::unique_lock<std::mutex> lock(mSock->mImpl->mMtx);
+				mHandle = h;
+				suspendBuffered(done);
+			}
+
+			// as below, clear the stop callbacks outside the lock and 
+			// then resume the completed operations.
+			for (auto d : done)
+				if (d && d->mReg)
+					d->mReg.reset();
+
+			if (done[0] == this || done[1] == this)
+			{
+				auto other = done[0] == this ? done[1] : done[0];
+				if (other)
+					other->mHandle.resume();
+				return h;
+			}
+
+			if (done[0])
+				return done[0]->mHandle;
+			return macoro::noop_coroutine();
+		}
+
 		// Note that we might have just canceled our operation.
 		{
 
@@ -463,9 +608,8 @@ namespace coproto
 
 
 			// op is set when we can complete the operation.
-			// If so we will do some booking to extract
+			// If so we will copy the data and do some booking to extract
 			//
-			// * src,dst : the buffers
 			// * c0,c1 : the callbacks
 			// * r0,r1 : the stop callbacks.
 			if (op)
@@ -479,16 +623,19 @@ namespace coproto
 				COPROTO_ASSERT(mRecv->mType == Awaiter::Type::recv);
 				COPROTO_ASSERT(mSend->mType == Awaiter::Type::send);
 
-				auto min = std::min<u64>(mSend->mData.size(), mRecv->mData.size());
-				COPROTO_ASSERT(min);
-
-				src = mSend->mData.subspan(0, min);
-				dst = mRecv->mData.subspan(0, min);
-
-				mSend->mData = mSend->mData.subspan(min);
-				mRecv->mData = mRecv->mData.subspan(min);
+				// copy as much as we can. Either side might be vectored so
+				// we walk both buffer lists in one pass. mData is only empty
+				// once all of the buffers are exhausted.
+				COPROTO_ASSERT(mSend->mData.size() && mRecv->mData.size());
+				while (mSend->mData.size() && mRecv->mData.size())
+				{
+					auto min = std::min<u64>(mSend->mData.size(), mRecv->mData.size());
+					memcpy(mRecv->mData.data(), mSend->mData.data(), min);
+					mSend->advance(min);
+					mRecv->advance(min);
+				}
 
-				if (mRecv->mData.size() == 0)
+				if (mRecv->mData.size() == 0 || mRecv->mSome)
 				{
 					mRecv->mEc = code::success;
 					assert(mRecv->mHandle);
@@ -514,7 +661,6 @@ namespace coproto
 
 		// outside the lock we will perform 
 		// 
-		// * the data copy 
 		// * clear the stop_callbacks. This must be done outside the locks as
 		//   there might be someone in the stop_callback that is blocked on the
 		//   lock. To prevent a race, we will/must block until they are out of 
@@ -528,9 +674,6 @@ namespace coproto
 		// 
 		if (op)
 		{
-
-			memcpy(dst.data(), src.data(), src.size());
-
 			if (c0 && c1)
 			{
 				// stop the cancellation callbacks.
@@ -569,4 +712,85 @@ namespace coproto
 		return macoro::noop_coroutine();
 	}
 
+	inline void LocalAsyncSocket::Awaiter::suspendBuffered(std::array<Awaiter*, 2>& done)
+	{
+		// check if we canceled synchronously.
+		if (mEc)
+		{
+			done[0] = this;
+			return;
+		}
+
+		if (!ec() && errFn())
+			ec() = errFn()();
+
+		auto& pair = mType == Type::send ? outbound() : inbound();
+		auto& ring = mType == Type::send ? mSock->outBuffer() : mSock->inBuffer();
+
+		// data that was sent before the other end closed can still be received.
+		if (ec() && (mType == Type::send || ec() != code::remoteClosed || ring.size() == 0))
+		{
+			mEc = ec();
+			done[0] = this;
+			return;
+		}
+
+		if (mType == Type::send)
+		{
+			assert(!pair.mSend);
+			pair.mSend = this;
+		}
+		else
+		{
+			assert(!pair.mRecv);
+			pair.mRecv = this;
+		}
+
+		auto& send = pair.mSend;
+		auto& recv = pair.mRecv;
+
+		// the receiver first gets the buffered data, then directly from
+		// the sender. Whatever the sender has left goes into the buffer.
+		if (recv)
+		{
+			while (recv->mData.size() && ring.size())
+				recv->advance(ring.pop(recv->mData));
+
+			while (send && send->mData.size() && recv->mData.size())
+			{
+				auto min = std::min<u64>(send->mData.size(), recv->mData.size());
+				memcpy(recv->mData.data(), send->mData.data(), min);
+				send->advance(min);
+				recv->advance(min);
+			}
+		}
+
+		if (send)
+		{
+			while (send->mData.size() && ring.space())
+				send->advance(ring.push(send->mData));
+		}
+
+		u64 n = 0;
+		if (recv && (recv->mData.size() == 0 || (recv->mSome && recv->mBytesTransfered)))
+		{
+			recv->mEc = code::success;
+			done[n++] = std::exchange(recv, nullptr);
+		}
+
+		if (send && send->mData.size() == 0)
+		{
+			send->mEc = code::success;
+			done[n++] = std::exchange(send, nullptr);
+		}
+
+		// the remote party closed and we have received all the data.
+		if (recv == this && ec())
+		{
+			mEc = ec();
+			recv = nullptr;
+			done[n++] = this;
+		}
+	}
+
 }
\ No newline at end of file
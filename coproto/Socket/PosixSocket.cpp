@@ -0,0 +1,469 @@
+#include "PosixSocket.h"
+
+#ifdef COPROTO_ENABLE_POSIX_SOCKET
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+namespace coproto
+{
+	namespace
+	{
+		error_code toErrorCode(int err)
+		{
+			switch (err)
+			{
+			case EPIPE:
+			case ECONNRESET:
+				return code::remoteClosed;
+			default:
+				return error_code(err, std::system_category());
+			}
+		}
+
+		void setNonBlocking(int fd)
+		{
+			auto flags = fcntl(fd, F_GETFL);
+			if (flags == -1 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) == -1)
+				throw std::runtime_error("failed to make the fd non-blocking, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+		}
+
+		bool isSocket(int fd)
+		{
+			struct stat st;
+			return fstat(fd, &st) == 0 && S_ISSOCK(st.st_mode);
+		}
+
+		// the number of buffers passed to a single readv/writev.
+		constexpr u64 maxIov = 16;
+	}
+
+	struct PosixReactor::Impl
+	{
+		Impl();
+		~Impl();
+
+		int mEpoll = -1;
+
+		// written to wake the thread once mStop is set.
+		int mEventFd = -1;
+
+		std::atomic<bool> mStop{ false };
+		std::thread mThread;
+
+		// Sockets that have been closed. Their fds have been removed from
+		// the epoll but an epoll_wait that was already running might still
+		// report them. They are therefore destroyed by the thread after its
+		// next epoll_wait has been processed.
+		std::mutex mMtx;
+		std::vector<std::shared_ptr<PosixSocket::State>> mRetired;
+
+		void add(int fd, u32 events, PosixSocket::State* state)
+		{
+			epoll_event ev;
+			ev.events = events | EPOLLET;
+			ev.data.ptr = state;
+			if (epoll_ctl(mEpoll, EPOLL_CTL_ADD, fd, &ev))
+				throw std::runtime_error("epoll_ctl failed, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+		}
+
+		void remove(int fd)
+		{
+			epoll_ctl(mEpoll, EPOLL_CTL_DEL, fd, nullptr);
+		}
+
+		void retire(std::shared_ptr<PosixSocket::State> state)
+		{
+			std::lock_guard<std::mutex> lock(mMtx);
+			mRetired.push_back(std::move(state));
+		}
+
+		// The loop run by mThread.
+		void run();
+	};
+
+	struct PosixSocket::State : std::enable_shared_from_this<State>
+	{
+		State(int readFd, int writeFd, PosixReactor::Impl* reactor)
+			: mReadFd(readFd)
+			, mWriteFd(writeFd)
+			, mIsSocket(isSocket(writeFd))
+			, mReactor(reactor)
+		{}
+
+		~State()
+		{
+			closeFds();
+		}
+
+		int mReadFd, mWriteFd;
+
+		// if true, sends use sendmsg(..., MSG_NOSIGNAL).
+		bool mIsSocket;
+
+		PosixReactor::Impl* mReactor;
+
+		// protects the members below. The io itself is also performed while
+		// holding this so that a readiness event can not be missed between an
+		// attempt that would block and the operation becoming pending.
+		std::mutex mMtx;
+
+		// true once the socket has been closed.
+		bool mClosed = false;
+
+		// The pending operations, if any.
+		Awaiter* mPendingRecv = nullptr;
+		Awaiter* mPendingSend = nullptr;
+
+		using Lock = std::unique_lock<std::mutex>;
+
+		void closeFds()
+		{
+			if (mReadFd != -1)
+				::close(mReadFd);
+			if (mWriteFd != -1 && mWriteFd != mReadFd)
+				::close(mWriteFd);
+			mReadFd = mWriteFd = -1;
+		}
+
+		// Perform as much of op as possible without blocking. Returns
+		// true if op has completed.
+		bool tryIo(Awaiter* op, Lock&)
+		{
+			while (true)
+			{
+				std::array<iovec, maxIov> iov;
+				u64 n = 0;
+				iov[n++] = { op->mData.data(), op->mData.size() };
+				for (u64 i = 0; i < op->mRest.size() && n < maxIov; ++i)
+					if (op->mRest[i].size())
+						iov[n++] = { op->mRest[i].data(), op->mRest[i].size() };
+
+				ssize_t r;
+				if (!op->mSend)
+					r = ::readv(mReadFd, iov.data(), static_cast<int>(n));
+				else if (mIsSocket)
+				{
+					msghdr msg;
+					std::memset(&msg, 0, sizeof(msg));
+					msg.msg_iov = iov.data();
+					msg.msg_iovlen = n;
+					r = ::sendmsg(mWriteFd, &msg, MSG_NOSIGNAL);
+				}
+				else
+					r = ::writev(mWriteFd, iov.data(), static_cast<int>(n));
+
+				if (r > 0)
+				{
+					op->advance(r);
+					if (op->mData.size() == 0 || op->mSome)
+					{
+						op->mEc = code::success;
+						return true;
+					}
+				}
+				else if (r == 0 && !op->mSend)
+				{
+					op->mEc = code::remoteClosed;
+					return true;
+				}
+				else if (errno == EAGAIN || errno == EWOULDBLOCK)
+					return false;
+				else if (errno != EINTR)
+				{
+					op->mEc = toErrorCode(errno);
+					return true;
+				}
+			}
+		}
+
+		static void complete(Awaiter* op)
+		{
+			if (op->mReg)
+				op->mReg.reset();
+			op->mHandle.resume();
+		}
+
+		// called by the reactor when one of the fds is ready.
+		void onEvent(u32 events)
+		{
+			Awaiter* done[2] = {};
+			{
+				Lock l(mMtx);
+				if (mClosed)
+					return;
+
+				if (mPendingRecv && (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && tryIo(mPendingRecv, l))
+					done[0] = std::exchange(mPendingRecv, nullptr);
+				if (mPendingSend && (events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) && tryIo(mPendingSend, l))
+					done[1] = std::exchange(mPendingSend, nullptr);
+			}
+
+			for (auto op : done)
+				if (op)
+					complete(op);
+		}
+	};
+
+	PosixReactor::Impl::Impl()
+	{
+		mEpoll = epoll_create1(EPOLL_CLOEXEC);
+		if (mEpoll == -1)
+			throw std::runtime_error("epoll_create1 failed, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+
+		mEventFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		if (mEventFd == -1)
+		{
+			::close(mEpoll);
+			throw std::runtime_error("eventfd failed, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+		}
+
+		try {
+			add(mEventFd, EPOLLIN, nullptr);
+		}
+		catch (...)
+		{
+			::close(mEventFd);
+			::close(mEpoll);
+			throw;
+		}
+
+		mThread = std::thread([this] { run(); });
+	}
+
+	PosixReactor::Impl::~Impl()
+	{
+		mStop = true;
+		u64 one = 1;
+		if (::write(mEventFd, &one, sizeof(one)) != sizeof(one))
+		{
+			std::cout << "failed to wake the PosixReactor, " << strerror(errno) << " " << COPROTO_LOCATION << std::endl;
+			std::terminate();
+		}
+		mThread.join();
+
+		::close(mEventFd);
+		::close(mEpoll);
+	}
+
+	void PosixReactor::Impl::run()
+	{
+		std::array<epoll_event, 64> events;
+		std::vector<std::shared_ptr<PosixSocket::State>> retired;
+		while (!mStop)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mMtx);
+				std::swap(retired, mRetired);
+			}
+
+			auto n = epoll_wait(mEpoll, events.data(), static_cast<int>(events.size()), -1);
+			if (n < 0 && errno != EINTR)
+			{
+				std::cout << "epoll_wait failed, " << strerror(errno) << " " << COPROTO_LOCATION << std::endl;
+				std::terminate();
+			}
+
+			for (int i = 0; i < n; ++i)
+			{
+				if (auto state = static_cast<PosixSocket::State*>(events[i].data.ptr))
+					state->onEvent(events[i].events);
+			}
+
+			// none of these can be reported by the next epoll_wait.
+			retired.clear();
+		}
+	}
+
+	PosixReactor::PosixReactor()
+		: mImpl(new Impl)
+	{}
+
+	PosixReactor::~PosixReactor() = default;
+
+	PosixReactor& global_posix_reactor()
+	{
+		static PosixReactor reactor;
+		return reactor;
+	}
+
+	PosixSocket::Awaiter::Awaiter(State* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some)
+		: mState(ss)
+		, mData(dd)
+		, mSend(send)
+		, mSome(some)
+		, mToken(t)
+	{
+		COPROTO_ASSERT(dd.size());
+	}
+
+	PosixSocket::Awaiter::Awaiter(State* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t)
+		: mState(ss)
+		, mRest(dd)
+		, mSend(send)
+		, mToken(t)
+	{
+		advance(0);
+		COPROTO_ASSERT(mData.size());
+	}
+
+	void PosixSocket::Awaiter::advance(u64 n)
+	{
+		// a partial readv/writev can end anywhere in the buffers.
+		do {
+			auto m = std::min<u64>(n, mData.size());
+			mData = mData.subspan(m);
+			mBytesTransfered += m;
+			n -= m;
+			while (mData.size() == 0 && mRest.size())
+			{
+				mData = mRest[0];
+				mRest = mRest.subspan(1);
+			}
+		} while (n);
+	}
+
+	coroutine_handle<> PosixSocket::Awaiter::await_suspend(coroutine_handle<> h)
+	{
+		if (mToken.stop_possible())
+		{
+			mReg.emplace(mToken, [this] {
+
+				// This might be called synchronously, before mHandle is set.
+				coroutine_handle<> cb;
+				{
+					State::Lock l(mState->mMtx);
+					if (!mEc)
+					{
+						mEc = code::operation_aborted;
+						if (mHandle)
+						{
+							auto& pending = mSend ? mState->mPendingSend : mState->mPendingRecv;
+							COPROTO_ASSERT(pending == this);
+							pending = nullptr;
+							cb = mHandle;
+						}
+					}
+				}
+
+				if (cb)
+					cb.resume();
+				});
+		}
+
+		State::Lock l(mState->mMtx);
+		mHandle = h;
+
+		// canceled synchronously.
+		if (mEc)
+			return h;
+
+		if (mState->mClosed)
+		{
+			mEc = code::closed;
+			return h;
+		}
+
+		if (mState->tryIo(this, l))
+			return h;
+
+		auto& pending = mSend ? mState->mPendingSend : mState->mPendingRecv;
+		COPROTO_ASSERT(pending == nullptr);
+		pending = this;
+		return macoro::noop_coroutine();
+	}
+
+	PosixSocket::Sock::Sock(std::shared_ptr<State> state)
+		: mState(std::move(state))
+	{}
+
+	PosixSocket::Sock::~Sock()
+	{
+		if (mState)
+			close();
+	}
+
+	void PosixSocket::Sock::close()
+	{
+		Awaiter* done[2] = {};
+		{
+			State::Lock l(mState->mMtx);
+			if (mState->mClosed)
+				return;
+			mState->mClosed = true;
+
+			auto reactor = mState->mReactor;
+			reactor->remove(mState->mReadFd);
+			if (mState->mWriteFd != mState->mReadFd)
+				reactor->remove(mState->mWriteFd);
+			if (mState->mIsSocket)
+				::shutdown(mState->mWriteFd, SHUT_RDWR);
+			mState->closeFds();
+			reactor->retire(mState);
+
+			done[0] = std::exchange(mState->mPendingRecv, nullptr);
+			done[1] = std::exchange(mState->mPendingSend, nullptr);
+			for (auto op : done)
+				if (op)
+					op->mEc = code::closed;
+		}
+
+		for (auto op : done)
+			if (op)
+				State::complete(op);
+	}
+
+	PosixSocket::PosixSocket(int fd, PosixReactor& reactor)
+		: PosixSocket(fd, fd, reactor)
+	{}
+
+	PosixSocket::PosixSocket(int readFd, int writeFd, PosixReactor& reactor)
+	{
+		auto state = std::make_shared<State>(readFd, writeFd, reactor.mImpl.get());
+		setNonBlocking(readFd);
+		if (writeFd != readFd)
+			setNonBlocking(writeFd);
+
+		// the fds stay registered until the socket is closed. Being
+		// edge triggered, the reactor is only woken on new readiness.
+		if (readFd == writeFd)
+			reactor.mImpl->add(readFd, EPOLLIN | EPOLLOUT | EPOLLRDHUP, state.get());
+		else
+		{
+			reactor.mImpl->add(readFd, EPOLLIN | EPOLLRDHUP, state.get());
+			try {
+				reactor.mImpl->add(writeFd, EPOLLOUT, state.get());
+			}
+			catch (...)
+			{
+				reactor.mImpl->remove(readFd);
+				throw;
+			}
+		}
+
+		auto sock = std::make_unique<Sock>(std::move(state));
+		mSock = sock.get();
+		*static_cast<Socket*>(this) = Socket(make_socket_tag{}, std::move(sock));
+	}
+
+	std::array<PosixSocket, 2> PosixSocket::makePair(PosixReactor& reactor)
+	{
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds))
+			throw std::runtime_error("socketpair failed, " + std::string(strerror(errno)) + " " COPROTO_LOCATION);
+
+		return { PosixSocket(fds[0], reactor), PosixSocket(fds[1], reactor) };
+	}
+}
+#endif
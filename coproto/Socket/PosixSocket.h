@@ -0,0 +1,159 @@
+#pragma once
+// © 2022 Visa.
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+
+#include "coproto/config.h"
+#ifdef COPROTO_ENABLE_POSIX_SOCKET
+
+#include "coproto/Socket/Socket.h"
+#include "coproto/Common/macoro.h"
+#include <memory>
+
+namespace coproto
+{
+	// An epoll instance along with the thread that waits on it. Any
+	// number of PosixSocket can share one reactor. The reactor must
+	// outlive its sockets.
+	class PosixReactor
+	{
+	public:
+		PosixReactor();
+		PosixReactor(const PosixReactor&) = delete;
+		~PosixReactor();
+
+		struct Impl;
+		std::unique_ptr<Impl> mImpl;
+	};
+
+	// A reactor that is created on first use and lives until the
+	// program exits.
+	PosixReactor& global_posix_reactor();
+
+	// A socket that performs its io on plain file descriptors, e.g. a
+	// connected TCP or unix domain socket, a socketpair or a pair of pipes.
+	// It has no dependencies beyond the OS. The socket owns the file
+	// descriptors, which are made non-blocking, and closes them once
+	// the socket is closed or destroyed.
+	//
+	// An operation first calls readv/writev directly. If this completes
+	// the operation, the caller is resumed inline. Otherwise the operation
+	// waits until the reactor reports that the descriptor is ready and is
+	// then completed on the reactor's thread.
+	//
+	// Writes to a socket do not raise SIGPIPE. Writes to a pipe whose
+	// reader has been closed do, and so the caller should ignore SIGPIPE
+	// when pipes are used.
+	struct PosixSocket : public Socket
+	{
+		// The state of the socket. The reactor keeps this alive
+		// for as long as it might refer to it.
+		struct State;
+
+		// The actual socket implementation.
+		struct Sock;
+
+		// The awaiter that is returned from send(...) and recv(...).
+		struct Awaiter
+		{
+			Awaiter(State* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some = false);
+
+			// A vectored operation. The buffers are sent/received in order
+			// as if they were one contiguous buffer.
+			Awaiter(State* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t);
+
+			// The socket that this io operation belongs to.
+			State* mState;
+
+			// The data remaining to be sent or received. For vectored
+			// operations this is the current buffer.
+			span<u8> mData;
+
+			// For vectored operations, the buffers that follow mData.
+			span<span<u8>> mRest;
+
+			// The amount of data that has been sent or received.
+			u64 mBytesTransfered = 0;
+
+			// If true, this is a send, otherwise a receive.
+			bool mSend;
+
+			// If true, a receive completes as soon as some data
+			// has been received.
+			bool mSome = false;
+
+			// Set once the operation has completed.
+			optional<error_code> mEc;
+
+			// The coroutine callback that should be called when this operation completes.
+			coroutine_handle<> mHandle;
+
+			// An optional token that the user can provide to stop an asynchronous operation.
+			macoro::stop_token mToken;
+
+			// the stop callback.
+			macoro::optional_stop_callback mReg;
+
+			bool await_ready() { return false; }
+
+			// Tries to complete the operation synchronously. If it can not, the
+			// operation waits on the reactor and h is resumed once it completes
+			// or is canceled.
+			macoro::coroutine_handle<> await_suspend(macoro::coroutine_handle<> h);
+
+#ifdef COPROTO_CPP20
+			// this version of await_suspend allows c++20 coroutine support.
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+				return await_suspend(macoro::coroutine_handle<>(h)).std_cast();
+			}
+#endif
+
+			std::pair<error_code, u64> await_resume()
+			{
+				COPROTO_ASSERT(mEc);
+				return { *mEc, mBytesTransfered };
+			}
+
+			// consume n bytes of the data.
+			void advance(u64 n);
+		};
+
+		struct Sock
+		{
+			Sock(std::shared_ptr<State> state);
+			Sock(const Sock&) = delete;
+			~Sock();
+
+			Awaiter send(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, true, std::move(token)); };
+			Awaiter recv(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token)); };
+			Awaiter send(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, true, std::move(token)); };
+			Awaiter recv(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token)); };
+			Awaiter recvSome(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token), true); };
+
+			// Close the file descriptors. Pending operations complete with
+			// code::closed and the other party sees code::remoteClosed.
+			void close();
+
+			std::shared_ptr<State> mState;
+		};
+
+		PosixSocket() = default;
+
+		// Take ownership of the connected stream socket fd.
+		PosixSocket(int fd, PosixReactor& reactor = global_posix_reactor());
+
+		// Take ownership of readFd and writeFd, e.g. the ends of two pipes.
+		// Data is received from readFd and sent to writeFd.
+		PosixSocket(int readFd, int writeFd, PosixReactor& reactor = global_posix_reactor());
+
+		// Create a pair of connected sockets using socketpair(...).
+		static std::array<PosixSocket, 2> makePair(PosixReactor& reactor = global_posix_reactor());
+
+		Sock* mSock = nullptr;
+	};
+}
+#endif
@@ -8,13 +8,13 @@
 namespace coproto::internal
 {
 	struct SocketFork;
-	using SocketForkIter = std::list<SocketFork>::iterator;
+	using SocketForkIter = SocketFork*;
 	u64& recvIndex(SocketFork*);
 	// an receive data operation.
 	struct RecvOperation
 	{
 
-		enum class Status
+		enum class Status : u8
 		{
 			NotStarted,
 			InProgress,
@@ -28,12 +28,13 @@ namespace coproto::internal
 		coroutine_handle<void> mCH;
 		RecvBuffer& mRecvBuffer;
 
-		// the current status of the operation
-		Status mStatus = Status::NotStarted;
-
 		optional<macoro::stop_callback> mReg;
 
-		std::vector<std::shared_ptr<FlushToken>> mFlushes;
+		// the sequence number that FlushQueue assigned to this operation.
+		u64 mSeq = 0;
+
+		// the current status of the operation
+		Status mStatus = Status::NotStarted;
 	public:
 
 		//u64 mIndex;
@@ -42,7 +43,7 @@ namespace coproto::internal
 			RecvBuffer& r,
 			coroutine_handle<void> ch,
 			SocketForkIter s)
-			: mSocketFork(&*s)
+			: mSocketFork(s)
 			, mCH(ch)
 			, mRecvBuffer(r)
 			//, mIndex(recvIndex(mSocketFork)++)
@@ -60,9 +61,14 @@ namespace coproto::internal
 			}
 		}
 
-		void addFlush(std::shared_ptr<FlushToken>& t, Lock& l)
+		u64 seq()
+		{
+			return mSeq;
+		}
+
+		void setSeq(u64 seq)
 		{
-			mFlushes.push_back(t);
+			mSeq = seq;
 		}
 
 		SocketFork& fork()
@@ -1,6 +1,5 @@
 #pragma once
 
-#include <list>
 #include "coproto/Common/macoro.h"
 //#include "coproto/Proto/Buffers.h"
 #include "coproto/Socket/Executor.h"
@@ -8,6 +7,10 @@
 #include "coproto/Common/Optional.h"
 #include "coproto/Common/InlinePoly.h"
 #include "coproto/Proto/Operation.h"
+#include "coproto/Proto/SessionID.h"
+#include <mutex>
+#include <atomic>
+#include <new>
 
 namespace coproto::internal
 {
@@ -15,36 +18,46 @@ namespace coproto::internal
 
 	struct SockScheduler;
 	struct SocketFork;
-	using SocketForkIter = std::list<SocketFork>::iterator;
+	struct SendSubmitQueue;
+	using SocketForkIter = SocketFork*;
 
 
 	struct SendOperation
 	{
 
-		enum class Status
+		enum class Status : u8
 		{
+			// submitted but not yet picked up by the send task.
+			Pending,
+			// canceled while pending. The send task will complete it.
+			Aborted,
+			// waiting for the remote party to grant its fork credit or
+			// for the fork's message that is being sent in fragments.
+			Blocked,
 			NotStarted,
 			InProgress,
 			Canceling
 		};
 
 	private:
-		// the completion handle
-		coroutine_handle<void> mCH = nullptr;
+		// The members are ordered to avoid padding, mStorage is over-aligned.
 
 		// optional storage to keep the buffer alive
 		InlinePoly<SendBuffer, 8 * sizeof(u64)> mStorage;
 
-		// the data to be sent.
-		span<u8> mSendBuffer;
+		// the completion handle
+		coroutine_handle<void> mCH = nullptr;
 
-		// the current status of the operation
-		Status mStatus = Status::NotStarted;
+		// the session id of the parent fork. 
+		SessionID mSessionID;
 
-		// a pointer to the parent fork.
-		SocketForkIter mSocketFork;
+		// a pointer to the parent fork. Initially an optional hint
+		// provided by the caller. The send task resolves it once the 
+		// operation has been taken from the submission queue.
+		SocketForkIter mSocketFork = nullptr;
 
-		// in intrusive linked list of the send operation in order.
+		// in intrusive linked list of the send operation in order. Also
+		// used by SendSubmitQueue while the operation is pending.
 		SendOperation* mNext = nullptr;
 
 		// in intrusive linked list of the send operation in order.
@@ -56,8 +69,17 @@ namespace coproto::internal
 		// if mToken is set, then this will be the registation callback.
 		optional<macoro::stop_callback> mReg;
 
-		// flush operations that are waiting on this operation.
-		std::vector<std::shared_ptr<FlushToken>> mFlushes;
+		// the sequence number that FlushQueue assigned to this operation.
+		u64 mSeq = 0;
+
+		// the current status of the operation
+		Status mStatus = Status::Pending;
+
+		// set if the caller was resumed before the operation completed. The
+		// bytes then count towards the socket's buffered send capacity.
+		bool mBuffered = false;
+
+		friend struct SendSubmitQueue;
 	public:
 
 		SendOperation() = delete;
@@ -66,13 +88,14 @@ namespace coproto::internal
 
 		template<typename Buffer>
 		SendOperation(
-			SocketForkIter ss,
+			const SessionID& id,
+			SocketForkIter hint,
 			coroutine_handle<void> ch,
 			Buffer&& s)
-			: mCH(ch)
-			, mStorage(std::forward<Buffer>(s))
-			, mSendBuffer(mStorage->asSpan())
-			, mSocketFork(ss)
+			: mStorage(std::forward<Buffer>(s))
+			, mCH(ch)
+			, mSessionID(id)
+			, mSocketFork(hint)
 		{}
 
 		template<typename Fn>
@@ -86,9 +109,29 @@ namespace coproto::internal
 			}
 		}
 
-		void addFlush(std::shared_ptr<FlushToken>& t, Lock& l)
+		u64 seq()
+		{
+			return mSeq;
+		}
+
+		void setSeq(u64 seq)
+		{
+			mSeq = seq;
+		}
+
+		const SessionID& sessionID()
+		{
+			return mSessionID;
+		}
+
+		void setFork(SocketForkIter fork)
+		{
+			mSocketFork = fork;
+		}
+
+		SocketForkIter forkHint()
 		{
-			mFlushes.push_back(t);
+			return mSocketFork;
 		}
 
 		SocketFork& fork()
@@ -106,6 +149,16 @@ namespace coproto::internal
 			mStatus = s;
 		}
 
+		bool buffered()
+		{
+			return mBuffered;
+		}
+
+		void setBuffered(bool b)
+		{
+			mBuffered = b;
+		}
+
 		SendOperation* next()
 		{
 			return mNext;
@@ -123,6 +176,16 @@ namespace coproto::internal
 				next->mPrev = this;
 		}
 
+		// remove this operation from the intrusive list.
+		void unlink()
+		{
+			if (mPrev)
+				mPrev->mNext = mNext;
+			if (mNext)
+				mNext->mPrev = mPrev;
+			mPrev = mNext = nullptr;
+		}
+
 		//[this] {
 
 		//	CBQueue<coroutine_handle<>> cb;
@@ -217,4 +280,144 @@ namespace coproto::internal
 		//}
 	};
 
+	// a free list of SendOperation storage so that a warm socket 
+	// does not allocate per send. Operations are made by the sending
+	// threads and destroyed by the send task. So that Socket::send stays
+	// lock free, the list is a Treiber stack. Its head is tagged with a 
+	// counter in the top 16 bits, which user space pointers do not use, 
+	// so that a pop can not succeed on a stale head (ABA). Storage at an
+	// address that does not fit is not kept. At most retainedCapacity() 
+	// bytes of operations are kept.
+	//
+	// A pop reads the next pointer of a node that another thread might 
+	// have popped in the meantime. Nodes are therefore only freed by the
+	// destructor. Lowering the capacity frees the excess as it is reused.
+	struct SendOperationPool
+	{
+		struct Node
+		{
+			std::atomic<Node*> mNext;
+		};
+
+		static_assert(alignof(SendOperation) <= __STDCPP_DEFAULT_NEW_ALIGNMENT__, 
+			"SendOperation is allocated with the default operator new.");
+		static_assert(sizeof(void*) == sizeof(u64), "the tagged head requires 64 bit pointers.");
+
+		static constexpr u64 TagShift = 48;
+		static constexpr u64 PtrMask = (1ull << TagShift) - 1;
+
+		// the free list of operation storage, tagged.
+		std::atomic<u64> mHead{ 0 };
+
+		// the number of entries in the free list.
+		std::atomic<u64> mSize{ 0 };
+
+		// the maximum number of entries in the free list.
+		std::atomic<u64> mMaxRetained{ (1 << 16) / sizeof(SendOperation) };
+
+		// the number of operations that are currently in use and
+		// the largest that this has been.
+		std::atomic<u64> mInUse{ 0 }, mHighWaterMark{ 0 };
+
+		SendOperationPool() = default;
+		SendOperationPool(const SendOperationPool&) = delete;
+
+		~SendOperationPool()
+		{
+			while (auto node = pop())
+				::operator delete(node);
+		}
+
+		template<typename... Args>
+		SendOperation* make(Args&&... args)
+		{
+			void* ptr = pop();
+
+			auto inUse = mInUse.fetch_add(1, std::memory_order_relaxed) + 1;
+			auto high = mHighWaterMark.load(std::memory_order_relaxed);
+			while (high < inUse && !mHighWaterMark.compare_exchange_weak(high, inUse, std::memory_order_relaxed))
+				;
+
+			if (ptr == nullptr)
+				ptr = ::operator new(sizeof(SendOperation));
+
+			try {
+				return new (ptr) SendOperation(std::forward<Args>(args)...);
+			}
+			catch (...)
+			{
+				release(ptr);
+				throw;
+			}
+		}
+
+		void destroy(SendOperation* op)
+		{
+			op->~SendOperation();
+			release(op);
+		}
+
+		// the number of bytes of freed operations that are kept.
+		void setRetainedCapacity(u64 bytes)
+		{
+			mMaxRetained.store(bytes / sizeof(SendOperation), std::memory_order_relaxed);
+		}
+
+		// the largest number of bytes of operations that have been in use.
+		u64 highWaterMark()
+		{
+			return mHighWaterMark.load(std::memory_order_relaxed) * sizeof(SendOperation);
+		}
+
+	private:
+
+		// ptr with the tag of head incremented.
+		static u64 tagged(Node* ptr, u64 head)
+		{
+			return reinterpret_cast<u64>(ptr) | ((head & ~PtrMask) + (1ull << TagShift));
+		}
+
+		Node* pop()
+		{
+			auto head = mHead.load(std::memory_order_acquire);
+			while (true)
+			{
+				auto node = reinterpret_cast<Node*>(head & PtrMask);
+				if (node == nullptr)
+					return nullptr;
+
+				// if node has been popped by another thread, next might be
+				// garbage but the tag has changed and so the exchange fails.
+				auto next = node->mNext.load(std::memory_order_relaxed);
+				if (mHead.compare_exchange_weak(head, tagged(next, head),
+					std::memory_order_acquire, std::memory_order_acquire))
+				{
+					mSize.fetch_sub(1, std::memory_order_relaxed);
+					return node;
+				}
+			}
+		}
+
+		void release(void* ptr)
+		{
+			mInUse.fetch_sub(1, std::memory_order_relaxed);
+
+			if ((reinterpret_cast<u64>(ptr) & ~PtrMask) == 0)
+			{
+				if (mSize.fetch_add(1, std::memory_order_relaxed) < mMaxRetained.load(std::memory_order_relaxed))
+				{
+					auto node = new (ptr) Node;
+					auto head = mHead.load(std::memory_order_relaxed);
+					do {
+						node->mNext.store(reinterpret_cast<Node*>(head & PtrMask), std::memory_order_relaxed);
+					} while (!mHead.compare_exchange_weak(head, tagged(node, head),
+						std::memory_order_release, std::memory_order_relaxed));
+					return;
+				}
+				mSize.fetch_sub(1, std::memory_order_relaxed);
+			}
+
+			::operator delete(ptr);
+		}
+	};
 }
\ No newline at end of file
@@ -0,0 +1,539 @@
+#include "SharedMemSocket.h"
+
+#ifdef COPROTO_ENABLE_SHARED_MEM
+#include <atomic>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace coproto
+{
+	namespace
+	{
+		// the futexes live in memory shared between processes and
+		// therefore the non-private operations are used.
+		void futexWait(std::atomic<u32>& word, u32 expected)
+		{
+			syscall(SYS_futex, reinterpret_cast<u32*>(&word), FUTEX_WAIT, expected, nullptr, nullptr, 0);
+		}
+
+		void futexWake(std::atomic<u32>& word)
+		{
+			syscall(SYS_futex, reinterpret_cast<u32*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+		}
+
+		// the number of times the thread polls before it goes to sleep.
+		constexpr u64 spinCount = 1 << 12;
+
+		inline void spinPause()
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#endif
+		}
+
+		u64 roundUpPow2(u64 n)
+		{
+			u64 r = 64;
+			while (r < n)
+				r *= 2;
+			return r;
+		}
+	}
+
+	// The shared region consists of this header followed by the data of
+	// the two rings. An all zero region is a valid initial state, so a
+	// freshly created region needs no initialization.
+	struct SharedMemSocket::Region
+	{
+		// One direction. Both counters only ever increase; the ring
+		// holds mWrite - mRead bytes. Each is written by one process.
+		struct Ring
+		{
+			alignas(64) std::atomic<u64> mWrite;
+			alignas(64) std::atomic<u64> mRead;
+		};
+
+		// The state of one end.
+		struct End
+		{
+			// incremented whenever something this end might be waiting
+			// for happens. Its thread sleeps on this futex.
+			alignas(64) std::atomic<u32> mSeq;
+
+			// non-zero if the thread is (about to be) asleep and
+			// waiting on the other end.
+			std::atomic<u32> mSleeping;
+
+			// non-zero once this end has been closed.
+			std::atomic<u32> mClosed;
+
+			// non-zero once a process has opened this end by name.
+			std::atomic<u32> mOpened;
+		};
+
+		// the size of each ring, set by whoever opens the region first.
+		std::atomic<u64> mCapacity;
+
+		// the number of processes that have opened a named region.
+		std::atomic<u32> mAttached;
+
+		// ring i holds the data being sent to end i.
+		std::array<Ring, 2> mRings;
+
+		std::array<End, 2> mEnds;
+
+		static_assert(std::atomic<u64>::is_always_lock_free, "shared memory atomics must be lock free");
+		static_assert(std::atomic<u32>::is_always_lock_free, "shared memory atomics must be lock free");
+	};
+
+	struct SharedMemSocket::Mapping
+	{
+		Mapping(int fd, u64 capacity)
+		{
+			// The other process might already be using the region. It is 
+			// only ever grown, shrinking it would unmap the rings under the
+			// other process. posix_fallocate never shrinks the file. The 
+			// capacity is checked using the header before the rings are sized.
+			if (posix_fallocate(fd, 0, sizeof(Region)))
+				throw std::runtime_error("failed to size the shared memory region. " COPROTO_LOCATION);
+
+			auto ptr = mmap(nullptr, sizeof(Region), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (ptr == MAP_FAILED)
+				throw std::runtime_error("failed to map the shared memory region. " COPROTO_LOCATION);
+
+			u64 c = 0;
+			auto header = static_cast<Region*>(ptr);
+			auto match = header->mCapacity.compare_exchange_strong(c, capacity) || c == capacity;
+			munmap(ptr, sizeof(Region));
+			if (!match)
+				throw std::runtime_error("the shared memory region was opened with a different buffer size. " COPROTO_LOCATION);
+
+			mSize = sizeof(Region) + 2 * capacity;
+			if (posix_fallocate(fd, 0, mSize))
+				throw std::runtime_error("failed to size the shared memory region. " COPROTO_LOCATION);
+
+			ptr = mmap(nullptr, mSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (ptr == MAP_FAILED)
+				throw std::runtime_error("failed to map the shared memory region. " COPROTO_LOCATION);
+			mRegion = static_cast<Region*>(ptr);
+			mCapacity = capacity;
+		}
+
+		~Mapping()
+		{
+			munmap(mRegion, mSize);
+		}
+
+		Region* mRegion = nullptr;
+		u64 mSize = 0, mCapacity = 0;
+
+		// the data of ring i.
+		u8* data(u64 i) { return reinterpret_cast<u8*>(mRegion + 1) + i * mCapacity; }
+	};
+
+	struct SharedMemSocket::State : std::enable_shared_from_this<State>
+	{
+		State(std::shared_ptr<Mapping> mapping, u64 idx)
+			: mMapping(std::move(mapping))
+			, mRegion(mMapping->mRegion)
+			, mIdx(idx)
+		{}
+
+		std::shared_ptr<Mapping> mMapping;
+		Region* mRegion;
+
+		// We are end mIdx of the region.
+		u64 mIdx;
+
+		// Protects the members below and our use of the rings.
+		std::mutex mMtx;
+
+		// The pending operations, if any.
+		Awaiter* mPendingSend = nullptr;
+		Awaiter* mPendingRecv = nullptr;
+
+		// The thread that completes pending operations. Started on the
+		// first operation that does not complete synchronously.
+		std::thread mThread;
+		bool mStop = false;
+
+		Region::End& self() { return mRegion->mEnds[mIdx]; }
+		Region::End& peer() { return mRegion->mEnds[mIdx ^ 1]; }
+
+		// copy as much of src into the ring to the other end as fits.
+		u64 push(span<u8> src)
+		{
+			auto& ring = mRegion->mRings[mIdx ^ 1];
+			auto cap = mMapping->mCapacity;
+			auto w = ring.mWrite.load(std::memory_order_relaxed);
+			auto r = ring.mRead.load(std::memory_order_acquire);
+			auto n = std::min<u64>(src.size(), cap - (w - r));
+			auto pos = w & (cap - 1);
+			auto n0 = std::min<u64>(n, cap - pos);
+			auto data = mMapping->data(mIdx ^ 1);
+			std::memcpy(data + pos, src.data(), n0);
+			std::memcpy(data, src.data() + n0, n - n0);
+			ring.mWrite.store(w + n, std::memory_order_release);
+			return n;
+		}
+
+		// copy as much as is available from our ring into dst.
+		u64 pop(span<u8> dst)
+		{
+			auto& ring = mRegion->mRings[mIdx];
+			auto cap = mMapping->mCapacity;
+			auto r = ring.mRead.load(std::memory_order_relaxed);
+			auto w = ring.mWrite.load(std::memory_order_acquire);
+			auto n = std::min<u64>(dst.size(), w - r);
+			auto pos = r & (cap - 1);
+			auto n0 = std::min<u64>(n, cap - pos);
+			auto data = mMapping->data(mIdx);
+			std::memcpy(dst.data(), data + pos, n0);
+			std::memcpy(dst.data() + n0, data, n - n0);
+			ring.mRead.store(r + n, std::memory_order_release);
+			return n;
+		}
+
+		// Wake end idx. Unless force is set, the other end's thread is
+		// only woken if it is waiting on us.
+		void notify(u64 idx, bool force = false)
+		{
+			auto& end = mRegion->mEnds[idx];
+			end.mSeq.fetch_add(1);
+			if (force || end.mSleeping.load())
+				futexWake(end.mSeq);
+		}
+
+		// Send and receive as much as possible for the pending operations
+		// and return the ones that completed. Called while holding mMtx.
+		void progress(std::array<Awaiter*, 2>& done)
+		{
+			u64 n = 0;
+			bool moved = false;
+			auto closed = self().mClosed.load(std::memory_order_acquire);
+
+			// must be read before receiving. If the other end had closed,
+			// everything it sent is in the ring by now.
+			auto remoteClosed = peer().mClosed.load(std::memory_order_acquire);
+
+			if (auto op = mPendingSend)
+			{
+				if (closed || remoteClosed)
+					op->mEc = closed ? code::closed : code::remoteClosed;
+				else
+				{
+					u64 m;
+					while (op->mData.size() && (m = push(op->mData)))
+					{
+						op->advance(m);
+						moved = true;
+					}
+					if (op->mData.size() == 0)
+						op->mEc = code::success;
+				}
+
+				if (op->mEc)
+					done[n++] = std::exchange(mPendingSend, nullptr);
+			}
+
+			if (auto op = mPendingRecv)
+			{
+				if (closed)
+					op->mEc = code::closed;
+				else
+				{
+					u64 m;
+					while (op->mData.size() && (m = pop(op->mData)))
+					{
+						op->advance(m);
+						moved = true;
+					}
+					if (op->mData.size() == 0 || (op->mSome && op->mBytesTransfered))
+						op->mEc = code::success;
+					else if (remoteClosed)
+						op->mEc = code::remoteClosed;
+				}
+
+				if (op->mEc)
+					done[n++] = std::exchange(mPendingRecv, nullptr);
+			}
+
+			if (moved)
+				notify(mIdx ^ 1);
+		}
+
+		// The loop run by mThread. It makes progress on the pending
+		// operations whenever the other end signals us.
+		void run()
+		{
+			auto& end = self();
+			while (true)
+			{
+				auto seq = end.mSeq.load();
+				std::array<Awaiter*, 2> done{};
+				bool pending;
+				{
+					std::lock_guard<std::mutex> lock(mMtx);
+					if (mStop)
+						return;
+					progress(done);
+					pending = mPendingSend || mPendingRecv;
+				}
+
+				if (done[0])
+				{
+					complete(done, nullptr);
+					continue;
+				}
+
+				if (pending)
+				{
+					// the other end is likely to respond soon, poll
+					// for a bit before paying for a sleep.
+					for (u64 i = 0; i < spinCount && end.mSeq.load(std::memory_order_acquire) == seq; ++i)
+						spinPause();
+
+					end.mSleeping.store(1);
+					if (end.mSeq.load() == seq)
+						futexWait(end.mSeq, seq);
+					end.mSleeping.store(0);
+				}
+				else
+				{
+					// Nothing to do until an operation is started or we are
+					// stopped. Both force a wake up.
+					futexWait(end.mSeq, seq);
+				}
+			}
+		}
+
+		// clear the stop callbacks of the completed operations and resume
+		// all of them except skip. Must not hold the lock.
+		static void complete(std::array<Awaiter*, 2>& done, Awaiter* skip)
+		{
+			for (auto d : done)
+				if (d && d->mReg)
+					d->mReg.reset();
+			for (auto d : done)
+				if (d && d != skip)
+					d->mHandle.resume();
+		}
+	};
+
+	SharedMemSocket::Awaiter::Awaiter(State* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some)
+		: mState(ss)
+		, mData(dd)
+		, mSend(send)
+		, mSome(some)
+		, mToken(t)
+	{
+		COPROTO_ASSERT(dd.size());
+	}
+
+	SharedMemSocket::Awaiter::Awaiter(State* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t)
+		: mState(ss)
+		, mRest(dd)
+		, mSend(send)
+		, mToken(t)
+	{
+		advance(0);
+		COPROTO_ASSERT(mData.size());
+	}
+
+	void SharedMemSocket::Awaiter::advance(u64 n)
+	{
+		mData = mData.subspan(n);
+		mBytesTransfered += n;
+		while (mData.size() == 0 && mRest.size())
+		{
+			mData = mRest[0];
+			mRest = mRest.subspan(1);
+		}
+	}
+
+	coroutine_handle<> SharedMemSocket::Awaiter::await_suspend(coroutine_handle<> h)
+	{
+		if (mToken.stop_possible())
+		{
+			mReg.emplace(mToken, [this] {
+
+				// This might be called synchronously, before mHandle is set.
+				coroutine_handle<> cb;
+				{
+					std::lock_guard<std::mutex> lock(mState->mMtx);
+					if (!mEc)
+					{
+						cb = mHandle;
+						auto& pending = mSend ? mState->mPendingSend : mState->mPendingRecv;
+						COPROTO_ASSERT(pending == (cb ? this : nullptr));
+						pending = nullptr;
+						mEc = code::operation_aborted;
+					}
+				}
+
+				if (cb)
+					cb.resume();
+				});
+		}
+
+		std::array<Awaiter*, 2> done{};
+		{
+			std::lock_guard<std::mutex> lock(mState->mMtx);
+			mHandle = h;
+
+			// canceled synchronously.
+			if (mEc)
+				return h;
+
+			auto& pending = mSend ? mState->mPendingSend : mState->mPendingRecv;
+			COPROTO_ASSERT(pending == nullptr);
+			pending = this;
+
+			mState->progress(done);
+
+			if (done[0] != this && done[1] != this)
+			{
+				// hand the operation to the thread. It owns a reference to
+				// the state since the socket might be destroyed by a
+				// coroutine that it resumes.
+				if (!mState->mThread.joinable())
+					mState->mThread = std::thread([s = mState->shared_from_this()] { s->run(); });
+				mState->notify(mState->mIdx, true);
+			}
+		}
+
+		// resume the other operation that completed, if any, and then
+		// complete this one synchronously.
+		if (done[0] == this || done[1] == this)
+		{
+			State::complete(done, this);
+			return h;
+		}
+
+		if (done[0])
+		{
+			auto other = done[0];
+			if (other->mReg)
+				other->mReg.reset();
+			return other->mHandle;
+		}
+
+		return macoro::noop_coroutine();
+	}
+
+	SharedMemSocket::Sock::Sock(std::shared_ptr<State> state)
+		: mState(std::move(state))
+	{}
+
+	SharedMemSocket::Sock::~Sock()
+	{
+		{
+			std::lock_guard<std::mutex> lock(mState->mMtx);
+			mState->mStop = true;
+		}
+
+		if (mState->mThread.joinable())
+		{
+			mState->notify(mState->mIdx, true);
+
+			// we might be destroyed from a coroutine that the thread resumed.
+			// The thread holds a reference to the state and will exit once
+			// it sees mStop.
+			if (mState->mThread.get_id() == std::this_thread::get_id())
+				mState->mThread.detach();
+			else
+				mState->mThread.join();
+		}
+	}
+
+	void SharedMemSocket::Sock::close()
+	{
+		std::array<Awaiter*, 2> done{};
+		{
+			std::lock_guard<std::mutex> lock(mState->mMtx);
+			mState->self().mClosed.store(1, std::memory_order_release);
+
+			u64 n = 0;
+			for (auto p : { &mState->mPendingSend, &mState->mPendingRecv })
+			{
+				if (auto op = std::exchange(*p, nullptr))
+				{
+					op->mEc = code::closed;
+					done[n++] = op;
+				}
+			}
+		}
+
+		mState->notify(mState->mIdx ^ 1, true);
+		State::complete(done, nullptr);
+	}
+
+	SharedMemSocket::SharedMemSocket(const std::string& name, u64 idx, u64 bufferSize)
+	{
+		if (idx > 1)
+			throw std::runtime_error("idx must be 0 or 1. " COPROTO_LOCATION);
+
+		auto fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0600);
+		if (fd == -1)
+			throw std::runtime_error("failed to open the shared memory region " + name + ". " COPROTO_LOCATION);
+
+		std::shared_ptr<Mapping> mapping;
+		try {
+			mapping = std::make_shared<Mapping>(fd, roundUpPow2(bufferSize));
+		}
+		catch (...)
+		{
+			::close(fd);
+			throw;
+		}
+		::close(fd);
+
+		// each end can only be opened once. Otherwise two processes
+		// would both read and write the same rings.
+		if (mapping->mRegion->mEnds[idx].mOpened.exchange(1))
+			throw std::runtime_error("end " + std::to_string(idx) + " of the shared memory region " + name + " is already open. " COPROTO_LOCATION);
+
+		// the second process to open the region removes the name.
+		if (mapping->mRegion->mAttached.fetch_add(1) == 1)
+			shm_unlink(name.c_str());
+
+		auto sock = std::make_unique<Sock>(std::make_shared<State>(std::move(mapping), idx));
+		mSock = sock.get();
+		*static_cast<Socket*>(this) = Socket(make_socket_tag{}, std::move(sock));
+	}
+
+	std::array<SharedMemSocket, 2> SharedMemSocket::makePair(u64 bufferSize)
+	{
+		auto fd = memfd_create("coproto", MFD_CLOEXEC);
+		if (fd == -1)
+			throw std::runtime_error("failed to create the shared memory region. " COPROTO_LOCATION);
+
+		std::shared_ptr<Mapping> mapping;
+		try {
+			mapping = std::make_shared<Mapping>(fd, roundUpPow2(bufferSize));
+		}
+		catch (...)
+		{
+			::close(fd);
+			throw;
+		}
+		::close(fd);
+
+		std::array<SharedMemSocket, 2> pair;
+		for (u64 i = 0; i < 2; ++i)
+		{
+			auto sock = std::make_unique<Sock>(std::make_shared<State>(mapping, i));
+			pair[i].mSock = sock.get();
+			*static_cast<Socket*>(&pair[i]) = Socket(make_socket_tag{}, std::move(sock));
+		}
+		return pair;
+	}
+}
+#endif
@@ -0,0 +1,163 @@
+#pragma once
+// © 2022 Visa.
+// Permission is hereby granted, free of charge, to any person obtaining a copy of this software and associated documentation files (the "Software"), to deal in the Software without restriction, including without limitation the rights to use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of the Software, and to permit persons to whom the Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+
+#include "coproto/config.h"
+#ifdef COPROTO_ENABLE_SHARED_MEM
+
+#include "coproto/Socket/Socket.h"
+#include "coproto/Common/macoro.h"
+#include <memory>
+#include <string>
+
+namespace coproto
+{
+	// A socket for communicating between two processes on the same
+	// host. The data is passed through a shared memory region that
+	// holds one single-producer/single-consumer byte ring per
+	// direction. A process that is waiting for data or space sleeps
+	// on a futex in the shared region which the other process wakes.
+	// This is only available on linux and if the library is built with
+	// COPROTO_ENABLE_SHARED_MEM.
+	//
+	// There are two ways to create the sockets.
+	//
+	// * makePair(bufferSize) creates an anonymous region (memfd) and
+	//   returns both ends. The sockets can be used directly or, before
+	//   they are used, the process can fork(). The parent then keeps
+	//   one end and the child the other. Destroying an end does not
+	//   close it, and so the end that is not used can simply be dropped.
+	// * SharedMemSocket(name, idx, bufferSize) opens the end idx of the
+	//   region with the given name (shm_open). Two unrelated processes
+	//   should call this with the same name and bufferSize and opposite
+	//   idx. The name is removed once both processes have opened it.
+	//   Each end can only be opened once.
+	//
+	// Since destroying the socket does not close it, the socket should
+	// be closed with `co_await socket.close()` once the protocol is done.
+	// Otherwise the other process will not see an error.
+	//
+	// Like LocalAsyncSocket, the SocketImpl is the nested struct Sock.
+	// Operations first try to complete synchronously. If they can not,
+	// a thread owned by the Sock waits for the other process and
+	// completes them, resuming the caller on that thread.
+	struct SharedMemSocket : public Socket
+	{
+		// The layout of the shared region.
+		struct Region;
+
+		// The mapping of the shared region into this process.
+		struct Mapping;
+
+		// The state of one end. This is shared with the thread that
+		// completes pending operations so that the socket can be
+		// destroyed from a coroutine that this thread resumed.
+		struct State;
+
+		// The actual socket implementation.
+		struct Sock;
+
+		// The awaiter that is returned from send(...) and recv(...).
+		struct Awaiter
+		{
+			Awaiter(State* ss, span<u8> dd, bool send, macoro::stop_token&& t, bool some = false);
+
+			// A vectored operation. The buffers are sent/received in order
+			// as if they were one contiguous buffer.
+			Awaiter(State* ss, span<span<u8>> dd, bool send, macoro::stop_token&& t);
+
+			// The end of the socket that this io operation belongs to.
+			State* mState;
+
+			// The data remaining to be sent or received. For vectored
+			// operations this is the current buffer.
+			span<u8> mData;
+
+			// For vectored operations, the buffers that follow mData.
+			span<span<u8>> mRest;
+
+			// The amount of data that has been sent or received.
+			u64 mBytesTransfered = 0;
+
+			// If true, this is a send, otherwise a receive.
+			bool mSend;
+
+			// If true, a receive completes as soon as some data
+			// has been received.
+			bool mSome = false;
+
+			// Set once the operation has completed.
+			optional<error_code> mEc;
+
+			// The coroutine callback that should be called when this operation completes.
+			coroutine_handle<> mHandle;
+
+			// An optional token that the user can provide to stop an asynchronous operation.
+			macoro::stop_token mToken;
+
+			// the stop callback.
+			macoro::optional_stop_callback mReg;
+
+			bool await_ready() { return false; }
+
+			// Tries to complete the operation synchronously. If it can not, the
+			// operation is handed to the socket's thread and h is resumed once it
+			// completes or is canceled.
+			macoro::coroutine_handle<> await_suspend(macoro::coroutine_handle<> h);
+
+#ifdef COPROTO_CPP20
+			// this version of await_suspend allows c++20 coroutine support.
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) {
+				return await_suspend(macoro::coroutine_handle<>(h)).std_cast();
+			}
+#endif
+
+			std::pair<error_code, u64> await_resume()
+			{
+				COPROTO_ASSERT(mEc);
+				return { *mEc, mBytesTransfered };
+			}
+
+			// consume n bytes of the data.
+			void advance(u64 n);
+		};
+
+		struct Sock
+		{
+			Sock(std::shared_ptr<State> state);
+			Sock(const Sock&) = delete;
+			~Sock();
+
+			Awaiter send(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, true, std::move(token)); };
+			Awaiter recv(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token)); };
+			Awaiter send(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, true, std::move(token)); };
+			Awaiter recv(span<span<u8>> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token)); };
+			Awaiter recvSome(span<u8> data, macoro::stop_token token = {}) { return Awaiter(mState.get(), data, false, std::move(token), true); };
+
+			// Close this end. Pending operations complete with code::closed
+			// and the other process sees code::remoteClosed once it has
+			// received the data that was already sent.
+			void close();
+
+			std::shared_ptr<State> mState;
+		};
+
+		SharedMemSocket() = default;
+
+		// Open end idx of the shared memory region called name, creating it
+		// if needed. Both processes must use the same bufferSize. Throws if
+		// end idx of the region has already been opened.
+		SharedMemSocket(const std::string& name, u64 idx, u64 bufferSize = 1 << 20);
+
+		// Create a pair of connected sockets in a new shared memory region.
+		// Each direction can hold up to bufferSize bytes in flight.
+		static std::array<SharedMemSocket, 2> makePair(u64 bufferSize = 1 << 20);
+
+		Sock* mSock = nullptr;
+	};
+}
+#endif
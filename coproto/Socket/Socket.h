@@ -84,6 +84,23 @@ namespace coproto
 	// 
 	//   This is basically the same as send(...) but should receive data.
 	//
+	// Optionally, SocketImpl can also implement vectored (scatter/gather) versions:
+	//
+	// * SendAwaiter SocketImpl::send(span<span<u8>> buffers, macoro::stop_token token = {})
+	// * RecvAwaiter SocketImpl::recv(span<span<u8>> buffers, macoro::stop_token token = {})
+	//
+	//   These should behave as if the buffers were concatenated into one buffer. The number
+	//   of bytes returned by await_resume() is the total over all buffers. Some buffers may
+	//   be empty. If the send overload is detected, the message header and body (and any
+	//   control block) are sent with a single call instead of several. The buffers are
+	//   only guaranteed to be valid until the operation completes.
+	//
+	// * RecvAwaiter SocketImpl::recvSome(span<u8> data, macoro::stop_token token = {})
+	//
+	//   Optional. The same as recv(...) except that it completes as soon as some (at least
+	//   one byte) data has been received. await_resume() returns the number of bytes received.
+	//   This is required by Socket::enableReadAhead().
+	//
 	// For example implementations see the socket tutorial or LocalAsyncSocket, AsioSocket or BufferingSocket.
 	//
 	class Socket
@@ -98,9 +115,33 @@ namespace coproto
 		// the user defined SocketImpl.
 		std::shared_ptr<internal::SockScheduler> mImpl;
 
+		// The fork of mImpl with session id mId. It lets operations skip the
+		// SessionID lookup. If mId is changed, the scheduler notices the 
+		// mismatch and falls back to the lookup. The fork counts the Socket's
+		// that refer to it and is closed once the last one is destroyed. A
+		// Socket whose mId was changed does not keep that fork open. Its 
+		// operations fail with code::closed once the fork is closed.
+		internal::SocketFork* mFork = nullptr;
+
 		Socket() = default;
-		Socket(const Socket& s) = default;
-		Socket(Socket&& s) = default;
+		Socket(const Socket& s)
+			: mId(s.mId)
+			, mImpl(s.mImpl)
+			, mFork(s.mFork)
+		{
+			acquire();
+		}
+
+		Socket(Socket&& s)
+			: mId(s.mId)
+			, mImpl(std::move(s.mImpl))
+			, mFork(std::exchange(s.mFork, nullptr))
+		{}
+
+		~Socket()
+		{
+			release();
+		}
 
 
 		// Construct a new socket using SocketImpl&& s as the underlaying socket. Use
@@ -109,7 +150,10 @@ namespace coproto
 		Socket(make_socket_tag, SocketImpl&& s, SessionID sid = SessionID::root())
 			: mId(sid)
 			, mImpl(std::make_shared<internal::SockScheduler>(std::forward<SocketImpl>(s), mId))
-		{}
+			, mFork(mImpl->getFork(mId))
+		{
+			acquire();
+		}
 
 
 		// Construct a new socket using std::unique_ptr<SocketImpl>&& s as the underlaying socket.
@@ -117,11 +161,28 @@ namespace coproto
 		Socket(make_socket_tag, std::unique_ptr<SocketImpl>&& s, SessionID sid = SessionID::root())
 			: mId(sid)
 			, mImpl(std::make_shared<internal::SockScheduler>(std::move(s), mId))
-		{}
+			, mFork(mImpl->getFork(mId))
+		{
+			acquire();
+		}
 
 
-		Socket& operator=(Socket&& s) = default;
-		Socket& operator=(const Socket& s) = default;
+		Socket& operator=(Socket&& s)
+		{
+			if (this != &s)
+			{
+				release();
+				mId = s.mId;
+				mImpl = std::move(s.mImpl);
+				mFork = std::exchange(s.mFork, nullptr);
+			}
+			return *this;
+		}
+
+		Socket& operator=(const Socket& s)
+		{
+			return *this = Socket(s);
+		}
 
 		// Send the Container `t` with a timeout `to`. After the timeout the operation is canceled.
 		// The return value must be awaited for the data to be scheduled. 
@@ -140,7 +201,7 @@ namespace coproto
 		template<typename Container>
 		auto send(Container& t, macoro::stop_token token = {})
 		{
-			return internal::RefSendAwaiter<Container>(mImpl.get(), mId, t, std::move(token));
+			return internal::RefSendAwaiter<Container>(mImpl.get(), mId, t, std::move(token), mFork);
 		}
 
 		// Send the Container `t`. A stop_token can be provided to request that the send be 
@@ -152,7 +213,7 @@ namespace coproto
 		template<typename Container>
 		auto send(Container&& t, macoro::stop_token token = {})
 		{
-			return internal::MoveSendAwaiter<Container>(mImpl.get(), mId, std::forward<Container>(t), std::move(token));
+			return internal::MoveSendAwaiter<Container>(mImpl.get(), mId, std::forward<Container>(t), std::move(token), mFork);
 		}
 
 		// Receive the next message into the container `r` with a timeout `to`. After the timeout 
@@ -168,7 +229,7 @@ namespace coproto
 		template<typename Container>
 		auto recv(Container& t, macoro::stop_token token = {})
 		{
-			return internal::RefRecvAwaiter<Container, false>(mImpl.get(), mId, t, std::move(token));
+			return internal::RefRecvAwaiter<Container, false>(mImpl.get(), mId, t, std::move(token), mFork);
 		}
 
 		// Receive the next message into the container `r`. An optional stop_token can be provided
@@ -176,7 +237,7 @@ namespace coproto
 		template<typename Container>
 		auto recv(Container&& t, macoro::stop_token token = {})
 		{
-			return internal::MoveRecvAwaiter<Container, false>(mImpl.get(), mId, std::forward<Container>(t), std::move(token));
+			return internal::MoveRecvAwaiter<Container, false>(mImpl.get(), mId, std::forward<Container>(t), std::move(token), mFork);
 		}
 
 		// Receive the next message and store the message in a class of type Container. An optional 
@@ -185,7 +246,7 @@ namespace coproto
 		template<typename Container>
 		auto recv(macoro::stop_token token = {})
 		{
-			return internal::MoveRecvAwaiter<Container, true>(mImpl.get(), mId, std::move(token));
+			return internal::MoveRecvAwaiter<Container, true>(mImpl.get(), mId, std::move(token), mFork);
 		}
 
 		// Receive the next message into the container `r` with a timeout `to`. After the timeout 
@@ -203,7 +264,7 @@ namespace coproto
 		template<typename Container>
 		auto recvResize(Container& t, macoro::stop_token token = {})
 		{
-			return internal::RefRecvAwaiter<Container, true>(mImpl.get(), mId, t, std::move(token));
+			return internal::RefRecvAwaiter<Container, true>(mImpl.get(), mId, t, std::move(token), mFork);
 		}
 
 		// returns the number of bytes sent.
@@ -244,16 +305,120 @@ namespace coproto
 		// call fork. Messages on each fork will then remain separate.
 		// However, the underlying socket will be sending all messages.
 		// The messages are distinguished by sending a per fork tag.
+		//
+		// Once the returned socket and all copies of it have been destroyed,
+		// the fork is closed. Messages that later arrive on it are discarded
+		// and the other party is told that it was closed. The notice is read
+		// by the other party ahead of its next message. Receives on its fork
+		// then fail with code::remoteClosed. Once both parties have closed the 
+		// fork, its state is freed and its id is reused. Operations on the fork
+		// must have been started before it is closed. Later operations on its
+		// session id fail with code::closed.
 		Socket fork()
 		{
-			Socket ret = *this;
-			ret.mId = mImpl->fork(mId);
+			Socket ret;
+			ret.mImpl = mImpl;
+			ret.mFork = mImpl->fork(mId, mFork);
+			ret.mId = ret.mFork->mSessionID;
+			ret.acquire();
 			return ret;
 		}
 
 		// return the underlaying socket.
 		void* getNative() { return mImpl->getSocket(); }
 
+		// Read incoming data ahead into an internal buffer of size `capacity`.
+		// Message headers and small messages are then parsed out of this
+		// buffer instead of each requiring its own read. Large messages are
+		// still read directly into the user's buffer. This applies to all
+		// forks of the socket. Requires the underlaying socket to implement
+		// recvSome(...) and must be called before anything is received.
+		void enableReadAhead(u64 capacity = 1 << 16)
+		{
+			mImpl->enableReadAhead(capacity);
+		}
+
+		// By default, if a message arrives on a fork that has not yet called
+		// recv(...), all forks stop receiving until it does. Enabling eager
+		// receiving instead buffers such messages, up to `capacity` bytes in
+		// total, and a later recv(...) completes immediately from the buffer.
+		// Once the limit is reached the default behavior resumes. This applies
+		// to all forks of the socket. A capacity of zero disables it.
+		void enableEagerRecv(u64 capacity = 1 << 20)
+		{
+			mImpl->enableEagerRecv(capacity);
+		}
+
+		// While a write is in progress, new messages are queued. When enabled,
+		// the queued messages (from any fork) are copied into one buffer of at
+		// most `maxSize` bytes and sent with a single write. Messages are never
+		// delayed to wait for more data, so this only changes how much is
+		// written at a time. Larger messages are sent as usual. A size of zero
+		// disables it.
+		void enableSendCoalescing(u64 maxSize = 1 << 14)
+		{
+			mImpl->enableSendCoalescing(maxSize);
+		}
+
+		// Pending operations are allocated from caches that are shared by all
+		// the forks of the socket. Once an operation completes, its memory is
+		// kept for reuse by later operations, up to `bytes` for send operations
+		// and `bytes` for receive operations. The default is 64 KiB each. A
+		// value of zero releases memory as soon as it is no longer used. Send
+		// operation memory that is already cached when the capacity is lowered
+		// is released once it has been reused.
+		void setOperationCacheCapacity(u64 bytes)
+		{
+			mImpl->setOperationCacheCapacity(bytes);
+		}
+
+		// The largest number of bytes of send operations that have been pending
+		// at once plus the same for receive operations. This can be used to
+		// choose the capacity of setOperationCacheCapacity(...).
+		u64 operationCacheHighWaterMark()
+		{
+			return mImpl->operationCacheHighWaterMark();
+		}
+
+		// By default, a fork can send any amount of data that the other party
+		// has not asked for yet, and all forks wait on a message that is not
+		// received. With flow control, each fork may only be `window` bytes
+		// ahead of what the other party has received. Sends beyond that wait
+		// until the other party receives more. In exchange, messages that arrive
+		// early are always buffered so the forks do not block each other. A 
+		// fragmented message, see enableFragmentation(), that arrives early must
+		// fit in the window or the eager capacity, otherwise the socket fails 
+		// with code::badCoprotoMessageHeader. Both parties must enable it with
+		// the same window before anything is sent or received. Applies to all
+		// forks of the socket.
+		void enableFlowControl(u64 window = 1 << 20)
+		{
+			mImpl->enableFlowControl(window);
+		}
+
+		// By default, a message is written in one piece and the messages of the
+		// other forks wait until it has been. With fragmentation, messages larger 
+		// than `fragmentSize` bytes are sent in fragments of that size with the 
+		// queued messages of the other forks sent in between. Canceling such a send
+		// after part of it has been sent fails the other party's recv with 
+		// code::remoteCancel instead of closing the socket. A canceled send that is
+		// being written is completed first. Messages are still limited to 32 bit
+		// sizes. Must be called before anything is sent. Only the sending party
+		// has to enable it. Applies to all forks of the socket.
+		void enableFragmentation(u64 fragmentSize = 1 << 18)
+		{
+			mImpl->enableFragmentation(fragmentSize);
+		}
+
+		// A send of a moved buffer normally completes right away and the data is
+		// buffered until it has been written. Once `bytes` of such data is buffered,
+		// later moved sends instead complete once they are written. This applies
+		// to all forks of the socket. The default is unlimited.
+		void setSendBufferCapacity(u64 bytes)
+		{
+			mImpl->setSendBufferCapacity(bytes);
+		}
+
 
 
 		// Unstable function to enable logging.
@@ -285,6 +450,20 @@ namespace coproto
 			mImpl->setExecutor(scheduler, mId);
 		}
 
+	private:
+		void acquire()
+		{
+			if (mFork)
+				mFork->mRefCount.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		// close the fork if this was the last Socket that refers to it.
+		void release()
+		{
+			if (mFork && mFork->mRefCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				mImpl->closeFork(mFork);
+			mFork = nullptr;
+		}
 	};
 
 	template<typename T>
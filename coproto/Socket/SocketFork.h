@@ -4,6 +4,8 @@
 #include "coproto/Proto/SessionID.h"
 #include "coproto/Socket/RecvOperation.h"
 #include "coproto/Socket/SendOperation.h"
+#include <atomic>
+#include <vector>
 
 namespace coproto::internal
 {
@@ -22,8 +24,10 @@ namespace coproto::internal
 	// completions will be enqued there.
 	struct SocketFork
 	{
-		SocketFork(SessionID id)
+		SocketFork(SessionID id, QueueBlockPool* pool = nullptr)
 			: mSessionID(id)
+			, mEagerRecvs(pool)
+			, mRecvOps(pool)
 		{}
 
 		// the sesssion id of the fork.
@@ -41,27 +45,75 @@ namespace coproto::internal
 		// send messages with our smaller local id.
 		bool mInitiated = false;
 
+		// set once every Socket that refers to this fork has been 
+		// destroyed. No new operations will be started on the fork.
+		bool mClosed = false;
+
+		// set once the close notice for this fork has been queued.
+		bool mCloseQueued = false;
+
+		// set once the remote party has closed the fork. It will not 
+		// send any more messages on it.
+		bool mRemoteClosed = false;
+
+		// set if the remote party closed the fork before it was created 
+		// locally. Cleared once it is.
+		bool mEarlyClosed = false;
+
+		// the number of Socket's that refer to this fork.
+		std::atomic<u64> mRefCount{ 0 };
+
+		// the number of send operations of this fork that are in 
+		// SockScheduler's send list or in mBlockedBegin.
+		u64 mNumSends = 0;
+
+		// with flow control, the number of bytes that may still be sent on
+		// this fork. A message is sent whole as long as some credit is left
+		// so this can be negative. Read without the lock by move sends.
+		std::atomic<i64> mSendCredit{ 0 };
+
+		// with flow control, the number of bytes that the user has received
+		// on this fork and that have not been granted back to the remote party.
+		u64 mUngranted = 0;
+
+		// the send operations that wait for credit or for mFragmentedSend, in
+		// order. They are linked like SockScheduler's send list.
+		SendOperation* mBlockedBegin = nullptr;
+		SendOperation* mBlockedLast = nullptr;
+
+		// with fragmentation, the operation of this fork that is being sent in
+		// fragments and the number of its bytes that have been sent. Later sends
+		// of the fork are blocked until it completes.
+		SendOperation* mFragmentedSend = nullptr;
+		u64 mFragmentSendOffset = 0;
+
+		// the message of this fork that is being received in fragments. If 
+		// mFragmentRecvSize is non-zero, mFragmentRecvOffset of its bytes have
+		// been written to mFragmentDst. mFragmentRecv is the operation that 
+		// receives it or nullptr if it is buffered in mFragmentBuffer or, if 
+		// mFragmentDst is empty, discarded.
+		RecvOperation* mFragmentRecv = nullptr;
+		span<u8> mFragmentDst;
+		std::vector<u8> mFragmentBuffer;
+		u64 mFragmentRecvSize = 0, mFragmentRecvOffset = 0;
+
 		// an optional executor.
 		ExecutorRef mExecutor;
 
 		// a name that can be set for debugging. Not typically used.
 		std::string mName;
 
+		// messages that arrived before the user requested them. Only
+		// used if eager receiving is enabled. If non-empty, there are
+		// no pending recv operations on this fork.
+		Queue<std::vector<u8>, 4> mEagerRecvs;
+
 	private:
 		// the queue of recv operations assoicated with this fork.
+		// Send operations are owned by SockScheduler's send list.
 		Queue<RecvOperation> mRecvOps;
-
-		// the queue of send operations assoicated with this fork.
-		Queue<SendOperation> mSendOps;
 	public:
 
-		template<typename... Args>
-		SendOperation& emplace_send(Lock&, Args&&... args)
-		{
-			mSendOps.emplace_back(std::forward<Args>(args)...);
-			return mSendOps.back();
-		}
-
 		template<typename... Args>
 		RecvOperation& emplace_recv(Lock&, Args&&... args)
 		{
@@ -69,53 +121,40 @@ namespace coproto::internal
 			return mRecvOps.back();
 		}
 
-		template<typename... Args>
-		void pop_front_send(Lock&)
-		{
-			mSendOps.pop_front();
-		}
-
 		template<typename... Args>
 		void pop_front_recv(Lock&)
 		{
 			mRecvOps.pop_front();
 		}
 
-		void erase_send(Lock&, SendOperation* ptr)
-		{
-			mSendOps.erase(ptr);
-		}
-
 		void erase_recv(Lock&, RecvOperation* ptr)
 		{
 			mRecvOps.erase(ptr);
 		}
 
-		auto size_send(Lock&)
-		{
-			return mSendOps.size();
-		}
 		auto size_recv(Lock&)
 		{
 			return mRecvOps.size();
 		}
 
-		auto& front_send(Lock&)
-		{
-			return mSendOps.front();
-		}
 		auto& front_recv(Lock&)
 		{
 			return mRecvOps.front();
 		}
-		auto& back_send(Lock&)
-		{
-			return mSendOps.back();
-		}
 		auto& back_recv(Lock&)
 		{
 			return mRecvOps.back();
 		}
+
+		// the fragmented message has been received or aborted.
+		void endFragmentRecv()
+		{
+			mFragmentRecv = nullptr;
+			mFragmentDst = {};
+			mFragmentBuffer = {};
+			mFragmentRecvSize = 0;
+			mFragmentRecvOffset = 0;
+		}
 	};
 	
 	//inline
@@ -127,29 +166,14 @@ namespace coproto::internal
 	inline void SendOperation::completeOn(ExecutionQueue::Handle& queue, Lock& l)
 	{
 		assert(mCH);
-		queue.push_back(std::exchange(mCH, nullptr), mSocketFork->mExecutor, l);
-		for (auto& f : mFlushes)
-		{
-			if (f.use_count() == 1)
-			{
-				queue.push_back(std::exchange(f->mHandle, nullptr), mSocketFork->mExecutor, l);
-			}
-		}
-		mFlushes.clear();
+		// the fork is not set if it was closed before the operation was started.
+		queue.push_back(std::exchange(mCH, nullptr), mSocketFork ? mSocketFork->mExecutor : ExecutorRef{}, l);
 	}
 
 	inline void RecvOperation::completeOn(ExecutionQueue::Handle& queue, Lock& l)
 	{
 		assert(mCH);
 		queue.push_back(std::exchange(mCH, nullptr), mSocketFork->mExecutor, l);
-		for (auto& f : mFlushes)
-		{
-			if (f.use_count() == 1)
-			{
-				queue.push_back(std::exchange(f->mHandle, nullptr), mSocketFork->mExecutor, l);
-			}
-		}
-		mFlushes.clear();
 	}
 
 	//using SocketForkIter = std::list<SocketFork>::iterator;
@@ -12,24 +12,60 @@
 namespace coproto {
 	namespace internal
 	{
-		coroutine_handle<void> SockScheduler::recv(SessionID id, RecvBuffer* data, coroutine_handle<void> ch, macoro::stop_token&& token)
+		coroutine_handle<void> SockScheduler::recv(SessionID id, RecvBuffer* data, coroutine_handle<void> ch, macoro::stop_token&& token, SocketFork* hint)
 		{
 			ExecutionQueue::Handle exQueue;
 			{
 				Lock l = Lock(mMutex);
 				exQueue = mExQueue.acquire(l);
 
-				auto fork = getLocalSocketFork(id, l);
+				auto fork = getLocalSocketFork(id, hint, l);
 
-				if (mEC)
+				if (fork == nullptr)
+				{
+					// the fork of id has been closed.
+					data->setError(code::closed);
+					exQueue.push_back(ch, {}, l);
+				}
+				else if (mEC)
 				{
 					data->setError(mEC);
 					exQueue.push_back(ch, fork->mExecutor, l);
 				}
+				else if (fork->mEagerRecvs.size())
+				{
+					// the message has already arrived. Complete synchronously.
+					COPROTO_ASSERT(fork->size_recv(l) == 0);
+					auto msg = std::move(fork->mEagerRecvs.front());
+					fork->mEagerRecvs.pop_front();
+					mEagerRecvSize -= msg.size();
+
+					auto buffer = data->asSpan(msg.size());
+					if (buffer.size() != msg.size())
+					{
+						data->setError(code::badBufferSize);
+						cancel(exQueue, Caller::Extern, code::badBufferSize, l);
+					}
+					else
+					{
+						std::memcpy(buffer.data(), msg.data(), msg.size());
+						grantCredit(*fork, msg.size(), exQueue, l);
+					}
+					recycleEagerBuffer(std::move(msg), l);
+
+					exQueue.push_back(ch, fork->mExecutor, l);
+				}
+				else if (fork->mRemoteClosed)
+				{
+					// no more messages will arrive on this fork.
+					data->setError(code::remoteClosed);
+					exQueue.push_back(ch, fork->mExecutor, l);
+				}
 				else
 				{
 					++mNumRecvs;
 					auto& op = fork->emplace_recv(l, *data, ch, fork);
+					op.setSeq(mFlushQueue.registerOp(l));
 
 					// if this is only recv op, we need to resume the recv task
 					if (mAnyRecvOp)
@@ -67,7 +103,10 @@ namespace coproto {
 								--mNumRecvs;
 								opPtr->setError(code::operation_aborted);
 								opPtr->completeOn(exQueue, l);
-								opPtr->fork().erase_recv(l, opPtr);
+								auto& fork = opPtr->fork();
+								mFlushQueue.complete(opPtr->seq(), fork.mExecutor, exQueue, l);
+								fork.erase_recv(l, opPtr);
+								reclaimFork(fork, exQueue, l);
 							}
 							else
 							{
@@ -75,9 +114,7 @@ namespace coproto {
 								opPtr->setStatus(RecvOperation::Status::Canceling);
 								// the operation is in progress, call cancel.
 								if (cancelSrc.stop_possible())
-									exQueue.push_back_fn([cancelSrc = std::move(mRecvCancelSrc)]() mutable {
-									cancelSrc.request_stop();
-										}, l);
+									exQueue.push_back_stop(std::move(mRecvCancelSrc), l);
 							}
 						}
 						exQueue.run();
@@ -89,41 +126,45 @@ namespace coproto {
 			return exQueue.runReturnLast();
 		}
 
-		SessionID SockScheduler::fork(SessionID s)
+		SocketFork* SockScheduler::fork(const SessionID& s, SocketFork* hint)
 		{
 			Lock l(mMutex);
-			auto slot = getLocalSocketFork(s, l);
+			auto slot = getLocalSocketFork(s, hint, l);
+			if (slot == nullptr)
+				throw std::runtime_error("can not fork a socket whose fork has been closed. " COPROTO_LOCATION);
 			auto s2 = slot->mSessionID.derive();
-			initLocalSocketFork(s2, slot->mExecutor, l);
-			return s2;
+			return initLocalSocketFork(s2, slot->mExecutor, l);
 		}
 
-		void SockScheduler::initLocalSocketFork(const SessionID& id, const ExecutorRef& ex, Lock& _)
+		SocketFork* SockScheduler::initLocalSocketFork(const SessionID& id, const ExecutorRef& ex, Lock& _)
 		{
-			auto iter = mIdSocketForkMapping_.find(id);
-			if (iter == mIdSocketForkMapping_.end())
+			// If we have already received a message for this slot
+			// it will already exist and have a local id.
+			auto fork = mForks.find(id);
+			if (fork == nullptr)
 			{
 				// We have initialized the slot before receiving any messages.
-				mSocketForks_.emplace_back(id);
-				auto slot = --mSocketForks_.end();
-				iter = mIdSocketForkMapping_.insert({ id, slot }).first;
+				fork = &emplaceFork(id, _);
 			}
-			else
+			else if (fork->mEarlyClosed)
 			{
-				// We have already received a message for this slot.
-				// assign its local id.
-				COPROTO_ASSERT(~iter->second->mLocalId == 0);
+				fork->mEarlyClosed = false;
+				--mNumEarlyClosed;
 			}
 
-			iter->second->mLocalId = mNextLocalSocketFork++;
-			iter->second->mExecutor = ex;
+			COPROTO_ASSERT(fork->mClosed == false);
+			fork->mExecutor = ex;
+			return fork;
 		}
 
 		SocketForkIter SockScheduler::getLocalSocketFork(const SessionID& id, Lock& _)
 		{
-			auto iter = mIdSocketForkMapping_.find(id);
-			COPROTO_ASSERT(iter != mIdSocketForkMapping_.end() && iter->second->mLocalId != 0);
-			return iter->second;
+			// a Socket whose mId was set directly does not keep the fork 
+			// open. Once the fork is closed, it can no longer be used.
+			auto fork = mForks.find(id);
+			if (fork && fork->mClosed)
+				return nullptr;
+			return fork;
 		}
 
 		error_code SockScheduler::initRemoteSocketFork(u32 slotId, SessionID id, Lock& _)
@@ -131,46 +172,575 @@ namespace coproto {
 			if (slotId == ~u32(0))
 				return code::badCoprotoMessageHeader;
 
-			auto iter = mIdSocketForkMapping_.find(id);
-			SocketForkIter slot;
-			if (iter == mIdSocketForkMapping_.end())
-			{
-				mSocketForks_.emplace_back(id);
-				slot = --mSocketForks_.end();
-				iter = mIdSocketForkMapping_.insert({ id, slot }).first;
+			auto slot = mForks.find(id);
+			if (slot == nullptr)
+				slot = &emplaceFork(id, _);
 
-			}
-			else
-				slot = iter->second;
-
-			if (slot->mRemoteId != ~u32(0))
+			if (slot->mRemoteId != ~u32(0) || mForks.findRemote(slotId))
 				return code::badCoprotoMessageHeader;
 
 			COPROTO_ASSERT(slot->mSessionID == id);
-			COPROTO_ASSERT(mRemoteSocketForkMapping_.find(slotId) == mRemoteSocketForkMapping_.end());
 			slot->mRemoteId = slotId;
-			mRemoteSocketForkMapping_.insert({ slotId, slot });
+			mForks.setRemote(slotId, *slot);
 
 			return {};
 		}
 
-		coroutine_handle<> SockScheduler::flush(coroutine_handle<> h)
+		error_code SockScheduler::closeRemoteSocketFork(u32 slotId, SessionID id)
+		{
+			error_code ec;
+			ExecutionQueue::Handle queue;
+			{
+				Lock l(mMutex);
+				queue = mExQueue.acquire(l);
+
+				auto fork = mForks.find(id);
+
+				// the remote party closed the fork before it was created locally. 
+				// Keep it so that it is known to be closed once it is. The session
+				// id might never be created so only a limited number are kept.
+				if (fork == nullptr && slotId == ~u32(0) && mNumEarlyClosed < MaxEarlyClosedForks)
+				{
+					fork = &emplaceFork(id, l);
+					fork->mEarlyClosed = true;
+					++mNumEarlyClosed;
+				}
+
+				if (fork == nullptr || fork->mRemoteClosed || fork->mRemoteId != slotId)
+					ec = code::badCoprotoMessageHeader;
+				else
+				{
+					fork->mRemoteClosed = true;
+					if (slotId != ~u32(0))
+					{
+						mForks.clearRemote(slotId);
+						fork->mRemoteId = ~u32(0);
+					}
+
+					// nothing more will arrive for the pending receives.
+					while (fork->size_recv(l))
+					{
+						auto& op = fork->front_recv(l);
+						COPROTO_ASSERT(op.status() == RecvOperation::Status::NotStarted);
+						op.setError(code::remoteClosed);
+						op.completeOn(queue, l);
+						mFlushQueue.complete(op.seq(), fork->mExecutor, queue, l);
+						fork->pop_front_recv(l);
+						--mNumRecvs;
+					}
+
+					// the remote party discards anything else that is sent
+					// on the fork, so its sends no longer need credit.
+					releaseBlockedSends(*fork, queue, l);
+					reclaimFork(*fork, queue, l);
+				}
+			}
+
+			queue.run();
+			return ec;
+		}
+
+		void SockScheduler::closeFork(SocketFork* fork)
+		{
+			ExecutionQueue::Handle queue;
+			{
+				Lock l(mMutex);
+				queue = mExQueue.acquire(l);
+				COPROTO_ASSERT(fork->mClosed == false);
+
+				// any buffered sends of the fork must be counted before 
+				// it is closed. Later operations on the fork fail.
+				appendSubmitted(mSubmitQueue.popAll(), queue, l);
+				fork->mClosed = true;
+
+				// messages that arrived early can no longer be received.
+				while (fork->mEagerRecvs.size())
+				{
+					auto& msg = fork->mEagerRecvs.front();
+					mEagerRecvSize -= msg.size();
+					grantCredit(*fork, msg.size(), queue, l);
+					recycleEagerBuffer(std::move(msg), l);
+					fork->mEagerRecvs.pop_front();
+				}
+
+				if (!mEC)
+				{
+					// the receive task is waiting for a recv on this fork. It 
+					// should now read and discard the message.
+					if (mGetRequestedRecvSocketFork &&
+						fork->mRemoteId == mGetRequestedRecvSocketFork->forkID() &&
+						fork->size_recv(l) == 0)
+					{
+						COPROTO_ASSERT(mRecvStatus == Status::RequestedRecvOp);
+						mRecvStatus = Status::InUse;
+						mEagerRecvSize += mGetRequestedRecvSocketFork->size();
+						queue.push_back(mGetRequestedRecvSocketFork->getHandle(
+							macoro::Ok(static_cast<RecvOperation*>(nullptr)), mGetRequestedRecvSocketFork), {}, l);
+					}
+
+					reclaimFork(*fork, queue, l);
+				}
+			}
+
+			queue.run();
+		}
+
+		void SockScheduler::reclaimFork(SocketFork& fork, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			if (fork.mClosed == false || fork.mNumSends || mEC)
+				return;
+
+			if (fork.mCloseQueued == false)
+			{
+				fork.mCloseQueued = true;
+
+				// the remote party only knows our id if we have sent it.
+				SendControlBlock notice;
+				notice.mHeader.mForkId = fork.mInitiated ? fork.mLocalId : ~u32(0);
+				notice.setType(ControlBlock::Type::CloseSocketFork);
+				notice.mCtrlBlk.setSessionID(fork.mSessionID);
+				queueControlFrame(notice, queue, l);
+			}
+
+			// the close notice is ahead of any message that will reuse 
+			// the local id so the fork can now be freed.
+			if (fork.mRemoteClosed && fork.size_recv(l) == 0)
+				mForks.erase(fork);
+		}
+
+		void SockScheduler::enableReadAhead(u64 capacity)
 		{
 			Lock l(mMutex);
-			if (mNumRecvs == 0 && mSendBufferBegin == nullptr)
-				return h;
+			if (mRecvSomeSupported == false)
+				throw std::runtime_error("read-ahead requires the socket to implement recvSome(...). " COPROTO_LOCATION);
+			if (mRecvStatus != Status::Idle || mBytesReceived)
+				throw std::runtime_error("read-ahead must be enabled before the first receive. " COPROTO_LOCATION);
+			if (capacity < sizeof(Header) + sizeof(ControlBlock))
+				throw std::runtime_error("read-ahead capacity is too small. " COPROTO_LOCATION);
+
+			mReadAhead.mData.resize(capacity);
+		}
 
-			auto f = std::make_shared<FlushToken>(h);
+		void SockScheduler::enableEagerRecv(u64 capacity)
+		{
+			Lock l(mMutex);
+			mEagerRecvCapacity = capacity;
+			while (mEagerBufferPoolSize > mEagerRecvCapacity)
+			{
+				mEagerBufferPoolSize -= mEagerBufferPool.back().capacity();
+				mEagerBufferPool.pop_back();
+			}
+		}
+
+		void SockScheduler::enableSendCoalescing(u64 maxSize)
+		{
+			Lock l(mMutex);
+			mCoalesceSize = maxSize;
+		}
 
-			for (auto& slot : mSocketForks_)
+		void SockScheduler::setOperationCacheCapacity(u64 bytes)
+		{
+			Lock l(mMutex);
+			mBlockPool.setRetainedCapacity(bytes);
+			mSendOpPool.setRetainedCapacity(bytes);
+		}
+
+		u64 SockScheduler::operationCacheHighWaterMark()
+		{
+			Lock l(mMutex);
+			return mBlockPool.highWaterMark() + mSendOpPool.highWaterMark();
+		}
+
+		void SockScheduler::enableFlowControl(u64 window)
+		{
+			Lock l(mMutex);
+			if (window == 0 || window > (1ull << 62))
+				throw std::runtime_error("flow control window is out of range. " COPROTO_LOCATION);
+			if (mBytesSent || mBytesReceived || mSendBufferBegin || mNumRecvs)
+				throw std::runtime_error("flow control must be enabled before anything is sent or received. " COPROTO_LOCATION);
+
+			mFlowWindow = window;
+			for (u64 i = 0; i < mForks.size(); ++i)
+			{
+				if (mForks.slot(i).has_value())
+					mForks[i].mSendCredit.store(static_cast<i64>(window), std::memory_order_relaxed);
+			}
+		}
+
+		void SockScheduler::enableFragmentation(u64 fragmentSize)
+		{
+			Lock l(mMutex);
+			if (fragmentSize == 0 || fragmentSize >= std::numeric_limits<u32>::max())
+				throw std::runtime_error("fragment size is out of range. " COPROTO_LOCATION);
+			if (mBytesSent || mSendBufferBegin || mNumBlockedSends)
+				throw std::runtime_error("fragmentation must be enabled before anything is sent. " COPROTO_LOCATION);
+
+			mFragmentSize = fragmentSize;
+		}
+
+		void SockScheduler::setSendBufferCapacity(u64 bytes)
+		{
+			mSendBufferCapacity.store(bytes, std::memory_order_relaxed);
+		}
+
+		bool SockScheduler::reserveBufferedSend(u64 size, const SessionID& id, SocketFork* fork)
+		{
+			// the fork is out of credit. The caller waits until the 
+			// message is written, which waits for the remote party.
+			if (mFlowWindow && fork && fork->mSessionID == id &&
+				fork->mSendCredit.load(std::memory_order_relaxed) <= 0)
+				return false;
+
+			auto capacity = mSendBufferCapacity.load(std::memory_order_relaxed);
+			auto cur = mBufferedSendBytes.load(std::memory_order_relaxed);
+			do {
+				if (cur + size > capacity || cur + size < cur)
+					return false;
+			} while (!mBufferedSendBytes.compare_exchange_weak(cur, cur + size, std::memory_order_relaxed));
+
+			return true;
+		}
+
+		void SockScheduler::releaseBlockedSends(SocketFork& fork, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			bool released = false;
+			while (fork.mBlockedBegin && fork.mFragmentedSend == nullptr && (
+				mFlowWindow == 0 ||
+				fork.mRemoteClosed ||
+				fork.mSendCredit.load(std::memory_order_relaxed) > 0))
+			{
+				auto& op = *fork.mBlockedBegin;
+				fork.mBlockedBegin = op.next();
+				if (fork.mBlockedBegin == nullptr)
+					fork.mBlockedLast = nullptr;
+				op.unlink();
+				--mNumBlockedSends;
+
+				COPROTO_ASSERT(op.status() == SendOperation::Status::Blocked);
+				op.setStatus(SendOperation::Status::NotStarted);
+				admitSend(op, l);
+				released = true;
+			}
+
+			// the send task might be waiting for work.
+			if (released && mSubmitQueue.tryUnpark(false))
+				queue.push_back(mNextSendOp->getHandle(macoro::Ok(static_cast<SendOperation*>(nullptr)), mNextSendOp), {}, l);
+		}
+
+		void SockScheduler::admitSend(SendOperation& op, Lock& l)
+		{
+			auto& fork = op.fork();
+			auto size = op.asSpan().size();
+			if (mFlowWindow)
+				fork.mSendCredit.fetch_sub(static_cast<i64>(size), std::memory_order_relaxed);
+
+			// once the socket has failed, the operation is not sent.
+			if (mFragmentSize && size > mFragmentSize && !mEC)
+			{
+				COPROTO_ASSERT(fork.mFragmentedSend == nullptr);
+				fork.mFragmentedSend = &op;
+				fork.mFragmentSendOffset = 0;
+			}
+			pushSend(op, l);
+		}
+
+		void SockScheduler::endFragmentedSend(SocketFork& fork, bool aborted, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			COPROTO_ASSERT(fork.mFragmentedSend);
+			if (aborted && fork.mFragmentSendOffset)
 			{
-				if (slot.size_recv(l))
-					slot.back_recv(l).addFlush(f, l);
-				if (slot.size_send(l))
-					slot.back_send(l).addFlush(f, l); 
+				SendControlBlock abort;
+				abort.mHeader.mForkId = fork.mLocalId;
+				abort.setType(ControlBlock::Type::MessageAbort);
+				abort.mCtrlBlk.data = {};
+				queueControlFrame(abort, queue, l);
 			}
 
-			return macoro::noop_coroutine();
+			fork.mFragmentedSend = nullptr;
+			fork.mFragmentSendOffset = 0;
+			releaseBlockedSends(fork, queue, l);
+		}
+
+		error_code SockScheduler::abortFragmentRecv(u32 remoteForkId)
+		{
+			error_code ec;
+			ExecutionQueue::Handle queue;
+			{
+				Lock l(mMutex);
+				queue = mExQueue.acquire(l);
+
+				auto fork = mForks.findRemote(remoteForkId);
+				if (fork == nullptr || fork->mFragmentRecvSize == 0)
+					ec = code::badCoprotoMessageHeader;
+				else
+				{
+					if (auto op = fork->mFragmentRecv)
+					{
+						COPROTO_ASSERT(&fork->front_recv(l) == op);
+						op->setError(code::remoteCancel);
+						op->completeOn(queue, l);
+						mFlushQueue.complete(op->seq(), fork->mExecutor, queue, l);
+						fork->pop_front_recv(l);
+						--mNumRecvs;
+					}
+					else
+						mEagerRecvSize -= fork->mFragmentRecvSize;
+
+					// the sender was charged for the whole message.
+					grantCredit(*fork, fork->mFragmentRecvSize, queue, l);
+					fork->endFragmentRecv();
+					reclaimFork(*fork, queue, l);
+				}
+			}
+
+			queue.run();
+			return ec;
+		}
+
+		error_code SockScheduler::addSendCredit(u32 localId, u64 credit)
+		{
+			error_code ec;
+			ExecutionQueue::Handle queue;
+			{
+				Lock l(mMutex);
+				queue = mExQueue.acquire(l);
+
+				// the remote party only grants credit for a fork that it
+				// has received on. The fork is not freed before it has 
+				// received the close notice, which follows any grant.
+				auto fork = mForks.findLocal(localId);
+				if (fork == nullptr || mFlowWindow == 0)
+					ec = code::badCoprotoMessageHeader;
+				else
+				{
+					fork->mSendCredit.fetch_add(static_cast<i64>(credit), std::memory_order_relaxed);
+					releaseBlockedSends(*fork, queue, l);
+				}
+			}
+
+			queue.run();
+			return ec;
+		}
+
+		void SockScheduler::grantCredit(SocketFork& fork, u64 size, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			if (mFlowWindow == 0)
+				return;
+
+			fork.mUngranted += size;
+
+			// after the close notice, the remote party does not 
+			// use the credit. It might also have freed the fork.
+			if (fork.mUngranted < std::max<u64>(mFlowWindow / 2, 1) ||
+				fork.mCloseQueued ||
+				fork.mRemoteId == ~u32(0) ||
+				mEC)
+				return;
+
+			SendControlBlock grant;
+			grant.mHeader.mForkId = fork.mRemoteId;
+			grant.setType(ControlBlock::Type::SocketForkCredit);
+			grant.mCtrlBlk.setCredit(std::exchange(fork.mUngranted, 0));
+			queueControlFrame(grant, queue, l);
+		}
+
+		void SockScheduler::queueControlFrame(const SendControlBlock& frame, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			mPendingControlFrames.push_back(frame);
+
+			// the remote party might be waiting for this frame and the 
+			// socket might stay idle. If so, send it on its own.
+			if (mSubmitQueue.tryUnpark(false))
+				queue.push_back(mNextSendOp->getHandle(macoro::Ok(static_cast<SendOperation*>(nullptr)), mNextSendOp), {}, l);
+		}
+
+		SendOperation* SockScheduler::coalesceSends(SendOperation* op, std::vector<u8>& buffer)
+		{
+			Lock l(mMutex);
+			COPROTO_ASSERT(mSendBufferBegin == op);
+			buffer.clear();
+
+			// nothing to coalesce with.
+			if (op->next() == nullptr)
+				return nullptr;
+
+			// the control blocks go first.
+			takeControlFrames(l);
+			buffer.resize(mControlFrames.size() * sizeof(SendControlBlock));
+			if (buffer.size())
+				std::memcpy(buffer.data(), mControlFrames.data(), buffer.size());
+
+			SendOperation* last = nullptr;
+			for (auto iter = op; iter; iter = iter->next())
+			{
+				auto& fork = iter->fork();
+				auto data = iter->asSpan();
+				auto frameSize = sizeof(Header) + data.size();
+				if (fork.mInitiated == false)
+					frameSize += sizeof(SendControlBlock);
+
+				// fragmented messages are sent one fragment at a time.
+				if (buffer.size() + frameSize > mCoalesceSize ||
+					fork.mFragmentedSend == iter)
+					break;
+
+				if (iter != op)
+				{
+					COPROTO_ASSERT(iter->status() == SendOperation::Status::NotStarted);
+					iter->setStatus(SendOperation::Status::InProgress);
+				}
+
+				auto size = buffer.size();
+				buffer.resize(size + frameSize);
+				auto dst = buffer.data() + size;
+
+				if (fork.mInitiated == false)
+				{
+					fork.mInitiated = true;
+					SendControlBlock meta;
+					meta.mHeader.mForkId = fork.mLocalId;
+					meta.setType(ControlBlock::Type::NewSocketFork);
+					meta.mCtrlBlk.setSessionID(fork.mSessionID);
+
+					std::memcpy(dst, &meta, sizeof(meta));
+					dst += sizeof(meta);
+				}
+
+				Header header;
+				header.mSize = static_cast<u32>(data.size());
+				header.mForkId = fork.mLocalId;
+				std::memcpy(dst, &header, sizeof(header));
+				dst += sizeof(header);
+				std::memcpy(dst, data.data(), data.size());
+
+				last = iter;
+			}
+
+			if (last == nullptr)
+				buffer.clear();
+
+			return last;
+		}
+
+		RecvOperation* SockScheduler::completeEagerRecv(u32 remoteForkId, std::vector<u8>& msg, error_code& ec, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			auto forkPtr = mForks.findRemote(remoteForkId);
+			COPROTO_ASSERT(forkPtr);
+			auto& fork = *forkPtr;
+
+			if (fork.size_recv(l) == 0 && fork.mClosed)
+			{
+				// the fork was closed, discard the message.
+				mEagerRecvSize -= msg.size();
+				grantCredit(fork, msg.size(), queue, l);
+				return nullptr;
+			}
+
+			if (fork.size_recv(l) == 0)
+			{
+				fork.mEagerRecvs.push_back(std::move(msg));
+				return nullptr;
+			}
+
+			// a recv was requested while the message was being read.
+			COPROTO_ASSERT(fork.mEagerRecvs.size() == 0);
+			mEagerRecvSize -= msg.size();
+
+			auto& op = fork.front_recv(l);
+			op.setStatus(RecvOperation::Status::InProgress);
+			auto buffer = op.asSpan(msg.size());
+			if (buffer.size() != msg.size())
+				ec = code::badBufferSize;
+			else
+				std::memcpy(buffer.data(), msg.data(), msg.size());
+
+			return &op;
+		}
+
+		void SockScheduler::recycleEagerBuffer(std::vector<u8>&& buffer, Lock&)
+		{
+			if (mEagerBufferPoolSize + buffer.capacity() <= mEagerRecvCapacity)
+			{
+				mEagerBufferPoolSize += buffer.capacity();
+				mEagerBufferPool.push_back(std::move(buffer));
+			}
+		}
+
+		void SockScheduler::reuseEagerBuffer(std::vector<u8>& buffer, Lock&)
+		{
+			if (buffer.capacity() == 0 && mEagerBufferPool.size())
+			{
+				buffer = std::move(mEagerBufferPool.back());
+				mEagerBufferPool.pop_back();
+				mEagerBufferPoolSize -= buffer.capacity();
+			}
+		}
+
+		void SockScheduler::appendSubmitted(SendOperation* ops, ExecutionQueue::Handle& queue, Lock& l)
+		{
+			while (ops)
+			{
+				auto& op = *ops;
+				ops = op.next();
+				op.setNext(nullptr);
+				auto forkPtr = getLocalSocketFork(op.sessionID(), op.forkHint(), l);
+				op.setFork(forkPtr);
+
+				if (op.status() == SendOperation::Status::Aborted || forkPtr == nullptr)
+				{
+					// canceled while pending or the fork has been closed.
+					op.setError(forkPtr ? code::operation_aborted : code::closed);
+					op.completeOn(queue, l);
+					destroySendOp(&op);
+					continue;
+				}
+
+				COPROTO_ASSERT(op.status() == SendOperation::Status::Pending);
+				op.setStatus(SendOperation::Status::NotStarted);
+				op.setSeq(mFlushQueue.registerOp(l));
+				auto& fork = op.fork();
+				++fork.mNumSends;
+
+				if (!mEC && (fork.mBlockedBegin || fork.mFragmentedSend || (
+					mFlowWindow && !fork.mRemoteClosed && 
+					fork.mSendCredit.load(std::memory_order_relaxed) <= 0)))
+				{
+					// wait for the remote party to grant credit or for the 
+					// fork's fragmented send to complete.
+					op.setStatus(SendOperation::Status::Blocked);
+					if (fork.mBlockedLast)
+						fork.mBlockedLast->setNext(&op);
+					else
+						fork.mBlockedBegin = &op;
+					fork.mBlockedLast = &op;
+					++mNumBlockedSends;
+
+					// the credit is read by the receive task.
+					if (mFlowWindow && mAnyRecvOp)
+					{
+						COPROTO_ASSERT(mRecvStatus == Status::Idle);
+						mRecvStatus = Status::InUse;
+						queue.push_back(mAnyRecvOp->getHandle(code::success, mAnyRecvOp), {}, l);
+					}
+					continue;
+				}
+
+				admitSend(op, l);
+			}
+		}
+
+		coroutine_handle<> SockScheduler::flush(coroutine_handle<> h)
+		{
+			ExecutionQueue::Handle queue;
+			{
+				Lock l(mMutex);
+				queue = mExQueue.acquire(l);
+				appendSubmitted(mSubmitQueue.popAll(), queue, l);
+
+				mFlushQueue.flush(h, queue, l);
+			}
+
+			return queue.runReturnLast();
 		}
 
 		void SockScheduler::cancel(
@@ -207,8 +777,10 @@ namespace coproto {
 					queue.push_back(mGetRequestedRecvSocketFork->getHandle(macoro::Err(e), mGetRequestedRecvSocketFork), {}, l);
 				}
 
-				if (mNextSendOp)
+				if (mSubmitQueue.tryUnpark(true))
 				{
+					// the send task was waiting for work. It will now exit
+					// and no more operations will be accepted.
 					queue.push_back(mNextSendOp->getHandle(macoro::Err(error_code(code::cancel)), mNextSendOp), {}, l);
 				}
 			}
@@ -216,22 +788,46 @@ namespace coproto {
 			if (c == Caller::Sender)
 			{
 				mSendStatus = Status::Closed;
-				auto iter = mSendBufferBegin;
-				mSendBufferBegin = nullptr;
-				mSendBufferLast = nullptr;
+
+				// stop accepting new operations and fail the ones
+				// that are still queued.
+				appendSubmitted(mSubmitQueue.close(), queue, l);
 				SEND_LOG("close", 0, {});
 
-				while (iter)
+				auto failSends = [&](SendOperation* iter) {
+					while (iter)
+					{
+						auto& op = *iter;
+						assert(
+							op.status() == SendOperation::Status::NotStarted ||
+							op.status() == SendOperation::Status::Blocked);
+
+						op.setError(std::exchange(ec, code::cancel));
+						op.completeOn(queue, l);
+						mFlushQueue.complete(op.seq(), op.fork().mExecutor, queue, l);
+						--op.fork().mNumSends;
+						if (op.fork().mFragmentedSend == &op)
+							op.fork().mFragmentedSend = nullptr;
+						iter = op.next();
+						op.unlink();
+						destroySendOp(&op);
+					}
+				};
+
+				failSends(std::exchange(mSendBufferBegin, nullptr));
+				mSendBufferLast = nullptr;
+
+				// the sends that were waiting for credit or a fragmented send.
+				for (u64 i = 0; mNumBlockedSends && i < mForks.size(); ++i)
 				{
-					auto& op = *iter;
-					assert(op.status() == SendOperation::Status::NotStarted);
-					assert(&op == &op.fork().front_send(l));
+					if (mForks.slot(i).has_value() == false)
+						continue;
 
-					op.setError(std::exchange(ec, code::cancel));
-					op.completeOn(queue, l);
-					iter = op.next();
-					op.fork().pop_front_send(l);
+					auto& fork = mForks[i];
+					failSends(std::exchange(fork.mBlockedBegin, nullptr));
+					fork.mBlockedLast = nullptr;
 				}
+				mNumBlockedSends = 0;
 			}
 			else
 			{
@@ -242,13 +838,18 @@ namespace coproto {
 			{
 				RECV_LOG("close", 0, {});
 				mRecvStatus = Status::Closed;
-				for (auto& fork : mSocketForks_)
+				for (u64 i = 0; i < mForks.size(); ++i)
 				{
+					if (mForks.slot(i).has_value() == false)
+						continue;
+
+					auto& fork = mForks[i];
 					while (fork.size_recv(l))
 					{
 						auto& op = fork.front_recv(l);
 						op.setError(std::exchange(ec, code::cancel));
 						op.completeOn(queue, l);
+						mFlushQueue.complete(op.seq(), op.fork().mExecutor, queue, l);
 						fork.pop_front_recv(l);
 					}
 				}
@@ -27,9 +27,12 @@
 #include "coproto/Socket/SendOperation.h"
 #include "coproto/Socket/RecvOperation.h"
 #include "coproto/Socket/SocketFork.h"
+#include "coproto/Socket/ForkTable.h"
+#include "coproto/Socket/FlushQueue.h"
 #include "macoro/result.h"
 #include "coproto/Common/Exceptions.h"
 #include <cstring>
+#include <exception>
 
 #ifdef COPROTO_SOCK_LOGGING
 #define RECV_LOG(X, S, M) if(mLogging) mRecvLog.push_back(SockScheduler::LogEntry{X, S, M});
@@ -56,47 +59,433 @@ namespace coproto
 
 			// the fork id of the sending party.
 			u32 mForkId;
+
+			// sizes from this on announce a control block, as does zero. 
+			// Messages must therefore be smaller.
+			static constexpr u32 ControlSize = ~u32(0) - 15;
+
+			bool isControl() const { return mSize == 0 || mSize >= ControlSize; }
 		};
 
-		// a struct meant to encode various meta data.
-		// right now the only thing its is used for is
-		// sending the SessionId -> remoteID mapping.
+		// a struct meant to encode various meta data. It is
+		// used to send the SessionId -> remoteID mapping, to
+		// retire a fork, to grant flow control credit and to 
+		// send a large message in fragments.
 		struct ControlBlock
 		{
 			// the data to be sent.
 			std::array<u8, 16> data;
+
+			// the type is encoded in the size of the header that
+			// precedes the block, see SendControlBlock.
 			enum class Type : u8
 			{
-				NewSocketFork = 1
+				NewSocketFork = 1,
+				CloseSocketFork = 2,
+				SocketForkCredit = 3,
+				MessageFragment = 4,
+				MessageAbort = 5
 			};
 
-			Type getType() { return Type::NewSocketFork; }
+			// the type of the block announced by header, which must be a control header.
+			static Type getType(const Header& header) {
+				return header.mSize == 0 ?
+					Type::NewSocketFork :
+					static_cast<Type>(header.mSize - Header::ControlSize);
+			}
+
 			SessionID getSessionID() {
 				SessionID ret;
 				std::memcpy(ret.mVal, data.data(), 16);
 				return ret;
 			}
 
-			void setType(Type t) {};
 			void setSessionID(const SessionID& id) {
 				std::memcpy(data.data(), id.mVal, 16);
 			}
+
+			u64 getCredit() {
+				u64 ret;
+				std::memcpy(&ret, data.data(), sizeof(ret));
+				return ret;
+			}
+
+			void setCredit(u64 credit) {
+				data = {};
+				std::memcpy(data.data(), &credit, sizeof(credit));
+			}
+
+			// the size of the whole message.
+			u64 getFragmentTotal() {
+				u64 ret;
+				std::memcpy(&ret, data.data(), sizeof(ret));
+				return ret;
+			}
+
+			// the size of this fragment.
+			u32 getFragmentSize() {
+				u32 ret;
+				std::memcpy(&ret, data.data() + sizeof(u64), sizeof(ret));
+				return ret;
+			}
+
+			void setFragment(u64 total, u32 size) {
+				data = {};
+				std::memcpy(data.data(), &total, sizeof(total));
+				std::memcpy(data.data() + sizeof(u64), &size, sizeof(size));
+			}
+		};
+
+		// a meta message, see SockScheduler.
+		struct SendControlBlock
+		{
+			Header mHeader;
+			ControlBlock mCtrlBlk;
+
+			// NewSocketFork keeps the original zero size so that
+			// the other types do not change its encoding.
+			void setType(ControlBlock::Type t) {
+				mHeader.mSize = t == ControlBlock::Type::NewSocketFork ?
+					0 : Header::ControlSize + static_cast<u32>(t);
+			}
+		};
+		static_assert(sizeof(SendControlBlock) == sizeof(Header) + sizeof(ControlBlock), "SendControlBlock is sent as is.");
+
+		// detects if Sock has the optional vectored send overload
+		// `send(span<span<u8>>, macoro::stop_token)`.
+		template<typename Sock, typename = void>
+		struct has_vectored_send : false_type
+		{};
+
+		template<typename Sock>
+		struct has_vectored_send<Sock, void_t<
+			decltype(std::declval<Sock&>().send(
+				std::declval<span<span<u8>>>(),
+				std::declval<macoro::stop_token>()))
+			>>
+			: true_type
+		{};
+
+		// detects if Sock has the optional vectored recv overload
+		// `recv(span<span<u8>>, macoro::stop_token)`.
+		template<typename Sock, typename = void>
+		struct has_vectored_recv : false_type
+		{};
+
+		template<typename Sock>
+		struct has_vectored_recv<Sock, void_t<
+			decltype(std::declval<Sock&>().recv(
+				std::declval<span<span<u8>>>(),
+				std::declval<macoro::stop_token>()))
+			>>
+			: true_type
+		{};
+
+		// detects if Sock has the optional `recvSome(span<u8>, macoro::stop_token)`
+		// which completes once some data has been received.
+		template<typename Sock, typename = void>
+		struct has_recv_some : false_type
+		{};
+
+		template<typename Sock>
+		struct has_recv_some<Sock, void_t<
+			decltype(std::declval<Sock&>().recvSome(
+				std::declval<span<u8>>(),
+				std::declval<macoro::stop_token>()))
+			>>
+			: true_type
+		{};
+
+		// A buffer that the receive task reads ahead into. Data is 
+		// appended at mEnd and consumed from mBegin.
+		struct ReadAheadBuffer
+		{
+			std::vector<u8> mData;
+			u64 mBegin = 0, mEnd = 0;
+
+			// the maximum number of bytes that can be buffered.
+			u64 capacity() const { return mData.size(); }
+
+			// the number of buffered bytes.
+			u64 size() const { return mEnd - mBegin; }
+
+			// copy as many bytes as possible into dst. Returns the number copied.
+			u64 pop(span<u8> dst)
+			{
+				auto n = std::min<u64>(size(), dst.size());
+				if (n)
+					std::memcpy(dst.data(), mData.data() + mBegin, n);
+				mBegin += n;
+				if (mBegin == mEnd)
+					mBegin = mEnd = 0;
+				return n;
+			}
+
+			// the free space at the end of the buffer.
+			span<u8> writable()
+			{
+				if (mBegin && mEnd == mData.size())
+				{
+					std::memmove(mData.data(), mData.data() + mBegin, size());
+					mEnd -= mBegin;
+					mBegin = 0;
+				}
+				return span<u8>(mData.data() + mEnd, mData.size() - mEnd);
+			}
+
+			// mark n bytes of writable() as filled.
+			void commit(u64 n)
+			{
+				COPROTO_ASSERT(mEnd + n <= mData.size());
+				mEnd += n;
+			}
+		};
+
+		// Storage for one coroutine frame that is reused by the next frame
+		// once the previous one is destroyed. If the storage is in use, the
+		// frame is allocated on the heap. Each frame is prefixed by a pointer
+		// to the cache that it came from, or null.
+		struct CoroFrameCache
+		{
+			static constexpr u64 PrefixSize = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+			static_assert(PrefixSize >= sizeof(void*), "");
+
+			void* mPtr = nullptr;
+			u64 mSize = 0;
+			bool mInUse = false;
+
+			CoroFrameCache() = default;
+			CoroFrameCache(const CoroFrameCache&) = delete;
+			~CoroFrameCache()
+			{
+				COPROTO_ASSERT(mInUse == false);
+				::operator delete(mPtr);
+			}
+
+			void* allocate(u64 size)
+			{
+				CoroFrameCache* owner = nullptr;
+				u8* ptr;
+				if (mInUse == false)
+				{
+					if (mSize < size + PrefixSize)
+					{
+						::operator delete(mPtr);
+						mPtr = nullptr;
+						mSize = 0;
+						mPtr = ::operator new(size + PrefixSize);
+						mSize = size + PrefixSize;
+					}
+					mInUse = true;
+					owner = this;
+					ptr = (u8*)mPtr;
+				}
+				else
+					ptr = (u8*)::operator new(size + PrefixSize);
+
+				std::memcpy(ptr, &owner, sizeof(owner));
+				return ptr + PrefixSize;
+			}
+
+			static void deallocate(void* frame)
+			{
+				auto ptr = (u8*)frame - PrefixSize;
+				CoroFrameCache* owner;
+				std::memcpy(&owner, ptr, sizeof(owner));
+				if (owner)
+					owner->mInUse = false;
+				else
+					::operator delete(ptr);
+			}
 		};
 
+		// The coroutine returned by SockScheduler::recvData(...). The frame
+		// is allocated from SockScheduler::mRecvFrame so that receiving
+		// does not allocate. It starts when awaited and resumes the awaiter
+		// with the error code and number of bytes received.
+		struct RecvDataTask
+		{
+			struct promise_type
+			{
+				std::pair<error_code, u64> mRes;
+				std::exception_ptr mExcept;
+				std::coroutine_handle<> mContinuation;
+
+				template<typename Scheduler, typename... Args>
+				static void* operator new(std::size_t size, Scheduler& s, Args&...)
+				{
+					return s.mRecvFrame.allocate(size);
+				}
+
+				static void operator delete(void* ptr)
+				{
+					CoroFrameCache::deallocate(ptr);
+				}
+
+				RecvDataTask get_return_object() noexcept
+				{
+					return RecvDataTask(std::coroutine_handle<promise_type>::from_promise(*this));
+				}
+
+				std::suspend_always initial_suspend() noexcept { return {}; }
+
+				struct FinalAwaiter
+				{
+					bool await_ready() noexcept { return false; }
+					std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> h) noexcept
+					{
+						return h.promise().mContinuation;
+					}
+					void await_resume() noexcept {}
+				};
+
+				FinalAwaiter final_suspend() noexcept { return {}; }
+
+				void return_value(std::pair<error_code, u64> res) noexcept { mRes = res; }
+
+				void unhandled_exception() noexcept { mExcept = std::current_exception(); }
+			};
+
+			std::coroutine_handle<promise_type> mHandle;
+
+			explicit RecvDataTask(std::coroutine_handle<promise_type> h) noexcept
+				: mHandle(h)
+			{}
+
+			RecvDataTask(RecvDataTask&& o) noexcept
+				: mHandle(std::exchange(o.mHandle, nullptr))
+			{}
+
+			RecvDataTask& operator=(RecvDataTask&&) = delete;
+
+			~RecvDataTask()
+			{
+				if (mHandle)
+					mHandle.destroy();
+			}
+
+			bool await_ready() noexcept { return false; }
+
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<> h) noexcept
+			{
+				mHandle.promise().mContinuation = h;
+				return mHandle;
+			}
+
+			std::pair<error_code, u64> await_resume()
+			{
+				if (mHandle.promise().mExcept)
+					std::rethrow_exception(mHandle.promise().mExcept);
+				return mHandle.promise().mRes;
+			}
+		};
+
+
+		// A lock-free multi-producer, single-consumer queue of submitted send
+		// operations. Producers push onto an intrusive stack with a CAS and 
+		// the send task takes the whole stack at once. The head can also hold
+		// a marker. Parked means the send task is waiting for work and the 
+		// producer that replaces the marker must wake it. Closed means no more
+		// operations are accepted.
+		struct SendSubmitQueue
+		{
+			enum class PushResult
+			{
+				// the send task is running and will pick up the operation.
+				Queued,
+				// the send task was parked. The caller must wake it.
+				Wake,
+				// the send task has exited. The operation was not queued.
+				Closed
+			};
+
+			std::atomic<SendOperation*> mHead{ nullptr };
+
+			static SendOperation* parked() { return reinterpret_cast<SendOperation*>(std::uintptr_t(1)); }
+			static SendOperation* closed() { return reinterpret_cast<SendOperation*>(std::uintptr_t(2)); }
+
+			PushResult push(SendOperation* op)
+			{
+				auto head = mHead.load(std::memory_order_relaxed);
+				do {
+					if (head == closed())
+						return PushResult::Closed;
+					op->mNext = head == parked() ? nullptr : head;
+				} while (!mHead.compare_exchange_weak(head, op,
+					std::memory_order_acq_rel, std::memory_order_relaxed));
+
+				return head == parked() ? PushResult::Wake : PushResult::Queued;
+			}
+
+			// take all submitted operations. They are returned oldest 
+			// first and linked by SendOperation::next().
+			SendOperation* popAll() { return take(nullptr); }
+
+			// take all submitted operations and stop accepting new ones.
+			SendOperation* close() { return take(closed()); }
+
+			// called by the send task when there is no work. Returns false if 
+			// an operation was submitted in the meantime.
+			bool tryPark()
+			{
+				SendOperation* expected = nullptr;
+				return mHead.compare_exchange_strong(expected, parked(),
+					std::memory_order_release, std::memory_order_relaxed);
+			}
+
+			// if the send task is parked, take the right to wake it. If close
+			// is set, no more operations are accepted afterwards.
+			bool tryUnpark(bool close)
+			{
+				auto expected = parked();
+				return mHead.compare_exchange_strong(expected, close ? closed() : nullptr,
+					std::memory_order_acquire, std::memory_order_relaxed);
+			}
 
-		// an awaiter used to get tne next message to be sent.
+		private:
+			SendOperation* take(SendOperation* replacement)
+			{
+				auto head = mHead.load(std::memory_order_relaxed);
+				do {
+					COPROTO_ASSERT(head != parked() || replacement != closed());
+					if (head == replacement || head == parked() || head == closed())
+						return nullptr;
+				} while (!mHead.compare_exchange_weak(head, replacement,
+					std::memory_order_acquire, std::memory_order_relaxed));
+
+				// the stack is newest first, reverse it.
+				SendOperation* prev = nullptr;
+				while (head)
+				{
+					auto next = head->mNext;
+					head->mNext = prev;
+					prev = head;
+					head = next;
+				}
+				return prev;
+			}
+		};
+
+		// an awaiter used to get tne next message to be sent. The result
+		// is nullptr if the send task was woken by a new submission.
 		struct NextSendOp
 		{
 			NextSendOp(
 				SendOperation* prevOp,
+				SendOperation* prevLast,
 				error_code prevEc,
 				SockScheduler& ss)
 				: mPrevOp(prevOp)
+				, mPrevLast(prevLast)
 				, mPrevEc(prevEc)
 				, mSched(ss) {}
 
 		private:
 			SendOperation* mPrevOp;
+
+			// if several operations were sent together, the last of them. 
+			// mPrevOp, ..., mPrevLast are then completed.
+			SendOperation* mPrevLast;
 			error_code mPrevEc;
 			SockScheduler& mSched;
 			std::coroutine_handle<> mHandle;
@@ -120,14 +509,18 @@ namespace coproto
 
 		struct GetRequestedRecvSocketFork
 		{
-			GetRequestedRecvSocketFork(SockScheduler& ss, u32 remoteForkId)
+			GetRequestedRecvSocketFork(SockScheduler& ss, u32 remoteForkId, u64 size)
 				: mSched(ss)
 				, mRemoteForkId(remoteForkId)
+				, mSize(size)
 			{}
 		private:
 			macoro::result<RecvOperation*, std::error_code> mRes;
 			SockScheduler& mSched;
 			u32 mRemoteForkId;
+
+			// the size of the message that has arrived.
+			u64 mSize;
 			std::coroutine_handle<> mHandle;
 
 		public:
@@ -137,6 +530,11 @@ namespace coproto
 				return mRemoteForkId;
 			}
 
+			u64 size()
+			{
+				return mSize;
+			}
+
 			std::coroutine_handle<> getHandle(
 				macoro::result<RecvOperation*, std::error_code> r,
 				GetRequestedRecvSocketFork*& self);
@@ -156,14 +554,19 @@ namespace coproto
 			AnyRecvOp(
 				RecvOperation* prevOp,
 				error_code prevEc,
+				u64 prevSize,
 				SockScheduler& ss)
 				: mPrevOp(prevOp)
 				, mPrevEc(prevEc)
+				, mPrevSize(prevSize)
 				, mSched(ss) {}
 
 		private:
 			RecvOperation* mPrevOp;
 			error_code mPrevEc;
+
+			// the size of the message that mPrevOp received.
+			u64 mPrevSize;
 			std::optional<error_code> mRes;
 			SockScheduler& mSched;
 			std::coroutine_handle<> mHandle;
@@ -240,21 +643,42 @@ namespace coproto
 		// There are two types of messages:
 		// 
 		// Data - these messages have the format  [msg-size:32, slot-id:32, msg].
-		//   * msg-size is a non-zero 32 bit value denoting the length in bytes of the message.
+		//   * msg-size is a non-zero 32 bit value, smaller than Header::ControlSize, denoting the
+		//     length in bytes of the message.
 		//   * slot-id is a 32 bit value that is used to identify which slot this message corresponds to.
 		//     This id should have previously been initialized, see below.
 		//   * msg is the actual data of the message. This will consist of msg-size bytes.
 		// 
-		// Meta - these messages have the format [ zero:32, slot-id:32, meta-data]. 
+		// Meta - these messages have the format [ type:32, slot-id:32, meta-data]. 
 		//   These messages are used to initialize new slots and other socket internal state.
-		//   * zero is always value 0 and 32 bits long. This allows meta message to be 
-		//     distinguished from data messages, which always start with a non-zero message.
+		//   * type is 0 for NewSocketFork and Header::ControlSize + t for the other types t. Data 
+		//     messages are non-zero and smaller than Header::ControlSize so the two can be 
+		//     distinguished. NewSocketFork has the same encoding as before the other types were
+		//     added. A party without them misreads the other types as data. Both parties must
+		//     therefore use a version that has them once forks are closed, flow control or
+		//     fragmentation are used.
 		//   * slot-id is a 32 bit value to identify the slot-id that this meta message corresponds to.
-		//   * meta-data is the data associated with this meta message. Currently there is only
-		//     one option for this. In particular, the only meta message currently supported is 
-		//     to create a new slot. This is done by sending a new/unused value for slot-id and the have
-		//     meta-data be the 128-bit session ID corresponding to this slot/fork. Note that each party
-		//     may associate a different slot-id with the same session ID. 
+		//   * meta-data is 16 bytes of data. The types are
+		//     - NewSocketFork, creates a new slot. This is done by sending a new/unused value for slot-id 
+		//       and the session ID corresponding to this slot/fork. Note that each party may associate
+		//       a different slot-id with the same session ID. 
+		//     - CloseSocketFork, sent once every Socket for the fork has been destroyed and all of its
+		//       sends are done. The data is the session ID and slot-id is the id being retired or ~0
+		//       if it was never sent. The other party stops delivering to that fork, fails its pending
+		//       receives with remoteClosed and frees the slot once it has closed the fork too. A retired
+		//       slot-id can then be reused by a new NewSocketFork. Messages that arrive on a fork after
+		//       it has been closed locally are read and discarded.
+		//     - SocketForkCredit, only used with flow control. slot-id is the receiver's own id for
+		//       the fork and the data starts with the 64 bit number of bytes that it may send in addition.
+		//     - MessageFragment, only used with fragmentation. The data is the 64 bit size of the whole
+		//       message followed by the 32 bit size of the fragment. The meta message is followed by 
+		//       that many bytes of the message. The fragments of a message are sent in order and no other
+		//       message of the fork is sent in between.
+		//     - MessageAbort, the sender canceled the message that it was sending in fragments. The
+		//       receiver drops what it has received and fails the recv with remoteCancel.
+		//
+		//     Close, credit and abort messages are sent ahead of the next message of any fork. They
+		//     are sent on their own if there is nothing else to send.
 		// 
 		//     Each fork/slot is associated with a unique/random-ish session ID. Instead of sending the 128 bit
 		//     session ID with each message, we associate the session ID with a 32 bit slot-id.
@@ -279,15 +703,25 @@ namespace coproto
 		// an async send still pending. As a workaround, we allow the user to "flush" the 
 		// socket which will suspend the user until all messages have been sent.
 		// 
+		// Optionally, the forks can use credit based flow control, see enableFlowControl(). Each
+		// fork may then have at most a window of bytes sent that the remote user has not received.
+		// The receiver therefore buffers any message that arrives before it is requested and
+		// grants the bytes back once received. Sends on a fork without credit wait in the fork's
+		// blocked list and the receive task keeps reading so that the credit is seen.
+		// 
+		// Optionally, messages larger than a fragment size are sent in fragments, see 
+		// enableFragmentation(). After each fragment the operation is moved to the back 
+		// of the send list so that the messages of other forks are sent in between. The 
+		// receive task writes the fragments directly into the recv buffer.
+		// 
 		// Another complications is that the user can cancel send/recv operations.
 		// In the event that one message is canceled, the user is still allowed to
 		// send and receive messages on the socket. However, in the event that a message
 		// is half sent we are forced to send the whole message because the receiver is 
-		// expecting the whole message. One could partially fix this by breaking messages up  
-		// into small chunks but the implementation does not do this. Instead, if the user
-		// requests a cancel on a send, the operation is immediately canceled (assuming the 
-		// underlaying socket cooperates). Later, if the message was half sent and the user
-		// want to send some other message, the first message must be completed first.
+		// expecting the whole message. Therefore, if the user requests a cancel on a send 
+		// that is being written, the socket is canceled (assuming the underlaying socket 
+		// cooperates) and can no longer be used. With fragmentation, the current fragment
+		// is instead written and the rest of the message is aborted with a MessageAbort.
 		// 
 		struct SockScheduler
 		{
@@ -304,21 +738,24 @@ namespace coproto
 			enum class Caller { Sender, Recver, Extern };
 
 			NextSendOp* mNextSendOp = nullptr;
-			NextSendOp completeOpAndGetNextSend(SendOperation* op, error_code ec)
+			NextSendOp completeOpAndGetNextSend(SendOperation* op, error_code ec, SendOperation* last = nullptr)
 			{
-				return { op, ec, *this };
+				return { op, last, ec, *this };
 			}
 
 			AnyRecvOp* mAnyRecvOp = nullptr;
-			auto completeOpAndWaitForAnyRecv(RecvOperation* prevOp, error_code prevEc) {
-				return AnyRecvOp{ prevOp, prevEc, *this };
+			auto completeOpAndWaitForAnyRecv(RecvOperation* prevOp, error_code prevEc, u64 prevSize) {
+				return AnyRecvOp{ prevOp, prevEc, prevSize, *this };
 			}
 
 
+			// returns the recv operation for the message that has arrived on forkId.
+			// If eager receiving is enabled and the fork has no pending recv,
+			// the result will be nullptr and the message should be buffered.
 			GetRequestedRecvSocketFork* mGetRequestedRecvSocketFork = nullptr;
-			auto getRequestedRecvSocketFork(u32 forkId)
+			auto getRequestedRecvSocketFork(u32 forkId, u64 size)
 			{
-				return GetRequestedRecvSocketFork(*this, forkId);
+				return GetRequestedRecvSocketFork(*this, forkId, size);
 			}
 
 			// a flag indicating if close() has been awaited.
@@ -330,17 +767,12 @@ namespace coproto
 			// storage used to store the socket.
 			AnyNoCopy mSockStorage;
 
-			// The list of forks.
-			std::list<SocketFork> mSocketForks_;
+			// the blocks of the forks' recv queues are allocated from here.
+			// It must outlive mForks.
+			QueueBlockPool mBlockPool;
 
-			// the index of the next local fork id.
-			u32 mNextLocalSocketFork = 1;
-
-			// maps SessionID to slot index.
-			std::unordered_map<SessionID, SocketForkIter> mIdSocketForkMapping_;
-
-			// maps their slot index to SessionID
-			std::unordered_map<u32, SocketForkIter> mRemoteSocketForkMapping_;
+			// The forks, indexed by local id, remote id and SessionID.
+			ForkTable mForks{ &mBlockPool };
 
 			// a mutex used to guard member variables.
 			std::recursive_mutex mMutex;
@@ -349,6 +781,27 @@ namespace coproto
 			SendOperation* mSendBufferBegin = nullptr;
 			SendOperation* mSendBufferLast = nullptr;
 
+			// recycles the storage of completed send operations.
+			SendOperationPool mSendOpPool;
+
+			// newly submitted send operations. These are moved to the
+			// list above by the send task, flush() or cancel().
+			SendSubmitQueue mSubmitQueue;
+
+			// the flush() operations that are waiting on pending operations.
+			FlushQueue mFlushQueue;
+
+			// close notices and credit grants. They are sent ahead of the 
+			// next message or on their own if the send task is idle.
+			std::vector<SendControlBlock> mPendingControlFrames;
+
+			// the control blocks that the send task is currently sending.
+			// Only accessed by the send task.
+			std::vector<SendControlBlock> mControlFrames;
+
+			// set while the send task is writing control blocks on their own.
+			bool mControlSend = false;
+
 			// the current overall error code.
 			error_code mEC;
 
@@ -358,11 +811,60 @@ namespace coproto
 			// the current status of the send coroutine.
 			Status mSendStatus = Status::Idle;
 
+			// true if the socket implements recvSome(...).
+			bool mRecvSomeSupported = false;
+
+			// if enabled, the buffer that headers and small messages
+			// are read into before being copied out.
+			ReadAheadBuffer mReadAhead;
+
+			// if non-zero, queued messages are packed into one write 
+			// of at most this many bytes.
+			u64 mCoalesceSize = 0;
+
+			// the maximum number of bytes that will be buffered for messages
+			// that arrive before they are requested. Zero disables eager receiving.
+			u64 mEagerRecvCapacity = 0;
+
+			// the number of bytes currently buffered in SocketFork::mEagerRecvs.
+			u64 mEagerRecvSize = 0;
+
+			// the buffers of eager messages that have been received by the user.
+			// The receive task reads the next early message into one of these.
+			// Their total capacity is at most mEagerRecvCapacity.
+			std::vector<std::vector<u8>> mEagerBufferPool;
+			u64 mEagerBufferPoolSize = 0;
+
+			// the flow control window of each fork in bytes. Zero disables flow control.
+			u64 mFlowWindow = 0;
+
+			// the number of forks that the remote party closed before they were
+			// created locally, see SocketFork::mEarlyClosed. Their session ids come
+			// from the wire so they are limited to MaxEarlyClosedForks.
+			u64 mNumEarlyClosed = 0;
+			static constexpr u64 MaxEarlyClosedForks = 1 << 16;
+
+			// the number of send operations in the forks' blocked lists.
+			u64 mNumBlockedSends = 0;
+
+			// messages larger than this are sent in fragments of this size.
+			// Zero disables fragmentation.
+			u64 mFragmentSize = 0;
+
+			// the number of bytes of moved send operations that the caller 
+			// no longer waits on, and the limit on this.
+			std::atomic<u64> mBufferedSendBytes{ 0 };
+			std::atomic<u64> mSendBufferCapacity{ ~0ull };
+
 			// metrics, the total number of receive operations
 			u64 mNumRecvs = 0;
 			// metrics, the total number bytes sent and received.
 			u64 mBytesSent = 0, mBytesReceived = 0;
 
+			// the frame of the recvData(...) coroutine that the receive task 
+			// is awaiting. It must outlive mRecvTask.
+			CoroFrameCache mRecvFrame;
+
 			macoro::blocking_task<macoro::task<>> mSendTask;
 			macoro::blocking_task<macoro::task<>> mRecvTask;
 
@@ -408,7 +910,11 @@ namespace coproto
 
 			~SockScheduler()
 			{
-				if (mRecvStatus == Status::InUse || mSendStatus == Status::InUse)
+				// with flow control the tasks might only be reading or writing 
+				// control blocks. Those are stopped by close().
+				auto recvPending = mRecvStatus == Status::InUse && (mFlowWindow == 0 || mNumRecvs);
+				auto sendPending = mSendStatus == Status::InUse && mControlSend == false;
+				if (recvPending || sendPending)
 				{
 					std::cout << "Socket was destroyed with pending operations. "
 						<< "terminate() is being called. Await Socket::flush() "
@@ -441,22 +947,193 @@ namespace coproto
 			template<typename Sock>
 			macoro::task<> receiveDataTask(Sock* socket);
 
+			// receive dst.size() bytes for the receive task. With the read-ahead
+			// buffer, any buffered data is consumed first. Large reads then go 
+			// directly into dst while small reads fill the read-ahead buffer 
+			// using socket->recvSome(...).
+			template<typename Sock>
+			RecvDataTask recvData(Sock* socket, span<u8> dst);
+
+			// Enable the read-ahead buffer with the given capacity. Must be 
+			// called before any data has been received. Throws if the socket
+			// does not implement recvSome(...).
+			void enableReadAhead(u64 capacity);
+
+			// Buffer up to capacity bytes of messages that arrive on a fork before
+			// the user has requested them. Zero disables.
+			void enableEagerRecv(u64 capacity);
+
+			// Pack multiple queued messages into a single write of at most
+			// maxSize bytes. Zero disables.
+			void enableSendCoalescing(u64 maxSize);
+
+			// Keep up to bytes of freed send operations and, separately, 
+			// of freed recv queue blocks for reuse.
+			void setOperationCacheCapacity(u64 bytes);
+
+			// Give each fork a window of window bytes that it may send before the
+			// remote party grants more. Both parties must enable it with the same
+			// window before anything is sent or received.
+			void enableFlowControl(u64 window);
+
+			// Send messages larger than fragmentSize bytes in fragments of that
+			// size. Must be called before anything is sent.
+			void enableFragmentation(u64 fragmentSize);
+
+			// Moved sends complete before they are written as long as at most
+			// bytes of such sends are pending. Others complete once written.
+			void setSendBufferCapacity(u64 bytes);
+
+			// returns true if a moved send of size bytes on fork can complete
+			// before it is written, in which case the bytes are reserved. 
+			// fork is an optional hint as in send(...).
+			bool reserveBufferedSend(u64 size, const SessionID& id, SocketFork* fork);
+
+			// destroy a send operation that has been completed.
+			void destroySendOp(SendOperation* op)
+			{
+				if (op->buffered())
+					mBufferedSendBytes.fetch_sub(op->asSpan().size(), std::memory_order_relaxed);
+				mSendOpPool.destroy(op);
+			}
+
+			// The largest number of bytes of send operations that have been
+			// in use at once plus the same for recv queue blocks.
+			u64 operationCacheHighWaterMark();
+
+			// Starting at op, the head of the send list, write as many whole frames 
+			// (control block, header, body) into buffer as fit in mCoalesceSize. 
+			// The operations that are included are marked as in progress and the
+			// last one is returned. Returns nullptr and leaves buffer empty if op
+			// is the only queued operation or does not fit.
+			SendOperation* coalesceSends(SendOperation* op, std::vector<u8>& buffer);
+
+			// append the operations returned by mSubmitQueue to the send list.
+			// Operations that were canceled while pending are completed. With
+			// flow control, operations of forks without credit are blocked.
+			void appendSubmitted(SendOperation* ops, ExecutionQueue::Handle& queue, Lock& _);
+
+			// append op to the send list.
+			void pushSend(SendOperation& op, Lock&)
+			{
+				if (mSendBufferLast)
+					mSendBufferLast->setNext(&op);
+				else
+					mSendBufferBegin = &op;
+				mSendBufferLast = &op;
+			}
+
+			// move the blocked sends of fork to the send list while it has credit
+			// and is not sending a message in fragments.
+			void releaseBlockedSends(SocketFork& fork, ExecutionQueue::Handle& queue, Lock& _);
+
+			// admit op to the send list. Large operations are marked as the 
+			// fork's fragmented send.
+			void admitSend(SendOperation& op, Lock& _);
+
+			// the fragmented send of fork has been removed from the send list. If it 
+			// was aborted after part of it was sent, the remote party is told to drop it.
+			// The fork's blocked sends are then released.
+			void endFragmentedSend(SocketFork& fork, bool aborted, ExecutionQueue::Handle& queue, Lock& _);
+
+			// the remote party aborted the message that it was sending in fragments
+			// on the fork with remote id remoteForkId.
+			error_code abortFragmentRecv(u32 remoteForkId);
+
+			// the remote party granted credit bytes to the fork with local id localId.
+			error_code addSendCredit(u32 localId, u64 credit);
+
+			// the user has received size bytes on fork. With flow control, they
+			// are granted back to the remote party once half a window is reached.
+			void grantCredit(SocketFork& fork, u64 size, ExecutionQueue::Handle& queue, Lock& _);
+
+			// queue a control block to be sent. With flow control, the send task
+			// is woken so that it is sent even if no message follows.
+			void queueControlFrame(const SendControlBlock& frame, ExecutionQueue::Handle& queue, Lock& _);
+
+			// The receive task has buffered msg for remoteForkId. If a recv has since
+			// been requested, msg is copied into it and the operation is returned. 
+			// Otherwise the message is queued on the fork and nullptr is returned.
+			RecvOperation* completeEagerRecv(u32 remoteForkId, std::vector<u8>& msg, error_code& ec, ExecutionQueue::Handle& queue, Lock& _);
+
+			// keep a consumed eager message buffer for reuse, see mEagerBufferPool.
+			void recycleEagerBuffer(std::vector<u8>&& buffer, Lock& _);
+
+			// if buffer has been handed to a fork, replace it with a recycled one.
+			void reuseEagerBuffer(std::vector<u8>& buffer, Lock& _);
+
+			// returns the fork with session id, id, or nullptr if it does
+			// not exist or has been closed.
 			SocketForkIter getLocalSocketFork(const SessionID& id, Lock& _);
 
-			void initLocalSocketFork(const SessionID& id, const ExecutorRef& ex, Lock& _);
+			// returns hint if it is the fork for id, otherwise looks id up.
+			SocketForkIter getLocalSocketFork(const SessionID& id, SocketFork* hint, Lock& _)
+			{
+				if (hint && hint->mSessionID == id)
+					return hint;
+				return getLocalSocketFork(id, _);
+			}
+
+			// returns the fork with session id, id. 
+			SocketFork* getFork(const SessionID& id)
+			{
+				Lock l(mMutex);
+				return getLocalSocketFork(id, l);
+			}
+
+			// add a fork with its initial credit.
+			SocketFork& emplaceFork(const SessionID& id, Lock&)
+			{
+				auto& fork = mForks.emplace(id);
+				fork.mSendCredit.store(static_cast<i64>(mFlowWindow), std::memory_order_relaxed);
+				return fork;
+			}
+
+			SocketFork* initLocalSocketFork(const SessionID& id, const ExecutorRef& ex, Lock& _);
 			error_code initRemoteSocketFork(u32 slotId, SessionID id, Lock& _);
 
-			SessionID fork(SessionID s);
+			// the remote party has closed the fork with session id, id. slotId is
+			// the id it used for the fork or ~0 if it never sent on it. Fails if
+			// MaxEarlyClosedForks forks are already closed before being created.
+			error_code closeRemoteSocketFork(u32 slotId, SessionID id);
 
+			// called once the last Socket that refers to fork has been destroyed.
+			// Messages that arrive on the fork are discarded from now on.
+			void closeFork(SocketFork* fork);
+
+			// once a closed fork has no queued sends, queue its close notice. Once
+			// the remote party has closed it too and it has no pending operations, 
+			// free it. Should be called whenever an operation of a closed fork is removed.
+			void reclaimFork(SocketFork& fork, ExecutionQueue::Handle& queue, Lock& _);
+
+			// move the pending control blocks to mControlFrames.
+			void takeControlFrames(Lock& _)
+			{
+				if (mPendingControlFrames.size())
+				{
+					mControlFrames.insert(mControlFrames.end(), mPendingControlFrames.begin(), mPendingControlFrames.end());
+					mPendingControlFrames.clear();
+				}
+			}
+
+			// create a new fork derived from the fork s. hint can optionally be
+			// the fork of s.
+			SocketFork* fork(const SessionID& s, SocketFork* hint = nullptr);
+
+			// send buffer on the fork with session id, id. If provided, fork 
+			// should be that fork and is used to skip the lookup. buffered
+			// should be set if the bytes were reserved with reserveBufferedSend.
 			template<typename Buffer>
 			MACORO_NODISCARD coroutine_handle<void> send(
 				SessionID id,
 				Buffer&& buffer,
 				coroutine_handle<void> callback,
-				macoro::stop_token&& token);
+				macoro::stop_token&& token,
+				SocketFork* fork = nullptr,
+				bool buffered = false);
 
 			MACORO_NODISCARD
-				coroutine_handle<void> recv(SessionID id, RecvBuffer* data, coroutine_handle<void> ch, macoro::stop_token&& token);
+				coroutine_handle<void> recv(SessionID id, RecvBuffer* data, coroutine_handle<void> ch, macoro::stop_token&& token, SocketFork* fork = nullptr);
 
 
 			void cancel(
@@ -467,6 +1144,8 @@ namespace coproto
 
 			void close();
 
+			// resume h once the operations that were submitted before 
+			// the call have completed.
 			coroutine_handle<> flush(coroutine_handle<>h);
 
 			bool mLogging = false;
@@ -487,6 +1166,8 @@ namespace coproto
 			{
 				Lock lock(mMutex);
 				auto iter = getLocalSocketFork(id, lock);
+				if (iter == nullptr)
+					throw std::runtime_error("can not set the executor of a closed fork. " COPROTO_LOCATION);
 				iter->mExecutor = ExecutorRef(scheduler);
 			}
 		};
@@ -496,6 +1177,7 @@ namespace coproto
 		void SockScheduler::init(SocketImpl* sock, SessionID sid)
 		{
 			mSockPtr = sock;
+			mRecvSomeSupported = has_recv_some<SocketImpl>::value;
 			mExQueue.setMutex(mMutex);
 			//auto mCloseSock = [this, sock](std::coroutine_handle<> h) {
 
@@ -544,7 +1226,9 @@ namespace coproto
 			SessionID id,
 			Buffer&& buffer,
 			coroutine_handle<void> callback,
-			macoro::stop_token&& token)
+			macoro::stop_token&& token,
+			SocketFork* fork,
+			bool buffered)
 		{
 			assert(callback);
 			if (buffer.asSpan().size() == 0)
@@ -553,79 +1237,94 @@ namespace coproto
 				return callback;
 			}
 
-			ExecutionQueue::Handle exQueue;
-
-			{
-				Lock l = Lock(mMutex);
-				exQueue = mExQueue.acquire(l);
-				auto fork = getLocalSocketFork(id, l);
-
-				if (mEC)
+			auto opPtr = mSendOpPool.make(id, fork, callback, std::move(buffer));
+			opPtr->setBuffered(buffered);
+			opPtr->setCancelation(std::move(token), [this, opPtr] {
+				macoro::stop_source cancelSrc;
+				ExecutionQueue::Handle exQueue;
 				{
-					buffer.setError(mEC);
-					exQueue.push_back(callback, fork->mExecutor, l);
-				}
-				else
-				{
-					auto opPtr = &fork->emplace_send(l,
-						fork, callback, std::move(buffer));
-
-					if (mNextSendOp)
+					Lock l(mMutex);
+					exQueue = mExQueue.acquire(l);
+					if (opPtr->status() == SendOperation::Status::Pending)
 					{
-						COPROTO_ASSERT(mSendStatus == Status::Idle);
-						mSendStatus = Status::InUse;
-						opPtr->setStatus(SendOperation::Status::InProgress);
-
-						assert(mSendBufferBegin == nullptr);
-						assert(mSendBufferLast == nullptr);
-
-						exQueue.push_back(mNextSendOp->getHandle(macoro::Ok(opPtr), mNextSendOp), {}, l);
-
-						mSendBufferBegin = opPtr;
-						mSendBufferLast = opPtr;
+						// the send task has not seen this operation yet. It 
+						// will complete it when the operation is dequeued.
+						opPtr->setStatus(SendOperation::Status::Aborted);
+					}
+					else if (opPtr->status() == SendOperation::Status::NotStarted ||
+						opPtr->status() == SendOperation::Status::Blocked)
+					{
+						// we will skip this operation and calls its cb
+						opPtr->setError(code::operation_aborted);
+						opPtr->completeOn(exQueue, l);
+						mFlushQueue.complete(opPtr->seq(), opPtr->fork().mExecutor, exQueue, l);
+
+						// blocked operations are in the fork's list.
+						auto& fork = opPtr->fork();
+						auto blocked = opPtr->status() == SendOperation::Status::Blocked;
+						auto& begin = blocked ? fork.mBlockedBegin : mSendBufferBegin;
+						auto& last = blocked ? fork.mBlockedLast : mSendBufferLast;
+						if (blocked)
+							--mNumBlockedSends;
+						if (begin == opPtr)
+							begin = opPtr->next();
+						if (last == opPtr)
+							last = opPtr->prev();
+						--fork.mNumSends;
+						opPtr->unlink();
+
+						// the remote party will not grant back the credit of a 
+						// message that it never sees, so it is returned here.
+						auto partial = fork.mFragmentedSend == opPtr && fork.mFragmentSendOffset;
+						if (mFlowWindow && !blocked && !partial)
+							fork.mSendCredit.fetch_add(static_cast<i64>(opPtr->asSpan().size()), std::memory_order_relaxed);
+
+						if (fork.mFragmentedSend == opPtr)
+							endFragmentedSend(fork, true, exQueue, l);
+						else
+							releaseBlockedSends(fork, exQueue, l);
+						destroySendOp(opPtr);
+						reclaimFork(fork, exQueue, l);
 					}
 					else
 					{
-						assert(mNextSendOp == nullptr);
-						assert(mSendBufferLast != nullptr);
-
-						mSendBufferLast->setNext(opPtr);
-						mSendBufferLast = opPtr;
+						opPtr->setStatus(SendOperation::Status::Canceling);
+						// the operation is in progress, call cancel.
+						// in this case we must have alrady released then enque 
+						// lock and we are only holding the current lock.
+						// With fragmentation, at most one fragment is being written.
+						// The operation is aborted once it is, see NextSendOp::completePrev.
+						if (mFragmentSize == 0 && cancelSrc.stop_possible())
+							exQueue.push_back_stop(std::move(mSendCancelSrc), l);
 					}
+				}
+				exQueue.run();
+				});
 
-					opPtr->setCancelation(std::move(token), [this, opPtr] {
-						macoro::stop_source cancelSrc;
-						ExecutionQueue::Handle exQueue;
-						{
-							Lock l(mMutex);
-							exQueue = mExQueue.acquire(l);
-							if (opPtr->status() == SendOperation::Status::NotStarted)
-							{
-								// we will skip this operation and calls its cb
-								opPtr->setError(code::operation_aborted);
-								opPtr->completeOn(exQueue, l);
-								assert(opPtr->prev());
-								opPtr->prev()->setNext(opPtr->next());
-								opPtr->fork().erase_send(l, opPtr);
-							}
-							else
-							{
-								opPtr->setStatus(SendOperation::Status::Canceling);
-								// the operation is in progress, call cancel.
-								// in this case we must have alrady released then enque 
-								// lock and we are only holding the current lock.
-								if (cancelSrc.stop_possible())
-									exQueue.push_back_fn([cancelSrc = std::move(mSendCancelSrc)]() mutable {
-									cancelSrc.request_stop();
-										}, l);
-							}
-						}
-						exQueue.run();
-						});
+			switch (mSubmitQueue.push(opPtr))
+			{
+			case SendSubmitQueue::PushResult::Queued:
+				return macoro::noop_coroutine();
+			case SendSubmitQueue::PushResult::Wake:
+				// we took the send task out of the parked state and 
+				// therefore have exclusive access to mNextSendOp.
+				return coroutine_handle<void>(mNextSendOp->getHandle(macoro::Ok(static_cast<SendOperation*>(nullptr)), mNextSendOp));
+			default:
+			{
+				// the send task has exited, fail the operation.
+				ExecutionQueue::Handle exQueue;
+				{
+					Lock l(mMutex);
+					exQueue = mExQueue.acquire(l);
+					COPROTO_ASSERT(mEC);
+					opPtr->setFork(getLocalSocketFork(id, fork, l));
+					opPtr->setError(mEC);
+					opPtr->completeOn(exQueue, l);
+					destroySendOp(opPtr);
 				}
+				return exQueue.runReturnLast();
+			}
 			}
-
-			return exQueue.runReturnLast();
 		}
 
 
@@ -679,8 +1378,8 @@ namespace coproto
 				queue = mSched.mExQueue.acquire(lock);
 
 				// make sure the fork ID they sent exist.
-				auto iter = mSched.mRemoteSocketForkMapping_.find(mRemoteForkId);
-				if (iter == mSched.mRemoteSocketForkMapping_.end())
+				auto forkPtr = mSched.mForks.findRemote(mRemoteForkId);
+				if (forkPtr == nullptr)
 				{
 					mSched.cancel(queue, SockScheduler::Caller::Recver, code::badCoprotoMessageHeader, lock);
 				}
@@ -694,10 +1393,32 @@ namespace coproto
 				{
 
 					// get the fork and set the return value.
-					auto& fork = *iter->second;
+					auto& fork = *forkPtr;
 
+					if (fork.size_recv(lock) == 0 && fork.mClosed)
+					{
+						// the fork has been closed, no one will ask for this 
+						// message. The receive task reads and discards it.
+						RECV_LOG("getRequestedRecvSocketFork::closed", mSize, {});
+						mSched.mEagerRecvSize += mSize;
+						mRes = macoro::Ok(static_cast<RecvOperation*>(nullptr));
+						queue.push_back(h, {}, lock);
+					}
 					// check of we have a matching recv
-					if (fork.size_recv(lock) == 0)
+					else if (fork.size_recv(lock) == 0 && (mSched.mFlowWindow || (
+						mSched.mEagerRecvCapacity &&
+						mSched.mEagerRecvSize + mSize <= mSched.mEagerRecvCapacity)))
+					{
+						// no one has asked for this message yet but we have room
+						// to buffer it. Tell the receive task to read it now so
+						// that other forks are not blocked. With flow control the
+						// remote party is at most a window ahead so there always is.
+						RECV_LOG("getRequestedRecvSocketFork::eager", mSize, {});
+						mSched.mEagerRecvSize += mSize;
+						mRes = macoro::Ok(static_cast<RecvOperation*>(nullptr));
+						queue.push_back(h, {}, lock);
+					}
+					else if (fork.size_recv(lock) == 0)
 					{
 						// ok, data has arrived but we dont have anywhere 
 						// to store it. We will store the continuation
@@ -723,7 +1444,6 @@ namespace coproto
 
 		inline macoro::result<RecvOperation*, std::error_code> GetRequestedRecvSocketFork::await_resume()
 		{
-			assert(mRes.has_error() || mRes.value());
 			return std::move(mRes);
 		}
 
@@ -758,9 +1478,13 @@ namespace coproto
 			{
 				op.setError(std::exchange(mPrevEc, code::cancel));
 			}
+			else
+				mSched.grantCredit(fork, mPrevSize, queue, lock);
 			op.completeOn(queue, lock);
+			mSched.mFlushQueue.complete(op.seq(), fork.mExecutor, queue, lock);
 			fork.pop_front_recv(lock);
 			--mSched.mNumRecvs;
+			mSched.reclaimFork(fork, queue, lock);
 		}
 
 		inline std::coroutine_handle<> AnyRecvOp::await_suspend(std::coroutine_handle<>h)
@@ -781,7 +1505,8 @@ namespace coproto
 				}
 				else
 				{
-					if (mSched.mNumRecvs)
+					// a blocked send needs the receive task to read its credit.
+					if (mSched.mNumRecvs || (mSched.mFlowWindow && mSched.mNumBlockedSends))
 					{
 						mRes.emplace(code::success);
 						queue.push_back(h, {}, lock);
@@ -823,13 +1548,21 @@ namespace coproto
 			RecvOperation* op = nullptr;
 			error_code ec = code::success;
 			u64 bt;
+
+			// the size of the message that op received.
+			u64 opSize = 0;
+
+			// storage for messages that arrive before they are requested.
+			std::vector<u8> eagerBuffer;
 			while (true)
 			{
 			Next:
 				// await until we have at least one receive operation
+				// or, with flow control, a send that waits for credit.
 				if (co_await completeOpAndWaitForAnyRecv(
 					std::exchange(op, nullptr),
-					std::exchange(ec, {})))
+					std::exchange(ec, {}),
+					std::exchange(opSize, 0)))
 					break;
 
 				RECV_LOG("new-recv", 0, {});
@@ -838,67 +1571,193 @@ namespace coproto
 
 				// the first thing we need to do is get a receive header.
 				// This will let us know what receive operation to handle
-				// next. We do this in a while loop because we might receive 
-				// more than one header if a header contains only meta data.
-				while (true)
+				// next. If the header contains only meta data, it is 
+				// processed and we go back to waiting for an operation.
+				RECV_LOG("recving-header", 0, {});
+				std::tie(ec, bt) = co_await recvData(sock, asSpan(header));
+				if (checkRecv(ec, bt, sizeof(header)))
 				{
-					// recev the header
-					RECV_LOG("recving-header", 0, {});
-					std::tie(ec, bt) = co_await sock->recv(asSpan(header), mRecvToken);
-					mBytesReceived += bt;
-					if (checkRecv(ec, bt, sizeof(header)))
+					RECV_LOG("recved-header: error.", bt,
+						"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+						std::to_string(sizeof(header))
+					);
+					goto Next;
+				}
+				else
+				{
+					RECV_LOG("recved-header", bt, {});
+				}
+
+				// the header announces meta-data instead of a message.
+				ControlBlock metadata;
+				bool fragment = false;
+				if (header.isControl())
+				{
+					RECV_LOG("recving-header-meta", 0, {});
+
+					std::tie(ec, bt) = co_await recvData(sock, asSpan(metadata));
+					if (checkRecv(ec, bt, sizeof(metadata)))
 					{
-						RECV_LOG("recved-header: error.", bt,
+						RECV_LOG("recved-header-meta: error.", bt,
 							"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
-							std::to_string(sizeof(header))
-						);
+							std::to_string(sizeof(header)));
 						goto Next;
 					}
 					else
 					{
-						RECV_LOG("recved-header", bt, {});
+						RECV_LOG("recved-header-meta", bt, {});
 					}
 
-					// the message size will be zero if its meta-data
-					if (header.mSize == 0)
+					auto slotId = header.mForkId;
+					auto sid = metadata.getSessionID();
+					auto type = ControlBlock::getType(header);
+					if (type == ControlBlock::Type::NewSocketFork)
 					{
-						RECV_LOG("recving-header-meta", 0, {});
+						auto lock = Lock(mMutex);
+						ec = initRemoteSocketFork(slotId, sid, lock);
+					}
+					else if (type == ControlBlock::Type::CloseSocketFork)
+						ec = closeRemoteSocketFork(slotId, sid);
+					else if (type == ControlBlock::Type::SocketForkCredit)
+						ec = addSendCredit(slotId, metadata.getCredit());
+					else if (type == ControlBlock::Type::MessageAbort)
+						ec = abortFragmentRecv(slotId);
+					else if (type == ControlBlock::Type::MessageFragment)
+						fragment = true;
+					else
+						ec = code::badCoprotoMessageHeader;
 
-						ControlBlock metadata;
-						std::tie(ec, bt) = co_await sock->recv(asSpan(metadata), mRecvToken);
-						mBytesReceived += bt;
-						if (checkRecv(ec, bt, sizeof(metadata)))
+					if (ec)
+					{
+						RECV_LOG("recved-header-meta: error.", 0, 
+							"ec=" + ec.message() + ", slotId=" + std::to_string(slotId) +
+							", sid=" + sid.toString());
+					}
+					if (fragment == false)
+						goto Next;
+				}
+
+				if (fragment)
+				{
+					// part of a large message, see enableFragmentation(). The fragments are
+					// written directly into the recv buffer, the eager buffer or, if the
+					// fork has been closed, discarded.
+					auto total = metadata.getFragmentTotal();
+					u64 size = metadata.getFragmentSize();
+					SocketFork* fork = nullptr;
+					{
+						auto lock = Lock(mMutex);
+						fork = mForks.findRemote(header.mForkId);
+
+						// the total is read from the wire. Messages are limited to 32 bits
+						// and, with flow control, one that arrives before its recv is 
+						// buffered. It must then fit in the window or the eager capacity
+						// so that the remote party can not choose how much we allocate.
+						auto eager = fork && fork->mFragmentRecvSize == 0 &&
+							fork->size_recv(lock) == 0 && fork->mClosed == false;
+						if (fork == nullptr || size == 0 ||
+							total > std::numeric_limits<u32>::max() ||
+							(eager && mFlowWindow && total > std::max(mFlowWindow, mEagerRecvCapacity)) ||
+							(fork->mFragmentRecvSize == 0 && size > total) ||
+							(fork->mFragmentRecvSize && (
+								fork->mFragmentRecvSize != total ||
+								fork->mFragmentRecvOffset + size > total)))
+							ec = code::badCoprotoMessageHeader;
+					}
+					if (ec)
+					{
+						RECV_LOG("recved-fragment: error.", size,
+							"ec=" + ec.message() + ", forkId=" + std::to_string(header.mForkId) +
+							", total=" + std::to_string(total));
+						goto Next;
+					}
+
+					if (fork->mFragmentRecvSize == 0)
+					{
+						// the first fragment, get the recv operation as for any other message.
+						RECV_LOG("getRequestedRecvSocketFork-enter", 0, {});
+						auto opRes = co_await getRequestedRecvSocketFork(header.mForkId, total);
+						if (opRes.has_error())
 						{
-							RECV_LOG("recved-header-meta: error.", bt,
-								"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
-								std::to_string(sizeof(header)));
+							RECV_LOG("getRequestedRecvSocketFork: error.", 0,
+								"ec=" + opRes.error().message() + ", forkId=" + std::to_string(header.mForkId));
+							ec = opRes.error();
 							goto Next;
 						}
-						else
-						{
-							RECV_LOG("recved-header-meta", bt, {});
-						}
 
-						auto slotId = header.mForkId;
-						auto sid = metadata.getSessionID();
 						auto lock = Lock(mMutex);
-						ec = initRemoteSocketFork(slotId, sid, lock);
-						if (ec)
+						fork->mFragmentRecvSize = total;
+						fork->mFragmentRecv = opRes.value();
+						if (fork->mFragmentRecv)
 						{
-							RECV_LOG("initRemoteSocketFork: error.", 0, 
-								"ec=" + ec.message() + ", slotId=" + std::to_string(slotId) +
-								", sid=" + sid.toString());
-							goto Next;
+							fork->mFragmentDst = fork->mFragmentRecv->asSpan(total);
+							if (fork->mFragmentDst.size() != total)
+							{
+								ec = code::badBufferSize;
+								RECV_LOG("recved-fragment: error, Bad buffer size.", total,
+									"ec=" + ec.message() + ", expected: " + std::to_string(fork->mFragmentDst.size()));
+								op = fork->mFragmentRecv;
+								opSize = total;
+								fork->endFragmentRecv();
+								goto Next;
+							}
+						}
+						else if (fork->mClosed == false)
+						{
+							fork->mFragmentBuffer.resize(total);
+							fork->mFragmentDst = fork->mFragmentBuffer;
 						}
 					}
+
+					span<u8> buffer;
+					if (fork->mFragmentDst.size())
+						buffer = fork->mFragmentDst.subspan(fork->mFragmentRecvOffset, size);
 					else
 					{
-						break;
+						eagerBuffer.resize(size);
+						buffer = eagerBuffer;
+					}
+
+					RECV_LOG("recving-fragment", size, {});
+					std::tie(ec, bt) = co_await recvData(sock, buffer);
+
+					if (checkRecv(ec, bt, buffer.size()))
+					{
+						RECV_LOG("recved-fragment: error.", bt,
+							"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+							std::to_string(buffer.size()));
+						goto Next;
+					}
+
+					RECV_LOG("recved-fragment", bt, {});
+
+					ExecutionQueue::Handle queue;
+					{
+						auto lock = Lock(mMutex);
+						queue = mExQueue.acquire(lock);
+						fork->mFragmentRecvOffset += size;
+						if (fork->mFragmentRecvOffset == total)
+						{
+							// the whole message has arrived, complete it like any other.
+							if (fork->mFragmentRecv)
+								op = fork->mFragmentRecv;
+							else if (fork->mFragmentDst.size())
+								op = completeEagerRecv(header.mForkId, fork->mFragmentBuffer, ec, queue, lock);
+							else
+							{
+								mEagerRecvSize -= total;
+								grantCredit(*fork, total, queue, lock);
+							}
+							opSize = total;
+							fork->endFragmentRecv();
+						}
 					}
+					queue.run();
+					goto Next;
 				}
 
 				RECV_LOG("getRequestedRecvSocketFork-enter", 0, {});
-				auto opRes = co_await getRequestedRecvSocketFork(header.mForkId);
+				auto opRes = co_await getRequestedRecvSocketFork(header.mForkId, header.mSize);
 				if (opRes.has_error())
 				{
 					RECV_LOG("getRequestedRecvSocketFork: error.", 0,
@@ -907,7 +1766,42 @@ namespace coproto
 					goto Next;
 				}
 
+				if (opRes.value() == nullptr)
+				{
+					// the fork has not requested this message. Read it into
+					// eagerBuffer and hand it to the fork.
+					eagerBuffer.resize(header.mSize);
+					span<u8> buffer = eagerBuffer;
+
+					RECV_LOG("recving-eager-body", header.mSize, {});
+					std::tie(ec, bt) = co_await recvData(sock, buffer);
+
+					if (checkRecv(ec, bt, buffer.size()))
+					{
+						RECV_LOG("recved-eager-body: error.", bt,
+							"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+							std::to_string(buffer.size()));
+						goto Next;
+					}
+
+					RECV_LOG("recved-eager-body", bt, {});
+
+					// if a recv was requested while we were reading, op
+					// will be set and completed at the top of the loop.
+					ExecutionQueue::Handle queue;
+					{
+						auto lock = Lock(mMutex);
+						queue = mExQueue.acquire(lock);
+						op = completeEagerRecv(header.mForkId, eagerBuffer, ec, queue, lock);
+						opSize = header.mSize;
+						reuseEagerBuffer(eagerBuffer, lock);
+					}
+					queue.run();
+					goto Next;
+				}
+
 				op = opRes.value();
+				opSize = header.mSize;
 				span<u8> buffer = op->asSpan(header.mSize);
 
 				if (buffer.size() != header.mSize)
@@ -922,8 +1816,7 @@ namespace coproto
 
 
 				RECV_LOG("recving-body", header.mSize, {});
-				std::tie(ec, bt) = co_await sock->recv(buffer, mRecvToken);
-				mBytesReceived += bt;
+				std::tie(ec, bt) = co_await recvData(sock, buffer);
 
 				if (checkRecv(ec, bt, buffer.size()))
 				{
@@ -940,6 +1833,56 @@ namespace coproto
 
 		}
 
+		template<typename Sock>
+		RecvDataTask SockScheduler::recvData(Sock* sock, span<u8> dst)
+		{
+			error_code ec;
+			u64 bt = 0, n;
+			if (mReadAhead.capacity() == 0)
+			{
+				std::tie(ec, bt) = co_await sock->recv(dst, mRecvToken);
+			}
+			else
+			{
+				bt = mReadAhead.pop(dst);
+				dst = dst.subspan(bt);
+
+				// large reads are not worth the extra copy. 
+				if (dst.size() >= mReadAhead.capacity() / 2)
+				{
+					RECV_LOG("read-ahead-direct", dst.size(), {});
+					std::tie(ec, n) = co_await sock->recv(dst, mRecvToken);
+					bt += n;
+				}
+
+				while (dst.size() && !ec)
+				{
+					if constexpr (has_recv_some<Sock>::value)
+					{
+						RECV_LOG("read-ahead-fill", mReadAhead.writable().size(), {});
+						std::tie(ec, n) = co_await sock->recvSome(mReadAhead.writable(), mRecvToken);
+						mReadAhead.commit(n);
+						if (!ec && n == 0)
+							ec = code::ioError;
+					}
+					else
+					{
+						// enableReadAhead prevents us from getting here.
+						COPROTO_ASSERT(0);
+						ec = code::ioError;
+					}
+
+					auto m = mReadAhead.pop(dst);
+					bt += m;
+					dst = dst.subspan(m);
+				}
+			}
+
+			mBytesReceived += bt;
+			co_return std::pair<error_code, u64>{ ec, bt };
+		}
+
+
 
 
 
@@ -960,7 +1903,6 @@ namespace coproto
 		{
 			COPROTO_ASSERT(this == self);
 			self = nullptr;
-			COPROTO_ASSERT(r.has_error() || r.value());
 			mRes = std::move(r);
 			return std::exchange(mHandle, nullptr);
 		}
@@ -969,23 +1911,60 @@ namespace coproto
 		inline void NextSendOp::completePrev(Lock& lock, ExecutionQueue::Handle& queue)
 		{
 			COPROTO_ASSERT(mPrevOp);
-			auto& op = *mPrevOp;
-			if (mPrevEc)
+			auto opPtr = mPrevOp;
+			while (true)
 			{
-				op.setError(std::exchange(mPrevEc, code::cancel));
-			}
-			op.completeOn(queue, lock);
-			auto next = op.next();
-			op.setNext(nullptr);
+				auto& op = *opPtr;
+				auto last = mPrevLast == nullptr || opPtr == mPrevLast;
+				auto& fork = op.fork();
+				auto next = op.next();
+				assert(mSched.mSendBufferBegin == &op);
+
+				mSched.mSendBufferBegin = next;
+				if (next == nullptr)
+					mSched.mSendBufferLast = nullptr;
+				op.unlink();
+
+				if (fork.mFragmentedSend == &op)
+				{
+					// a fragment has been sent. Unless it was the last, the operation 
+					// goes to the back of the list so that the other forks get a turn.
+					// Fragmented operations are never coalesced.
+					COPROTO_ASSERT(last);
+					auto aborted = false;
+					if (!mPrevEc && fork.mFragmentSendOffset < op.asSpan().size())
+					{
+						if (op.status() != SendOperation::Status::Canceling)
+						{
+							op.setStatus(SendOperation::Status::NotStarted);
+							mSched.pushSend(op, lock);
+							break;
+						}
+
+						aborted = true;
+						op.setError(code::operation_aborted);
+					}
+
+					mSched.endFragmentedSend(fork, aborted, queue, lock);
+				}
+
+				if (mPrevEc)
+				{
+					op.setError(std::exchange(mPrevEc, code::cancel));
+				}
+				op.completeOn(queue, lock);
+				mSched.mFlushQueue.complete(op.seq(), fork.mExecutor, queue, lock);
 
-			assert(&op.fork().front_send(lock) == &op);
-			assert(mSched.mSendBufferBegin == &op);
+				--fork.mNumSends;
+				mSched.destroySendOp(&op);
+				mSched.reclaimFork(fork, queue, lock);
 
-			mSched.mSendBufferBegin = next;
-			if (next == nullptr)
-				mSched.mSendBufferLast = nullptr;
+				if (last)
+					break;
 
-			op.fork().pop_front_send(lock);
+				COPROTO_ASSERT(next);
+				opPtr = next;
+			}
 		}
 
 		inline bool NextSendOp::await_ready() { return false; }
@@ -997,28 +1976,58 @@ namespace coproto
 				queue = mSched.mExQueue.acquire(lock);
 				if (mPrevOp)
 					completePrev(lock, queue);
-				if (mPrevEc || mSched.mEC)
-				{
-					COPROTO_ASSERT(mSched.mSendBufferBegin == nullptr || mSched.mSendBufferBegin->status() == SendOperation::Status::NotStarted);
-					mSched.cancel(queue, SockScheduler::Caller::Sender, mPrevEc, lock);
-					mRes = macoro::Err(code::closed);
-					queue.push_back(h, {}, lock);
-				}
-				else
+
+				// the previous control blocks have been sent.
+				mSched.mControlFrames.clear();
+				mSched.mControlSend = false;
+
+				while (true)
 				{
+					if (mPrevEc || mSched.mEC)
+					{
+						COPROTO_ASSERT(mSched.mSendBufferBegin == nullptr || mSched.mSendBufferBegin->status() == SendOperation::Status::NotStarted);
+						mSched.cancel(queue, SockScheduler::Caller::Sender, mPrevEc, lock);
+						mRes = macoro::Err(code::closed);
+						queue.push_back(h, {}, lock);
+						break;
+					}
+
+					mSched.appendSubmitted(mSched.mSubmitQueue.popAll(), queue, lock);
 					if (mSched.mSendBufferBegin)
 					{
 						COPROTO_ASSERT(mSched.mSendBufferBegin->status() == SendOperation::Status::NotStarted);
+						mSched.takeControlFrames(lock);
 						mSched.mSendBufferBegin->setStatus(SendOperation::Status::InProgress);
+						mSched.mSendStatus = SockScheduler::Status::InUse;
 						mRes = macoro::Ok(mSched.mSendBufferBegin);
 						queue.push_back(h, {}, lock);
+						break;
 					}
-					else
+
+					// the remote party might be waiting on a credit, an abort
+					// or a close notice. Send the control blocks on their own.
+					if (mSched.mPendingControlFrames.size())
 					{
-						mSched.mSendStatus = SockScheduler::Status::Idle;
-						mSched.mNextSendOp = this;
-						mHandle = h;
+						mSched.takeControlFrames(lock);
+						mSched.mSendStatus = SockScheduler::Status::InUse;
+						mSched.mControlSend = true;
+						mRes = macoro::Ok(static_cast<SendOperation*>(nullptr));
+						queue.push_back(h, {}, lock);
+						break;
 					}
+
+					// nothing to send. Park until the next submission. Once 
+					// parked, another thread may resume h so this awaiter must 
+					// not be accessed afterwards.
+					mSched.mSendStatus = SockScheduler::Status::Idle;
+					mSched.mNextSendOp = this;
+					mHandle = h;
+					if (mSched.mSubmitQueue.tryPark())
+						break;
+
+					// an operation was submitted in the meantime.
+					mSched.mNextSendOp = nullptr;
+					mHandle = nullptr;
 				}
 			}
 
@@ -1027,7 +2036,6 @@ namespace coproto
 
 		inline macoro::result<SendOperation*, macoro::error_code> NextSendOp::await_resume()
 		{
-			COPROTO_ASSERT(mRes.has_error() || mRes.value());
 			return mRes;
 		}
 
@@ -1042,95 +2050,231 @@ namespace coproto
 				return ec;
 				};
 
-			SendOperation* op = nullptr;
+			SendOperation* op = nullptr, *last = nullptr;
 			error_code ec;
 			u64 bt;
+
+			// the staging buffer used when coalescing messages.
+			std::vector<u8> coalesced;
 			while (true)
 			{
 				auto opRes = co_await completeOpAndGetNextSend(
 					std::exchange(op, nullptr),
-					std::exchange(ec, {}));
+					std::exchange(ec, {}),
+					std::exchange(last, nullptr));
 
 				if (opRes.has_error())
 					break;
-				SEND_LOG("new-send", 0, {});
 
+				// woken by a new submission, go get it. We might instead 
+				// have to send control blocks on their own.
+				if (opRes.value() == nullptr)
+				{
+					if (mControlFrames.size())
+					{
+						span<u8> frames(
+							reinterpret_cast<u8*>(mControlFrames.data()),
+							mControlFrames.size() * sizeof(SendControlBlock));
+
+						SEND_LOG("sending-control", frames.size(), {});
+						std::tie(ec, bt) = co_await sock->send(frames, mSendToken);
+						mBytesSent += bt;
+
+						if (checkSend(ec, bt, frames.size()))
+						{
+							SEND_LOG("sending-control: error", bt,
+								"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+								std::to_string(frames.size()));
+						}
+						else
+						{
+							SEND_LOG("sending-control-done", bt, {});
+						}
+					}
+					continue;
+				}
+
+				SEND_LOG("new-send", 0, {});
 				op = opRes.value();
 				auto& fork = op->fork();
 				auto data = op->asSpan();
 
+				// a large message is sent one fragment per turn, see enableFragmentation().
+				bool fragmented = fork.mFragmentedSend == op;
+
 				COPROTO_ASSERT(op->status() != SendOperation::Status::NotStarted);
 				COPROTO_ASSERT(data.size() != 0);
-				COPROTO_ASSERT(data.size() < std::numeric_limits<u32>::max());
+				COPROTO_ASSERT(fragmented || data.size() < Header::ControlSize);
 				COPROTO_ASSERT(fork.mLocalId != ~u32(0));
 
-				if (fork.mInitiated == false)
+				if (mCoalesceSize && !fragmented)
+					last = coalesceSends(op, coalesced);
+
+				if (last)
 				{
-					SEND_LOG("meta", 0, {});
+					// several messages are queued. Send them with one write.
+					SEND_LOG("sending-coalesced", coalesced.size(), {});
+					std::tie(ec, bt) = co_await sock->send(span<u8>(coalesced), mSendToken);
+					mBytesSent += bt;
 
-					struct SendControlBlock
+					if (checkSend(ec, bt, coalesced.size()))
 					{
-						Header mHeader;
-						ControlBlock mCtrlBlk;
-					};
+						SEND_LOG("sending-coalesced: error", bt,
+							"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+							std::to_string(coalesced.size()));
+					}
+					else
+					{
+						SEND_LOG("sending-coalesced-done", bt, {});
+					}
+					continue;
+				}
+
+				// the close notices and credit of other forks go first.
+				span<u8> notices(
+					reinterpret_cast<u8*>(mControlFrames.data()),
+					mControlFrames.size() * sizeof(SendControlBlock));
+
+				SendControlBlock meta;
+				bool sendMeta = fork.mInitiated == false;
+				if (sendMeta)
+				{
+					SEND_LOG("meta", 0, {});
 
 					fork.mInitiated = true;
-					SendControlBlock meta;
-					meta.mHeader.mSize = 0;
 					meta.mHeader.mForkId = fork.mLocalId;
-					meta.mCtrlBlk.setType(ControlBlock::Type::NewSocketFork);
+					meta.setType(ControlBlock::Type::NewSocketFork);
 					meta.mCtrlBlk.setSessionID(fork.mSessionID);
+				}
 
-					std::tie(ec, bt) = co_await sock->send(asSpan(meta), mSendToken);
+				// the header or, for a fragment, the fragment's control block.
+				Header header;
+				SendControlBlock fragment;
+				span<u8> head;
+				if (fragmented)
+				{
+					auto total = data.size();
+					data = data.subspan(fork.mFragmentSendOffset,
+						std::min<u64>(mFragmentSize, total - fork.mFragmentSendOffset));
+
+					fragment.mHeader.mForkId = fork.mLocalId;
+					fragment.setType(ControlBlock::Type::MessageFragment);
+					fragment.mCtrlBlk.setFragment(total, static_cast<u32>(data.size()));
+					head = asSpan(fragment);
+				}
+				else
+				{
+					header.mForkId = fork.mLocalId;
+					header.mSize = static_cast<u32>(data.size());
+					head = asSpan(header);
+				}
 
+				if constexpr (has_vectored_send<Sock>::value)
+				{
+					// the socket supports scatter/gather. Send the optional 
+					// control blocks, the header and the body in a single write.
+					std::array<span<u8>, 4> buffers;
+					u64 numBuffers = 0;
+					if (notices.size())
+						buffers[numBuffers++] = notices;
+					if (sendMeta)
+						buffers[numBuffers++] = asSpan(meta);
+					buffers[numBuffers++] = head;
+					buffers[numBuffers++] = data;
+
+					auto total = notices.size() + data.size() + head.size() + (sendMeta ? sizeof(meta) : 0);
+					SEND_LOG("sending-vectored", total, {});
+
+					std::tie(ec, bt) = co_await sock->send(
+						span<span<u8>>(buffers.data(), numBuffers), mSendToken);
 					mBytesSent += bt;
-					if (checkSend(ec, bt, sizeof(meta)))
+
+					if (checkSend(ec, bt, total))
 					{
-						SEND_LOG("meta-sent: error", bt, 
+						SEND_LOG("sending-vectored: error", bt,
 							"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
-							std::to_string(sizeof(meta)));
+							std::to_string(total));
 						continue;
 					}
 					else
 					{
-						SEND_LOG("meta-sent", bt, {});
+						SEND_LOG("sending-vectored-done", bt, {});
 					}
 				}
-
-				Header header;
-				header.mForkId = fork.mLocalId;
-				header.mSize = static_cast<u32>(data.size());
-				SEND_LOG("sending-header", asSpan(header).size(), {});
-
-				std::tie(ec, bt) = co_await sock->send(asSpan(header), mSendToken);
-				mBytesSent += bt;
-				if (checkSend(ec, bt, sizeof(header)))
-				{
-					SEND_LOG("sending-header: error", bt,
-						"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
-						std::to_string(sizeof(header)));
-					continue;
-				}
 				else
 				{
-					SEND_LOG("sending-header-done", bt, {});
-				}
+					if (notices.size())
+					{
+						std::tie(ec, bt) = co_await sock->send(notices, mSendToken);
 
-				SEND_LOG("sending-body", data.size(), {});
-				std::tie(ec, bt) = co_await sock->send(data, mSendToken);
-				mBytesSent += bt;
+						mBytesSent += bt;
+						if (checkSend(ec, bt, notices.size()))
+						{
+							SEND_LOG("notices-sent: error", bt,
+								"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+								std::to_string(notices.size()));
+							continue;
+						}
+						else
+						{
+							SEND_LOG("notices-sent", bt, {});
+						}
+					}
 
-				if (checkSend(ec, bt, data.size()))
-				{
-					SEND_LOG("sending-body: error", bt,
-						"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
-						std::to_string(data.size()));
-					continue;
-				}
-				else
-				{
-					SEND_LOG("sending-body-done", bt, {});
+					if (sendMeta)
+					{
+						std::tie(ec, bt) = co_await sock->send(asSpan(meta), mSendToken);
+
+						mBytesSent += bt;
+						if (checkSend(ec, bt, sizeof(meta)))
+						{
+							SEND_LOG("meta-sent: error", bt,
+								"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+								std::to_string(sizeof(meta)));
+							continue;
+						}
+						else
+						{
+							SEND_LOG("meta-sent", bt, {});
+						}
+					}
+
+					SEND_LOG("sending-header", head.size(), {});
+
+					std::tie(ec, bt) = co_await sock->send(head, mSendToken);
+					mBytesSent += bt;
+					if (checkSend(ec, bt, head.size()))
+					{
+						SEND_LOG("sending-header: error", bt,
+							"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+							std::to_string(head.size()));
+						continue;
+					}
+					else
+					{
+						SEND_LOG("sending-header-done", bt, {});
+					}
+
+					SEND_LOG("sending-body", data.size(), {});
+					std::tie(ec, bt) = co_await sock->send(data, mSendToken);
+					mBytesSent += bt;
+
+					if (checkSend(ec, bt, data.size()))
+					{
+						SEND_LOG("sending-body: error", bt,
+							"ec=" + ec.message() + ", bt=" + std::to_string(bt) + " expected:" +
+							std::to_string(data.size()));
+						continue;
+					}
+					else
+					{
+						SEND_LOG("sending-body-done", bt, {});
+					}
 				}
+
+				// the next fragment is sent on the operation's next turn.
+				if (fragmented)
+					fork.mFragmentSendOffset += data.size();
 			}
 
 			SEND_LOG("exit", 0, {});
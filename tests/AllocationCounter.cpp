@@ -0,0 +1,57 @@
+#include "AllocationCounter.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace coproto
+{
+	namespace tests
+	{
+		namespace
+		{
+			std::atomic<u64> gAllocationCount(0);
+		}
+
+		u64 allocationCount()
+		{
+			return gAllocationCount.load();
+		}
+	}
+}
+
+// The other forms, e.g. new[] and sized delete, call these by default.
+void* operator new(std::size_t n)
+{
+	++coproto::tests::gAllocationCount;
+	if (auto p = std::malloc(n ? n : 1))
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept
+{
+	std::free(p);
+}
+
+void* operator new(std::size_t n, std::align_val_t al)
+{
+	++coproto::tests::gAllocationCount;
+	auto a = static_cast<std::size_t>(al);
+	n = (n + a - 1) / a * a;
+#ifdef _MSC_VER
+	if (auto p = _aligned_malloc(n ? n : a, a))
+#else
+	if (auto p = std::aligned_alloc(a, n ? n : a))
+#endif
+		return p;
+	throw std::bad_alloc();
+}
+
+void operator delete(void* p, std::align_val_t) noexcept
+{
+#ifdef _MSC_VER
+	_aligned_free(p);
+#else
+	std::free(p);
+#endif
+}
@@ -1,6 +1,7 @@
 #include "AsioSocket_tests.h"
 #include "coproto/Socket/AsioSocket.h"
 #include "Tests.h"
+#include "AllocationCounter.h"
 #include "macoro/thread_pool.h"
 #include "macoro/start_on.h"
 #include <thread>
@@ -626,6 +627,118 @@ namespace coproto
 			for (auto& t : thrds)
 				t.join();
 		}
+
+		void AsioSocket_globalContext_test()
+		{
+			// start over with three single threaded io_contexts.
+			detail::destroy_global_asio_io_context();
+			AsioContextConfig config;
+			config.mNumContexts = 3;
+			config.mThreadsPerContext = 1;
+
+			// pin to a cpu that we can run on.
+			auto perCore = AsioContextConfig::perCore();
+			if (perCore.mCpus.size())
+				config.mCpus = { perCore.mCpus[0] };
+			configure_global_io_context(config);
+
+			std::vector<boost::asio::io_context*> iocs;
+			for (u64 i = 0; i < 6; ++i)
+				iocs.push_back(&global_io_context());
+			if (iocs[0] == iocs[1] || iocs[1] == iocs[2] || iocs[0] == iocs[2] ||
+				iocs[0] != iocs[3] || iocs[1] != iocs[4] || iocs[2] != iocs[5])
+				throw MACORO_RTE_LOC;
+			if (&global_io_context(4) != &global_io_context(1))
+				throw MACORO_RTE_LOC;
+
+			// the configuration can not change while it is running.
+			bool threw = false;
+			try { configure_global_io_context(AsioContextConfig{}); }
+			catch (std::runtime_error&) { threw = true; }
+			if (!threw)
+				throw MACORO_RTE_LOC;
+
+			for (u64 i = 0; i < 3; ++i)
+			{
+				auto s = AsioSocket::makePair();
+				std::vector<u8> sb(10), rb(10);
+				sb[4] = 5;
+				macoro::sync_wait(macoro::when_all_ready(s[0].send(sb), s[1].recv(rb)));
+				if (sb != rb)
+					throw MACORO_RTE_LOC;
+			}
+
+			detail::destroy_global_asio_io_context();
+
+#ifdef __linux__
+			// a cpu that the thread can not be pinned to is an error.
+			config.mCpus = { ~0ull };
+			configure_global_io_context(config);
+			threw = false;
+			try { global_io_context(); }
+			catch (std::runtime_error&) { threw = true; }
+			if (!threw)
+				throw MACORO_RTE_LOC;
+#endif
+
+			configure_global_io_context(AsioContextConfig{});
+		}
+
+		void AsioSocket_allocation_test()
+		{
+#ifdef COPROTO_ASIO_DEBUG
+			throw UnitTestSkipped("the asio debug checks allocate, build in release");
+#else
+			// one thread so that the per thread caches of asio are warm.
+			boost::asio::io_context ioc;
+			optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> w(boost::asio::make_work_guard(ioc));
+			auto f = std::async([&] { ioc.run(); });
+
+			{
+				auto s = AsioSocket::makePair(ioc);
+				u64 n = 1000, begin = 0, end = 0;
+
+				auto ping = [&]() -> task<> {
+					std::vector<u8> buff(100);
+					for (u64 i = 0; i < 2 * n; ++i)
+					{
+						// the first half warms up the handler pools.
+						if (i == n)
+							begin = allocationCount();
+						auto r = co_await s[0].mSock->send(buff);
+						if (r.first)
+							throw MACORO_RTE_LOC;
+						r = co_await s[0].mSock->recv(buff);
+						if (r.first)
+							throw MACORO_RTE_LOC;
+					}
+					end = allocationCount();
+				};
+				auto echo = [&]() -> task<> {
+					std::vector<u8> buff(100);
+					for (u64 i = 0; i < 2 * n; ++i)
+					{
+						auto r = co_await s[1].mSock->recv(buff);
+						if (r.first)
+							throw MACORO_RTE_LOC;
+						r = co_await s[1].mSock->send(buff);
+						if (r.first)
+							throw MACORO_RTE_LOC;
+					}
+				};
+
+				auto r = macoro::sync_wait(macoro::when_all_ready(ping(), echo()));
+				std::get<0>(r).result();
+				std::get<1>(r).result();
+
+				if (end != begin)
+					throw std::runtime_error(std::to_string(end - begin) + " allocations for " + std::to_string(n) + " round trips. " COPROTO_LOCATION);
+			}
+
+			w.reset();
+			f.get();
+#endif
+		}
 #else
 		namespace
 		{
@@ -641,6 +754,8 @@ namespace coproto
 		void AsioSocket_cancellation_test() { skip(); }
 		void AsioSocket_parCancellation_test(const CLP&) { skip(); }
 		void AsioSocket_close_test() { skip(); }
+		void AsioSocket_globalContext_test() { skip(); }
+		void AsioSocket_allocation_test() { skip(); }
 #endif
 	}
 }
@@ -21,5 +21,7 @@ namespace coproto
 		void AsioSocket_cancellation_test();
 		void AsioSocket_parCancellation_test(const CLP& cmd);
 		void AsioSocket_close_test();
+		void AsioSocket_globalContext_test();
+		void AsioSocket_allocation_test();
 	}
 }
\ No newline at end of file
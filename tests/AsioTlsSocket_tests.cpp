@@ -743,6 +743,186 @@ namespace coproto
 		}
 
 
+		void AsioTlsSocket_ktls_test()
+		{
+			boost::asio::io_context ioc;
+			optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> w(boost::asio::make_work_guard(ioc));
+			auto f = std::async([&] { ioc.run(); });
+
+			boost::asio::ssl::context serverCtx(boost::asio::ssl::context::tlsv13_server);
+			boost::asio::ssl::context clientCtx(boost::asio::ssl::context::tlsv13_client);
+			serverCtx.set_verify_mode(
+				boost::asio::ssl::verify_peer |
+				boost::asio::ssl::verify_fail_if_no_peer_cert);
+
+			auto dir = std::string(COPROTO_TEST_DIR) + "/cert";
+			auto file = dir + "/ca.cert.pem";
+			serverCtx.load_verify_file(file);
+			clientCtx.load_verify_file(file);
+			clientCtx.use_private_key_file(dir + "/client-0.key.pem", boost::asio::ssl::context::file_format::pem);
+			clientCtx.use_certificate_file(dir + "/client-0.cert.pem", boost::asio::ssl::context::file_format::pem);
+			serverCtx.use_private_key_file(dir + "/server-0.key.pem", boost::asio::ssl::context::file_format::pem);
+			serverCtx.use_certificate_file(dir + "/server-0.cert.pem", boost::asio::ssl::context::file_format::pem);
+			ktlsPrepare(serverCtx);
+			ktlsPrepare(clientCtx);
+
+			{
+				auto address = "localhost:1212";
+				auto S = macoro::sync_wait(macoro::when_all_ready(
+					macoro::make_task(AsioTlsAcceptor(address, ioc, serverCtx)),
+					macoro::make_task(AsioTlsConnect(address, ioc, clientCtx))
+				));
+				auto s0 = std::get<0>(S).result();
+				auto s1 = std::get<1>(S).result();
+
+				// the kernel might not support it, in which case
+				// OpenSSL continues to encrypt the data.
+				auto e = macoro::sync_wait(macoro::when_all_ready(ktlsEnable(s0), ktlsEnable(s1)));
+				std::get<0>(e).result();
+				std::get<1>(e).result();
+
+				std::vector<u8> sb(100000), rb(100000);
+				for (u64 i = 0; i < sb.size(); ++i)
+					sb[i] = i * 7;
+
+				auto send = [&](AsioTlsSocket& s) -> task<std::pair<error_code, u64>> {
+					co_return co_await s.mSock->send(sb);
+				};
+				auto recv = [&](AsioTlsSocket& s) -> task<std::pair<error_code, u64>> {
+					co_return co_await s.mSock->recv(rb);
+				};
+
+				for (u64 i = 0; i < 10; ++i)
+				{
+					std::fill(rb.begin(), rb.end(), 0);
+					auto r = i % 2
+						? macoro::sync_wait(macoro::when_all_ready(send(s0), recv(s1)))
+						: macoro::sync_wait(macoro::when_all_ready(send(s1), recv(s0)));
+					if (std::get<0>(r).result().first || std::get<1>(r).result().first || sb != rb)
+						throw MACORO_RTE_LOC;
+				}
+			}
+
+			w.reset();
+			f.get();
+		}
+
+		void AsioTlsSocket_ktlsEarlyData_test()
+		{
+			boost::asio::io_context ioc;
+			optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> w(boost::asio::make_work_guard(ioc));
+			auto f = std::async([&] { ioc.run(); });
+
+			boost::asio::ssl::context serverCtx(boost::asio::ssl::context::tlsv13_server);
+			boost::asio::ssl::context clientCtx(boost::asio::ssl::context::tlsv13_client);
+			serverCtx.set_verify_mode(
+				boost::asio::ssl::verify_peer |
+				boost::asio::ssl::verify_fail_if_no_peer_cert);
+
+			auto dir = std::string(COPROTO_TEST_DIR) + "/cert";
+			auto file = dir + "/ca.cert.pem";
+			serverCtx.load_verify_file(file);
+			clientCtx.load_verify_file(file);
+			clientCtx.use_private_key_file(dir + "/client-0.key.pem", boost::asio::ssl::context::file_format::pem);
+			clientCtx.use_certificate_file(dir + "/client-0.cert.pem", boost::asio::ssl::context::file_format::pem);
+			serverCtx.use_private_key_file(dir + "/server-0.key.pem", boost::asio::ssl::context::file_format::pem);
+			serverCtx.use_certificate_file(dir + "/server-0.cert.pem", boost::asio::ssl::context::file_format::pem);
+			ktlsPrepare(serverCtx);
+			ktlsPrepare(clientCtx);
+
+			{
+				auto address = "localhost:1212";
+				auto S = macoro::sync_wait(macoro::when_all_ready(
+					macoro::make_task(AsioTlsAcceptor(address, ioc, serverCtx)),
+					macoro::make_task(AsioTlsConnect(address, ioc, clientCtx))
+				));
+				auto s0 = std::get<0>(S).result();
+				auto s1 = std::get<1>(S).result();
+
+				std::vector<u8> sb(1000), rb(1000);
+				for (u64 i = 0; i < sb.size(); ++i)
+					sb[i] = i * 7;
+
+				// the server sends as soon as ktlsEnable returns, possibly 
+				// before the client's ktlsEnable has returned. The data must 
+				// not be left in OpenSSL's buffer on the client.
+				auto server = [&]() -> task<std::pair<error_code, u64>> {
+					co_await ktlsEnable(s0);
+					co_return co_await s0.mSock->send(sb);
+				};
+				auto client = [&]() -> task<std::pair<error_code, u64>> {
+					co_await ktlsEnable(s1);
+					co_return co_await s1.mSock->recv(rb);
+				};
+
+				auto r = macoro::sync_wait(macoro::when_all_ready(server(), client()));
+				if (std::get<0>(r).result().first || std::get<1>(r).result().first || sb != rb)
+					throw MACORO_RTE_LOC;
+			}
+
+			w.reset();
+			f.get();
+		}
+
+		void AsioTlsSocket_resumption_test()
+		{
+			boost::asio::io_context ioc;
+			optional<boost::asio::executor_work_guard<boost::asio::io_context::executor_type>> w(boost::asio::make_work_guard(ioc));
+			auto f = std::async([&] { ioc.run(); });
+
+			boost::asio::ssl::context serverCtx(boost::asio::ssl::context::tlsv13_server);
+			boost::asio::ssl::context clientCtx(boost::asio::ssl::context::tlsv13_client);
+			serverCtx.set_verify_mode(
+				boost::asio::ssl::verify_peer |
+				boost::asio::ssl::verify_fail_if_no_peer_cert);
+
+			auto dir = std::string(COPROTO_TEST_DIR) + "/cert";
+			auto file = dir + "/ca.cert.pem";
+			serverCtx.load_verify_file(file);
+			clientCtx.load_verify_file(file);
+			clientCtx.use_private_key_file(dir + "/client-0.key.pem", boost::asio::ssl::context::file_format::pem);
+			clientCtx.use_certificate_file(dir + "/client-0.cert.pem", boost::asio::ssl::context::file_format::pem);
+			serverCtx.use_private_key_file(dir + "/server-0.key.pem", boost::asio::ssl::context::file_format::pem);
+			serverCtx.use_certificate_file(dir + "/server-0.cert.pem", boost::asio::ssl::context::file_format::pem);
+
+			tlsEnableResumption(serverCtx);
+
+			{
+				TlsSessionCache cache(clientCtx);
+				AsioTlsAcceptor acceptor("localhost:1212", ioc, serverCtx);
+
+				u64 n = 3;
+				for (u64 i = 0; i < n; ++i)
+				{
+					auto S = macoro::sync_wait(macoro::when_all_ready(
+						macoro::make_task(acceptor.accept()),
+						macoro::make_task(AsioTlsConnect("localhost:1212", ioc, clientCtx))
+					));
+					auto s0 = std::get<0>(S).result();
+					auto s1 = std::get<1>(S).result();
+
+					// the client receives the session ticket with the data.
+					std::vector<u8> sb(10), rb(10);
+					auto r = macoro::sync_wait(macoro::when_all_ready(s0.send(sb), s1.recv(rb)));
+					std::get<0>(r).result();
+					std::get<1>(r).result();
+					macoro::sync_wait(s0.flush());
+
+					// a resumed session still has the peer's certificate.
+					if (getX509(s1).oneline() != getX509(serverCtx).oneline())
+						throw MACORO_RTE_LOC;
+				}
+
+				if (cache.misses() != 1 || cache.hits() != n - 1 || cache.size() != 1)
+					throw MACORO_RTE_LOC;
+				if (acceptor.mStats.mMisses != 1 || acceptor.mStats.mHits != n - 1)
+					throw MACORO_RTE_LOC;
+			}
+
+			w.reset();
+			f.get();
+		}
+
 #else
 
 		namespace
@@ -756,6 +936,9 @@ namespace coproto
 		void AsioTlsSocket_sendRecv_base_test() { skip(); }
 		void AsioTlsSocket_sendRecv_test() { skip(); }
 		void AsioTlsSocket_parSendRecv_test() { skip(); }
+		void AsioTlsSocket_ktls_test() { skip(); }
+		void AsioTlsSocket_ktlsEarlyData_test() { skip(); }
+		void AsioTlsSocket_resumption_test() { skip(); }
 
 
 #endif
@@ -19,6 +19,9 @@ namespace coproto
 		void AsioTlsSocket_sendRecv_base_test();
 		void AsioTlsSocket_sendRecv_test();
 		void AsioTlsSocket_parSendRecv_test();
+		void AsioTlsSocket_ktls_test();
+		void AsioTlsSocket_ktlsEarlyData_test();
+		void AsioTlsSocket_resumption_test();
 
 
 	}
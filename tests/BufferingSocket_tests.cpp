@@ -3,6 +3,8 @@
 #include "coproto/Socket/BufferingSocket.h"
 #include "macoro/thread_pool.h"
 #include "macoro/start_on.h"
+#include <set>
+#include <deque>
 
 namespace coproto
 {
@@ -528,5 +530,182 @@ namespace coproto
 				f.join();
 			}
 		}
+
+		void BufferingSocket_vectored_test()
+		{
+			static_assert(internal::has_vectored_send<BufferingSocket::SockImpl>::value, "");
+			static_assert(internal::has_vectored_recv<BufferingSocket::SockImpl>::value, "");
+
+			std::array<BufferingSocket, 2> s;
+
+			std::vector<u8> s0(3), s1(0), s2(14), r0(9), r1(8);
+			for (u64 i = 0; i < s0.size(); ++i)
+				s0[i] = i;
+			for (u64 i = 0; i < s2.size(); ++i)
+				s2[i] = i + s0.size();
+
+			std::array<span<u8>, 3> sendBuffers{ { s0, s1, s2 } };
+			std::array<span<u8>, 2> recvBuffers{ { r0, r1 } };
+
+			auto a0 = s[0].mSock->send(sendBuffers);
+			auto a1 = s[1].mSock->recv(recvBuffers);
+			std::pair<error_code, u64> sr, rr;
+			auto task_ = [&](bool sender) -> task<void> {
+
+				MC_BEGIN(task<>, &, sender);
+				if (sender)
+					MC_AWAIT_SET(sr, a0);
+				else
+					MC_AWAIT_SET(rr, a1);
+				MC_END();
+			};
+
+			auto t = macoro::make_blocking(macoro::when_all_ready(
+				task_(0),
+				task_(1)
+			));
+
+			// the vectored send should be buffered as a single message.
+			if (s[0].mSock->mOutboundBuffer_.size() != 17)
+				throw MACORO_RTE_LOC;
+
+			BufferingSocket::exchangeMessages(s[0], s[1]);
+
+			auto r = t.get();
+			std::get<0>(r).result();
+			std::get<1>(r).result();
+
+			if (sr.first || sr.second != 17)
+				throw MACORO_RTE_LOC;
+			if (rr.first || rr.second != 17)
+				throw MACORO_RTE_LOC;
+			for (u64 i = 0; i < r0.size(); ++i)
+				if (r0[i] != i)
+					throw MACORO_RTE_LOC;
+			for (u64 i = 0; i < r1.size(); ++i)
+				if (r1[i] != i + r0.size())
+					throw MACORO_RTE_LOC;
+		}
+	
+		void BufferingSocket_ring_test()
+		{
+			BufferingSocket::Buffer b;
+			std::deque<u8> expected;
+			std::vector<u8> src(100), dst(100);
+			for (u64 i = 0; i < src.size(); ++i)
+				src[i] = i;
+
+			// push and pop at different rates so that the data wraps around.
+			for (u64 i = 0; i < 200; ++i)
+			{
+				span<u8> d(src.data() + i % 50, (i * 7) % 11);
+				b.push(d);
+				expected.insert(expected.end(), d.begin(), d.end());
+
+				auto m = std::min<u64>(b.size(), (i * 5) % 13);
+				b.pop(span<u8>(dst.data(), m));
+				for (u64 j = 0; j < m; ++j)
+				{
+					if (dst[j] != expected.front())
+						throw MACORO_RTE_LOC;
+					expected.pop_front();
+				}
+
+				if (b.size() != expected.size())
+					throw MACORO_RTE_LOC;
+			}
+
+			// the capacity should stay small since the buffer is drained.
+			if (b.capacity() > 64)
+				throw MACORO_RTE_LOC;
+
+			// swapping in the same vector should reuse the same two buffers.
+			BufferingSocket sock;
+			std::vector<u8> out;
+			std::set<u8*> storage;
+			for (u64 i = 0; i < 10; ++i)
+			{
+				auto a = sock.mSock->send(src);
+				auto t = [&]() -> task<> {
+					MC_BEGIN(task<>, &);
+					MC_AWAIT(a);
+					MC_END();
+				};
+				macoro::sync_wait(t());
+
+				if (!sock.getOutbound(out) || out != src)
+					throw MACORO_RTE_LOC;
+				storage.insert(out.data());
+			}
+			if (storage.size() != 2)
+				throw MACORO_RTE_LOC;
+		}
+	
+		void BufferingSocket_pump_test()
+		{
+			u64 numOps = 1000;
+			macoro::thread_pool ex[2];
+			auto work0 = ex[0].make_work();
+			auto work1 = ex[1].make_work();
+			ex[0].create_threads(2);
+			ex[1].create_threads(2);
+
+			// two pairs on one pump.
+			std::array<BufferingSocket, 4> s;
+			BufferingSocketPump pump;
+			pump.add(s[0], s[1]);
+			pump.add(s[2], s[3]);
+
+			auto f = [&](u64 idx) -> task<u64> {
+				MC_BEGIN(task<u64>, idx, &numOps, &s, &ex,
+					i = u64{},
+					v = u64{},
+					sum = u64{});
+
+				for (i = 0; i < numOps; ++i)
+				{
+					// run on the executor rather than the pump's thread.
+					MC_AWAIT(macoro::transfer_to(ex[idx & 1]));
+
+					if (idx & 1)
+					{
+						MC_AWAIT(s[idx].recv(v));
+						sum += v;
+						MC_AWAIT(s[idx].send(v + 1));
+					}
+					else
+					{
+						MC_AWAIT(s[idx].send(i));
+						MC_AWAIT(s[idx].recv(v));
+						if (v != i + 1)
+							throw MACORO_RTE_LOC;
+					}
+				}
+
+				MC_AWAIT(s[idx].flush());
+				MC_RETURN(sum);
+				MC_END();
+			};
+
+			auto r = macoro::sync_wait(macoro::when_all_ready(f(0), f(1), f(2), f(3)));
+			if (std::get<0>(r).result() != 0 ||
+				std::get<1>(r).result() != numOps * (numOps - 1) / 2 ||
+				std::get<3>(r).result() != numOps * (numOps - 1) / 2)
+				throw MACORO_RTE_LOC;
+			std::get<2>(r).result();
+
+			// closing one socket should be forwarded to the other.
+			std::vector<u8> b(1);
+			std::pair<error_code, u64> rr;
+			s[2].mSock->close();
+			auto t = [&]() -> task<> {
+				MC_BEGIN(task<>, &);
+				MC_AWAIT_SET(rr, s[3].mSock->recv(b));
+				MC_END();
+			};
+			macoro::sync_wait(t());
+			if (rr.first != code::remoteClosed)
+				throw MACORO_RTE_LOC;
+		}
 	}
 }
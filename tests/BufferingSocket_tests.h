@@ -18,6 +18,9 @@ namespace coproto
 		void BufferingSocket_cancellation_test();
 		void BufferingSocket_parCancellation_test();
 		void BufferingSocket_close_test();
+		void BufferingSocket_vectored_test();
+		void BufferingSocket_ring_test();
+		void BufferingSocket_pump_test();
 
 	}
 }
\ No newline at end of file
@@ -0,0 +1,174 @@
+#include "IoUringSocket_tests.h"
+#include "coproto/Socket/IoUringSocket.h"
+#include "Tests.h"
+
+namespace coproto
+{
+	namespace tests
+	{
+#ifdef COPROTO_ENABLE_IO_URING
+		namespace
+		{
+			// the kernel might not support io_uring or it might be disabled.
+			std::unique_ptr<IoUringContext> makeContext(u64 bufferCount = 256, u64 bufferSize = 1 << 14)
+			{
+				try {
+					return std::make_unique<IoUringContext>(256, bufferCount, bufferSize);
+				}
+				catch (std::runtime_error& e)
+				{
+					throw UnitTestSkipped(e.what());
+				}
+			}
+		}
+
+		void IoUringSocket_sendRecv_test()
+		{
+			// few small buffers so that the receiver runs out of them
+			// and the data spans several buffers.
+			auto ctx = makeContext(4, 256);
+			auto s = IoUringSocket::makePair(*ctx);
+
+			std::vector<u8> sb(1 << 20), rb(1 << 20);
+			for (u64 i = 0; i < sb.size(); ++i)
+				sb[i] = i * 7;
+
+			auto send = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s[0].mSock->send(sb);
+			};
+			auto recv = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s[1].mSock->recv(rb);
+			};
+
+			auto r = macoro::sync_wait(macoro::when_all_ready(send(), recv()));
+			auto sr = std::get<0>(r).result();
+			auto rr = std::get<1>(r).result();
+			if (sr.first || sr.second != sb.size())
+				throw MACORO_RTE_LOC;
+			if (rr.first || rr.second != rb.size())
+				throw MACORO_RTE_LOC;
+			if (sb != rb)
+				throw MACORO_RTE_LOC;
+
+			// vectored, with more buffers than fit in one sendmsg.
+			std::vector<span<u8>> sv, rv;
+			std::fill(rb.begin(), rb.end(), 0);
+			for (u64 i = 0, j = 0; i < 20; ++i)
+			{
+				sv.emplace_back(sb.data() + j, i * 100 + 1);
+				rv.emplace_back(rb.data() + j, i * 100 + 1);
+				j += i * 100 + 1;
+			}
+			auto sendv = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s[0].mSock->send(sv);
+			};
+			auto recvv = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s[1].mSock->recv(rv);
+			};
+			r = macoro::sync_wait(macoro::when_all_ready(sendv(), recvv()));
+			sr = std::get<0>(r).result();
+			rr = std::get<1>(r).result();
+			if (sr.first || sr.second != 19020 || rr.first || rr.second != 19020)
+				throw MACORO_RTE_LOC;
+			if (!std::equal(sb.begin(), sb.begin() + 19020, rb.begin()))
+				throw MACORO_RTE_LOC;
+
+			s[0].mSock->close();
+			s[1].mSock->close();
+		}
+
+		void IoUringSocket_close_test()
+		{
+			auto ctx = makeContext();
+			auto s = IoUringSocket::makePair(*ctx);
+
+			std::vector<u8> sb(10), rb(20);
+			auto r = macoro::sync_wait(s[0].mSock->send(sb));
+			if (r.first || r.second != sb.size())
+				throw MACORO_RTE_LOC;
+			s[0].mSock->close();
+
+			// the data that was sent before closing can be received.
+			r = macoro::sync_wait(s[1].mSock->recv(rb));
+			if (r.first != code::remoteClosed || r.second != sb.size())
+				throw MACORO_RTE_LOC;
+
+			r = macoro::sync_wait(s[0].mSock->recv(rb));
+			if (r.first != code::closed)
+				throw MACORO_RTE_LOC;
+
+			// a pending operation is completed by close().
+			auto s2 = IoUringSocket::makePair(*ctx);
+			auto recv = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s2[1].mSock->recv(rb);
+			};
+			auto close = [&]() -> task<> {
+				s2[1].mSock->close();
+				co_return;
+			};
+			auto rr = macoro::sync_wait(macoro::when_all_ready(recv(), close()));
+			if (std::get<0>(rr).result().first != code::closed)
+				throw MACORO_RTE_LOC;
+
+			// as is a pending operation that is canceled.
+			auto s3 = IoUringSocket::makePair(*ctx);
+			macoro::stop_source src;
+			auto recv2 = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s3[0].mSock->recv(rb, src.get_token());
+			};
+			auto cancel = [&]() -> task<> {
+				src.request_stop();
+				co_return;
+			};
+			rr = macoro::sync_wait(macoro::when_all_ready(recv2(), cancel()));
+			if (std::get<0>(rr).result().first != code::operation_aborted)
+				throw MACORO_RTE_LOC;
+		}
+
+		void IoUringSocket_scheduler_test()
+		{
+			auto ctx = makeContext();
+			auto s = IoUringSocket::makePair(*ctx);
+
+			u64 n = 100;
+			std::vector<u64> msg(10000), m;
+			for (u64 i = 0; i < msg.size(); ++i)
+				msg[i] = i;
+
+			auto echo = [&]() -> task<> {
+				std::vector<u64> mm;
+				for (u64 i = 0; i < n; ++i)
+				{
+					co_await s[1].recvResize(mm);
+					co_await s[1].send(std::move(mm));
+				}
+				co_await s[1].flush();
+			};
+			auto ping = [&]() -> task<> {
+				for (u64 i = 0; i < n; ++i)
+				{
+					co_await s[0].send(msg);
+					co_await s[0].recvResize(m);
+					if (m != msg)
+						throw MACORO_RTE_LOC;
+				}
+			};
+
+			auto r = macoro::sync_wait(macoro::when_all_ready(ping(), echo()));
+			std::get<0>(r).result();
+			std::get<1>(r).result();
+			macoro::sync_wait(s[0].close());
+			macoro::sync_wait(s[1].close());
+		}
+#else
+		namespace
+		{
+			void skip() { throw UnitTestSkipped("IoUringSocket is not enabled, see COPROTO_ENABLE_IO_URING"); }
+		}
+
+		void IoUringSocket_sendRecv_test() { skip(); }
+		void IoUringSocket_close_test() { skip(); }
+		void IoUringSocket_scheduler_test() { skip(); }
+#endif
+	}
+}
@@ -328,3 +328,125 @@ void coproto::tests::LocalAsyncSocket_close_test()
 	}
 
 }
+
+void coproto::tests::LocalAsyncSocket_vectored_test()
+{
+	static_assert(internal::has_vectored_send<LocalAsyncSocket::Sock>::value, "");
+	static_assert(internal::has_vectored_recv<LocalAsyncSocket::Sock>::value, "");
+
+	auto s = LocalAsyncSocket::makePair();
+
+	std::vector<u8> s0(3), s1(0), s2(14), r0(9), r1(8);
+	for (u64 i = 0; i < s0.size(); ++i)
+		s0[i] = i;
+	for (u64 i = 0; i < s2.size(); ++i)
+		s2[i] = i + s0.size();
+
+	std::array<span<u8>, 3> sendBuffers{ { s0, s1, s2 } };
+	std::array<span<u8>, 2> recvBuffers{ { r0, r1 } };
+
+	auto send = [&]() -> task<std::pair<error_code, u64>> {
+		co_return co_await s[0].mSock->send(sendBuffers);
+	};
+	auto recv = [&]() -> task<std::pair<error_code, u64>> {
+		co_return co_await s[1].mSock->recv(recvBuffers);
+	};
+
+	auto r = macoro::sync_wait(macoro::when_all_ready(send(), recv()));
+	auto sr = std::get<0>(r).result();
+	auto rr = std::get<1>(r).result();
+
+	if (sr.first || sr.second != 17)
+		throw MACORO_RTE_LOC;
+	if (rr.first || rr.second != 17)
+		throw MACORO_RTE_LOC;
+	for (u64 i = 0; i < r0.size(); ++i)
+		if (r0[i] != i)
+			throw MACORO_RTE_LOC;
+	for (u64 i = 0; i < r1.size(); ++i)
+		if (r1[i] != i + r0.size())
+			throw MACORO_RTE_LOC;
+
+	// the scheduler should now send the header and body in one write.
+	std::vector<u8> msg(100), msg2;
+	for (u64 i = 0; i < msg.size(); ++i)
+		msg[i] = i;
+	macoro::sync_wait(macoro::when_all_ready(s[0].send(msg), s[1].recvResize(msg2)));
+	if (msg != msg2)
+		throw MACORO_RTE_LOC;
+}
+
+void coproto::tests::LocalAsyncSocket_buffered_test()
+{
+	auto s = LocalAsyncSocket::makePair(16);
+
+	auto send = [&](LocalAsyncSocket& s, std::vector<u8>& buff) -> task<std::pair<error_code, u64>> {
+		co_return co_await s.mSock->send(span<u8>(buff));
+	};
+	auto recv = [&](LocalAsyncSocket& s, std::vector<u8>& buff) -> task<std::pair<error_code, u64>> {
+		co_return co_await s.mSock->recv(span<u8>(buff));
+	};
+
+	// a send that fits in the buffer completes without a receiver.
+	std::vector<u8> s0(10), s1(12), r0(8), r1(14);
+	for (u64 i = 0; i < s0.size(); ++i)
+		s0[i] = i;
+	for (u64 i = 0; i < s1.size(); ++i)
+		s1[i] = i + s0.size();
+
+	auto r = macoro::sync_wait(send(s[0], s0));
+	if (r.first || r.second != s0.size())
+		throw MACORO_RTE_LOC;
+
+	r = macoro::sync_wait(recv(s[1], r0));
+	if (r.first || r.second != r0.size())
+		throw MACORO_RTE_LOC;
+
+	// this send wraps around the end of the buffer and 
+	// only completes once enough has been received.
+	auto rr = macoro::sync_wait(macoro::when_all_ready(send(s[0], s1), recv(s[1], r1)));
+	auto sr = std::get<0>(rr).result();
+	r = std::get<1>(rr).result();
+	if (sr.first || sr.second != s1.size())
+		throw MACORO_RTE_LOC;
+	if (r.first || r.second != r1.size())
+		throw MACORO_RTE_LOC;
+
+	for (u64 i = 0; i < r0.size(); ++i)
+		if (r0[i] != i)
+			throw MACORO_RTE_LOC;
+	for (u64 i = 0; i < r1.size(); ++i)
+		if (r1[i] != i + r0.size())
+			throw MACORO_RTE_LOC;
+
+	// data sent before closing can still be received.
+	s0.resize(3);
+	r = macoro::sync_wait(send(s[1], s0));
+	if (r.first || r.second != s0.size())
+		throw MACORO_RTE_LOC;
+	s[1].mSock->close();
+
+	r = macoro::sync_wait(recv(s[0], r0));
+	if (r.first != code::remoteClosed || r.second != s0.size())
+		throw MACORO_RTE_LOC;
+	for (u64 i = 0; i < s0.size(); ++i)
+		if (r0[i] != i)
+			throw MACORO_RTE_LOC;
+
+	r = macoro::sync_wait(recv(s[0], r0));
+	if (r.first != code::remoteClosed || r.second != 0)
+		throw MACORO_RTE_LOC;
+
+	// the scheduler works over the buffered mode.
+	s = LocalAsyncSocket::makePair(1 << 10);
+	std::vector<u8> msg(3000), msg2;
+	for (u64 i = 0; i < msg.size(); ++i)
+		msg[i] = i;
+	for (u64 i = 0; i < 10; ++i)
+	{
+		macoro::sync_wait(macoro::when_all_ready(s[0].send(msg), s[1].recvResize(msg2)));
+		if (msg != msg2)
+			throw MACORO_RTE_LOC;
+	}
+	macoro::sync_wait(s[0].flush());
+}
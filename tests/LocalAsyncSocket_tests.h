@@ -17,6 +17,8 @@ namespace coproto
 		void LocalAsyncSocket_parSendRecv_test();
 		void LocalAsyncSocket_cancellation_test();
 		void LocalAsyncSocket_close_test();
+		void LocalAsyncSocket_vectored_test();
+		void LocalAsyncSocket_buffered_test();
 	}
 }
 
@@ -0,0 +1,179 @@
+#include "PosixSocket_tests.h"
+#include "coproto/Socket/PosixSocket.h"
+#include "Tests.h"
+#ifdef COPROTO_ENABLE_POSIX_SOCKET
+#include <signal.h>
+#include <unistd.h>
+#endif
+
+namespace coproto
+{
+	namespace tests
+	{
+#ifdef COPROTO_ENABLE_POSIX_SOCKET
+		namespace
+		{
+			// send more than the kernel buffers hold so that both
+			// operations have to wait on the reactor.
+			void sendRecv(PosixSocket& s0, PosixSocket& s1)
+			{
+				std::vector<u8> sb(1 << 22), rb(1 << 22);
+				for (u64 i = 0; i < sb.size(); ++i)
+					sb[i] = i * 7;
+
+				auto send = [&]() -> task<std::pair<error_code, u64>> {
+					co_return co_await s0.mSock->send(sb);
+				};
+				auto recv = [&]() -> task<std::pair<error_code, u64>> {
+					co_return co_await s1.mSock->recv(rb);
+				};
+
+				auto r = macoro::sync_wait(macoro::when_all_ready(send(), recv()));
+				auto sr = std::get<0>(r).result();
+				auto rr = std::get<1>(r).result();
+				if (sr.first || sr.second != sb.size())
+					throw MACORO_RTE_LOC;
+				if (rr.first || rr.second != rb.size())
+					throw MACORO_RTE_LOC;
+				if (sb != rb)
+					throw MACORO_RTE_LOC;
+			}
+		}
+
+		void PosixSocket_sendRecv_test()
+		{
+			auto s = PosixSocket::makePair();
+			sendRecv(s[0], s[1]);
+			sendRecv(s[1], s[0]);
+
+			// vectored, with more buffers than fit in one writev.
+			std::vector<u8> sb(100000), rb(100000);
+			for (u64 i = 0; i < sb.size(); ++i)
+				sb[i] = i * 3;
+			std::vector<span<u8>> sv, rv;
+			u64 size = 0;
+			for (u64 i = 0; i < 40; ++i)
+			{
+				sv.emplace_back(sb.data() + size, i * 100 + 1);
+				rv.emplace_back(rb.data() + size, i * 100 + 1);
+				size += i * 100 + 1;
+			}
+			auto send = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s[0].mSock->send(sv);
+			};
+			auto recv = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s[1].mSock->recv(rv);
+			};
+			auto r = macoro::sync_wait(macoro::when_all_ready(send(), recv()));
+			auto sr = std::get<0>(r).result();
+			auto rr = std::get<1>(r).result();
+			if (sr.first || sr.second != size || rr.first || rr.second != size)
+				throw MACORO_RTE_LOC;
+			if (!std::equal(sb.begin(), sb.begin() + size, rb.begin()))
+				throw MACORO_RTE_LOC;
+
+			// and through the scheduler.
+			for (u64 i = 0; i < 10; ++i)
+			{
+				macoro::sync_wait(macoro::when_all_ready(s[0].send(sb), s[1].recvResize(rb)));
+				if (sb != rb)
+					throw MACORO_RTE_LOC;
+			}
+			macoro::sync_wait(s[0].flush());
+			macoro::sync_wait(s[0].close());
+			macoro::sync_wait(s[1].close());
+		}
+
+		void PosixSocket_pipe_test()
+		{
+			// a write to a closed pipe raises SIGPIPE.
+			auto prev = signal(SIGPIPE, SIG_IGN);
+
+			int a[2], b[2];
+			if (pipe(a))
+				throw MACORO_RTE_LOC;
+			if (pipe(b))
+			{
+				::close(a[0]);
+				::close(a[1]);
+				throw MACORO_RTE_LOC;
+			}
+
+			PosixSocket s0(b[0], a[1]), s1(a[0], b[1]);
+			sendRecv(s0, s1);
+			sendRecv(s1, s0);
+
+			s0.mSock->close();
+			std::vector<u8> buff(10);
+			auto r = macoro::sync_wait(s1.mSock->recv(buff));
+			if (r.first != code::remoteClosed)
+				throw MACORO_RTE_LOC;
+			r = macoro::sync_wait(s1.mSock->send(buff));
+			if (r.first != code::remoteClosed)
+				throw MACORO_RTE_LOC;
+
+			signal(SIGPIPE, prev);
+		}
+
+		void PosixSocket_close_test()
+		{
+			auto s = PosixSocket::makePair();
+
+			std::vector<u8> sb(10), rb(20);
+			auto r = macoro::sync_wait(s[0].mSock->send(sb));
+			if (r.first || r.second != sb.size())
+				throw MACORO_RTE_LOC;
+			s[0].mSock->close();
+
+			// the data that was sent before closing can be received.
+			r = macoro::sync_wait(s[1].mSock->recv(rb));
+			if (r.first != code::remoteClosed || r.second != sb.size())
+				throw MACORO_RTE_LOC;
+
+			r = macoro::sync_wait(s[1].mSock->send(sb));
+			if (r.first != code::remoteClosed)
+				throw MACORO_RTE_LOC;
+
+			r = macoro::sync_wait(s[0].mSock->recv(rb));
+			if (r.first != code::closed)
+				throw MACORO_RTE_LOC;
+
+			// a pending operation is completed by close().
+			auto s2 = PosixSocket::makePair();
+			auto recv = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s2[1].mSock->recv(rb);
+			};
+			auto close = [&]() -> task<> {
+				s2[1].mSock->close();
+				co_return;
+			};
+			auto rr = macoro::sync_wait(macoro::when_all_ready(recv(), close()));
+			if (std::get<0>(rr).result().first != code::closed)
+				throw MACORO_RTE_LOC;
+
+			// as is a pending operation that is canceled.
+			auto s3 = PosixSocket::makePair();
+			macoro::stop_source src;
+			auto recv2 = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s3[0].mSock->recv(rb, src.get_token());
+			};
+			auto cancel = [&]() -> task<> {
+				src.request_stop();
+				co_return;
+			};
+			rr = macoro::sync_wait(macoro::when_all_ready(recv2(), cancel()));
+			if (std::get<0>(rr).result().first != code::operation_aborted)
+				throw MACORO_RTE_LOC;
+		}
+#else
+		namespace
+		{
+			void skip() { throw UnitTestSkipped("PosixSocket is not enabled, see COPROTO_ENABLE_POSIX_SOCKET"); }
+		}
+
+		void PosixSocket_sendRecv_test() { skip(); }
+		void PosixSocket_pipe_test() { skip(); }
+		void PosixSocket_close_test() { skip(); }
+#endif
+	}
+}
@@ -1,4 +1,5 @@
 #include "coproto/Common/Queue.h"
+#include "tests/AllocationCounter.h"
 
 #include <list>
 #include <set>
@@ -144,6 +145,51 @@ namespace coproto
 			}
 		}
 
+		// queues that share a pool should reuse each others blocks
+		// and not allocate once the pool is warm.
+		void Queue_pool_test()
+		{
+			QueueBlockPool pool;
+			{
+				u64 n = 10, burst = 100;
+				std::vector<std::unique_ptr<Queue<u64>>> queues(n);
+				u64 begin = 0;
+				for (u64 r = 0; r < 4; ++r)
+				{
+					// the first round warms up the pool.
+					if (r == 1)
+						begin = allocationCount();
+
+					for (auto& q : queues)
+						q.reset(new Queue<u64>(&pool));
+
+					for (u64 i = 0; i < n; ++i)
+					{
+						auto& q = *queues[(i + r) % n];
+						for (u64 j = 0; j < burst; ++j)
+							q.push_back(j);
+						for (u64 j = 0; j < burst; ++j)
+						{
+							if (q.front() != j)
+								throw COPROTO_RTE;
+							q.pop_front();
+						}
+					}
+				}
+
+				// only the queues themselves should be allocated.
+				if (allocationCount() - begin != 3 * n)
+					throw COPROTO_RTE;
+			}
+
+			// the queues are destroyed so their blocks are back in the pool.
+			if (pool.highWaterMark() == 0 || pool.inUse() != 0 || pool.retained() == 0)
+				throw COPROTO_RTE;
+
+			pool.setRetainedCapacity(0);
+			if (pool.retained())
+				throw COPROTO_RTE;
+		}
 
 	}
 }
@@ -0,0 +1,232 @@
+#include "SharedMemSocket_tests.h"
+#include "coproto/Socket/SharedMemSocket.h"
+#include "Tests.h"
+#ifdef COPROTO_ENABLE_SHARED_MEM
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace coproto
+{
+	namespace tests
+	{
+#ifdef COPROTO_ENABLE_SHARED_MEM
+		void SharedMemSocket_sendRecv_test()
+		{
+			// a small buffer so that the data wraps around and
+			// the operations have to wait on each other.
+			auto s = SharedMemSocket::makePair(64);
+
+			std::vector<u8> sb(1000), rb(1000);
+			for (u64 i = 0; i < sb.size(); ++i)
+				sb[i] = i * 7;
+
+			auto send = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s[0].mSock->send(sb);
+			};
+			auto recv = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s[1].mSock->recv(rb);
+			};
+
+			auto r = macoro::sync_wait(macoro::when_all_ready(send(), recv()));
+			auto sr = std::get<0>(r).result();
+			auto rr = std::get<1>(r).result();
+			if (sr.first || sr.second != sb.size())
+				throw MACORO_RTE_LOC;
+			if (rr.first || rr.second != rb.size())
+				throw MACORO_RTE_LOC;
+			if (sb != rb)
+				throw MACORO_RTE_LOC;
+
+			// and through the scheduler.
+			for (u64 i = 0; i < 10; ++i)
+			{
+				macoro::sync_wait(macoro::when_all_ready(s[0].send(sb), s[1].recvResize(rb)));
+				if (sb != rb)
+					throw MACORO_RTE_LOC;
+			}
+			macoro::sync_wait(s[0].flush());
+			macoro::sync_wait(s[0].close());
+			macoro::sync_wait(s[1].close());
+		}
+
+		void SharedMemSocket_close_test()
+		{
+			auto s = SharedMemSocket::makePair();
+
+			std::vector<u8> sb(10), rb(20);
+			auto r = macoro::sync_wait(s[0].mSock->send(sb));
+			if (r.first || r.second != sb.size())
+				throw MACORO_RTE_LOC;
+			s[0].mSock->close();
+
+			// the data that was sent before closing can be received.
+			r = macoro::sync_wait(s[1].mSock->recv(rb));
+			if (r.first != code::remoteClosed || r.second != sb.size())
+				throw MACORO_RTE_LOC;
+
+			r = macoro::sync_wait(s[1].mSock->send(sb));
+			if (r.first != code::remoteClosed)
+				throw MACORO_RTE_LOC;
+
+			r = macoro::sync_wait(s[0].mSock->recv(rb));
+			if (r.first != code::closed)
+				throw MACORO_RTE_LOC;
+
+			// a pending operation is completed by close().
+			auto s2 = SharedMemSocket::makePair();
+			auto recv = [&]() -> task<std::pair<error_code, u64>> {
+				co_return co_await s2[1].mSock->recv(rb);
+			};
+			auto close = [&]() -> task<> {
+				s2[1].mSock->close();
+				co_return;
+			};
+			auto rr = macoro::sync_wait(macoro::when_all_ready(recv(), close()));
+			if (std::get<0>(rr).result().first != code::closed)
+				throw MACORO_RTE_LOC;
+		}
+
+		void SharedMemSocket_destroyOnThread_test()
+		{
+			auto s = SharedMemSocket::makePair(64);
+			auto s1 = std::make_unique<SharedMemSocket>(std::move(s[1]));
+
+			std::vector<u8> sb(10, 1), rb(10);
+			auto recv = [&]() -> task<> {
+				auto r = co_await s1->mSock->recv(rb);
+				if (r.first || rb != sb)
+					throw MACORO_RTE_LOC;
+
+				// we are being resumed by the socket's thread. It must 
+				// outlive the socket.
+				s1.reset();
+			};
+
+			// nothing has been sent and so the thread completes the recv.
+			auto t = recv() | macoro::make_eager();
+			auto r = macoro::sync_wait(s[0].mSock->send(sb));
+			if (r.first)
+				throw MACORO_RTE_LOC;
+			macoro::sync_wait(std::move(t));
+			if (s1)
+				throw MACORO_RTE_LOC;
+
+			s[0].mSock->close();
+		}
+
+		void SharedMemSocket_fork_test()
+		{
+			auto s = SharedMemSocket::makePair(1 << 12);
+
+			u64 n = 100;
+			std::vector<u64> msg(10000);
+			for (u64 i = 0; i < msg.size(); ++i)
+				msg[i] = i;
+
+			auto pid = fork();
+			if (pid == -1)
+				throw MACORO_RTE_LOC;
+
+			if (pid == 0)
+			{
+				// the child echos the messages back.
+				int ret = 0;
+				try {
+					std::vector<u64> m;
+					for (u64 i = 0; i < n; ++i)
+					{
+						macoro::sync_wait(s[1].recvResize(m));
+						macoro::sync_wait(s[1].send(std::move(m)));
+					}
+					macoro::sync_wait(s[1].flush());
+					macoro::sync_wait(s[1].close());
+				}
+				catch (...)
+				{
+					ret = 1;
+				}
+				_exit(ret);
+			}
+
+			std::vector<u64> m;
+			for (u64 i = 0; i < n; ++i)
+			{
+				macoro::sync_wait(s[0].send(msg));
+				macoro::sync_wait(s[0].recvResize(m));
+				if (m != msg)
+					throw MACORO_RTE_LOC;
+			}
+
+			int status = 0;
+			if (waitpid(pid, &status, 0) != pid || !WIFEXITED(status) || WEXITSTATUS(status))
+				throw MACORO_RTE_LOC;
+			macoro::sync_wait(s[0].close());
+		}
+
+		void SharedMemSocket_named_test()
+		{
+			auto name = "/coproto_named_test_" + std::to_string(getpid());
+			shm_unlink(name.c_str());
+
+			SharedMemSocket s0(name, 0, 1 << 12);
+
+			// an end can only be opened once.
+			bool threw = false;
+			try { SharedMemSocket(name, 0, 1 << 12); }
+			catch (std::exception&) { threw = true; }
+			if (!threw)
+				throw MACORO_RTE_LOC;
+
+			// both ends must use the same buffer size.
+			threw = false;
+			try { SharedMemSocket(name, 1, 1 << 13); }
+			catch (std::exception&) { threw = true; }
+			if (!threw)
+				throw MACORO_RTE_LOC;
+
+			SharedMemSocket s1(name, 1, 1 << 12);
+
+			// the name is removed once both ends are open.
+			auto fd = shm_open(name.c_str(), O_RDWR, 0);
+			if (fd != -1)
+			{
+				::close(fd);
+				shm_unlink(name.c_str());
+				throw MACORO_RTE_LOC;
+			}
+
+			std::vector<u8> sb(10000), rb;
+			for (u64 i = 0; i < sb.size(); ++i)
+				sb[i] = i * 3;
+			for (u64 i = 0; i < 4; ++i)
+			{
+				macoro::sync_wait(macoro::when_all_ready(s0.send(sb), s1.recvResize(rb)));
+				if (sb != rb)
+					throw MACORO_RTE_LOC;
+				macoro::sync_wait(macoro::when_all_ready(s1.send(rb), s0.recvResize(sb)));
+				if (sb != rb)
+					throw MACORO_RTE_LOC;
+			}
+
+			macoro::sync_wait(s0.flush());
+			macoro::sync_wait(s1.flush());
+			macoro::sync_wait(s0.close());
+			macoro::sync_wait(s1.close());
+		}
+#else
+		namespace
+		{
+			void skip() { throw UnitTestSkipped("SharedMemSocket is not enabled, see COPROTO_ENABLE_SHARED_MEM"); }
+		}
+
+		void SharedMemSocket_sendRecv_test() { skip(); }
+		void SharedMemSocket_close_test() { skip(); }
+		void SharedMemSocket_destroyOnThread_test() { skip(); }
+		void SharedMemSocket_fork_test() { skip(); }
+		void SharedMemSocket_named_test() { skip(); }
+#endif
+	}
+}
@@ -2,8 +2,13 @@
 #include "coproto/Socket/LocalAsyncSock.h"
 #include "coproto/Socket/BufferingSocket.h"
 #include <vector>
+#include <algorithm>
 #include "macoro/thread_pool.h"
+#include "macoro/start_on.h"
 #include "tests/Tests.h"
+#include "tests/AllocationCounter.h"
+#include <thread>
+#include <atomic>
 
 namespace coproto
 {
@@ -1162,5 +1167,919 @@ namespace coproto
 
 		}
 
+
+		// send a mix of small and large messages on two forks with
+		// read-ahead enabled. The small messages should be parsed out
+		// of the read-ahead buffer while the large ones are read directly.
+		void SocketScheduler_readAhead_test()
+		{
+			auto test = [](std::array<Socket, 2> socks)
+			{
+				socks[0].enableReadAhead(256);
+				socks[1].enableReadAhead(256);
+
+				std::vector<u64> sizes;
+				for (u64 i = 1; i < 40; ++i)
+					sizes.push_back(i);
+				sizes.push_back(200);
+				sizes.push_back(1000);
+				sizes.push_back(3);
+
+				auto forks = std::array<std::array<Socket, 2>, 2>{ {
+					{ { socks[0], socks[0].fork() } },
+					{ { socks[1], socks[1].fork() } } } };
+
+				auto tt = [&](u64 party, u64 f)
+				{
+					MC_BEGIN(task<>, &, party, f,
+						i = u64{},
+						msg = std::vector<u8>{});
+
+					for (i = 0; i < sizes.size(); ++i)
+					{
+						if (party)
+						{
+							msg.resize(sizes[i]);
+							for (u64 j = 0; j < msg.size(); ++j)
+								msg[j] = static_cast<u8>(i + j + f);
+							MC_AWAIT(forks[party][f].send(std::move(msg)));
+						}
+						else
+						{
+							MC_AWAIT(forks[party][f].recvResize(msg));
+							if (msg.size() != sizes[i])
+								throw MACORO_RTE_LOC;
+							for (u64 j = 0; j < msg.size(); ++j)
+								if (msg[j] != static_cast<u8>(i + j + f))
+									throw MACORO_RTE_LOC;
+						}
+					}
+
+					MC_AWAIT(forks[party][f].flush());
+					MC_END();
+				};
+
+				auto r = macoro::sync_wait(macoro::when_all_ready(tt(0, 0), tt(0, 1), tt(1, 0), tt(1, 1)));
+				std::get<0>(r).result();
+				std::get<1>(r).result();
+				std::get<2>(r).result();
+				std::get<3>(r).result();
+
+				if (socks[0].bytesReceived() != socks[1].bytesSent())
+					throw MACORO_RTE_LOC;
+
+				// must be enabled before anything is received.
+				bool threw = false;
+				try { socks[0].enableReadAhead(256); }
+				catch (std::runtime_error&) { threw = true; }
+				if (!threw)
+					throw MACORO_RTE_LOC;
+			};
+
+			{
+				auto s = LocalAsyncSocket::makePair();
+				test({ { s[0], s[1] } });
+			}
+
+			{
+				std::array<BufferingSocket, 2> s;
+				std::atomic<bool> done(false);
+				auto thrd = std::thread([&]() {
+					while (!done)
+						BufferingSocket::exchangeMessages(s[0], s[1]);
+					});
+				test({ { s[0], s[1] } });
+				done = true;
+				thrd.join();
+			}
+		}
+
+		// Two forks, the first message on the wire is for a fork that
+		// has not called recv. With eager receiving enabled, the second
+		// fork should still receive its message and the first fork
+		// should then complete synchronously from the buffered message.
+		void SocketScheduler_eagerRecv_test()
+		{
+			auto socks = LocalAsyncSocket::makePair();
+			socks[1].enableEagerRecv(100);
+
+			std::array<Socket, 2> send{ { socks[0].fork(), socks[0].fork() } };
+			std::array<Socket, 2> recv{ { socks[1].fork(), socks[1].fork() } };
+
+			std::vector<u8> m0(10), m1(20), m2(200), r0, r1(20), r2;
+			for (u64 i = 0; i < m0.size(); ++i)
+				m0[i] = i;
+			for (u64 i = 0; i < m1.size(); ++i)
+				m1[i] = i * 3;
+			for (u64 i = 0; i < m2.size(); ++i)
+				m2[i] = i * 5;
+			auto e0 = m0, e1 = m1, e2 = m2;
+
+			macoro::sync_wait(send[0].send(std::move(m0)));
+			macoro::sync_wait(send[1].send(std::move(m1)));
+
+			// m0 is buffered.
+			macoro::sync_wait(recv[1].recv(r1));
+			if (r1 != e1)
+				throw MACORO_RTE_LOC;
+			if (socks[1].mImpl->mEagerRecvSize != e0.size())
+				throw MACORO_RTE_LOC;
+
+			macoro::sync_wait(recv[0].recvResize(r0));
+			if (r0 != e0)
+				throw MACORO_RTE_LOC;
+			if (socks[1].mImpl->mEagerRecvSize != 0)
+				throw MACORO_RTE_LOC;
+
+			// too large to buffer, the receive should proceed as normal.
+			macoro::sync_wait(send[0].send(std::move(m2)));
+			macoro::sync_wait(recv[0].recvResize(r2));
+			if (r2 != e2)
+				throw MACORO_RTE_LOC;
+
+			macoro::sync_wait(socks[0].flush());
+		}
+
+		// queue many small messages while the first write is pending.
+		// They should then all be sent with a single write.
+		void SocketScheduler_coalesce_test()
+		{
+			auto s = LocalAsyncSocket::makePair();
+			s[0].enableSendCoalescing();
+
+			u64 n = 50, size = 10;
+			for (u64 i = 0; i < n; ++i)
+			{
+				std::vector<u8> msg(size, static_cast<u8>(i));
+				macoro::sync_wait(s[0].send(std::move(msg)));
+			}
+
+			auto recvSome = [&](span<u8> buffer) {
+				auto t = [&]() -> task<std::pair<error_code, u64>> {
+					co_return co_await s[1].mSock->recvSome(buffer);
+				};
+				return macoro::sync_wait(t());
+			};
+
+			// the first message was sent by itself.
+			std::vector<u8> buffer(4096);
+			auto r = recvSome(buffer);
+			if (r.first || r.second != sizeof(internal::Header) * 2 + sizeof(internal::ControlBlock) + size)
+				throw MACORO_RTE_LOC;
+
+			// the rest are sent together.
+			r = recvSome(buffer);
+			if (r.first || r.second != (n - 1) * (sizeof(internal::Header) + size))
+				throw MACORO_RTE_LOC;
+
+			std::vector<u8> exp;
+			for (u64 i = 1; i < n; ++i)
+			{
+				push(u32(size), exp);
+				push(u32(1), exp);
+				exp.insert(exp.end(), size, static_cast<u8>(i));
+			}
+			if (std::equal(exp.begin(), exp.end(), buffer.begin()) == false)
+				throw MACORO_RTE_LOC;
+
+			macoro::sync_wait(s[0].flush());
+		}
+
+		// several threads send on their own fork of the same socket
+		// while other threads receive. Exercises the lock-free submission queue.
+		void SocketScheduler_concurrentSend_test()
+		{
+			auto s = LocalAsyncSocket::makePair();
+			u64 numThreads = 8, n = 1000;
+
+			std::vector<Socket> send, recv;
+			for (u64 t = 0; t < numThreads; ++t)
+			{
+				send.push_back(s[0].fork());
+				recv.push_back(s[1].fork());
+			}
+
+			std::vector<std::thread> thrds;
+			std::atomic<u64> failed(0);
+			for (u64 t = 0; t < numThreads; ++t)
+			{
+				thrds.emplace_back([&, t] {
+					for (u64 i = 0; i < n; ++i)
+					{
+						std::vector<u64> msg{ t, i };
+						macoro::sync_wait(send[t].send(std::move(msg)));
+					}
+				});
+				thrds.emplace_back([&, t] {
+					std::vector<u64> msg(2);
+					for (u64 i = 0; i < n; ++i)
+					{
+						macoro::sync_wait(recv[t].recv(msg));
+						if (msg[0] != t || msg[1] != i)
+							++failed;
+					}
+				});
+			}
+
+			for (auto& thrd : thrds)
+				thrd.join();
+
+			if (failed)
+				throw MACORO_RTE_LOC;
+
+			macoro::sync_wait(s[0].flush());
+			macoro::sync_wait(s[1].flush());
+		}
+
+		void SocketScheduler_forkTable_test()
+		{
+			{
+				internal::ForkTable table;
+				std::vector<SessionID> ids;
+				std::vector<internal::SocketFork*> forks;
+				u64 n = 10000;
+				auto root = SessionID::root();
+				for (u64 i = 0; i < n; ++i)
+				{
+					auto id = root.derive();
+					ids.push_back(id);
+					forks.push_back(&table.emplace(id));
+					table.setRemote(static_cast<u32>(n - i), *forks.back());
+				}
+
+				for (u64 i = 0; i < n; ++i)
+				{
+					if (forks[i]->mLocalId != i + 1 ||
+						&table[i] != forks[i] ||
+						table.find(ids[i]) != forks[i] ||
+						table.findLocal(static_cast<u32>(i + 1)) != forks[i] ||
+						table.findRemote(static_cast<u32>(n - i)) != forks[i])
+						throw MACORO_RTE_LOC;
+				}
+
+				if (table.find(root.derive()) || table.findRemote(0) || table.findRemote(~u32(0)) || table.findLocal(static_cast<u32>(n + 1)))
+					throw MACORO_RTE_LOC;
+
+				// large remote ids are kept in the sparse index.
+				auto large = ~u32(1);
+				table.clearRemote(static_cast<u32>(n));
+				table.setRemote(large, *forks[0]);
+				if (table.findRemote(large) != forks[0] || table.findRemote(large - 1) ||
+					table.mRemote.size() * internal::ForkTable::RemoteChunkSize > 2 * n)
+					throw MACORO_RTE_LOC;
+				table.clearRemote(large);
+				if (table.findRemote(large))
+					throw MACORO_RTE_LOC;
+			}
+
+			// many forks, one message each.
+			auto s = LocalAsyncSocket::makePair();
+			u64 n = 2000;
+			std::vector<Socket> send, recv;
+			for (u64 i = 0; i < n; ++i)
+			{
+				send.push_back(s[0].fork());
+				recv.push_back(s[1].fork());
+			}
+
+			for (u64 i = 0; i < n; ++i)
+				macoro::sync_wait(send[i].send(u64(i)));
+			for (u64 i = 0; i < n; ++i)
+			{
+				u64 v;
+				macoro::sync_wait(recv[i].recv(v));
+				if (v != i)
+					throw MACORO_RTE_LOC;
+			}
+
+			macoro::sync_wait(s[0].flush());
+		}
+
+		void SocketScheduler_forkHandle_test()
+		{
+			auto s = LocalAsyncSocket::makePair();
+			auto f0 = s[0].fork();
+			auto r0 = s[1].fork();
+
+			if (s[0].mFork == nullptr || s[0].mFork->mSessionID != s[0].mId)
+				throw MACORO_RTE_LOC;
+			if (f0.mFork == nullptr || f0.mFork == s[0].mFork ||
+				f0.mFork != s[0].mImpl->getFork(f0.mId))
+				throw MACORO_RTE_LOC;
+
+			// the cached fork is used.
+			macoro::sync_wait(f0.send(u64(1)));
+			u64 v = 0;
+			macoro::sync_wait(r0.recv(v));
+			if (v != 1)
+				throw MACORO_RTE_LOC;
+
+			// the cached fork does not match mId, the lookup should be used.
+			Socket g = s[0];
+			g.mId = f0.mId;
+			macoro::sync_wait(g.send(u64(2)));
+			macoro::sync_wait(r0.recv(v));
+			if (v != 2)
+				throw MACORO_RTE_LOC;
+
+			// g does not keep the fork open. Once it is closed,
+			// the operations of g should fail.
+			auto expectClosed = [&] {
+				for (auto sendOp : { true, false })
+				{
+					try {
+						if (sendOp)
+							macoro::sync_wait(g.send(v));
+						else
+							macoro::sync_wait(g.recv(v));
+						throw MACORO_RTE_LOC;
+					}
+					catch (std::system_error& ex)
+					{
+						if (ex.code() != code::closed)
+							throw;
+					}
+				}
+			};
+			auto id = f0.mId;
+			f0 = Socket();
+			expectClosed();
+
+			// and once its state has been freed.
+			r0 = Socket();
+			macoro::sync_wait(s[0].send(u64(3)));
+			macoro::sync_wait(s[1].recv(v));
+			macoro::sync_wait(s[1].send(u64(4)));
+			macoro::sync_wait(s[0].recv(v));
+			if (s[0].mImpl->mForks.find(id))
+				throw MACORO_RTE_LOC;
+			expectClosed();
+
+			macoro::sync_wait(s[0].flush());
+		}
+
+		// once warm, a send or recv on a socket or a fork should not
+		// allocate. This includes reads through the read-ahead buffer 
+		// and messages that are buffered by eager receiving.
+		void SocketScheduler_allocation_test()
+		{
+			enum class Mode { Default, ReadAhead, Eager };
+
+			// with eager receiving, each round trip also sends a message on 
+			// other that arrives before it is requested.
+			auto test = [](Socket& s0, Socket& s1, Socket& other0, Socket& other1, Mode mode) {
+				u64 n = 1000, begin = 0, end = 0;
+				bool early = mode == Mode::Eager;
+
+				auto ping = [&]() -> task<> {
+					std::vector<u8> buff(100);
+					for (u64 i = 0; i < 2 * n; ++i)
+					{
+						// the first half warms up the pools.
+						if (i == n)
+							begin = allocationCount();
+						if (early)
+							co_await other0.send(buff);
+						co_await s0.send(buff);
+						co_await s0.recv(buff);
+						co_await s0.flush();
+					}
+					end = allocationCount();
+				};
+				auto echo = [&]() -> task<> {
+					std::vector<u8> buff(100);
+					for (u64 i = 0; i < 2 * n; ++i)
+					{
+						co_await s1.recv(buff);
+						if (early)
+							co_await other1.recv(buff);
+						co_await s1.send(buff);
+					}
+				};
+
+				auto r = macoro::sync_wait(macoro::when_all_ready(ping(), echo()));
+				std::get<0>(r).result();
+				std::get<1>(r).result();
+
+				if (end != begin)
+					throw std::runtime_error(std::to_string(end - begin) + " allocations for " + std::to_string(n) + 
+						" round trips in mode " + std::to_string((int)mode) + ". " COPROTO_LOCATION);
+			};
+
+			for (auto mode : { Mode::Default, Mode::ReadAhead, Mode::Eager })
+			{
+				auto s = LocalAsyncSocket::makePair();
+				for (auto& ss : s)
+				{
+					if (mode == Mode::ReadAhead)
+						ss.enableReadAhead();
+					if (mode == Mode::Eager)
+						ss.enableEagerRecv();
+				}
+
+				auto f0 = s[0].fork();
+				auto f1 = s[1].fork();
+				test(s[0], s[1], f0, f1, mode);
+				test(f0, f1, s[0], s[1], mode);
+
+				macoro::sync_wait(s[0].flush());
+			}
+		}
+
+		// a flush should complete once the operations before it have
+		// completed, even if the operations on different forks
+		// complete out of order.
+		void SocketScheduler_flush_test()
+		{
+			auto s = LocalAsyncSocket::makePair();
+			u64 n = 20;
+			std::vector<Socket> f0, f1;
+			for (u64 i = 0; i < n; ++i)
+			{
+				f0.push_back(s[0].fork());
+				f1.push_back(s[1].fork());
+			}
+
+			std::vector<u8> recvDone(n), flushDone(n);
+			auto recv = [&](u64 i) -> task<> {
+				u64 v = 0;
+				co_await f1[i].recv(v);
+				if (v != i)
+					throw MACORO_RTE_LOC;
+				recvDone[i] = 1;
+			};
+			auto flush = [&](u64 i) -> task<> {
+				co_await s[1].flush();
+				for (u64 j = 0; j <= i; ++j)
+					if (recvDone[j] == 0)
+						throw MACORO_RTE_LOC;
+				flushDone[i] = 1;
+			};
+
+			// flush i waits on the receives of forks 0,...,i.
+			std::vector<macoro::eager_task<>> tasks;
+			for (u64 i = 0; i < n; ++i)
+			{
+				tasks.push_back(recv(i) | macoro::make_eager());
+				tasks.push_back(flush(i) | macoro::make_eager());
+			}
+
+			// complete the receives in the order 1,0,3,2,...
+			for (u64 i = 0; i < n; i += 2)
+			{
+				u64 v0 = i, v1 = i + 1;
+				macoro::sync_wait(f0[i + 1].send(v1));
+				if (flushDone[i] || flushDone[i + 1])
+					throw MACORO_RTE_LOC;
+
+				macoro::sync_wait(f0[i].send(v0));
+				if (!flushDone[i] || !flushDone[i + 1])
+					throw MACORO_RTE_LOC;
+				if (i + 2 < n && flushDone[i + 2])
+					throw MACORO_RTE_LOC;
+			}
+
+			for (auto& t : tasks)
+				macoro::sync_wait(std::move(t));
+
+			// nothing is pending.
+			macoro::sync_wait(s[1].flush());
+			macoro::sync_wait(s[0].flush());
+		}
+
+		// a fork is closed once its last Socket is destroyed. Once both
+		// parties have closed it, its slot and local id are reused.
+		void SocketScheduler_forkClose_test()
+		{
+			{
+				internal::ForkTable table;
+				auto root = SessionID::root();
+				std::vector<SessionID> ids;
+				u64 n = 100;
+				for (u64 i = 0; i < n; ++i)
+				{
+					ids.push_back(root.derive());
+					table.emplace(ids.back());
+				}
+
+				auto& f = *table.find(ids[3]);
+				f.mRemoteId = 7;
+				table.setRemote(7, f);
+				auto localId = f.mLocalId;
+				table.erase(f);
+
+				if (table.find(ids[3]) || table.findRemote(7) || table.findLocal(localId) || table.numForks() != n - 1)
+					throw MACORO_RTE_LOC;
+				for (u64 i = 0; i < n; ++i)
+					if (i != 3 && (table.find(ids[i]) == nullptr || table.find(ids[i])->mSessionID != ids[i]))
+						throw MACORO_RTE_LOC;
+
+				auto id = root.derive();
+				auto& g = table.emplace(id);
+				if (g.mLocalId != localId || table.size() != n || table.find(id) != &g)
+					throw MACORO_RTE_LOC;
+			}
+
+			auto s = LocalAsyncSocket::makePair();
+			u64 v = 0;
+
+			// the remote party closed the fork. Receives fail.
+			{
+				auto f0 = s[0].fork();
+				{
+					auto f1 = s[1].fork();
+					macoro::sync_wait(f0.send(u64(1)));
+					macoro::sync_wait(f1.recv(v));
+				}
+
+				// the close notice is sent ahead of this message.
+				macoro::sync_wait(s[1].send(u64(2)));
+				macoro::sync_wait(s[0].recv(v));
+				if (v != 2)
+					throw MACORO_RTE_LOC;
+
+				try {
+					macoro::sync_wait(f0.recv(v));
+					throw MACORO_RTE_LOC;
+				}
+				catch (std::system_error& ex)
+				{
+					if (ex.code() != code::remoteClosed)
+						throw;
+				}
+			}
+
+			// messages that arrive on a closed fork are discarded.
+			{
+				auto f0 = s[0].fork();
+				s[1].fork();
+				macoro::sync_wait(f0.send(u64(3)));
+				macoro::sync_wait(s[0].send(u64(4)));
+				macoro::sync_wait(s[1].recv(v));
+				if (v != 4)
+					throw MACORO_RTE_LOC;
+			}
+
+			// short lived forks should not grow the socket.
+			for (u64 i = 0; i < 100; ++i)
+			{
+				auto f0 = s[0].fork();
+				auto f1 = s[1].fork();
+				macoro::sync_wait(f0.send(i));
+				macoro::sync_wait(f1.recv(v));
+				if (v != i)
+					throw MACORO_RTE_LOC;
+				macoro::sync_wait(f1.send(v));
+				macoro::sync_wait(f0.recv(v));
+			}
+
+			// a party that only receives sends its close notices on their
+			// own. They are read while the other party waits for a message.
+			{
+				auto t = LocalAsyncSocket::makePair();
+				for (u64 i = 0; i < 10; ++i)
+				{
+					auto f0 = t[0].fork();
+					auto f1 = t[1].fork();
+					macoro::sync_wait(f0.send(i));
+					macoro::sync_wait(f1.recv(v));
+				}
+
+				auto recv = [&]() -> task<> { co_await t[0].recv(v); };
+				auto r = recv() | macoro::make_eager();
+				if (t[0].mImpl->mForks.numForks() != 1)
+					throw MACORO_RTE_LOC;
+				macoro::sync_wait(t[1].send(u64(7)));
+				macoro::sync_wait(std::move(r));
+				if (v != 7)
+					throw MACORO_RTE_LOC;
+
+				macoro::sync_wait(t[0].flush());
+				macoro::sync_wait(t[1].flush());
+			}
+
+			// deliver the last close notices.
+			macoro::sync_wait(s[0].send(u64(5)));
+			macoro::sync_wait(s[1].recv(v));
+			macoro::sync_wait(s[1].send(u64(6)));
+			macoro::sync_wait(s[0].recv(v));
+
+			for (auto& ss : s)
+			{
+				auto& forks = ss.mImpl->mForks;
+				if (forks.numForks() != 1 || forks.size() > 4)
+					throw MACORO_RTE_LOC;
+			}
+
+			macoro::sync_wait(s[0].flush());
+			macoro::sync_wait(s[1].flush());
+		}
+
+		// with flow control, a fork is at most a window ahead of the 
+		// receiver and the other forks are not blocked by it.
+		void SocketScheduler_flowControl_test()
+		{
+			auto s = LocalAsyncSocket::makePair();
+			u64 window = 64, size = 32, n = 10;
+			s[0].enableFlowControl(window);
+			s[1].enableFlowControl(window);
+			auto f0 = s[0].fork();
+			auto f1 = s[1].fork();
+
+			std::vector<std::vector<u8>> msgs(n);
+			std::vector<u8> sendDone(n);
+			auto send = [&](u64 i) -> task<> {
+				msgs[i].assign(size, static_cast<u8>(i));
+				co_await f0.send(msgs[i]);
+				sendDone[i] = 1;
+			};
+			auto numSent = [&] {
+				return std::count(sendDone.begin(), sendDone.end(), 1);
+			};
+
+			std::vector<macoro::eager_task<>> tasks;
+			for (u64 i = 0; i < n; ++i)
+				tasks.push_back(send(i) | macoro::make_eager());
+
+			// f1 has not received but the other forks are not blocked.
+			u64 v = 0;
+			macoro::sync_wait(s[0].send(u64(42)));
+			macoro::sync_wait(s[1].recv(v));
+			if (v != 42)
+				throw MACORO_RTE_LOC;
+
+			std::vector<u8> buff(size);
+			for (u64 i = 0; i < n; ++i)
+			{
+				if (numSent() > static_cast<i64>(i + window / size))
+					throw MACORO_RTE_LOC;
+
+				macoro::sync_wait(f1.recv(buff));
+				if (buff != msgs[i])
+					throw MACORO_RTE_LOC;
+			}
+
+			for (auto& t : tasks)
+				macoro::sync_wait(std::move(t));
+
+			try {
+				s[0].enableFlowControl(window);
+				throw MACORO_RTE_LOC;
+			}
+			catch (std::runtime_error&) {}
+
+			// moved sends complete once written if too much is buffered.
+			auto t = LocalAsyncSocket::makePair();
+			t[0].setSendBufferCapacity(0);
+			bool done = false;
+			auto sendMoved = [&]() -> task<> {
+				co_await t[0].send(std::vector<u8>(size, 1));
+				done = true;
+			};
+			auto st = sendMoved() | macoro::make_eager();
+			if (done)
+				throw MACORO_RTE_LOC;
+			macoro::sync_wait(t[1].recv(buff));
+			if (!done || buff != std::vector<u8>(size, 1))
+				throw MACORO_RTE_LOC;
+			macoro::sync_wait(std::move(st));
+
+			for (auto& ss : { &s[0], &s[1], &t[0], &t[1] })
+				macoro::sync_wait(ss->flush());
+		}
+
+		void SocketScheduler_fragmentation_test()
+		{
+			auto s = LocalAsyncSocket::makePair();
+			s[0].enableFragmentation(16);
+			auto f0 = s[0].fork();
+			auto f1 = s[1].fork();
+
+			std::vector<std::string> order;
+			auto send = [&](Socket& sock, std::vector<u8>& msg, macoro::stop_token token, std::string name) -> task<> {
+				try {
+					co_await sock.send(msg, std::move(token));
+					order.push_back(name);
+				}
+				catch (std::system_error& ex)
+				{
+					if (ex.code() != code::operation_aborted)
+						throw;
+					order.push_back(name + "-aborted");
+				}
+			};
+			auto recv = [&](Socket& sock, std::vector<u8>& msg, std::string name) -> task<> {
+				try {
+					co_await sock.recv(msg);
+					order.push_back(name + "-recv");
+				}
+				catch (std::system_error& ex)
+				{
+					if (ex.code() != code::remoteCancel)
+						throw;
+					order.push_back(name + "-canceled");
+				}
+			};
+
+			// the small messages are sent between the fragments of the large one.
+			std::vector<u8> large(100), small(8, 7), largeRecv(large.size()), smallRecv(small.size());
+			for (u64 i = 0; i < large.size(); ++i)
+				large[i] = static_cast<u8>(i);
+
+			std::vector<macoro::eager_task<>> tasks;
+			tasks.push_back(send(f0, large, {}, "large") | macoro::make_eager());
+			tasks.push_back(send(s[0], small, {}, "small") | macoro::make_eager());
+			tasks.push_back(recv(f1, largeRecv, "large") | macoro::make_eager());
+			tasks.push_back(recv(s[1], smallRecv, "small") | macoro::make_eager());
+			for (auto& t : tasks)
+				macoro::sync_wait(std::move(t));
+			tasks.clear();
+
+			if (largeRecv != large || smallRecv != small)
+				throw MACORO_RTE_LOC;
+			if (order != std::vector<std::string>{ "small", "small-recv", "large", "large-recv" })
+				throw MACORO_RTE_LOC;
+			order.clear();
+
+			// canceling a partially sent message aborts the remote recv
+			// and the fork can still be used.
+			macoro::stop_source src;
+			std::vector<u8> next(8, 9), nextRecv(next.size());
+			tasks.push_back(send(f0, large, src.get_token(), "large") | macoro::make_eager());
+			tasks.push_back(send(f0, next, {}, "next") | macoro::make_eager());
+			src.request_stop();
+			if (order.size())
+				throw MACORO_RTE_LOC;
+
+			tasks.push_back(recv(f1, largeRecv, "large") | macoro::make_eager());
+			tasks.push_back(recv(f1, nextRecv, "next") | macoro::make_eager());
+			for (auto& t : tasks)
+				macoro::sync_wait(std::move(t));
+
+			if (nextRecv != next)
+				throw MACORO_RTE_LOC;
+			if (order != std::vector<std::string>{ "large-aborted", "large-canceled", "next", "next-recv" })
+				throw MACORO_RTE_LOC;
+
+			try {
+				s[0].enableFragmentation(16);
+				throw MACORO_RTE_LOC;
+			}
+			catch (std::runtime_error&) {}
+
+			macoro::sync_wait(s[0].flush());
+			macoro::sync_wait(s[1].flush());
+		}
+
+		// The slot id of a new fork is read from the wire. A large one 
+		// should be accepted without growing the remote index.
+		//
+		//    0, <large-slot-id>, <root session id>
+		//    8, <large-slot-id>, <8 bytes>
+		//
+		void SocketScheduler_largeSlotId_test()
+		{
+			BufferingSocket sock;
+			u32 slotId = ~u32(1);
+
+			internal::SendControlBlock init;
+			init.mHeader.mForkId = slotId;
+			init.setType(internal::ControlBlock::Type::NewSocketFork);
+			init.mCtrlBlk.setSessionID(sock.mId);
+
+			internal::Header header;
+			header.mSize = sizeof(u64);
+			header.mForkId = slotId;
+
+			std::vector<u8> buffer;
+			push(init, buffer);
+			push(header, buffer);
+			push(u64(42), buffer);
+
+			u64 v = 0;
+			auto tt = [&]() -> task<> { co_await sock.recv(v); };
+			auto task = tt() | macoro::make_blocking();
+			sock.processInbound(buffer);
+			task.get();
+
+			auto& forks = sock.mImpl->mForks;
+			if (v != 42 ||
+				forks.findRemote(slotId) != forks.find(sock.mId) ||
+				forks.mRemote.size() > 1)
+				throw MACORO_RTE_LOC;
+		}
+
+		// A fork can be closed by the remote party before it is created
+		// locally. Its session id is read from the wire, so only a limited
+		// number of such forks are kept.
+		//
+		//    <close>, ~0, <session id>
+		//
+		void SocketScheduler_earlyClose_test()
+		{
+			BufferingSocket sock;
+			u64 max = internal::SockScheduler::MaxEarlyClosedForks;
+			// the first notice is for the fork that is created below.
+			auto sid = sock.mId;
+
+			auto notices = [&](u64 n) {
+				std::vector<u8> buffer;
+				for (u64 i = 0; i < n; ++i)
+				{
+					internal::SendControlBlock notice;
+					notice.mHeader.mForkId = ~u32(0);
+					notice.setType(internal::ControlBlock::Type::CloseSocketFork);
+					notice.mCtrlBlk.setSessionID(sid.derive());
+					push(notice, buffer);
+				}
+				return buffer;
+			};
+
+			u64 v = 0;
+			auto tt = [&]() -> task<> { co_await sock.recv(v); };
+			auto task = tt() | macoro::make_blocking();
+
+			// up to the limit, they are kept. They are passed in batches
+			// since each call processes its messages on the caller's stack.
+			std::vector<u8> buffer;
+			for (u64 i = 0; i < max; i += 256)
+			{
+				buffer = notices(std::min<u64>(256, max - i));
+				sock.processInbound(buffer);
+			}
+			if (sock.mImpl->mForks.numForks() != max + 1 ||
+				sock.mImpl->mNumEarlyClosed != max)
+				throw MACORO_RTE_LOC;
+
+			// one that is created locally no longer counts.
+			auto f = sock.fork();
+			if (sock.mImpl->mNumEarlyClosed != max - 1)
+				throw MACORO_RTE_LOC;
+
+			buffer = notices(2);
+			sock.processInbound(buffer);
+			try {
+				task.get();
+				throw COPROTO_RTE;
+			}
+			catch (std::system_error& e)
+			{
+				if (e.code() != code::badCoprotoMessageHeader)
+					throw;
+			}
+		}
+
+		// The size of a fragmented message is read from the wire. A size that
+		// can not be legitimate should fail the socket instead of allocating.
+		//
+		//    0, 0, <root session id>
+		//    <fragment>, 0, <total, 8>, <8 bytes>
+		//
+		void SocketScheduler_badFragment_test()
+		{
+			for (auto posted : { true, false })
+			{
+				BufferingSocket sock;
+				sock.enableFlowControl(1 << 10);
+				auto f = sock.fork();
+
+				internal::SendControlBlock init, frag;
+				init.mHeader.mForkId = 0;
+				init.setType(internal::ControlBlock::Type::NewSocketFork);
+				init.mCtrlBlk.setSessionID(sock.mId);
+
+				// larger than any message or, if no recv is posted, than the window.
+				frag.mHeader = init.mHeader;
+				frag.setType(internal::ControlBlock::Type::MessageFragment);
+				frag.mCtrlBlk.setFragment(posted ? u64(1) << 40 : u64(1) << 20, 8);
+
+				std::vector<u8> buffer;
+				push(init, buffer);
+				push(frag, buffer);
+				push(u64(0), buffer);
+
+				// f keeps the receive task reading when the root fork has no recv.
+				auto tt = [&]() -> task<> {
+					std::vector<u8> b(8);
+					if (posted)
+						co_await sock.recv(b);
+					else
+						co_await f.recv(b);
+				};
+				auto task = tt() | macoro::make_blocking();
+
+				sock.processInbound(buffer);
+
+				try {
+					task.get();
+					throw COPROTO_RTE;
+				}
+				catch (std::system_error& e)
+				{
+					if (e.code() != code::badCoprotoMessageHeader)
+						throw;
+				}
+			}
+		}
 	}
 }
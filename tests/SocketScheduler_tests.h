@@ -37,6 +37,21 @@ namespace coproto
 
 		void SocketScheduler_executor_test();
 
+		void SocketScheduler_readAhead_test();
+		void SocketScheduler_eagerRecv_test();
+		void SocketScheduler_coalesce_test();
+		void SocketScheduler_concurrentSend_test();
+		void SocketScheduler_forkTable_test();
+		void SocketScheduler_forkHandle_test();
+		void SocketScheduler_allocation_test();
+		void SocketScheduler_flush_test();
+		void SocketScheduler_forkClose_test();
+		void SocketScheduler_flowControl_test();
+		void SocketScheduler_fragmentation_test();
+		void SocketScheduler_badFragment_test();
+		void SocketScheduler_largeSlotId_test();
+		void SocketScheduler_earlyClose_test();
+
 
 
 	}
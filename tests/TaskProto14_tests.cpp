@@ -925,7 +925,7 @@ namespace coproto
 			//#undef MULTI
 			//#endif
 
-			for (auto t : { EvalTypes::async })
+			for (auto t : types)
 			{
 				auto r = evalEx(proto, t);
 				std::get<0>(r).result();
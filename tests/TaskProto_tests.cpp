@@ -1028,7 +1028,7 @@ namespace coproto
 
 				};
 
-			for (auto t : { EvalTypes::async })
+			for (auto t : types)
 			{
 				auto r = evalEx(proto, t);
 				std::get<0>(r).result();
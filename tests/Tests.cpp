@@ -8,6 +8,9 @@
 #include "tests/BufferingSocket_tests.h"
 #include "tests/AsioSocket_tests.h"
 #include "tests/AsioTlsSocket_tests.h"
+#include "tests/SharedMemSocket_tests.h"
+#include "tests/IoUringSocket_tests.h"
+#include "tests/PosixSocket_tests.h"
 
 #ifdef _MSC_VER
 #include <windows.h>
@@ -274,12 +277,15 @@ namespace coproto
 
         t.add("InlinePolyTest                        ", tests::InlinePolyTest);
         t.add("Queue_test                            ", tests::Queue_test);
+        t.add("Queue_pool_test                       ", tests::Queue_pool_test);
 
         t.add("LocalAsyncSocket_noop_test            ", tests::LocalAsyncSocket_noop_test);
         t.add("LocalAsyncSocket_sendRecv_test        ", tests::LocalAsyncSocket_sendRecv_test);
         t.add("LocalAsyncSocket_parSendRecv_test     ", tests::LocalAsyncSocket_parSendRecv_test);
         t.add("LocalAsyncSocket_cancellation_test    ", tests::LocalAsyncSocket_cancellation_test);
         t.add("LocalAsyncSocket_close_test           ", tests::LocalAsyncSocket_close_test);
+        t.add("LocalAsyncSocket_vectored_test        ", tests::LocalAsyncSocket_vectored_test);
+        t.add("LocalAsyncSocket_buffered_test        ", tests::LocalAsyncSocket_buffered_test);
 
         t.add("BufferingSocket_sendRecv_test         ", tests::BufferingSocket_sendRecv_test);
         t.add("BufferingSocket_asyncSend_test        ", tests::BufferingSocket_asyncSend_test);
@@ -287,6 +293,9 @@ namespace coproto
         t.add("BufferingSocket_cancellation_test     ", tests::BufferingSocket_cancellation_test);
         t.add("BufferingSocket_parCancellation_test  ", tests::BufferingSocket_parCancellation_test);
         t.add("BufferingSocket_close_test            ", tests::BufferingSocket_close_test);
+        t.add("BufferingSocket_vectored_test         ", tests::BufferingSocket_vectored_test);
+        t.add("BufferingSocket_ring_test             ", tests::BufferingSocket_ring_test);
+        t.add("BufferingSocket_pump_test             ", tests::BufferingSocket_pump_test);
         
 
         t.add("AsioSocket_Accept_test                ", tests::AsioSocket_Accept_test);
@@ -298,6 +307,22 @@ namespace coproto
         t.add("AsioSocket_cancellation_test          ", tests::AsioSocket_cancellation_test);
         t.add("AsioSocket_parCancellation_test       ", tests::AsioSocket_parCancellation_test);
         t.add("AsioSocket_close_test                 ", tests::AsioSocket_close_test);
+        t.add("AsioSocket_globalContext_test         ", tests::AsioSocket_globalContext_test);
+        t.add("AsioSocket_allocation_test            ", tests::AsioSocket_allocation_test);
+
+        t.add("SharedMemSocket_sendRecv_test         ", tests::SharedMemSocket_sendRecv_test);
+        t.add("SharedMemSocket_close_test            ", tests::SharedMemSocket_close_test);
+        t.add("SharedMemSocket_destroyOnThread_test  ", tests::SharedMemSocket_destroyOnThread_test);
+        t.add("SharedMemSocket_fork_test             ", tests::SharedMemSocket_fork_test);
+        t.add("SharedMemSocket_named_test            ", tests::SharedMemSocket_named_test);
+
+        t.add("IoUringSocket_sendRecv_test           ", tests::IoUringSocket_sendRecv_test);
+        t.add("IoUringSocket_close_test              ", tests::IoUringSocket_close_test);
+        t.add("IoUringSocket_scheduler_test          ", tests::IoUringSocket_scheduler_test);
+
+        t.add("PosixSocket_sendRecv_test             ", tests::PosixSocket_sendRecv_test);
+        t.add("PosixSocket_pipe_test                 ", tests::PosixSocket_pipe_test);
+        t.add("PosixSocket_close_test                ", tests::PosixSocket_close_test);
 
         t.add("AsioTlsSocket_Accept_test             ", tests::AsioTlsSocket_Accept_test);
         t.add("AsioTlsSocket_Accept_sCacnel_test     ", tests::AsioTlsSocket_Accept_sCacnel_test);
@@ -306,6 +331,9 @@ namespace coproto
         t.add("AsioTlsSocket_sendRecv_base_test      ", tests::AsioTlsSocket_sendRecv_base_test);
         t.add("AsioTlsSocket_sendRecv_test           ", tests::AsioTlsSocket_sendRecv_test);
         t.add("AsioTlsSocket_parSendRecv_test        ", tests::AsioTlsSocket_parSendRecv_test);
+        t.add("AsioTlsSocket_ktls_test               ", tests::AsioTlsSocket_ktls_test);
+        t.add("AsioTlsSocket_ktlsEarlyData_test      ", tests::AsioTlsSocket_ktlsEarlyData_test);
+        t.add("AsioTlsSocket_resumption_test         ", tests::AsioTlsSocket_resumption_test);
         
 
         t.add("SocketScheduler_basicSend_test        ", tests::SocketScheduler_basicSend_test);
@@ -321,6 +349,20 @@ namespace coproto
         t.add("SocketScheduler_repeatInitSlot_test   ", tests::SocketScheduler_repeatInitSlot_test);
         t.add("SocketScheduler_badSlotSend_test      ", tests::SocketScheduler_badSlotSend_test);
         t.add("SocketScheduler_executor_test         ", tests::SocketScheduler_executor_test);
+        t.add("SocketScheduler_readAhead_test        ", tests::SocketScheduler_readAhead_test);
+        t.add("SocketScheduler_eagerRecv_test        ", tests::SocketScheduler_eagerRecv_test);
+        t.add("SocketScheduler_coalesce_test         ", tests::SocketScheduler_coalesce_test);
+        t.add("SocketScheduler_concurrentSend_test   ", tests::SocketScheduler_concurrentSend_test);
+        t.add("SocketScheduler_forkTable_test        ", tests::SocketScheduler_forkTable_test);
+        t.add("SocketScheduler_forkHandle_test       ", tests::SocketScheduler_forkHandle_test);
+        t.add("SocketScheduler_allocation_test       ", tests::SocketScheduler_allocation_test);
+        t.add("SocketScheduler_flush_test            ", tests::SocketScheduler_flush_test);
+        t.add("SocketScheduler_forkClose_test        ", tests::SocketScheduler_forkClose_test);
+        t.add("SocketScheduler_flowControl_test      ", tests::SocketScheduler_flowControl_test);
+        t.add("SocketScheduler_fragmentation_test    ", tests::SocketScheduler_fragmentation_test);
+        t.add("SocketScheduler_badFragment_test      ", tests::SocketScheduler_badFragment_test);
+        t.add("SocketScheduler_largeSlotId_test      ", tests::SocketScheduler_largeSlotId_test);
+        t.add("SocketScheduler_earlyClose_test       ", tests::SocketScheduler_earlyClose_test);
         
         t.add("task_proto_test                       ", tests::task_proto_test);
         t.add("task_strSendRecv_Test                 ", tests::task_strSendRecv_Test);
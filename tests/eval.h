@@ -48,34 +48,20 @@ namespace coproto
 			}
 			else
 			{
-				throw COPROTO_RTE;
-				//std::array<BufferingSocket, 2> s;
-
-				//macoro::thread_pool ex0, ex1;
-				//auto w0 = ex0.make_work();
-				//auto w1 = ex1.make_work();
-				//ex0.create_threads(1);
-				//ex1.create_threads(1);
-
-				//std::atomic<int> done = 2;
-
-				//auto F = [&](int i)
-				//{
-				//	MC_BEGIN(task)
-				//}
-
-				//auto w = macoro::when_all_ready(
-				//	p0(s[0], 0, ex0) | macoro::then([](){ --done; }) | macoro::start_on(ex0),
-				//	p1(s[1], 1, ex1) | macoro::then([](){ --done; }) | macoro::start_on(ex1));
-
-				//auto thrd = std::thread([&]() {
-				//	while (!done)
-				//		BufferingSocket::exchangeMessages(s[0], s[1]);
-				//	});
-
-				//auto r = macoro::sync_wait(std::move(w));
+				macoro::thread_pool stx0, stx1;
+				auto w0 = stx0.make_work();
+				auto w1 = stx1.make_work();
+				stx0.create_threads(4);
+				stx1.create_threads(4);
+				std::array<BufferingSocket, 2> s;
+				BufferingSocketPump pump;
+				pump.add(s[0], s[1]);
 
-				//return r;
+				auto w = macoro::when_all_ready(p0(s[0], 0, stx0), p1(s[1], 1, stx1));
+				auto r = macoro::sync_wait(std::move(w));
+				macoro::sync_wait(s[0].close());
+				macoro::sync_wait(s[1].close());
+				return r;
 			}
 		}
 